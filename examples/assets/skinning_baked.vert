@@ -0,0 +1,84 @@
+layout (binding = 0, std140) uniform UngFrame {
+    vec4 time; // x: seconds since game started, y: frame counter
+};
+
+layout (binding = 1, std140) uniform UngPass {
+    mat4 view;
+    mat4 view_inv;
+    mat4 projection;
+    mat4 projection_inv;
+    mat4 view_projection;
+    mat4 view_projection_inv;
+    vec4 view_dimensions; // xy: size, zw: reciprocal size
+};
+
+layout (binding = 2, std140) uniform UngTransform {
+    mat4 model;
+    mat4 model_view;
+    mat4 model_view_projection;
+    mat4 normal_matrix;
+};
+
+// See ung_baked_animation
+layout (binding = 9, std140) uniform UngMaterialDynamic {
+    vec4 u_ranges;
+    vec4 u_anim; // x: frame rate, y: number of frames, z: time offset
+};
+
+layout (binding = 1) uniform sampler2D u_joint_anim;
+
+layout (location = 0) in vec3 a_position;
+layout (location = 1) in vec2 a_texcoord;
+layout (location = 2) in vec3 a_normal;
+layout (location = 3) in vec4 a_color;
+layout (location = 4) in ivec4 a_joints;
+layout (location = 5) in vec4 a_weights;
+// Optional (from an instance buffer), so crowd members are not in sync
+layout (location = 6) in float i_time_offset;
+
+out vec2 vs_out_texcoord;
+out vec4 vs_out_color;
+out vec3 vs_out_normal; // view space
+out vec3 vs_out_position; // view space
+
+// Two 16 bit values in [0, 1] (high byte first)
+vec2 decode_texel(vec4 texel)
+{
+    vec4 b = round(texel * 255.0);
+    return vec2(b.r * 256.0 + b.g, b.b * 256.0 + b.a) / 65535.0;
+}
+
+mat4 joint_matrix(int joint, int frame)
+{
+    float v[12];
+    for (int i = 0; i < 6; ++i) {
+        vec2 d = decode_texel(texelFetch(u_joint_anim, ivec2(joint * 6 + i, frame), 0));
+        v[i * 2 + 0] = d.x;
+        v[i * 2 + 1] = d.y;
+    }
+    // The first 9 values are the upper 3x3 part, the last 3 the translation
+    for (int i = 0; i < 12; ++i) {
+        v[i] = i < 9 ? u_ranges.x + v[i] * u_ranges.y : u_ranges.z + v[i] * u_ranges.w;
+    }
+    return mat4(v[0], v[1], v[2], 0.0,
+                v[3], v[4], v[5], 0.0,
+                v[6], v[7], v[8], 0.0,
+                v[9], v[10], v[11], 1.0);
+}
+
+void main()
+{
+    float t = (time.x + u_anim.z + i_time_offset) * u_anim.x;
+    int frame = int(mod(t, u_anim.y - 1.0));
+
+    mat4 skin_matrix = a_weights.x * joint_matrix(a_joints.x, frame)
+                     + a_weights.y * joint_matrix(a_joints.y, frame)
+                     + a_weights.z * joint_matrix(a_joints.z, frame)
+                     + a_weights.w * joint_matrix(a_joints.w, frame);
+
+    vs_out_texcoord = a_texcoord;
+    vs_out_color = a_color;
+    vs_out_normal = mat3(view) * mat3(normal_matrix) * mat3(skin_matrix) * a_normal;
+    vs_out_position = (model_view * skin_matrix * vec4(a_position, 1.0)).xyz;
+    gl_Position = model_view_projection * skin_matrix * vec4(a_position, 1.0);
+}
@@ -1,5 +1,4 @@
 #include <cmath>
-#include <cstring>
 #include <span>
 #include <string>
 #include <unordered_map>
@@ -39,7 +38,6 @@ struct Game {
             = ung_material_load("examples/assets/skinning.vert", "examples/assets/skinning.frag",
                 {
                     .mugfx = { .cull_face = MUGFX_CULL_FACE_MODE_NONE },
-                    .dynamic_data_size = 64 * 16 * sizeof(float),
                 });
         const auto texture
             = ung_texture_load("examples/assets/checkerboard.png", UNG_TEXTURE_COLOR, {});
@@ -103,13 +101,14 @@ struct Game {
         const auto joint_transforms = ung_skeleton_get_joint_transforms(skel, &num_joints);
         const auto ta = fmodf(t, ung_animation_get_duration(animation));
         ung_animation_sample(animation, ta, joint_transforms, num_joints);
-        ung_skeleton_update(skel);
-        const auto skinning_matrices = ung_skeleton_get_skinning_matrices(skel, nullptr);
+        // The skinning matrices replace the material's dynamic data (binding 9)
+        uint32_t palette_offset = 0;
+        ung_skeletons_update_ex(&skel, 1, { .offsets = &palette_offset, .palette = true });
+        const auto palette = ung_skinning_palette_binding(9, palette_offset);
 
         for (const auto& prim : primitives) {
-            std::memcpy(ung_material_get_dynamic_data(prim.material), skinning_matrices,
-                num_joints * 16 * sizeof(float));
-            ung_draw(prim.material, prim.geometry, nullptr, {});
+            ung_draw(prim.material, prim.geometry, nullptr,
+                { .binding_overrides = &palette, .num_binding_overrides = 1 });
         }
 
         ung_end_pass();
@@ -2,7 +2,8 @@
 
 #include <stddef.h>
 
-#ifdef __cplusplus
+// UM_NO_EXTERN_C is only used by tools/um-check.cpp
+#if defined(__cplusplus) && !defined(UM_NO_EXTERN_C)
 extern "C" {
 #endif
 
@@ -185,6 +186,6 @@ float um_plane_point_distance(um_plane plane, um_vec3 point);
 
 bool um_sphere_in_frustum(um_sphere sphere, const um_plane* planes, size_t num_planes);
 
-#ifdef __cplusplus
+#if defined(__cplusplus) && !defined(UM_NO_EXTERN_C)
 }
 #endif
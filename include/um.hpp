@@ -4,13 +4,13 @@
 
 namespace um {
 
-using deg = ::um_deg;
-using rad = ::um_rad;
-using vec3 = ::um_vec3;
-using vec4 = ::um_vec4;
-using quat = ::um_quat;
-using mat = ::um_mat;
-using trafo = ::um_trafo;
+using deg = um_deg;
+using rad = um_rad;
+using vec3 = um_vec3;
+using vec4 = um_vec4;
+using quat = um_quat;
+using mat = um_mat;
+using trafo = um_trafo;
 
 [[nodiscard]] inline float exp(float x) noexcept
 {
@@ -17,12 +17,14 @@ extern "C" {
 // clang-format off
 typedef struct { uint64_t id; } ung_animation_id;
 typedef struct { uint64_t id; } ung_camera_id;
+typedef struct { uint64_t id; } ung_cmdlist_id;
 typedef struct { uint64_t id; } ung_controller_id;
 typedef struct { uint64_t id; } ung_file_watch_id;
 typedef struct { uint64_t id; } ung_font_id;
 typedef struct { uint64_t id; } ung_gamepad_id;
 typedef struct { uint64_t id; } ung_geometry_id;
 typedef struct { uint64_t id; } ung_material_id;
+typedef struct { uint64_t id; } ung_model_id;
 typedef struct { uint64_t id; } ung_resource_id;
 typedef struct { uint64_t id; } ung_resource_type_id;
 typedef struct { uint64_t id; } ung_shader_id;
@@ -32,6 +34,8 @@ typedef struct { uint64_t id; } ung_sound_source_id;
 typedef struct { uint64_t id; } ung_text_layout_id;
 typedef struct { uint64_t id; } ung_texture_id;
 typedef struct { uint64_t id; } ung_instance_buffer_id;
+typedef struct { uint64_t id; } ung_job_counter_id;
+typedef struct { uint64_t id; } ung_pack_id;
 // clang-format
 
 typedef struct {
@@ -83,6 +87,7 @@ typedef struct {
     ung_fullscreen_mode fullscreen_mode;
     uint8_t msaa_samples;
     bool vsync;
+    bool hidden; // don't show the window (e.g. for benchmarks)
     mugfx_color_space backbuffer_color_space;
 } ung_window_mode;
 
@@ -98,12 +103,19 @@ typedef struct {
     uint32_t max_num_geometries; // default: 1024
     uint32_t max_num_materials; // default: 1024
     uint32_t max_num_cameras; // default: 8
-    uint32_t max_num_sprite_vertices; // default: 1024*16
+    uint32_t max_num_cmdlists; // default: 16
+    // Per sprite batch. A full batch is flushed. The GPU buffers hold multiple batches per frame.
+    uint32_t max_num_sprite_vertices; // default: 1024*16, at most 65536
     uint32_t max_num_sprite_indices; // default: max_num_sprite_vertices / 4
     uint32_t max_num_gamepads; // default: 8
     uint32_t max_num_sound_sources; // default: 64
     uint32_t max_num_sounds; // default: 64
     uint32_t num_sound_groups; // default: 4
+    // At most this many sounds are mixed. The rest (lowest priority and least audible first) and
+    // spatial sounds quieter than sound_audible_volume are virtualized: they keep advancing their
+    // playback position, but are not mixed until they get a voice again.
+    uint32_t max_num_voices; // default: 32
+    float sound_audible_volume; // default: 0.001 (-60dB)
     uint32_t max_num_skeletons; // default: 64
     uint32_t max_num_animations; // default: 256
     uint32_t max_num_file_watches; // default: 128
@@ -112,11 +124,45 @@ typedef struct {
     uint32_t max_num_resource_types; // default: 16
     uint32_t max_num_resources; // default: sum of textures, shaders, materials, sounds, ...
     uint32_t max_num_instance_buffers; // default: 64
+    uint32_t max_num_packs; // default: 8
+    uint32_t max_num_models; // default: 64 (only for ung_model_load_async)
+    // Transforms are packed into a ring buffer that is orphaned once per frame (or when it's full)
+    uint32_t max_num_transforms_per_frame; // default: 4096
+    // Size of the skinning palette (see ung_skeletons_update_params::palette), panics if exceeded
+    uint32_t max_num_skinning_matrices_per_frame; // default: 4096
+    size_t frame_arena_size; // default: 4 MiB, for each of the two arenas (see ung_frame_alloc)
+    // Every thread (e.g. decode threads) gets a scratch arena of this size for temporary buffers
+    // while loading. Larger buffers are allocated from the heap.
+    size_t scratch_arena_size; // default: 16 MiB
+    uint32_t num_job_threads; // default: number of cores - 1
+    uint32_t max_num_job_counters; // default: 256
+    // Resources that finished decoding are uploaded in ung_begin_frame until this much time has
+    // passed (at least one per frame). Resources that are waited for are always uploaded.
+    uint32_t resource_upload_budget_us; // default: 0 (unlimited)
+    // The frame profiler keeps the zones of this many frames (see ung_profiler_push)
+    uint32_t profiler_num_frames; // default: 0 (disabled)
+    uint32_t profiler_max_zones_per_thread; // default: 16384
     mugfx_init_params mugfx;
     bool debug; // do error checking and panic if something is wrong
     bool auto_reload;
     bool async_decode; // default: true
+    // Don't wait for materials (and their shaders) in ung_draw. Draws with materials that are
+    // still loading are skipped or drawn with the fallback (ung_material_set_loading_fallback),
+    // so shader compilation is spread over multiple frames (see resource_upload_budget_us).
+    bool async_materials;
+    // Cache decoded textures and geometry in .ungcache/ (which must exist).
     bool load_cache;
+    // Store positions of geometry created from ung_geometry_data (e.g. ung_geometry_load) as 16 bit
+    // integers relative to the AABB. This reduces the vertex size from 24 to 20 bytes. Shaders
+    // get the original positions in model space, because the model matrix is adjusted.
+    bool quantize_geometry_positions;
+    // Geometry created from ung_geometry_data, files or glTF primitives gets this many lower
+    // levels of detail, each with geometry_lod_ratio times the triangles of the previous one (see
+    // ung_geometry_set_lods). They are generated when the geometry is created (and cached with
+    // load_cache).
+    uint32_t geometry_num_lods; // default: 0, at most UNG_MAX_GEOMETRY_LODS
+    float geometry_lod_ratio; // default: 0.5
+    float lod_pixel_error; // default: 1
 } ung_init_params;
 
 void ung_init(ung_init_params params);
@@ -142,6 +188,13 @@ void* ung_malloc(size_t size);
 void* ung_realloc(void* ptr, size_t new_size);
 void ung_free(void* ptr);
 
+// Allocates from a linear allocator that is reset in ung_begin_frame. There are two of them that
+// are used in alternating frames, so the memory stays valid until the ung_begin_frame after the
+// next one (e.g. for data the GPU still reads while the next frame is recorded).
+// alignment must be a power of two (0 means 16). This is thread-safe.
+// Returns null if the arena is full (see frame_arena_size). Never free the returned pointer.
+void* ung_frame_alloc(size_t size, size_t alignment);
+
 /*
  * Window
  */
@@ -178,9 +231,15 @@ typedef struct {
     uint32_t capacity;
     uint32_t free_list_head;
     uint32_t num_alive;
+    // Optional, capacity entries each. If given, the indices of all alive slots are kept packed
+    // in alive[0, num_alive) (in no particular order), so you can iterate only the alive slots.
+    // Removing swaps the last alive index into the removed position, so iterate backwards if you
+    // remove the current slot while iterating.
+    uint32_t* alive;
+    uint32_t* alive_pos; // position of each alive slot in `alive`
 } ung_slotmap;
 
-// set keys and capacity before init
+// set keys and capacity (and optionally alive and alive_pos) before init
 void ung_slotmap_init(ung_slotmap* s);
 // returns 0 on exhaustion
 uint64_t ung_slotmap_insert(ung_slotmap* s, uint32_t* idx);
@@ -192,6 +251,34 @@ uint32_t ung_slotmap_next_alive(const ung_slotmap* s, uint32_t min_index);
 bool ung_slotmap_contains(const ung_slotmap* s, uint64_t key);
 bool ung_slotmap_remove(ung_slotmap* s, uint64_t key);
 
+/*
+ * Jobs
+ * Jobs are executed by a pool of worker threads that steal work from each other. The thread
+ * that called ung_init participates only while it waits (ung_job_wait). Each job can signal a
+ * counter, which is incremented when the job is submitted and decremented when it finishes, so
+ * waiting for a counter waits for all jobs submitted with it.
+ * Jobs may submit and wait for other jobs. On Emscripten builds without pthreads, jobs are executed
+ * immediately when they are submitted.
+ */
+typedef void (*ung_job_func)(void* ctx, uint32_t index);
+
+// Counters may be used from any thread, but must not be destroyed while jobs are pending on them.
+ung_job_counter_id ung_job_counter_create();
+void ung_job_counter_destroy(ung_job_counter_id counter);
+bool ung_job_counter_done(ung_job_counter_id counter);
+
+// counter is optional (0), index is passed to func
+void ung_job_run(ung_job_func func, void* ctx, uint32_t index, ung_job_counter_id counter);
+// Runs func with indices [0, count)
+void ung_job_run_many(ung_job_func func, void* ctx, uint32_t count, ung_job_counter_id counter);
+// The job is started only after `dependency` is done (it may also be 0).
+void ung_job_run_after(ung_job_counter_id dependency, ung_job_func func, void* ctx, uint32_t index,
+    ung_job_counter_id counter);
+// Executes other jobs until the counter is done.
+void ung_job_wait(ung_job_counter_id counter);
+// Number of worker threads (excluding the main thread)
+uint32_t ung_job_get_num_threads();
+
 /*
  * Input
  */
@@ -324,6 +411,7 @@ typedef enum {
 typedef struct {
     bool flip_y;
     mugfx_texture_create_params mugfx;
+    int32_t priority; // see ung_resource_load_params
 } ung_texture_load_params;
 
 ung_texture_id ung_texture_load(
@@ -371,7 +459,15 @@ You may use
 
 to "include" these uniform blocks into your shader.
 
+If a vertex shader has "#define UNG_INSTANCED" before including UngTransform, the block instead
+contains UNG_MAX_AUTO_INSTANCES transforms indexed by gl_InstanceID and the names above are macros
+into that array. Draws of such a material in a pass with sort_draws that share geometry and binding
+overrides are then merged into instanced draws automatically. Only use it in the vertex shader and
+not together with explicit instancing (instance buffers or ung_draw_params::instance_count).
+
  */
+#define UNG_MAX_AUTO_INSTANCES 64
+
 typedef struct {
     mugfx_material_create_params mugfx;
     ung_shader_id vert;
@@ -386,6 +482,11 @@ ung_material_id ung_material_create(ung_material_create_params params);
 ung_material_id ung_material_load(
     const char* vert_path, const char* frag_path, ung_material_create_params params);
 void ung_material_destroy(ung_material_id material);
+// Whether the material (including its shaders) has been created, i.e. ung_draw will not wait
+bool ung_material_is_ready(ung_material_id material);
+// With async_materials, this is used instead of materials that are still loading. It is waited for
+// here. Pass {0} to skip those draws instead (the default).
+void ung_material_set_loading_fallback(ung_material_id material);
 void ung_material_set_binding(ung_material_id material, mugfx_draw_binding binding);
 void ung_material_set_buffer(
     ung_material_id material, uint32_t binding, mugfx_buffer_id uniform_data);
@@ -398,9 +499,20 @@ ung_resource_id ung_material_resource(ung_material_id material);
 /*
  * Files
  */
+// This will also find files in mounted packs (see below). The data is null-terminated.
 char* ung_read_whole_file(const char* path, size_t* size, bool panic_on_error);
 void ung_free_file_data(char* data, size_t size);
 
+// Packs are archives created with the ung-pack tool (tools/ung-pack.cpp). They are memory-mapped
+// and files in them are returned by ung_read_whole_file without a copy (unless they are
+// compressed). All loading functions (textures, shaders, sounds, models) will find them.
+// Packs mounted later take precedence. If auto_reload is enabled, loose files take precedence
+// over packs, so they can be edited and reloaded.
+// Returns 0 if the file could not be opened or is not a valid pack.
+ung_pack_id ung_pack_mount(const char* path);
+// This must not be called while data read from the pack is still in use.
+void ung_pack_unmount(ung_pack_id pack);
+
 typedef struct {
     ung_string section;
     ung_string key;
@@ -450,6 +562,11 @@ typedef struct {
     // If all you need is decode, set this to NULL.
     bool (*upload)(ung_resource_id self, void* instance);
 
+    // Optional, runs on main thread. If this returns false, ung_begin_frame does not upload the
+    // resource yet, but tries again next frame (e.g. because upload would wait for dependencies
+    // that are still loading). ung_resource_wait_ready uploads regardless.
+    bool (*can_upload)(ung_resource_id self, void* instance);
+
     const char* (*get_error)(void* instance);
 
     // This is always called, no matter if decode or upload fails and it is
@@ -466,17 +583,27 @@ typedef struct {
     bool created;
 } ung_resource_load_result;
 
+typedef struct {
+    // Resources with higher priority are decoded first. Resources loaded from the decode function
+    // of another resource have at least the priority of that resource. Waiting for a resource
+    // that not being decoded yet moves it to the front of the queue. default: 0
+    int32_t priority;
+} ung_resource_load_params;
+
 // If this returns an existing resource, it increments the reference count. If it created a
 // resource, it returns it with refcount = 1.
 ung_resource_load_result ung_resource_load(
     ung_resource_type_id res_type, const char* key, void* instance);
+ung_resource_load_result ung_resource_load_ex(ung_resource_type_id res_type, const char* key,
+    void* instance, ung_resource_load_params params);
 void* ung_resource_instance(ung_resource_id res);
 ung_resource_id ung_resource_get(ung_resource_type_id res_type, const char* key); // or {0}
 uint32_t ung_resource_incref(ung_resource_id res);
 uint32_t ung_resource_decref(ung_resource_id res);
 // This asserts that the reference cound is 1. ung_{texture,shader,...}_destroy simply forward to
 // this function. This may only be called from the main thread.
-// This decrements the reference count of all dependencies.
+// This decrements the reference count of all dependencies. If decoding has not started yet, it is
+// cancelled.
 void ung_resource_destroy(ung_resource_id res);
 // This function will NOT swap two resources through their resource handles.
 // You can't just swap two textures via their resource handles here and their texture IDs will
@@ -491,6 +618,8 @@ void ung_resource_depend_res(ung_resource_id res);
 void ung_resource_depend_file(const char* path);
 
 uint32_t ung_resource_version(ung_resource_id res);
+// Whether the initial load has completed. Once a resource is ready, it will remain ready.
+bool ung_resource_is_ready(ung_resource_id res);
 // This waits for the initial load to complete. Once a resource is ready, it will remain ready.
 // Reloads are asynchronous and as long as the reload is in progress, the old resource will be used.
 void ung_resource_wait_ready(ung_resource_id res);
@@ -500,6 +629,21 @@ void ung_load_profiler_push(const char* name);
 void ung_load_profiler_pop(const char* name); // name optional, asserts equality
 void ung_load_profiler_dump(bool verbose);
 
+// Frame Profiling
+// Records nested zones from any thread (every thread gets its own track) and GPU times of passes
+// (not on WebGL). Zones are kept in a ring buffer per thread and only those from the last
+// ung_init_params::profiler_num_frames frames are dumped. ung itself records zones for passes,
+// draws, sprite flushes, resource uploads and decodes, etc.
+// If the profiler is disabled, these do nothing.
+// The name is not copied, so it has to outlive the profiler (e.g. a string literal).
+void ung_profiler_push(const char* name);
+void ung_profiler_pop();
+// Names the track of the calling thread in the dump (copied)
+void ung_profiler_set_thread_name(const char* name);
+// Writes a Chrome trace (JSON), which can be opened in speedscope, ui.perfetto.dev or
+// chrome://tracing. GPU times are placed at the time the pass started on the CPU.
+void ung_profiler_dump(const char* path);
+
 /*
  * Geometry
  */
@@ -522,15 +666,84 @@ ung_geometry_data ung_geometry_data_box(float w, float h, float d);
 ung_geometry_data ung_geometry_data_sphere(float radius);
 void ung_geometry_data_destroy(ung_geometry_data gdata);
 
+typedef enum {
+    UNG_GEOMETRY_OPTIMIZE_WELD = 1 << 0, // merge identical vertices
+    UNG_GEOMETRY_OPTIMIZE_VERTEX_CACHE = 1 << 1, // reorder triangles for post-transform cache
+    UNG_GEOMETRY_OPTIMIZE_OVERDRAW = 1 << 2, // implies VERTEX_CACHE, sacrifices a little of it
+    UNG_GEOMETRY_OPTIMIZE_VERTEX_FETCH = 1 << 3, // reorder vertices in order of first use
+    UNG_GEOMETRY_OPTIMIZE_ALL = 0xf,
+} ung_geometry_optimize_flags;
+
+// This changes the number and order of vertices and triangles, but not what is drawn.
+// ung_geometry_data_load (OBJ) already does this with UNG_GEOMETRY_OPTIMIZE_ALL.
+void ung_geometry_data_optimize(ung_geometry_data* gdata, uint32_t flags);
+
+#define UNG_MAX_GEOMETRY_LODS 4
+
+// A lower level of detail of a geometry, which is a range of the same index buffer
+typedef struct {
+    uint32_t index_offset;
+    uint32_t index_count;
+    float error; // geometric deviation from the full geometry, relative to the bounds radius
+} ung_geometry_lod;
+
+// Simplifies the triangles to at most target_num_indices indices with quadric error edge
+// collapses ("Surface Simplification Using Quadric Error Metrics", Garland and Heckbert 1997),
+// unless that would introduce an error larger than max_error (relative to the bounds radius).
+// Only the indices change and every vertex stays where it is, so the result can share the vertex
+// buffer of the original geometry. Vertices on borders and attribute seams (multiple vertices
+// with the same position) are never removed, so weld first (UNG_GEOMETRY_OPTIMIZE_WELD).
+// indices must have room for gdata->num_indices. Returns the number of indices written and writes
+// the resulting error to error, if it's not null.
+uint32_t ung_geometry_data_simplify(const ung_geometry_data* gdata, uint32_t target_num_indices,
+    float max_error, uint32_t* indices, float* error);
+// Simplifies to up to num_lods levels, each with ratio times the triangles of the previous one.
+// Generation stops early if a level would not be meaningfully smaller than the previous one, so
+// this returns the number of levels. indices must have room for gdata->num_indices * num_lods.
+// The levels are written to it back to back and their offsets assume that they follow the
+// original indices in the same index buffer (see ung_geometry_set_lods).
+uint32_t ung_geometry_data_generate_lods(const ung_geometry_data* gdata, uint32_t num_lods,
+    float ratio, uint32_t* indices, ung_geometry_lod* lods);
+
 ung_geometry_id ung_geometry_create(mugfx_geometry_create_params params);
+// The buffers passed to ung_geometry_create are not destroyed. Buffers created by ung (e.g. for
+// ung_geometry_create_from_data, ung_geometry_box or glTF primitives) are.
+void ung_geometry_destroy(ung_geometry_id geom);
 void ung_geometry_set_vertex_range(ung_geometry_id geom, uint32_t offset, uint32_t count);
+// This removes the levels of detail (see ung_geometry_set_lods)
 void ung_geometry_set_index_range(ung_geometry_id geom, uint32_t offset, uint32_t count);
+// Geometries created from ung_geometry_data, files or cgltf primitives get their levels of detail
+// from ung_init_params::geometry_num_lods. ung_draw picks the coarsest level whose error projected
+// to the screen (the error times the projected radius of the bounding sphere) is at most
+// ung_init_params::lod_pixel_error pixels. Draws of geometries without bounds or with an instance
+// count always use the full geometry.
+// lods must be ordered from finest to coarsest (increasing error) and refer to the index buffer
+// of the geometry. Every level takes a mugfx geometry. Replaces the current levels.
+void ung_geometry_set_lods(ung_geometry_id geom, const ung_geometry_lod* lods, uint32_t num_lods);
+uint32_t ung_geometry_get_num_lods(ung_geometry_id geom);
 ung_geometry_id ung_geometry_create_from_data(ung_geometry_data gdata);
 // creates geometry data, creates draw geometry, destroys geometry data
+// If load_cache is enabled, the final vertex and index buffers are stored in .ungcache/ and
+// later loads upload them directly without parsing the file.
 ung_geometry_id ung_geometry_load(const char* path);
 ung_geometry_id ung_geometry_box(float w, float h, float d);
 ung_geometry_id ung_geometry_sphere(float radius);
 
+// Bounds are determined when creating geometries from ung_geometry_data, files or cgltf
+// primitives. They are used for frustum culling (see ung_pass_params).
+typedef struct {
+    float min[3];
+    float max[3];
+    float center[3]; // bounding sphere
+    float radius;
+} ung_geometry_bounds;
+
+ung_geometry_bounds ung_geometry_data_get_bounds(ung_geometry_data gdata);
+// Returns false if the geometry has no bounds (e.g. created with ung_geometry_create)
+bool ung_geometry_get_bounds(ung_geometry_id geom, ung_geometry_bounds* bounds);
+// If radius is 0, the bounding sphere is computed from the box.
+void ung_geometry_set_bounds(ung_geometry_id geom, ung_geometry_bounds bounds);
+
 // I consider this API a hack, but I don't know what a good version of this API could be.
 // The problem is that you need to create a new geometry, because instancing requires additional
 // vertex attributes and that ung_geometry owns the vertex buffers. So you would have to add parameters
@@ -559,7 +772,18 @@ ung_geometry_id ung_instanced_geometry_create(ung_geometry_id base_geometry,
  */
 // I don't think multiple sprite renderers are very useful, so there is a singleton
 
-void ung_sprite_set_material(ung_material_id mat); // {0} for default sprite material
+// Sprites are batched until the material changes or the batch runs out of texture slots.
+// Every texture in a batch is bound to its own slot (binding 0 to N-1) and the vertex shader
+// gets the slot index (location 3, see default_sprite_vert), which it passes to the fragment
+// shader as "flat out int vs_out_texture".
+#define UNG_SPRITE_MAX_TEXTURES 8
+
+// {0} for default sprite material. The default sprite and text materials use
+// UNG_SPRITE_MAX_TEXTURES texture slots, all other materials use a single slot, i.e. every
+// texture change flushes.
+void ung_sprite_set_material(ung_material_id mat);
+// The fragment shader of mat has to sample the texture bound to vs_out_texture
+void ung_sprite_set_material_ex(ung_material_id mat, uint32_t num_texture_slots);
 ung_material_id ung_sprite_get_material();
 void ung_sprite_set_texture(ung_texture_id tex);
 ung_texture_id ung_sprite_get_texture();
@@ -579,6 +803,16 @@ typedef struct {
 void ung_sprite_add(
     ung_texture_id tex, ung_transform_2d transform, ung_texture_region texture, ung_color color);
 
+typedef struct {
+    ung_transform_2d transform;
+    ung_texture_region region;
+    ung_color color;
+} ung_sprite_instance;
+
+// Like calling ung_sprite_add for every sprite, but much faster
+void ung_sprite_add_many(
+    ung_texture_id tex, const ung_sprite_instance* sprites, size_t num_sprites);
+
 void ung_sprite_flush();
 
 /*
@@ -636,6 +870,13 @@ size_t ung_text_layout_build_draw_items(ung_text_layout_id layout, uint32_t glyp
     uint32_t num_glyphs, ung_text_draw_item* items, size_t max_items);
 // If mat is {0}, the default material is used
 void ung_text_layout_draw(ung_text_layout_id layout, ung_material_id mat, float x, float y);
+// Draws the layout with a single ung_draw from a geometry that is only rebuilt when the layout
+// changed (ung_text_layout_reset/ung_text_layout_add_text). Use this for static text.
+// The vertices are like sprite vertices (see UNG_SPRITE_MAX_TEXTURES), so a layout can use at most
+// that many fonts. If mat is {0}, the default text mesh material is used. Its vertex shader applies
+// model_view_projection of UngTransform. Transform may be 0 to use the identity transform.
+void ung_text_layout_draw_mesh(
+    ung_text_layout_id layout, ung_material_id mat, const float transform[16]);
 
 /*
  * Camera Management
@@ -693,6 +934,33 @@ ung_joint_transform* ung_skeleton_get_joint_transforms(ung_skeleton_id skel, uin
 // Recalculate joint and skinning matrices (so it is not cheap).
 void ung_skeleton_update(ung_skeleton_id skel);
 
+typedef struct {
+    // Split the skeletons into this many jobs (see ung_job_run), default: 1
+    uint32_t num_jobs;
+    // Use fewer jobs if there are less joints than this per job, default: 1024
+    uint32_t min_joints_per_job;
+    // If given, the skinning matrices of all skeletons are written to this buffer (with a single
+    // update), starting at buffer_offset, in the order of the skeletons passed.
+    mugfx_buffer_id skinning_buffer;
+    size_t buffer_offset;
+    // The matrices of each skeleton start at a multiple of this (relative to buffer_offset),
+    // e.g. 256 to bind them as uniform buffer ranges. default: 64 (sizeof(mat4))
+    size_t offset_alignment;
+    // Optional, receives the byte offset in skinning_buffer for each skeleton
+    uint32_t* offsets;
+    // Write the matrices to the skinning palette instead of skinning_buffer (buffer_offset is
+    // ignored, offsets are relative to the palette). The palette is a uniform buffer that ung
+    // orphans every frame, so the matrices of all skeletons can be written with a single update
+    // each frame. The matrices of one call are contiguous, so draws can bind a range with
+    // ung_skinning_palette_binding and index it per instance (e.g. for crowds).
+    bool palette;
+} ung_skeletons_update_params;
+
+// Same as ung_skeleton_update for each skeleton, but faster for many skeletons.
+void ung_skeletons_update(const ung_skeleton_id* skeletons, size_t num_skeletons);
+void ung_skeletons_update_ex(
+    const ung_skeleton_id* skeletons, size_t num_skeletons, ung_skeletons_update_params params);
+
 // Returns a pointer to num_joints joint matrices (mat4, global transforms)
 // The returned pointer is valid for the lifetime of the skeleton.
 const float* ung_skeleton_get_joint_matrices(ung_skeleton_id skel, uint16_t* num_joints);
@@ -700,6 +968,14 @@ const float* ung_skeleton_get_joint_matrices(ung_skeleton_id skel, uint16_t* num
 // The skinning matrix is joint_matrix * inverse_bind_matrix
 const float* ung_skeleton_get_skinning_matrices(ung_skeleton_id skel, uint16_t* num_joints);
 
+// The size of the range bound by ung_skinning_palette_binding (the minimum
+// GL_MAX_UNIFORM_BLOCK_SIZE), i.e. 256 matrices.
+#define UNG_SKINNING_PALETTE_RANGE 16384
+
+// Returns a draw binding override (see ung_draw_params) for the palette range starting at offset,
+// which has to be one of the offsets returned by ung_skeletons_update_ex with palette set.
+mugfx_draw_binding ung_skinning_palette_binding(uint32_t binding, uint32_t offset);
+
 // This is a general purpose blend function, you most likely want to wrap this with something more
 // high level first.
 // `poses` should be an array of poses, with num_joints transforms each.
@@ -762,22 +1038,72 @@ typedef struct {
     const float* values; // vec3 or quat per sample
 } ung_animation_channel;
 
+typedef struct {
+    // Resample linearly interpolated channels to this many keys per second. Then finding the keys
+    // for a given time is a simple multiplication instead of a search, but fast movements between
+    // the original keys might get lost. 0 keeps the original keys.
+    float resample_rate;
+    // Remove keys that can be reconstructed from their neighbours with an error of at most
+    // this much (per component). Channels that are constant within this tolerance are reduced
+    // to a single key. Ignored for resampled channels. 0 keeps all keys.
+    float key_tolerance;
+    // Store rotations as 48-bit "smallest three" quaternions and translations/scales as 16-bit
+    // values relative to the range of each channel. This is lossy (about 1e-4 for rotations).
+    bool quantize;
+} ung_animation_options;
+
 typedef struct {
     // channels will be copied in ung_animation_create
     const ung_animation_channel* channels;
     size_t num_channels;
     float duration_s;
+    ung_animation_options options;
 } ung_animation_create_params;
 
 ung_animation_id ung_animation_create(ung_animation_create_params params);
 void ung_animation_destroy(ung_animation_id anim);
 
 float ung_animation_get_duration(ung_animation_id anim);
+uint32_t ung_animation_get_num_channels(ung_animation_id anim);
+// Returns the number of bytes used by the animation data. If `original_size` is not null, the
+// size before resampling, key removal and quantization is written to it.
+size_t ung_animation_get_memory_usage(ung_animation_id anim, size_t* original_size);
 
 // t will be clamped to [0, duration_s]
 void ung_animation_sample(
     ung_animation_id anim, float t, ung_joint_transform* joints, uint16_t num_joints);
 
+// Same as above, but the channel keys found are remembered in `cursors` (one per channel, see
+// ung_animation_get_num_channels, zero-initialized), which makes sampling with increasing t
+// much cheaper. Use one set of cursors per playing animation.
+void ung_animation_sample_cached(ung_animation_id anim, float t, uint32_t* cursors,
+    ung_joint_transform* joints, uint16_t num_joints);
+
+/* Baking samples an animation at a fixed rate and stores the skinning matrices of every frame in a
+ * texture, so a vertex shader can animate a mesh without any work on the CPU (e.g. for crowds).
+ * Every matrix is stored as the 12 values of its first three rows (column-major, like um_mat)
+ * quantized to 16 bits, two values per RGBA8 texel (high byte first), so every joint occupies
+ * 6 texels. The texture has one row per frame. The values of the upper 3x3 part are
+ * ranges[0] + q / 65535 * ranges[1] and the translations are ranges[2] + q / 65535 * ranges[3].
+ * See examples/assets/skinning_baked.vert.
+ */
+typedef struct {
+    float frame_rate; // default: 30
+} ung_animation_bake_params;
+
+typedef struct {
+    ung_texture_id texture; // width: 6 * num_joints, height: num_frames
+    uint32_t num_frames; // the last frame is at the end of the animation
+    uint16_t num_joints;
+    float frame_rate;
+    float ranges[4];
+} ung_baked_animation;
+
+// Joints that are not animated use the bind pose of the skeleton. The skeleton is not modified.
+// Destroy the texture with ung_texture_destroy.
+ung_baked_animation ung_animation_bake(
+    ung_animation_id anim, ung_skeleton_id skel, ung_animation_bake_params params);
+
 /*
  * Model Loading
  */
@@ -847,6 +1173,7 @@ typedef struct {
     // Missing names will have animation id {0}.
     const char* const* animation_names;
     uint32_t num_animation_names;
+    ung_animation_options animation_options;
 } ung_model_load_params;
 
 typedef struct {
@@ -880,6 +1207,20 @@ ung_model_load_result ung_model_load(ung_model_load_params params);
 // Safe to call on zero-initialized result.
 void ung_model_load_result_free(const ung_model_load_result* result);
 
+// Loads the model as a resource. The file is parsed and primitives are converted to geometry data
+// on the decode threads (in parallel using the job system), GPU objects are created during upload
+// on the main thread. If auto_reload is enabled, the model is reloaded when the file changes.
+// On reload the geometry and texture ids in the result stay the same, the skeleton and animations
+// are not reloaded and the number of primitives and materials must not change.
+// The model owns everything in the result, including the geometry data.
+ung_model_id ung_model_load_async(ung_model_load_params params);
+bool ung_model_is_ready(ung_model_id model);
+// Waits until the model is ready
+const ung_model_load_result* ung_model_get(ung_model_id model);
+ung_resource_id ung_model_resource(ung_model_id model);
+// Destroys all handles in the result
+void ung_model_destroy(ung_model_id model);
+
 #ifdef UNG_CGLTF
 typedef struct cgltf_primitive cgltf_primitive;
 ung_geometry_id ung_geometry_from_cgltf(const cgltf_primitive* prim);
@@ -892,6 +1233,8 @@ ung_skeleton_id ung_skeleton_from_cgltf(const cgltf_skin* skin);
 // nodes outside the skin are simply ignored.
 typedef struct cgltf_animation cgltf_animation;
 ung_animation_id ung_animation_from_cgltf(const cgltf_animation* anim, const cgltf_skin* skin);
+ung_animation_id ung_animation_from_cgltf_ex(
+    const cgltf_animation* anim, const cgltf_skin* skin, ung_animation_options options);
 
 typedef struct cgltf_texture_view cgltf_texture_view;
 ung_texture_id ung_texture_from_cgltf(const char* gltf_path, const cgltf_texture_view* tex_view,
@@ -907,15 +1250,78 @@ typedef struct {
     uint32_t instance_count; // non-instanced
 } ung_draw_params;
 
+typedef struct {
+    // Record all draws of this pass and submit them in ung_end_pass, sorted by material, geometry,
+    // texture and depth (front to back) to minimize state changes. Do not use this for passes
+    // that rely on submission order (e.g. alpha blending).
+    // Consecutive draws with UNG_INSTANCED materials are merged into instanced draws.
+    bool sort_draws;
+    // Skip draws of geometries with bounds that are outside of the camera frustum.
+    // Draws with an instance count or of geometries without bounds are never culled.
+    bool cull;
+} ung_pass_params;
+
 // use mugfx_clear, mugfx_set_viewport, mugfx_set_scissor
 void ung_begin_frame();
 void ung_begin_pass(mugfx_render_target_id target, ung_camera_id camera);
+void ung_begin_pass_ex(
+    mugfx_render_target_id target, ung_camera_id camera, ung_pass_params params);
 // Transform may be 0 to use the identity transform
 void ung_draw(ung_material_id material, ung_geometry_id geometry, const float transform[16],
     ung_draw_params params);
 void ung_end_pass();
 void ung_end_frame();
 
+/* Command lists record draws on any thread, so culling, sorting and transform computation for big
+ * scenes can be spread over multiple (job) threads. Create one list per thread and submit them on
+ * the main thread inside a pass with the same camera that was passed to ung_cmdlist_begin.
+ * While recording, do not destroy or change the camera, the geometries or the list itself
+ * (create and destroy lists on the main thread only). The recorded draws are referenced until the
+ * end of the pass they were submitted in, so don't begin the list again before that.
+ */
+ung_cmdlist_id ung_cmdlist_create();
+void ung_cmdlist_destroy(ung_cmdlist_id list);
+// Clears the list. If cull is set, draws outside of the camera frustum are not recorded at all.
+void ung_cmdlist_begin(ung_cmdlist_id list, ung_camera_id camera, bool cull);
+// Like ung_draw. Binding overrides are copied.
+void ung_cmdlist_draw(ung_cmdlist_id list, ung_material_id material, ung_geometry_id geometry,
+    const float transform[16], ung_draw_params params);
+// Main thread only. Submits the draws in recording order, or queues them if the pass sorts draws.
+// Lists may be submitted multiple times.
+void ung_cmdlist_submit(ung_cmdlist_id list);
+
+// All counters are reset in ung_begin_frame, so query this before that to get the whole frame.
+typedef struct {
+    uint64_t transform_upload_bytes;
+    uint64_t objects_culled;
+    uint64_t objects_drawn;
+    uint64_t draws_loading; // draws with materials that are still loading (see async_materials)
+    uint64_t resource_uploads; // finished loads (decode + upload) in ung_begin_frame
+    uint64_t resource_upload_us; // time spent on them
+    uint64_t resource_uploads_pending; // decoded, but deferred because of the upload budget
+    uint64_t resource_uploads_waiting; // decoded, but can_upload returned false
+    uint64_t resource_decodes; // finished (on any thread) since the previous ung_begin_frame
+    uint64_t draw_calls; // submitted to mugfx (after merging and culling)
+    uint64_t instances; // summed over all draw calls
+    uint64_t triangles;
+    uint64_t material_changes; // draw calls with a different material than the previous one
+    uint64_t binding_overrides; // per-draw textures/buffers (e.g. sprite textures)
+    uint64_t material_upload_bytes; // material dynamic data
+    uint64_t sprite_upload_bytes; // sprite vertices and indices
+    uint64_t instance_upload_bytes; // ung_instance_buffer_update
+    uint64_t other_upload_bytes; // text meshes, skinning matrices
+    uint64_t sprite_flushes;
+    uint64_t sounds_mixed; // sounds with a voice (see max_num_voices)
+    uint64_t sounds_virtual; // logically playing, but not mixed
+    // Live bytes allocated with the ung allocator at the time of the query (not reset)
+    uint64_t memory_core; // ung itself
+    uint64_t memory_mugfx;
+    uint64_t memory_text; // fonts and text layouts
+    uint64_t memory_malloc; // ung_malloc
+} ung_frame_stats;
+
+ung_frame_stats ung_get_frame_stats();
+
 /*
  * Sound
  */
@@ -942,8 +1348,13 @@ void ung_sound_set_default_spatial_params(ung_sound_spatial_params params);
 typedef struct {
     uint8_t group;
     uint32_t num_prewarm_sounds;
+    // Instead of decoding the whole file to PCM, every sound decodes a small window (two pages of
+    // 250ms) while playing. Use this for music and ambience. Files in uncompressed pack entries
+    // are read directly from the mapping.
     bool stream;
     const ung_sound_spatial_params* spatial_params; // optional
+    int32_t priority; // see ung_resource_load_params
+    int32_t voice_priority; // higher priority sounds get voices first (see max_num_voices)
 } ung_sound_source_load_params;
 
 ung_sound_source_id ung_sound_source_load(const char* path, ung_sound_source_load_params params);
@@ -957,10 +1368,18 @@ typedef struct {
     bool spatial; // has to be set for spatialization, even if spatial_params is set on the source
     bool loop;
     bool fail_if_no_idle;
+    // Added to the source's voice_priority. If there are no idle sounds, the sound with the lowest
+    // priority is stopped, if it's lower than this one's.
+    int32_t priority;
 } ung_sound_play_params;
 
 ung_sound_id ung_sound_play(ung_sound_source_id src, ung_sound_play_params params);
 void ung_sound_update(ung_sound_id snd, const float position[3], const float velocity[3]);
+// positions and velocities (optional) contain 3 floats per sound. Invalid sound ids are skipped.
+// Like ung_sound_update, this only queues the updates and the audio thread applies them after it
+// mixed the current period, so it is cheap to call for many sounds every frame.
+void ung_sounds_update(
+    const ung_sound_id* sounds, const float* positions, const float* velocities, size_t count);
 bool ung_sound_is_playing(ung_sound_id snd);
 void ung_sound_set_paused(ung_sound_id snd, bool paused);
 void ung_sound_stop(ung_sound_id snd); // this is the same as delete
@@ -45,6 +45,70 @@ Particle& Buffer::next()
     return p;
 }
 
+constexpr size_t NumSoaStreams = 16;
+
+void SoaBuffer::init(size_t capacity_)
+{
+    capacity = capacity_;
+    count = 0;
+    // One allocation, every stream is capacity floats
+    auto data = allocate<float>(capacity * NumSoaStreams);
+    float** streams[NumSoaStreams] = { &pos_x, &pos_y, &pos_z, &vel_x, &vel_y, &vel_z, &rot, &rvel,
+        &r, &g, &b, &a, &size, &spawn_size, &age, &lifetime };
+    for (size_t i = 0; i < NumSoaStreams; ++i) {
+        *streams[i] = data + capacity * i;
+    }
+}
+
+void SoaBuffer::free()
+{
+    deallocate(pos_x, capacity * NumSoaStreams);
+    *this = {};
+}
+
+bool SoaBuffer::push(const Particle& p)
+{
+    if (count >= capacity) {
+        return false;
+    }
+    const auto i = count++;
+    pos_x[i] = p.pos.x;
+    pos_y[i] = p.pos.y;
+    pos_z[i] = p.pos.z;
+    vel_x[i] = p.vel.x;
+    vel_y[i] = p.vel.y;
+    vel_z[i] = p.vel.z;
+    rot[i] = p.rot;
+    rvel[i] = p.rvel;
+    r[i] = p.r;
+    g[i] = p.g;
+    b[i] = p.b;
+    a[i] = p.a;
+    size[i] = p.size;
+    spawn_size[i] = p.size;
+    age[i] = p.age;
+    lifetime[i] = p.lifetime;
+    return true;
+}
+
+void SoaBuffer::compact()
+{
+    float* streams[NumSoaStreams] = { pos_x, pos_y, pos_z, vel_x, vel_y, vel_z, rot, rvel, r, g, b,
+        a, size, spawn_size, age, lifetime };
+    size_t i = 0;
+    while (i < count) {
+        if (age[i] < lifetime[i]) {
+            ++i;
+            continue;
+        }
+        // Move the last particle here and check it next
+        const auto last = --count;
+        for (auto stream : streams) {
+            stream[i] = stream[last];
+        }
+    }
+}
+
 bool add_behavior(std::span<Behavior> behaviors, const void* params, Behavior::UpdateFunc* func)
 {
     for (auto& b : behaviors) {
@@ -79,6 +143,126 @@ void update(std::span<const Behavior> behaviors, std::span<Particle> particles,
     }
 }
 
+bool add_behavior(
+    std::span<SoaBehavior> behaviors, const void* params, SoaBehavior::UpdateFunc* func)
+{
+    for (auto& b : behaviors) {
+        if (!b.func) {
+            b.params = params;
+            b.func = func;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void update_range(
+    std::span<const SoaBehavior> behaviors, SoaBuffer& buf, size_t begin, size_t end, float dt)
+{
+    for (size_t i = begin; i < end; ++i) {
+        buf.age[i] = fminf(buf.lifetime[i], buf.age[i] + dt);
+    }
+
+    for (const auto& b : behaviors) {
+        if (b.func) {
+            b.func(b.params, buf, begin, end, dt);
+        }
+    }
+
+    for (size_t i = begin; i < end; ++i) {
+        buf.pos_x[i] += buf.vel_x[i] * dt;
+        buf.pos_y[i] += buf.vel_y[i] * dt;
+        buf.pos_z[i] += buf.vel_z[i] * dt;
+        buf.rot[i] += buf.rvel[i] * dt;
+    }
+}
+
+struct UpdateJob {
+    std::span<const SoaBehavior> behaviors;
+    SoaBuffer* buf;
+    float dt;
+    size_t chunk_size;
+};
+
+static void update_job(void* ctx, uint32_t index)
+{
+    const auto job = (const UpdateJob*)ctx;
+    const auto begin = index * job->chunk_size;
+    const auto end = std::min(begin + job->chunk_size, job->buf->count);
+    update_range(job->behaviors, *job->buf, begin, end, job->dt);
+}
+
+void update(std::span<const SoaBehavior> behaviors, SoaBuffer& buf, float dt, size_t chunk_size)
+{
+    if (chunk_size && buf.count > chunk_size) {
+        UpdateJob job = { behaviors, &buf, dt, chunk_size };
+        const auto num_chunks = (buf.count + chunk_size - 1) / chunk_size;
+        const auto counter = ung_job_counter_create();
+        ung_job_run_many(update_job, &job, (uint32_t)num_chunks, counter);
+        ung_job_wait(counter);
+        ung_job_counter_destroy(counter);
+    } else {
+        update_range(behaviors, buf, 0, buf.count, dt);
+    }
+    buf.compact();
+}
+
+void gravity_behavior(const void* params, SoaBuffer& buf, size_t begin, size_t end, float dt)
+{
+    const auto dv = ((const Gravity*)params)->y * dt;
+    for (size_t i = begin; i < end; ++i) {
+        buf.vel_y[i] += dv;
+    }
+}
+
+void drag_behavior(const void* params, SoaBuffer& buf, size_t begin, size_t end, float dt)
+{
+    const auto drag = (const Drag*)(params);
+    const float f = 1.0f / (1.0f + drag->k * dt);
+    for (size_t i = begin; i < end; ++i) {
+        buf.vel_x[i] *= f;
+        buf.vel_y[i] *= f;
+        buf.vel_z[i] *= f;
+    }
+}
+
+void fade_behavior(const void* params, SoaBuffer& buf, size_t begin, size_t end, float)
+{
+    const auto fade = (const Fade*)(params);
+    // Branchless version of the AoS behavior
+    const auto in_scale = fade->in > 0.0f ? 1.0f / fade->in : 1e30f;
+    const auto out_scale = fade->out > 0.0f ? 1.0f / fade->out : 1e30f;
+    for (size_t i = begin; i < end; ++i) {
+        const auto t = buf.age[i] / buf.lifetime[i];
+        const auto fade_in = t * in_scale;
+        const auto fade_out = (1.0f - t) * out_scale;
+        buf.a[i] = clamp(fminf(fade_in, fade_out), 0.f, 1.f);
+    }
+}
+
+void size_over_life_behavior(const void* params, SoaBuffer& buf, size_t begin, size_t end, float)
+{
+    const auto sol = (const SizeOverLife*)(params);
+    const auto delta = sol->end - sol->start;
+    for (size_t i = begin; i < end; ++i) {
+        const auto t = buf.age[i] / buf.lifetime[i];
+        buf.size[i] = buf.spawn_size[i] * (sol->start + delta * t);
+    }
+}
+
+void color_over_life_behavior(const void* params, SoaBuffer& buf, size_t begin, size_t end, float)
+{
+    const auto col = (const ColorOverLife*)(params);
+    const auto delta = um_vec4_sub(col->end, col->start);
+    for (size_t i = begin; i < end; ++i) {
+        const auto t = buf.age[i] / buf.lifetime[i];
+        buf.r[i] = col->start.x + delta.x * t;
+        buf.g[i] = col->start.y + delta.y * t;
+        buf.b[i] = col->start.z + delta.z * t;
+        buf.a[i] = col->start.w + delta.w * t;
+    }
+}
+
 void gravity_behavior(const void* params, std::span<Particle> particles, float dt)
 {
     const auto grav = (const Gravity*)(params);
@@ -195,6 +379,18 @@ void SpawnParams::spawn(Buffer& buf, size_t n, um_vec3 pos, um_vec3 dir) const
     }
 }
 
+size_t SpawnParams::spawn(SoaBuffer& buf, size_t n, um_vec3 pos, um_vec3 dir) const
+{
+    for (size_t i = 0; i < n; ++i) {
+        Particle p;
+        spawn(p, pos, dir);
+        if (!buf.push(p)) {
+            return i;
+        }
+    }
+    return n;
+}
+
 size_t pack_gpu_particle_instances(
     std::span<const Particle> particles, std::span<GpuParticleInstance> gpu_particles)
 {
@@ -219,6 +415,29 @@ size_t pack_gpu_particle_instances(
     return i;
 }
 
+static uint8_t to_u8(float v)
+{
+    return (uint8_t)clamp(v * 255.f, 0.f, 255.f);
+}
+
+size_t pack_gpu_particle_instances(
+    const SoaBuffer& buf, std::span<GpuParticleInstance> gpu_particles)
+{
+    const auto n = std::min(buf.count, gpu_particles.size());
+    for (size_t i = 0; i < n; ++i) {
+        gpu_particles[i] = {
+            { buf.pos_x[i], buf.pos_y[i], buf.pos_z[i] },
+            buf.size[i],
+            buf.rot[i],
+            to_u8(buf.r[i]),
+            to_u8(buf.g[i]),
+            to_u8(buf.b[i]),
+            to_u8(buf.a[i]),
+        };
+    }
+    return n;
+}
+
 void sort_particles(std::span<GpuParticleInstance> gpu_particles, ung_camera_id cam, Sort sort)
 {
     if (sort == Sort::None) {
@@ -243,11 +462,9 @@ void sort_particles(std::span<GpuParticleInstance> gpu_particles, ung_camera_id
         });
 }
 
-size_t update_instance_buffer(mugfx_buffer_id instance_buffer, std::span<const Particle> particles,
-    std::span<GpuParticleInstance> gpu_particles, ung_camera_id cam, Sort sort)
+static size_t upload_instances(mugfx_buffer_id instance_buffer,
+    std::span<GpuParticleInstance> gpu_particles, size_t count, ung_camera_id cam, Sort sort)
 {
-    const auto count = pack_gpu_particle_instances(particles, gpu_particles);
-
     if (count == 0) {
         return 0;
     }
@@ -262,6 +479,20 @@ size_t update_instance_buffer(mugfx_buffer_id instance_buffer, std::span<const P
     return count;
 }
 
+size_t update_instance_buffer(mugfx_buffer_id instance_buffer, std::span<const Particle> particles,
+    std::span<GpuParticleInstance> gpu_particles, ung_camera_id cam, Sort sort)
+{
+    const auto count = pack_gpu_particle_instances(particles, gpu_particles);
+    return upload_instances(instance_buffer, gpu_particles, count, cam, sort);
+}
+
+size_t update_instance_buffer(mugfx_buffer_id instance_buffer, const SoaBuffer& buf,
+    std::span<GpuParticleInstance> gpu_particles, ung_camera_id cam, Sort sort)
+{
+    const auto count = pack_gpu_particle_instances(buf, gpu_particles);
+    return upload_instances(instance_buffer, gpu_particles, count, cam, sort);
+}
+
 mugfx_buffer_id create_instance_buffer(size_t max_instances)
 {
     mugfx_buffer_create_params b {};
@@ -271,13 +502,14 @@ mugfx_buffer_id create_instance_buffer(size_t max_instances)
     return mugfx_buffer_create(b);
 }
 
-ung_geometry_id create_particle_geometry(mugfx_buffer_id instance_buffer)
+// [-0.5..0.5] quad in local space; expanded in VS using camera right/up
+struct BillboardVert {
+    float pos[2];
+    float uv[2];
+};
+
+static void create_billboard_buffers(mugfx_buffer_id& vbuf, mugfx_buffer_id& ibuf)
 {
-    // [-0.5..0.5] quad in local space; expanded in VS using camera right/up
-    struct BillboardVert {
-        float pos[2];
-        float uv[2];
-    };
 
     static const BillboardVert verts[4] = {
         { { -0.5f, -0.5f }, { 0.0f, 0.0f } },
@@ -287,17 +519,23 @@ ung_geometry_id create_particle_geometry(mugfx_buffer_id instance_buffer)
     };
     static const uint16_t indices[6] = { 0, 1, 2, 0, 2, 3 };
 
-    mugfx_buffer_id vbuf = mugfx_buffer_create({
+    vbuf = mugfx_buffer_create({
         .target = MUGFX_BUFFER_TARGET_ARRAY,
         .usage = MUGFX_BUFFER_USAGE_HINT_STATIC,
         .data = mugfx_slice { verts, sizeof(verts) },
     });
 
-    mugfx_buffer_id ibuf = mugfx_buffer_create({
+    ibuf = mugfx_buffer_create({
         .target = MUGFX_BUFFER_TARGET_INDEX,
         .usage = MUGFX_BUFFER_USAGE_HINT_STATIC,
         .data = mugfx_slice { indices, sizeof(indices) },
     });
+}
+
+ung_geometry_id create_particle_geometry(mugfx_buffer_id instance_buffer)
+{
+    mugfx_buffer_id vbuf, ibuf;
+    create_billboard_buffers(vbuf, ibuf);
 
     const static auto tF32 = MUGFX_VERTEX_ATTRIBUTE_TYPE_F32;
     const static auto tU8norm = MUGFX_VERTEX_ATTRIBUTE_TYPE_U8_NORM;
@@ -333,8 +571,8 @@ ung_geometry_id create_particle_geometry(mugfx_buffer_id instance_buffer)
     });
 }
 
-ung_material_id create_particle_material(
-    const char* vert_path, const char* frag_path, ung_texture_id texture)
+static ung_material_id load_particle_material(const char* vert_path, const char* frag_path,
+    ung_texture_id texture, size_t dynamic_data_size)
 {
     const auto mat = ung_material_load(vert_path, frag_path, {
         .mugfx = {
@@ -344,11 +582,18 @@ ung_material_id create_particle_material(
             .src_blend = MUGFX_BLEND_FUNC_SRC_ALPHA,
             .dst_blend = MUGFX_BLEND_FUNC_ONE_MINUS_SRC_ALPHA,
         },
+        .dynamic_data_size = dynamic_data_size,
     });
     ung_material_set_texture(mat, 0, texture);
     return mat;
 }
 
+ung_material_id create_particle_material(
+    const char* vert_path, const char* frag_path, ung_texture_id texture)
+{
+    return load_particle_material(vert_path, frag_path, texture, 0);
+}
+
 void Renderer::init(size_t max_num_particles)
 {
     gpu_particles = allocate<GpuParticleInstance>(max_num_particles);
@@ -372,6 +617,156 @@ void Renderer::draw(std::span<Particle> particles, DrawData& draw_data, ung_came
         draw_data.material, draw_data.geometry, nullptr, { .instance_count = (uint32_t)count });
 }
 
+void Renderer::draw(const SoaBuffer& buf, DrawData& draw_data, ung_camera_id cam)
+{
+    const auto count = update_instance_buffer(draw_data.instance_buffer, buf,
+        { gpu_particles, num_gpu_particles }, cam, draw_data.sort);
+    if (count == 0) {
+        return;
+    }
+    ung_draw(
+        draw_data.material, draw_data.geometry, nullptr, { .instance_count = (uint32_t)count });
+}
+
+// Matches UngMaterialDynamic in pfx_gpu.vert (std140)
+struct GpuSimUniforms {
+    float gravity[4]; // xyz: gravity, w: drag
+    float params[4]; // x: time, y: fade in, z: fade out
+    float size_over_life[4]; // x: start, y: end
+    um_vec4 color_start;
+    um_vec4 color_end;
+};
+
+void GpuEmitter::init(
+    size_t capacity_, const char* vert_path, const char* frag_path, ung_texture_id texture)
+{
+    capacity = capacity_;
+    records = allocate<GpuSpawnRecord>(capacity);
+
+    material = load_particle_material(vert_path, frag_path, texture, sizeof(GpuSimUniforms));
+
+    mugfx_buffer_create_params b {};
+    b.target = MUGFX_BUFFER_TARGET_ARRAY;
+    b.usage = MUGFX_BUFFER_USAGE_HINT_DYNAMIC;
+    // Initialize with zeroed records (lifetime 0), so they are never drawn
+    b.data = mugfx_slice { .data = records, .length = capacity * sizeof(GpuSpawnRecord) };
+    spawn_buffer = mugfx_buffer_create(b);
+
+    create_billboard_buffers(billboard_vbuf, billboard_ibuf);
+
+    const static auto tF32 = MUGFX_VERTEX_ATTRIBUTE_TYPE_F32;
+    const static auto tU8norm = MUGFX_VERTEX_ATTRIBUTE_TYPE_U8_NORM;
+    const static auto inst = MUGFX_VERTEX_ATTRIBUTE_RATE_INSTANCE;
+    geometry = ung_geometry_create({
+        .draw_mode = MUGFX_DRAW_MODE_TRIANGLES,
+        .vertex_buffers = {
+            // VERTEX
+            {
+                .buffer = billboard_vbuf,
+                .stride = sizeof(BillboardVert),
+                .attributes = {
+                    { .location = 0, .components = 2, .type = tF32 }, // pos
+                    { .location = 1, .components = 2, .type = tF32 }, // uv
+                }
+            },
+            // INSTANCE
+            {
+                .buffer = spawn_buffer,
+                .stride = sizeof(GpuSpawnRecord),
+                .attributes = {
+                    { .location = 2, .components = 3, .type = tF32, .rate = inst }, // pos
+                    { .location = 3, .components = 1, .type = tF32, .rate = inst }, // spawn_time
+                    { .location = 4, .components = 3, .type = tF32, .rate = inst }, // vel
+                    { .location = 5, .components = 1, .type = tF32, .rate = inst }, // lifetime
+                    { .location = 6, .components = 1, .type = tF32, .rate = inst }, // size
+                    { .location = 7, .components = 1, .type = tF32, .rate = inst }, // rot
+                    { .location = 8, .components = 1, .type = tF32, .rate = inst }, // rvel
+                    { .location = 9, .components = 4, .type = tU8norm, .rate = inst }, // rgba
+                }
+            },
+        },
+        .vertex_count = 4,
+        .index_buffer = billboard_ibuf,
+        .index_type = MUGFX_INDEX_TYPE_U16,
+        .index_count = 6,
+    });
+}
+
+void GpuEmitter::free()
+{
+    ung_geometry_destroy(geometry);
+    mugfx_buffer_destroy(billboard_vbuf);
+    mugfx_buffer_destroy(billboard_ibuf);
+    mugfx_buffer_destroy(spawn_buffer);
+    ung_material_destroy(material);
+    deallocate(records, capacity);
+    records = nullptr;
+}
+
+void GpuEmitter::spawn(const SpawnParams& params, size_t n, um_vec3 pos, um_vec3 dir)
+{
+    for (size_t i = 0; i < n; ++i) {
+        Particle p;
+        params.spawn(p, pos, dir);
+        records[next_idx] = {
+            { p.pos.x, p.pos.y, p.pos.z },
+            time,
+            { p.vel.x, p.vel.y, p.vel.z },
+            p.lifetime,
+            p.size,
+            p.rot,
+            p.rvel,
+            to_u8(p.r),
+            to_u8(p.g),
+            to_u8(p.b),
+            to_u8(p.a),
+        };
+        if (dirty_count == 0) {
+            dirty_begin = next_idx;
+        }
+        dirty_count = std::min(dirty_count + 1, capacity);
+        next_idx = (next_idx + 1) % capacity;
+    }
+    num_spawned = std::min(num_spawned + n, capacity);
+}
+
+void GpuEmitter::update(float dt)
+{
+    time += dt;
+}
+
+void GpuEmitter::draw()
+{
+    if (dirty_count == capacity) {
+        mugfx_buffer_update(spawn_buffer, 0, { records, capacity * sizeof(GpuSpawnRecord) });
+    } else if (dirty_count > 0) {
+        // Upload only the new records, in two parts if they wrap around
+        const auto first = std::min(dirty_count, capacity - dirty_begin);
+        mugfx_buffer_update(spawn_buffer, dirty_begin * sizeof(GpuSpawnRecord),
+            { records + dirty_begin, first * sizeof(GpuSpawnRecord) });
+        if (first < dirty_count) {
+            mugfx_buffer_update(
+                spawn_buffer, 0, { records, (dirty_count - first) * sizeof(GpuSpawnRecord) });
+        }
+    }
+    dirty_count = 0;
+
+    if (num_spawned == 0) {
+        return;
+    }
+
+    auto uniforms = (GpuSimUniforms*)ung_material_get_dynamic_data(material);
+    *uniforms = {
+        .gravity = { 0.0f, gravity.y, 0.0f, drag.k },
+        .params = { time, fade.in, fade.out, 0.0f },
+        .size_over_life = { size_over_life.start, size_over_life.end, 0.0f, 0.0f },
+        .color_start = color_over_life.start,
+        .color_end = color_over_life.end,
+    };
+
+    ung_draw(material, geometry, nullptr, { .instance_count = (uint32_t)num_spawned });
+}
+
 static std::string_view sv(const ung_string& s)
 {
     return std::string_view(s.data, s.length);
@@ -43,6 +43,39 @@ struct Buffer {
     Particle& next();
 };
 
+// Structure of arrays with all alive particles packed at the front, so behaviors don't have to
+// check whether a particle is alive and their loops can be vectorized by the compiler.
+// Use this for effects with a lot of particles (e.g. explosions). Dead particles are removed in
+// update (swap with last), so the order of particles is not stable.
+struct SoaBuffer {
+    float* pos_x;
+    float* pos_y;
+    float* pos_z;
+    float* vel_x;
+    float* vel_y;
+    float* vel_z;
+    float* rot;
+    float* rvel;
+    float* r;
+    float* g;
+    float* b;
+    float* a;
+    float* size;
+    float* spawn_size;
+    float* age;
+    float* lifetime;
+    size_t capacity = 0;
+    size_t count = 0; // alive particles are [0, count)
+
+    void init(size_t capacity);
+    void free();
+
+    // Returns false if the buffer is full (the particle is not spawned then)
+    bool push(const Particle& p);
+    // Removes all particles with age >= lifetime
+    void compact();
+};
+
 // Spawning
 
 struct SpawnParams {
@@ -65,6 +98,8 @@ struct SpawnParams {
     void spawn(Particle& p, const um_vec3& pos, const um_vec3& dir = { 0.f, 1.f, 0.f }) const;
     Particle& spawn(Buffer& buf, const um_vec3& pos, const um_vec3& dir = { 0.f, 1.f, 0.f }) const;
     void spawn(Buffer& buf, size_t n, um_vec3 pos, um_vec3 dir = { 0.f, 1.f, 0.f }) const;
+    // Returns the number of spawned particles, which is less than n if buf is full
+    size_t spawn(SoaBuffer& buf, size_t n, um_vec3 pos, um_vec3 dir = { 0.f, 1.f, 0.f }) const;
 };
 
 struct Behavior {
@@ -95,6 +130,42 @@ struct Fade {
 
 void fade_behavior(const void* params, std::span<Particle> particles, float dt);
 
+// SoA behaviors work on the range [begin, end) of alive particles. They may be called from job
+// threads for different ranges at the same time.
+struct SoaBehavior {
+    using UpdateFunc = void(const void* params, SoaBuffer& buf, size_t begin, size_t end, float dt);
+    const void* params;
+    UpdateFunc* func;
+};
+
+bool add_behavior(
+    std::span<SoaBehavior> behaviors, const void* params, SoaBehavior::UpdateFunc* func);
+
+// Ages, applies behaviors, integrates and then removes dead particles.
+// If chunk_size is not 0 and there are more particles than that, the particles are split into
+// chunks of chunk_size that are updated in parallel on the job system.
+void update(
+    std::span<const SoaBehavior> behaviors, SoaBuffer& buf, float dt, size_t chunk_size = 0);
+
+struct SizeOverLife {
+    float start = 1.0f, end = 0.0f; // multiplied with the spawn size
+};
+
+struct ColorOverLife {
+    um_vec4 start = { 1.f, 1.f, 1.f, 1.f };
+    um_vec4 end = { 1.f, 1.f, 1.f, 0.f };
+};
+
+void gravity_behavior(const void* params, SoaBuffer& buf, size_t begin, size_t end, float dt);
+void drag_behavior(const void* params, SoaBuffer& buf, size_t begin, size_t end, float dt);
+void fade_behavior(const void* params, SoaBuffer& buf, size_t begin, size_t end, float dt);
+// Sets size to spawn size times the curve
+void size_over_life_behavior(
+    const void* params, SoaBuffer& buf, size_t begin, size_t end, float dt);
+// Overwrites the color completely
+void color_over_life_behavior(
+    const void* params, SoaBuffer& buf, size_t begin, size_t end, float dt);
+
 // Rendering
 
 struct GpuParticleInstance {
@@ -137,9 +208,15 @@ struct DrawData {
 size_t pack_gpu_particle_instances(
     std::span<const Particle> particles, std::span<GpuParticleInstance> gpu_particles);
 
+size_t pack_gpu_particle_instances(
+    const SoaBuffer& buf, std::span<GpuParticleInstance> gpu_particles);
+
 size_t update_instance_buffer(mugfx_buffer_id instance_buffer, std::span<const Particle> particles,
     std::span<GpuParticleInstance> gpu_particles, ung_camera_id cam = { 0 },
     Sort sort = Sort::None);
+size_t update_instance_buffer(mugfx_buffer_id instance_buffer, const SoaBuffer& buf,
+    std::span<GpuParticleInstance> gpu_particles, ung_camera_id cam = { 0 },
+    Sort sort = Sort::None);
 
 struct Renderer {
     // This is really just a container for gpu_particles, because it can easily be shared
@@ -152,6 +229,61 @@ struct Renderer {
     void free();
 
     void draw(std::span<Particle> particles, DrawData& draw, ung_camera_id cam = { 0 });
+    void draw(const SoaBuffer& buf, DrawData& draw, ung_camera_id cam = { 0 });
+};
+
+// GPU Simulation
+
+/* For effects with a lot of particles that don't need to interact with anything (weather, ambient
+ * dust, etc.), particles can be evaluated on the GPU instead (use pfx_gpu.vert).
+ * Nothing is simulated step by step. The vertex shader evaluates every particle in closed form
+ * from its spawn state and its age (gravity, drag, fade, size and color over life), so the only
+ * CPU work is writing new spawn records into a ring buffer and uploading those.
+ * Dead particles are collapsed to a degenerate quad and there is no sorting, so use blending that
+ * does not depend on draw order (e.g. additive).
+ */
+
+struct GpuSpawnRecord {
+    float pos[3];
+    float spawn_time;
+    float vel[3];
+    float lifetime;
+    float size;
+    float rot;
+    float rvel;
+    uint8_t r, g, b, a;
+};
+
+struct GpuEmitter {
+    ung_material_id material;
+    mugfx_buffer_id spawn_buffer;
+    ung_geometry_id geometry;
+    mugfx_buffer_id billboard_vbuf; // geometry does not own its buffers
+    mugfx_buffer_id billboard_ibuf;
+    GpuSpawnRecord* records; // CPU copy of spawn_buffer
+    size_t capacity = 0;
+    size_t next_idx = 0;
+    size_t num_spawned = 0;
+    // Range of records that were written since the last upload (may wrap around)
+    size_t dirty_begin = 0;
+    size_t dirty_count = 0;
+    float time = 0.0f;
+
+    Gravity gravity = {};
+    Drag drag = { 0.0f };
+    Fade fade = {};
+    SizeOverLife size_over_life = { 1.0f, 1.0f };
+    ColorOverLife color_over_life = { { 1.f, 1.f, 1.f, 1.f }, { 1.f, 1.f, 1.f, 1.f } };
+
+    // If more than capacity particles are alive, the oldest ones are replaced
+    void init(size_t capacity, const char* vert_path, const char* frag_path,
+        ung_texture_id texture);
+    void free();
+
+    void spawn(const SpawnParams& params, size_t n, um_vec3 pos, um_vec3 dir = { 0.f, 1.f, 0.f });
+    void update(float dt);
+    // Uploads new spawn records and draws all of them
+    void draw();
 };
 
 // High-Level
@@ -0,0 +1,83 @@
+layout (binding = 1, std140) uniform UngPass {
+    mat4 view;
+    mat4 view_inv;
+    mat4 projection;
+    mat4 projection_inv;
+    mat4 view_projection;
+    mat4 view_projection_inv;
+    vec4 view_dimensions; // xy: size, zw: reciprocal size
+};
+
+// Matches GpuSimUniforms in pfx.cpp
+layout (binding = 9, std140) uniform UngMaterialDynamic {
+    vec4 u_gravity; // xyz: gravity, w: drag
+    vec4 u_params; // x: time, y: fade in, z: fade out
+    vec4 u_size_over_life; // x: start, y: end
+    vec4 u_color_start;
+    vec4 u_color_end;
+};
+
+layout(location = 0) in vec2 a_position;  // [-0.5..0.5] quad in local billboard space
+layout(location = 1) in vec2 a_texcoord;
+
+// per instance (spawn state)
+layout(location = 2) in vec3  i_position;
+layout(location = 3) in float i_spawn_time;
+layout(location = 4) in vec3  i_velocity;
+layout(location = 5) in float i_lifetime;
+layout(location = 6) in float i_size;
+layout(location = 7) in float i_rot;
+layout(location = 8) in float i_rvel;
+layout(location = 9) in vec4  i_color;
+
+out vec2 vs_out_texcoord;
+out vec4 vs_out_color;
+
+void main()
+{
+    float age = u_params.x - i_spawn_time;
+    if (age < 0.0 || age >= i_lifetime) {
+        // Dead (or not yet spawned) particles collapse to a single point outside the clip volume
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        vs_out_texcoord = vec2(0.0);
+        vs_out_color = vec4(0.0);
+        return;
+    }
+    float t = age / i_lifetime;
+
+    // Closed form of v' = g - k * v, which is what gravity_behavior and drag_behavior integrate
+    vec3 g = u_gravity.xyz;
+    float k = u_gravity.w;
+    vec3 pos;
+    if (k > 1e-4) {
+        vec3 terminal = g / k;
+        pos = i_position + terminal * age + (i_velocity - terminal) * (1.0 - exp(-k * age)) / k;
+    } else {
+        pos = i_position + i_velocity * age + 0.5 * g * age * age;
+    }
+
+    float fade = 1.0;
+    if (t < u_params.y) {
+        fade = t / u_params.y;
+    } else if (t > 1.0 - u_params.z) {
+        fade = (1.0 - t) / u_params.z;
+    }
+
+    float size = i_size * mix(u_size_over_life.x, u_size_over_life.y, t);
+    float rot = i_rot + i_rvel * age;
+
+    // Rotate and scale billboard plane
+    float s = sin(rot);
+    float c = cos(rot);
+    vec2 p = size * vec2(c * a_position.x - s * a_position.y, s * a_position.x + c * a_position.y);
+
+    vec3 cam_right = view_inv[0].xyz;
+    vec3 cam_up = view_inv[1].xyz;
+    vec3 world_pos = pos + cam_right * p.x + cam_up * p.y;
+
+    vs_out_texcoord = a_texcoord;
+    vs_out_color = i_color * mix(u_color_start, u_color_end, t);
+    vs_out_color.a *= clamp(fade, 0.0, 1.0);
+
+    gl_Position = view_projection * vec4(world_pos, 1.0);
+}
@@ -27,19 +27,32 @@ ung_allocator allocator = {
     .ctx = nullptr,
 };
 
+std::atomic<int64_t> allocated_bytes[(size_t)MemTag::Count] = {};
+
 void* mugfx_allocate(size_t size, void* ctx)
 {
-    return allocator.allocate(size, ctx);
+    const auto ptr = allocator.allocate(size, ctx);
+    if (ptr) {
+        track_allocation(MemTag::Mugfx, (int64_t)size);
+    }
+    return ptr;
 }
 
 void* mugfx_reallocate(void* ptr, size_t old_size, size_t new_size, void* ctx)
 {
-    return allocator.reallocate(ptr, old_size, new_size, ctx);
+    const auto new_ptr = allocator.reallocate(ptr, old_size, new_size, ctx);
+    if (new_ptr) {
+        track_allocation(MemTag::Mugfx, (int64_t)new_size - (int64_t)old_size);
+    }
+    return new_ptr;
 }
 
 void mugfx_deallocate(void* ptr, size_t size, void* ctx)
 {
-    return allocator.deallocate(ptr, size, ctx);
+    allocator.deallocate(ptr, size, ctx);
+    if (ptr) {
+        track_allocation(MemTag::Mugfx, -(int64_t)size);
+    }
 }
 
 mugfx_allocator mugfx_alloc {
@@ -66,4 +79,131 @@ void deallocate_string(char* str)
     deallocate(str, len + 1);
 }
 
-}
\ No newline at end of file
+void Arena::init(size_t capacity_)
+{
+    // Not allocate<uint8_t>, because that would zero (and touch every page of) the whole arena
+    data = (uint8_t*)allocator.allocate(capacity_, allocator.ctx);
+    if (data) {
+        track_allocation(MemTag::Core, (int64_t)capacity_);
+    }
+    capacity = capacity_;
+    offset.store(0, std::memory_order_relaxed);
+}
+
+void Arena::free()
+{
+    deallocate(data, capacity);
+    data = nullptr;
+    capacity = 0;
+    offset.store(0, std::memory_order_relaxed);
+}
+
+void* Arena::allocate(size_t size, size_t alignment)
+{
+    assert(alignment && (alignment & (alignment - 1)) == 0);
+    const auto base = (uintptr_t)data;
+    auto cur = offset.load(std::memory_order_relaxed);
+    size_t start = 0;
+    do {
+        start = ((base + cur + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+        if (start + size > capacity) {
+            return nullptr;
+        }
+    } while (!offset.compare_exchange_weak(cur, start + size, std::memory_order_relaxed));
+    return data + start;
+}
+
+// One arena is written while the GPU might still read from the other.
+// Other threads might allocate while the arenas are swapped in ung_begin_frame, which then come
+// from either arena.
+static Arena frame_arenas[2];
+static std::atomic<uint32_t> frame_arena_idx = 0;
+static size_t scratch_size = 0;
+
+struct ScratchArena {
+    Arena arena;
+    uint32_t depth = 0; // number of active ScratchScopes
+
+    ~ScratchArena()
+    {
+        if (arena.data) {
+            arena.free();
+        }
+    }
+};
+
+static thread_local ScratchArena scratch;
+
+static Arena& get_scratch_arena()
+{
+    if (!scratch.arena.data && scratch_size) {
+        scratch.arena.init(scratch_size);
+    }
+    return scratch.arena;
+}
+
+void* frame_allocate(size_t size, size_t alignment)
+{
+    return frame_arenas[frame_arena_idx.load(std::memory_order_acquire)].allocate(size, alignment);
+}
+
+void init_arenas(size_t frame_arena_size, size_t scratch_arena_size)
+{
+    for (auto& arena : frame_arenas) {
+        arena.init(frame_arena_size);
+    }
+    frame_arena_idx.store(0, std::memory_order_relaxed);
+    scratch_size = scratch_arena_size;
+}
+
+void swap_frame_arenas()
+{
+    // Reset before publishing, so no allocation from the new arena is reset
+    const auto next = (frame_arena_idx.load(std::memory_order_relaxed) + 1) % 2;
+    frame_arenas[next].reset();
+    frame_arena_idx.store(next, std::memory_order_release);
+}
+
+void shutdown_arenas()
+{
+    for (auto& arena : frame_arenas) {
+        arena.free();
+    }
+    // The scratch arenas of other threads are freed when they exit
+    if (scratch.arena.data) {
+        assert(scratch.depth == 0);
+        scratch.arena.free();
+    }
+    scratch_size = 0;
+}
+
+ScratchScope::ScratchScope()
+{
+    offset = scratch.arena.offset.load(std::memory_order_relaxed);
+    scratch.depth++;
+}
+
+ScratchScope::~ScratchScope()
+{
+    assert(scratch.depth > 0);
+    scratch.depth--;
+    scratch.arena.reset(offset);
+}
+
+uint8_t* allocate_scratch(size_t size)
+{
+    assert(scratch.depth > 0);
+    if (const auto ptr = get_scratch_arena().allocate(size)) {
+        return (uint8_t*)ptr;
+    }
+    return allocate<uint8_t>(size);
+}
+
+void deallocate_scratch(uint8_t* ptr, size_t size)
+{
+    if (!scratch.arena.owns(ptr)) {
+        deallocate(ptr, size);
+    }
+}
+
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <atomic>
+#include <cassert>
+#include <mutex>
 #include <new> // needed for placement new
 
 #include "ung.h"
@@ -9,10 +12,23 @@ namespace ung {
 extern ung_allocator allocator;
 extern mugfx_allocator mugfx_alloc;
 
+// Live bytes are counted per tag for ung_get_frame_stats
+enum class MemTag { Core = 0, Mugfx, Text, Malloc, Count };
+
+extern std::atomic<int64_t> allocated_bytes[(size_t)MemTag::Count];
+
+inline void track_allocation(MemTag tag, int64_t delta)
+{
+    allocated_bytes[(size_t)tag].fetch_add(delta, std::memory_order_relaxed);
+}
+
 template <typename T>
 T* allocate(size_t count = 1)
 {
     const auto ptr = reinterpret_cast<T*>(allocator.allocate(sizeof(T) * count, allocator.ctx));
+    if (ptr) {
+        track_allocation(MemTag::Core, (int64_t)(sizeof(T) * count));
+    }
     for (size_t i = 0; i < count; ++i) {
         new (ptr + i) T {};
     }
@@ -21,7 +37,11 @@ T* allocate(size_t count = 1)
 
 inline void* reallocate(void* ptr, size_t old_size, size_t new_size)
 {
-    return allocator.reallocate(ptr, old_size, new_size, allocator.ctx);
+    const auto new_ptr = allocator.reallocate(ptr, old_size, new_size, allocator.ctx);
+    if (new_ptr) {
+        track_allocation(MemTag::Core, (int64_t)new_size - (int64_t)old_size);
+    }
+    return new_ptr;
 }
 
 template <typename T>
@@ -34,9 +54,97 @@ void deallocate(T* ptr, size_t count = 1)
         (ptr + i)->~T();
     }
     allocator.deallocate(ptr, sizeof(T) * count, allocator.ctx);
+    track_allocation(MemTag::Core, -(int64_t)(sizeof(T) * count));
 }
 
 char* allocate_string(const char* str);
 void deallocate_string(char* str);
 
-}
\ No newline at end of file
+// Linear allocator with a fixed capacity. allocate is thread-safe and returns nullptr if the
+// arena is full. Memory is only freed all at once with reset.
+struct Arena {
+    uint8_t* data = nullptr;
+    size_t capacity = 0;
+    std::atomic<size_t> offset = 0;
+
+    void init(size_t capacity);
+    void free();
+    void* allocate(size_t size, size_t alignment = 16);
+    void reset(size_t to = 0) { offset.store(to, std::memory_order_relaxed); }
+    bool owns(const void* ptr) const { return ptr >= data && ptr < data + capacity; }
+};
+
+// Called from ung_init/ung_begin_frame/ung_shutdown
+void init_arenas(size_t frame_arena_size, size_t scratch_arena_size);
+void swap_frame_arenas();
+void shutdown_arenas();
+// See ung_frame_alloc
+void* frame_allocate(size_t size, size_t alignment = 16);
+
+// Every thread has its own scratch arena for temporary buffers (created on first use).
+// Scratch allocations must happen inside a ScratchScope and are freed at the end of it.
+// If the scratch arena is full, allocate_scratch falls back to the heap, so always pass the
+// allocation to deallocate_scratch (which does nothing for arena allocations).
+struct ScratchScope {
+    size_t offset;
+
+    ScratchScope();
+    ~ScratchScope();
+    ScratchScope(const ScratchScope&) = delete;
+    ScratchScope& operator=(const ScratchScope&) = delete;
+};
+
+uint8_t* allocate_scratch(size_t size);
+void deallocate_scratch(uint8_t* ptr, size_t size);
+
+// Fixed number of blocks for objects of type T with a free list, for objects that are created and
+// destroyed often (e.g. per load). If all blocks are in use, it falls back to the heap.
+// It's thread-safe, so objects can be created in decode threads.
+template <typename T, size_t Capacity>
+struct BlockPool {
+    union Block {
+        Block* next;
+        alignas(T) uint8_t storage[sizeof(T)];
+    };
+
+    Block blocks[Capacity];
+    Block* free_head = nullptr;
+    size_t num_used = 0; // blocks [num_used, Capacity) have never been used
+    std::mutex mtx;
+
+    T* create()
+    {
+        Block* block = nullptr;
+        {
+            std::lock_guard lock(mtx);
+            if (free_head) {
+                block = free_head;
+                free_head = block->next;
+            } else if (num_used < Capacity) {
+                block = &blocks[num_used++];
+            }
+        }
+        if (!block) {
+            return ung::allocate<T>();
+        }
+        return new (block->storage) T {};
+    }
+
+    void destroy(T* ptr)
+    {
+        if (!ptr) {
+            return;
+        }
+        const auto block = reinterpret_cast<Block*>(ptr);
+        if (block < blocks || block >= blocks + Capacity) {
+            ung::deallocate(ptr);
+            return;
+        }
+        ptr->~T();
+        std::lock_guard lock(mtx);
+        block->next = free_head;
+        free_head = block;
+    }
+};
+
+}
@@ -1,5 +1,8 @@
+#include "state.hpp"
 #include "types.hpp"
 
+#include <algorithm>
+#include <cfloat>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
@@ -8,15 +11,12 @@
 #include "um.h"
 
 namespace ung::animation {
-struct Joint {
-    um_mat inverse_bind_matrix;
-    int16_t parent_index;
-};
-
+// Every joint attribute is a separate array, so updates only touch what they need.
 struct Skeleton {
     u16 num_joints;
-    // all four arrays below have num_joints elements
-    Joint* joints; // immutable
+    // all arrays below have num_joints elements
+    int16_t* parent_indices; // immutable
+    um_mat* inverse_bind_matrices; // immutable
     ung_joint_transform* joint_transforms; // mutable pose (local space)
     ung_joint_transform* local_bind; // local bind pose transforms
     // cached globals & skin matrices:
@@ -31,16 +31,32 @@ struct AnimationChannel {
     size_t num_samples;
     float* times; // size = num_samples
     float* values; // vec3: 3*num_samples, quat(xyzw): 4*num_samples
+    float inv_dt; // > 0 if times are uniformly spaced (resampled)
+    // If non-null, replaces values, 3 per sample.
+    // vec3: range_min + q / 0xffff * range_size, quat: smallest three (see quantize_quat)
+    u16* quantized;
+    float range_min[3];
+    float range_size[3];
 };
 
 struct Animation {
     float duration_s;
     Array<AnimationChannel> channels;
+    usize original_size; // in bytes, before compression
 };
 
 struct State {
     Pool<Skeleton> skeletons;
     Pool<Animation> animations;
+    Vector<Skeleton*> update_batch;
+    u32 update_batch_per_job;
+    Vector<u8> skinning_staging;
+
+    // Skinning palette (see ung_skeletons_update_params::palette), orphaned once per frame
+    mugfx_buffer_id palette;
+    u32 palette_size;
+    u32 palette_offset;
+    u64 palette_frame;
 };
 
 State* state;
@@ -53,6 +69,20 @@ void init(ung_init_params params)
 
     state->skeletons.init(params.max_num_skeletons ? params.max_num_skeletons : 64);
     state->animations.init(params.max_num_animations ? params.max_num_animations : 256);
+    state->update_batch.init(64);
+    state->skinning_staging.init(64 * 64 * sizeof(um_mat));
+
+    const auto max_num_palette_matrices = params.max_num_skinning_matrices_per_frame
+        ? params.max_num_skinning_matrices_per_frame
+        : 4096;
+    state->palette_size = max_num_palette_matrices * (u32)sizeof(um_mat);
+    // Bindings always cover UNG_SKINNING_PALETTE_RANGE bytes, so we need some slack at the end
+    state->palette = mugfx_buffer_create({
+        .target = MUGFX_BUFFER_TARGET_UNIFORM,
+        .usage = MUGFX_BUFFER_USAGE_HINT_STREAM,
+        .data = { nullptr, state->palette_size + UNG_SKINNING_PALETTE_RANGE },
+        .debug_label = "UngSkinningPalette",
+    });
 }
 
 void shutdown()
@@ -62,22 +92,17 @@ void shutdown()
     }
 
     // free remaining skeleton buffers to avoid leaks
-    for (u32 i = 0; i < state->skeletons.capacity(); ++i) {
-        const auto key = state->skeletons.get_key(i);
-        if (key == 0) {
-            continue;
-        }
-        ung_skeleton_destroy({ key });
+    for (u32 i = state->skeletons.size(); i-- > 0;) {
+        ung_skeleton_destroy({ state->skeletons.alive_key(i) });
     }
 
-    for (u32 i = 0; i < state->animations.capacity(); ++i) {
-        const auto key = state->animations.get_key(i);
-        if (key == 0) {
-            continue;
-        }
-        ung_animation_destroy({ key });
+    for (u32 i = state->animations.size(); i-- > 0;) {
+        ung_animation_destroy({ state->animations.alive_key(i) });
     }
 
+    mugfx_buffer_destroy(state->palette);
+    state->skinning_staging.free();
+    state->update_batch.free();
     state->animations.free();
     state->skeletons.free();
 
@@ -99,7 +124,8 @@ EXPORT ung_skeleton_id ung_skeleton_create(ung_skeleton_create_params params)
     Skeleton& s = *obj;
     s.num_joints = params.num_joints;
 
-    s.joints = allocate<Joint>(s.num_joints);
+    s.parent_indices = allocate<int16_t>(s.num_joints);
+    s.inverse_bind_matrices = allocate<um_mat>(s.num_joints);
     s.joint_transforms = allocate<ung_joint_transform>(s.num_joints);
     s.local_bind = allocate<ung_joint_transform>(s.num_joints);
     s.global_transforms = allocate<um_mat>(s.num_joints);
@@ -110,20 +136,18 @@ EXPORT ung_skeleton_id ung_skeleton_create(ung_skeleton_create_params params)
         const auto parent_idx = params.joints[i].parent_index;
         assert(parent_idx < i); // ensure topological ordering
 
-        s.joints[i] = {
-            .inverse_bind_matrix = um_mat_from_ptr(params.joints[i].inverse_bind_matrix),
-            .parent_index = parent_idx,
-        };
+        s.parent_indices[i] = parent_idx;
+        s.inverse_bind_matrices[i] = um_mat_from_ptr(params.joints[i].inverse_bind_matrix);
 
         if (params.local_bind) {
             s.local_bind[i] = params.local_bind[i];
         } else {
             // Derive local bind from inverse bind matrix
-            const auto bind_global = um_mat_invert(s.joints[i].inverse_bind_matrix);
+            const auto bind_global = um_mat_invert(s.inverse_bind_matrices[i]);
 
             um_mat local_m;
             if (parent_idx >= 0) {
-                const auto parent_global = um_mat_invert(s.joints[parent_idx].inverse_bind_matrix);
+                const auto parent_global = um_mat_invert(s.inverse_bind_matrices[parent_idx]);
                 const auto parent_inv = um_mat_invert(parent_global);
                 local_m = um_mat_mul(parent_inv, bind_global);
             } else {
@@ -150,8 +174,10 @@ EXPORT void ung_skeleton_destroy(ung_skeleton_id skel)
 {
     assert(state);
     auto s = get(state->skeletons, skel.id);
-    deallocate(s->joints, s->num_joints);
+    deallocate(s->parent_indices, s->num_joints);
+    deallocate(s->inverse_bind_matrices, s->num_joints);
     deallocate(s->joint_transforms, s->num_joints);
+    deallocate(s->local_bind, s->num_joints);
     deallocate(s->global_transforms, s->num_joints);
     deallocate(s->skinning_matrices, s->num_joints);
     state->skeletons.remove(skel.id);
@@ -175,26 +201,37 @@ EXPORT ung_joint_transform* ung_skeleton_get_joint_transforms(
     return s->joint_transforms;
 }
 
+// Same as translate(t) * from_quat(r) * scale(s), but without the two matrix multiplications
 static um_mat get_matrix(const ung_joint_transform& trafo)
 {
-    const auto t
-        = um_mat_translate({ trafo.translation[0], trafo.translation[1], trafo.translation[2] });
-    const auto r = um_mat_from_quat(
-        { trafo.rotation[0], trafo.rotation[1], trafo.rotation[2], trafo.rotation[3] });
-    const auto s = um_mat_scale({ trafo.scale[0], trafo.scale[1], trafo.scale[2] });
-    return um_mat_mul(um_mat_mul(t, r), s);
+    const auto [x, y, z, w] = trafo.rotation;
+    const auto [sx, sy, sz] = trafo.scale;
+    const auto [tx, ty, tz] = trafo.translation;
+
+    const float xx = x * x, xy = x * y, xz = x * z, xw = x * w;
+    const float yy = y * y, yz = y * z, yw = y * w;
+    const float zz = z * z, zw = z * w;
+
+    um_mat m;
+    m.cols[0] = { (1.0f - 2.0f * (yy + zz)) * sx, 2.0f * (xy + zw) * sx, 2.0f * (xz - yw) * sx,
+        0.0f };
+    m.cols[1] = { 2.0f * (xy - zw) * sy, (1.0f - 2.0f * (xx + zz)) * sy, 2.0f * (yz + xw) * sy,
+        0.0f };
+    m.cols[2] = { 2.0f * (xz + yw) * sz, 2.0f * (yz - xw) * sz, (1.0f - 2.0f * (xx + yy)) * sz,
+        0.0f };
+    m.cols[3] = { tx, ty, tz, 1.0f };
+    return m;
 }
 
-EXPORT void ung_skeleton_update(ung_skeleton_id skel)
+static void update(Skeleton* s)
 {
-    assert(state);
-    auto s = get(state->skeletons, skel.id);
-
     // This works only because the joints are topologically ordered (asserted in create)!
+    // Doing all the global transforms first and all skinning matrices afterwards streams through
+    // fewer arrays at a time.
     for (u16 i = 0; i < s->num_joints; ++i) {
         const auto local_trafo = get_matrix(s->joint_transforms[i]);
 
-        const auto parent = s->joints[i].parent_index;
+        const auto parent = s->parent_indices[i];
         if (parent >= 0) {
             const auto& parent_trafo = s->global_transforms[(u16)parent];
             s->global_transforms[i] = um_mat_mul(parent_trafo, local_trafo);
@@ -202,10 +239,133 @@ EXPORT void ung_skeleton_update(ung_skeleton_id skel)
             // root
             s->global_transforms[i] = local_trafo;
         }
+    }
+
+    for (u16 i = 0; i < s->num_joints; ++i) {
+        s->skinning_matrices[i] = um_mat_mul(s->global_transforms[i], s->inverse_bind_matrices[i]);
+    }
+}
+
+static void update(std::span<Skeleton*> skeletons)
+{
+    for (auto s : skeletons) {
+        update(s);
+    }
+}
+
+static void update_job(void*, uint32_t index)
+{
+    const auto& batch = state->update_batch;
+    const auto start = index * state->update_batch_per_job;
+    update(std::span<Skeleton*>(
+        batch.data + start, std::min(state->update_batch_per_job, batch.size - start)));
+}
+
+EXPORT void ung_skeleton_update(ung_skeleton_id skel)
+{
+    assert(state);
+    update(get(state->skeletons, skel.id));
+}
+
+EXPORT void ung_skeletons_update(const ung_skeleton_id* skeletons, size_t num_skeletons)
+{
+    ung_skeletons_update_ex(skeletons, num_skeletons, {});
+}
+
+static usize align_up(usize v, usize alignment)
+{
+    return (v + alignment - 1) / alignment * alignment;
+}
+
+// Returns the offset into the palette for size bytes
+static u32 reserve_palette(u32 size)
+{
+    if (state->palette_frame != ung::state->frame_counter) {
+        // The palette of the last frame might still be in use
+        mugfx_buffer_update(state->palette, 0, {}); // orphan
+        state->palette_offset = 0;
+        state->palette_frame = ung::state->frame_counter;
+    }
+    // 256 is the largest GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT we care about
+    const auto offset = (u32)align_up(state->palette_offset, 256);
+    // Orphaning again would invalidate the ranges of draws earlier this frame
+    UNG_OR_PANIC(offset + size <= state->palette_size,
+        "Skinning palette full (%u + %u > %u bytes), raise max_num_skinning_matrices_per_frame",
+        offset, size, state->palette_size);
+    state->palette_offset = offset + size;
+    return offset;
+}
+
+EXPORT void ung_skeletons_update_ex(
+    const ung_skeleton_id* skeletons, size_t num_skeletons, ung_skeletons_update_params params)
+{
+    assert(state);
+    auto& batch = state->update_batch;
+    batch.clear();
+    batch.reserve((u32)num_skeletons);
+    u32 num_joints = 0;
+    for (size_t i = 0; i < num_skeletons; ++i) {
+        auto s = get(state->skeletons, skeletons[i].id);
+        batch.push(s);
+        num_joints += s->num_joints;
+    }
+
+    // Skeletons are independent, so we just split them into contiguous ranges.
+    u32 num_jobs = std::max(params.num_jobs, 1u);
+    const auto min_joints = params.min_joints_per_job ? params.min_joints_per_job : 1024;
+    num_jobs = std::min({ num_jobs, std::max(num_joints / min_joints, 1u), batch.size });
+    if (num_jobs > 1) {
+        state->update_batch_per_job = (batch.size + num_jobs - 1) / num_jobs;
+        num_jobs = (batch.size + state->update_batch_per_job - 1) / state->update_batch_per_job;
+        const auto counter = ung_job_counter_create();
+        ung_job_run_many(update_job, nullptr, num_jobs, counter);
+        ung_job_wait(counter);
+        ung_job_counter_destroy(counter);
+    } else {
+        update(std::span<Skeleton*>(batch.data, batch.size));
+    }
+
+    if (!params.skinning_buffer.id && !params.palette) {
+        return;
+    }
+
+    // Pack all skinning matrices into one buffer update
+    const usize alignment = params.offset_alignment ? params.offset_alignment : sizeof(um_mat);
+    auto& staging = state->skinning_staging;
+    staging.clear();
+    for (u32 i = 0; i < batch.size; ++i) {
+        const auto offset = align_up(staging.size, alignment);
+        const auto size = batch[i]->num_joints * sizeof(um_mat);
+        staging.reserve((u32)(offset + size));
+        std::memset(staging.data + staging.size, 0, offset - staging.size);
+        std::memcpy(staging.data + offset, batch[i]->skinning_matrices, size);
+        staging.size = (u32)(offset + size);
+        if (params.offsets) {
+            params.offsets[i] = (u32)offset;
+        }
+    }
 
-        s->skinning_matrices[i]
-            = um_mat_mul(s->global_transforms[i], s->joints[i].inverse_bind_matrix);
+    auto buffer = params.skinning_buffer;
+    auto buffer_offset = params.buffer_offset;
+    if (params.palette) {
+        buffer = state->palette;
+        buffer_offset = reserve_palette(staging.size);
+    }
+    if (params.offsets) {
+        for (u32 i = 0; i < batch.size; ++i) {
+            params.offsets[i] += (u32)buffer_offset;
+        }
     }
+    mugfx_buffer_update(buffer, buffer_offset, { staging.data, staging.size });
+    ung::state->frame_stats.other_upload_bytes += staging.size;
+}
+
+EXPORT mugfx_draw_binding ung_skinning_palette_binding(uint32_t binding, uint32_t offset)
+{
+    return {
+        .type = MUGFX_BINDING_TYPE_BUFFER,
+        .buffer = { binding, state->palette, offset, UNG_SKINNING_PALETTE_RANGE },
+    };
 }
 
 EXPORT const float* ung_skeleton_get_joint_matrices(ung_skeleton_id skel, uint16_t* num_joints)
@@ -285,6 +445,248 @@ EXPORT void ung_lerp_poses(const ung_joint_transform* pose_a, const ung_joint_tr
     }
 }
 
+static size_t get_stride(ung_animation_sampler_type type)
+{
+    return type == UNG_ANIM_SAMPLER_TYPE_VEC3 ? 3 : 4;
+}
+
+static um_vec3 interp(
+    ung_animation_interp interp, float t0, const um_vec3& v0, float t1, const um_vec3& v1, float t);
+static um_quat interp(
+    ung_animation_interp interp, float t0, const um_quat& q0, float t1, const um_quat& q1, float t);
+static size_t find_interval(std::span<float> times, float t);
+
+// The smallest three components of a unit quaternion are in [-1/sqrt(2), 1/sqrt(2)]
+static constexpr float QuatRange = 0.70710678f;
+
+// Stores the index of the largest component in the top bits of the first two values and the other
+// three components in 15 bits each. The largest component is reconstructed from the others.
+static void quantize_quat(const float q[4], u16 out[3])
+{
+    u32 largest = 0;
+    for (u32 c = 1; c < 4; ++c) {
+        if (std::fabs(q[c]) > std::fabs(q[largest])) {
+            largest = c;
+        }
+    }
+    // q and -q are the same rotation, so we make the largest component positive
+    const auto sign = q[largest] < 0.0f ? -1.0f : 1.0f;
+    u32 o = 0;
+    for (u32 c = 0; c < 4; ++c) {
+        if (c != largest) {
+            const auto v = fminf(fmaxf(q[c] * sign, -QuatRange), QuatRange);
+            out[o++] = (u16)std::lround((v + QuatRange) / (2.0f * QuatRange) * 0x7fff);
+        }
+    }
+    out[0] = (u16)(out[0] | ((largest >> 1) << 15));
+    out[1] = (u16)(out[1] | ((largest & 1) << 15));
+}
+
+static void dequantize_quat(const u16 in[3], float q[4])
+{
+    const auto largest = ((in[0] >> 15) << 1) | (in[1] >> 15);
+    float sum_sq = 0.0f;
+    u32 i = 0;
+    for (u32 c = 0; c < 4; ++c) {
+        if (c != (u32)largest) {
+            q[c] = (float)(in[i++] & 0x7fff) / 0x7fff * (2.0f * QuatRange) - QuatRange;
+            sum_sq += q[c] * q[c];
+        }
+    }
+    q[largest] = std::sqrt(std::fmax(0.0f, 1.0f - sum_sq));
+}
+
+static void get_key(const AnimationChannel& ch, size_t i, float* out)
+{
+    if (!ch.quantized) {
+        std::memcpy(out, ch.values + i * get_stride(ch.sampler_type),
+            sizeof(float) * get_stride(ch.sampler_type));
+    } else if (ch.sampler_type == UNG_ANIM_SAMPLER_TYPE_VEC3) {
+        for (u32 c = 0; c < 3; ++c) {
+            out[c] = ch.range_min[c] + (float)ch.quantized[i * 3 + c] / 0xffff * ch.range_size[c];
+        }
+    } else {
+        dequantize_quat(ch.quantized + i * 3, out);
+    }
+}
+
+// Interpolates between keys i0 and i1, which do not have to be adjacent
+static void interp_keys(const AnimationChannel& ch, size_t i0, size_t i1, float t, float* out)
+{
+    float k0[4], k1[4];
+    get_key(ch, i0, k0);
+    get_key(ch, i1, k1);
+    if (ch.sampler_type == UNG_ANIM_SAMPLER_TYPE_VEC3) {
+        const auto v0 = um_vec3_from_ptr(k0);
+        const auto v1 = um_vec3_from_ptr(k1);
+        um_vec3_to_ptr(interp(ch.interp_type, ch.times[i0], v0, ch.times[i1], v1, t), out);
+    } else if (ch.sampler_type == UNG_ANIM_SAMPLER_TYPE_QUAT) {
+        // Quantization picks the sign of each key independently, so neighbouring keys might
+        // point away from each other (see add_quat)
+        if (qdot(k0, k1) < 0.0f) {
+            for (u32 c = 0; c < 4; ++c) {
+                k1[c] = -k1[c];
+            }
+        }
+        const auto q0 = um_quat_from_ptr(k0);
+        const auto q1 = um_quat_from_ptr(k1);
+        um_quat_to_ptr(interp(ch.interp_type, ch.times[i0], q0, ch.times[i1], q1, t), out);
+    }
+}
+
+static void sample_channel(const AnimationChannel& ch, size_t i0, float t, float* out)
+{
+    interp_keys(ch, i0, i0 + 1, t, out);
+}
+
+// Largest component difference. For quaternions q and -q are considered equal.
+static float key_distance(ung_animation_sampler_type type, const float* a, const float* b)
+{
+    const auto stride = get_stride(type);
+    float sign = 1.0f;
+    if (type == UNG_ANIM_SAMPLER_TYPE_QUAT && qdot(a, b) < 0.0f) {
+        sign = -1.0f;
+    }
+    float dist = 0.0f;
+    for (size_t c = 0; c < stride; ++c) {
+        dist = std::fmax(dist, std::fabs(a[c] - b[c] * sign));
+    }
+    return dist;
+}
+
+static void set_keys(AnimationChannel& ch, float* times, float* values, size_t num_samples)
+{
+    const auto stride = get_stride(ch.sampler_type);
+    deallocate(ch.times, ch.num_samples);
+    deallocate(ch.values, ch.num_samples * stride);
+    ch.times = times;
+    ch.values = values;
+    ch.num_samples = num_samples;
+}
+
+// Removes keys that can be reconstructed within `tolerance` by interpolating between the keys
+// next to them. Constant channels end up with a single key.
+static void remove_redundant_keys(AnimationChannel& ch, float tolerance)
+{
+    const auto stride = get_stride(ch.sampler_type);
+    const auto n = ch.num_samples;
+    if (n < 2) {
+        return;
+    }
+
+    bool constant = true;
+    for (size_t i = 1; i < n && constant; ++i) {
+        constant = key_distance(ch.sampler_type, ch.values, ch.values + i * stride) <= tolerance;
+    }
+
+    auto times = allocate<float>(n);
+    auto values = allocate<float>(n * stride);
+    size_t num_kept = 0;
+    const auto keep = [&](size_t i) {
+        times[num_kept] = ch.times[i];
+        std::memcpy(values + num_kept * stride, ch.values + i * stride, sizeof(float) * stride);
+        num_kept++;
+    };
+
+    keep(0);
+    if (!constant) {
+        size_t last_kept = 0;
+        for (size_t i = 1; i < n - 1; ++i) {
+            // Can we skip every key from last_kept to i + 1?
+            bool redundant = true;
+            for (size_t k = last_kept + 1; k <= i && redundant; ++k) {
+                float v[4];
+                interp_keys(ch, last_kept, i + 1, ch.times[k], v);
+                redundant = key_distance(ch.sampler_type, v, ch.values + k * stride) <= tolerance;
+            }
+            if (!redundant) {
+                keep(i);
+                last_kept = i;
+            }
+        }
+        keep(n - 1);
+    }
+
+    if (num_kept == n) {
+        deallocate(times, n);
+        deallocate(values, n * stride);
+        return;
+    }
+
+    // Shrink to fit
+    auto kept_times = allocate<float>(num_kept);
+    auto kept_values = allocate<float>(num_kept * stride);
+    std::memcpy(kept_times, times, sizeof(float) * num_kept);
+    std::memcpy(kept_values, values, sizeof(float) * num_kept * stride);
+    deallocate(times, n);
+    deallocate(values, n * stride);
+    set_keys(ch, kept_times, kept_values, num_kept);
+}
+
+static void quantize(AnimationChannel& ch)
+{
+    const auto n = ch.num_samples;
+    ch.quantized = allocate<u16>(n * 3);
+    if (ch.sampler_type == UNG_ANIM_SAMPLER_TYPE_VEC3) {
+        for (u32 c = 0; c < 3; ++c) {
+            float min = ch.values[c], max = ch.values[c];
+            for (size_t i = 1; i < n; ++i) {
+                min = std::fmin(min, ch.values[i * 3 + c]);
+                max = std::fmax(max, ch.values[i * 3 + c]);
+            }
+            ch.range_min[c] = min;
+            ch.range_size[c] = max - min;
+            for (size_t i = 0; i < n; ++i) {
+                const auto v = ch.range_size[c] > 0.0f
+                    ? (ch.values[i * 3 + c] - min) / ch.range_size[c]
+                    : 0.0f;
+                ch.quantized[i * 3 + c] = (u16)std::lround(v * 0xffff);
+            }
+        }
+    } else {
+        for (size_t i = 0; i < n; ++i) {
+            quantize_quat(ch.values + i * 4, ch.quantized + i * 3);
+        }
+    }
+    deallocate(ch.values, n * get_stride(ch.sampler_type));
+    ch.values = nullptr;
+}
+
+static usize get_memory_size(const AnimationChannel& ch)
+{
+    const auto value_size = ch.quantized ? 3 * sizeof(u16)
+                                         : get_stride(ch.sampler_type) * sizeof(float);
+    const auto values_size = ch.num_samples * value_size;
+    return sizeof(AnimationChannel) + ch.num_samples * sizeof(float) + values_size;
+}
+
+// Replaces the keys of the channel with uniformly spaced keys, so the interval for a given time
+// can be computed directly.
+static void resample(AnimationChannel& ch, float rate)
+{
+    if (ch.num_samples < 2 || ch.interp_type != UNG_ANIM_INTERP_LINEAR) {
+        return; // resampling step interpolation would move the steps
+    }
+
+    const auto start = ch.times[0];
+    const auto duration = ch.times[ch.num_samples - 1] - start;
+    const auto num_samples = std::max((size_t)std::ceil(duration * rate) + 1, (size_t)2);
+    const auto dt = duration / (float)(num_samples - 1);
+    const auto stride = get_stride(ch.sampler_type);
+
+    auto times = allocate<float>(num_samples);
+    auto values = allocate<float>(num_samples * stride);
+    for (size_t s = 0; s < num_samples; ++s) {
+        // Avoid accumulating error at the end
+        times[s] = s == num_samples - 1 ? start + duration : start + (float)s * dt;
+        sample_channel(ch, find_interval({ ch.times, ch.num_samples }, times[s]), times[s],
+            values + s * stride);
+    }
+
+    set_keys(ch, times, values, num_samples);
+    ch.inv_dt = 1.0f / dt;
+}
+
 EXPORT ung_animation_id ung_animation_create(ung_animation_create_params params)
 {
     assert(state);
@@ -309,11 +711,11 @@ EXPORT ung_animation_id ung_animation_create(ung_animation_create_params params)
 
         dst.times = allocate<float>(dst.num_samples);
         std::memcpy(dst.times, src.times, sizeof(float) * dst.num_samples);
-        for (size_t s = 0; s < dst.num_samples - 1; ++s) {
+        for (size_t s = 0; s + 1 < dst.num_samples; ++s) {
             assert(dst.times[s] < dst.times[s + 1]);
         }
 
-        const size_t stride = dst.sampler_type == UNG_ANIM_SAMPLER_TYPE_VEC3 ? 3 : 4;
+        const size_t stride = get_stride(dst.sampler_type);
         dst.values = allocate<float>(dst.num_samples * stride);
 
         if (dst.sampler_type == UNG_ANIM_SAMPLER_TYPE_VEC3) {
@@ -324,6 +726,19 @@ EXPORT ung_animation_id ung_animation_create(ung_animation_create_params params)
                 um_quat_to_ptr(um_quat_normalized(q), dst.values + s * 4);
             }
         }
+
+        anim.original_size += get_memory_size(dst);
+
+        // Removing keys would make resampled channels non-uniform
+        if (params.options.resample_rate > 0.0f) {
+            resample(dst, params.options.resample_rate);
+        } else if (params.options.key_tolerance > 0.0f) {
+            remove_redundant_keys(dst, params.options.key_tolerance);
+        }
+
+        if (params.options.quantize && dst.num_samples > 0) {
+            quantize(dst);
+        }
     }
 
     return { id };
@@ -336,9 +751,9 @@ EXPORT void ung_animation_destroy(ung_animation_id anim_id)
 
     for (u32 i = 0; i < anim->channels.size; ++i) {
         auto& ch = anim->channels[i];
-        deallocate(ch.times, (u32)ch.num_samples);
-        const size_t stride = (ch.sampler_type == UNG_ANIM_SAMPLER_TYPE_VEC3) ? 3 : 4;
-        deallocate(ch.values, (u32)(ch.num_samples * stride));
+        deallocate(ch.times, ch.num_samples);
+        deallocate(ch.values, ch.num_samples * get_stride(ch.sampler_type));
+        deallocate(ch.quantized, ch.num_samples * 3);
     }
     anim->channels.free();
     state->animations.remove(anim_id.id);
@@ -350,6 +765,26 @@ EXPORT float ung_animation_get_duration(ung_animation_id anim_id)
     return get(state->animations, anim_id.id)->duration_s;
 }
 
+EXPORT uint32_t ung_animation_get_num_channels(ung_animation_id anim_id)
+{
+    assert(state);
+    return get(state->animations, anim_id.id)->channels.size;
+}
+
+EXPORT size_t ung_animation_get_memory_usage(ung_animation_id anim_id, size_t* original_size)
+{
+    assert(state);
+    const auto anim = get(state->animations, anim_id.id);
+    if (original_size) {
+        *original_size = anim->original_size;
+    }
+    usize size = 0;
+    for (const auto& ch : std::span(anim->channels.data, anim->channels.size)) {
+        size += get_memory_size(ch);
+    }
+    return size;
+}
+
 // returns i in [0, n-2] so that t is in [times[i], times[i+1]) (n = times.size())
 // or n-2 if t >= times[n-1]
 static size_t find_interval(std::span<float> times, float t)
@@ -377,6 +812,35 @@ static size_t find_interval(std::span<float> times, float t)
     return low;
 }
 
+static size_t find_interval(const AnimationChannel& ch, float t, u32* cursor)
+{
+    const auto last = ch.num_samples - 2;
+    if (ch.inv_dt > 0.0f) {
+        const auto i = (ch.times[0] < t) ? (size_t)((t - ch.times[0]) * ch.inv_dt) : 0;
+        return std::min(i, last);
+    }
+
+    if (!cursor) {
+        return find_interval({ ch.times, ch.num_samples }, t);
+    }
+
+    // Playback usually moves forward by less than a key per sample, so we check the interval of
+    // the last sample and the next few before falling back to a binary search.
+    auto i = std::min((size_t)*cursor, last);
+    if (ch.times[i] <= t) {
+        for (u32 step = 0; step < 4 && i < last && t >= ch.times[i + 1]; ++step) {
+            i++;
+        }
+        if (t < ch.times[i + 1] || i == last) {
+            *cursor = (u32)i;
+            return i;
+        }
+    }
+    i = find_interval({ ch.times, ch.num_samples }, t);
+    *cursor = (u32)i;
+    return i;
+}
+
 static float clamp(float v, float lo, float hi)
 {
     assert(lo <= hi);
@@ -413,12 +877,9 @@ static um_quat interp(
     }
 }
 
-EXPORT void ung_animation_sample(
-    ung_animation_id anim_id, float t, ung_joint_transform* joints, uint16_t num_joints)
+static void sample(const Animation* anim, float t, u32* cursors, ung_joint_transform* joints,
+    uint16_t num_joints)
 {
-    assert(state);
-    auto anim = get(state->animations, anim_id.id);
-
     t = clamp(t, 0.0f, anim->duration_s);
 
     for (u32 c = 0; c < anim->channels.size; ++c) {
@@ -434,47 +895,138 @@ EXPORT void ung_animation_sample(
             continue;
         }
 
+        float* out = nullptr;
+        if (ch.sampler_type == UNG_ANIM_SAMPLER_TYPE_VEC3) {
+            if (ch.key.dof == UNG_JOINT_DOF_TRANSLATION) {
+                out = joint.translation;
+            } else if (ch.key.dof == UNG_JOINT_DOF_SCALE) {
+                out = joint.scale;
+            }
+        } else if (ch.sampler_type == UNG_ANIM_SAMPLER_TYPE_QUAT) {
+            if (ch.key.dof == UNG_JOINT_DOF_ROTATION) {
+                out = joint.rotation;
+            }
+        }
+        if (!out) {
+            continue;
+        }
+
         // Single sample
         if (ch.num_samples == 1) {
-            if (ch.sampler_type == UNG_ANIM_SAMPLER_TYPE_VEC3) {
-                const auto v = um_vec3_from_ptr(ch.values);
-                if (ch.key.dof == UNG_JOINT_DOF_TRANSLATION) {
-                    um_vec3_to_ptr(v, joint.translation);
-                } else if (ch.key.dof == UNG_JOINT_DOF_SCALE) {
-                    um_vec3_to_ptr(v, joint.scale);
-                }
-            } else if (ch.sampler_type == UNG_ANIM_SAMPLER_TYPE_QUAT) {
-                const auto q = um_quat_from_ptr(ch.values);
-                if (ch.key.dof == UNG_JOINT_DOF_ROTATION) {
-                    um_quat_to_ptr(q, joint.rotation);
-                }
-            }
+            get_key(ch, 0, out);
             continue;
         }
 
         // More than one sample
-        const auto i0 = find_interval({ ch.times, ch.num_samples }, t);
-        const auto i1 = i0 + 1;
+        sample_channel(ch, find_interval(ch, t, cursors ? cursors + c : nullptr), t, out);
+    }
+}
 
-        if (ch.sampler_type == UNG_ANIM_SAMPLER_TYPE_VEC3) {
-            const auto v0 = um_vec3_from_ptr(ch.values + i0 * 3);
-            const auto v1 = um_vec3_from_ptr(ch.values + i1 * 3);
-            const auto v = interp(ch.interp_type, ch.times[i0], v0, ch.times[i1], v1, t);
+EXPORT void ung_animation_sample(
+    ung_animation_id anim_id, float t, ung_joint_transform* joints, uint16_t num_joints)
+{
+    assert(state);
+    sample(get(state->animations, anim_id.id), t, nullptr, joints, num_joints);
+}
 
-            if (ch.key.dof == UNG_JOINT_DOF_TRANSLATION) {
-                um_vec3_to_ptr(v, joint.translation);
-            } else if (ch.key.dof == UNG_JOINT_DOF_SCALE) {
-                um_vec3_to_ptr(v, joint.scale);
-            }
-        } else if (ch.sampler_type == UNG_ANIM_SAMPLER_TYPE_QUAT) {
-            const auto q0 = um_quat_from_ptr(ch.values + i0 * 4);
-            const auto q1 = um_quat_from_ptr(ch.values + i1 * 4);
-            const auto q = interp(ch.interp_type, ch.times[i0], q0, ch.times[i1], q1, t);
+EXPORT void ung_animation_sample_cached(ung_animation_id anim_id, float t, uint32_t* cursors,
+    ung_joint_transform* joints, uint16_t num_joints)
+{
+    assert(state);
+    assert(cursors);
+    sample(get(state->animations, anim_id.id), t, cursors, joints, num_joints);
+}
 
-            if (ch.key.dof == UNG_JOINT_DOF_ROTATION) {
-                um_quat_to_ptr(q, joint.rotation);
+static void update_range(float range[2], float v)
+{
+    range[0] = std::min(range[0], v);
+    range[1] = std::max(range[1], v);
+}
+
+EXPORT ung_baked_animation ung_animation_bake(
+    ung_animation_id anim_id, ung_skeleton_id skel_id, ung_animation_bake_params params)
+{
+    assert(state);
+    const auto anim = get(state->animations, anim_id.id);
+    const auto skel = get(state->skeletons, skel_id.id);
+    const auto frame_rate = params.frame_rate > 0.0f ? params.frame_rate : 30.0f;
+    const auto num_frames = (u32)std::ceil(anim->duration_s * frame_rate) + 1;
+    const auto num_joints = skel->num_joints;
+
+    // Shares the immutable arrays, but has its own pose, so skel is not modified. The skinning
+    // matrices of all frames are written to one array directly.
+    Skeleton temp = *skel;
+    temp.joint_transforms = allocate<ung_joint_transform>(num_joints);
+    temp.global_transforms = allocate<um_mat>(num_joints);
+    auto matrices = allocate<um_mat>(num_frames * num_joints);
+    auto cursors = allocate<u32>(anim->channels.size);
+    std::memset(cursors, 0, anim->channels.size * sizeof(u32));
+
+    float linear_range[2] = { FLT_MAX, -FLT_MAX };
+    float translation_range[2] = { FLT_MAX, -FLT_MAX };
+    for (u32 f = 0; f < num_frames; ++f) {
+        std::memcpy(
+            temp.joint_transforms, skel->local_bind, num_joints * sizeof(ung_joint_transform));
+        const auto t = std::min((float)f / frame_rate, anim->duration_s);
+        sample(anim, t, cursors, temp.joint_transforms, num_joints);
+        temp.skinning_matrices = matrices + f * num_joints;
+        update(&temp);
+
+        for (u16 j = 0; j < num_joints; ++j) {
+            const auto m = &temp.skinning_matrices[j].cols[0].x;
+            for (u32 e = 0; e < 12; ++e) {
+                const auto col = e / 3, row = e % 3;
+                update_range(col < 3 ? linear_range : translation_range, m[col * 4 + row]);
             }
         }
     }
+
+    const float ranges[4] = {
+        linear_range[0],
+        std::max(linear_range[1] - linear_range[0], 1e-6f),
+        translation_range[0],
+        std::max(translation_range[1] - translation_range[0], 1e-6f),
+    };
+
+    // 12 values with 2 bytes each are 6 RGBA8 texels per joint
+    const auto width = 6u * num_joints;
+    const auto data_size = (usize)width * num_frames * 4;
+    auto data = allocate<u8>(data_size);
+    for (u32 i = 0; i < num_frames * num_joints; ++i) {
+        const auto m = &matrices[i].cols[0].x;
+        const auto out = data + i * 24;
+        for (u32 e = 0; e < 12; ++e) {
+            const auto col = e / 3, row = e % 3;
+            const auto min = col < 3 ? ranges[0] : ranges[2];
+            const auto size = col < 3 ? ranges[1] : ranges[3];
+            const auto v = std::clamp((m[col * 4 + row] - min) / size, 0.0f, 1.0f);
+            const auto q = (u16)std::lround(v * 65535.0f);
+            out[e * 2 + 0] = (u8)(q >> 8);
+            out[e * 2 + 1] = (u8)(q & 0xFF);
+        }
+    }
+
+    const auto texture = ung_texture_create({
+        .width = width,
+        .height = num_frames,
+        .format = MUGFX_PIXEL_FORMAT_RGBA8,
+        .data = { data, data_size },
+        .data_format = MUGFX_PIXEL_FORMAT_RGBA8,
+        .debug_label = "UngBakedAnimation",
+    });
+
+    deallocate(data, data_size);
+    deallocate(cursors, anim->channels.size);
+    deallocate(matrices, num_frames * num_joints);
+    deallocate(temp.global_transforms, num_joints);
+    deallocate(temp.joint_transforms, num_joints);
+
+    return {
+        .texture = texture,
+        .num_frames = num_frames,
+        .num_joints = num_joints,
+        .frame_rate = frame_rate,
+        .ranges = { ranges[0], ranges[1], ranges[2], ranges[3] },
+    };
 }
 }
@@ -5,23 +5,218 @@
 
 #include <SDL.h>
 
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <unistd.h>
+#define UNG_INOTIFY
+#endif
+
 #include "state.hpp"
 
+// Changes are detected with inotify on Linux. Other platforms (or if inotify is not available)
+// fall back to polling the mtime of every watched file. Files whose directory could not be watched
+// are polled as well.
+// We watch directories instead of files, because many editors replace the file on save.
+// The same directory might be watched with different spellings (e.g. "a" and "./a"), which
+// inotify gives the same watch descriptor, so those are refcounted separately.
+
+namespace ung::pack {
+char* read(const char* path, usize* size);
+void free(char* data);
+}
+
 namespace ung::files {
 struct Watch {
     Array<char*> paths;
     Array<uint64_t> last_mtime;
+    Array<bool> polled; // watch failed
     ung_file_watch_cb cb;
     void* ctx;
 };
 
+struct WatchedDir {
+    char* path; // the part of the file paths before the last '/'
+    int wd;
+    u32 refcount; // watched files in this directory
+};
+
+struct WatchDescriptor {
+    int wd;
+    u32 refcount; // WatchedDirs with this wd
+};
+
 struct State {
     Pool<Watch> watches;
     float next_file_watch_check;
+    int notify_fd;
+    Vector<WatchedDir> dirs;
+    Vector<WatchDescriptor> wds;
+    Vector<char*> changed_paths; // since last frame
+    bool events_lost;
+    u32 num_polled_paths; // of watches
 };
 
 State* state;
 
+static std::string_view get_dir(std::string_view path)
+{
+    const auto slash = path.find_last_of('/');
+    return slash == std::string_view::npos ? std::string_view() : path.substr(0, slash);
+}
+
+// Returns false if the file has to be polled instead. Only call unwatch if this returned true.
+bool watch(const char* path)
+{
+#ifdef UNG_INOTIFY
+    if (state->notify_fd < 0) {
+        return false;
+    }
+
+    const auto dir = get_dir(path);
+    for (auto& d : state->dirs) {
+        if (dir == d.path) {
+            d.refcount++;
+            return true;
+        }
+    }
+
+    auto dir_path = allocate<char>(dir.size() + 1);
+    if (!dir.empty()) {
+        std::memcpy(dir_path, dir.data(), dir.size());
+    }
+    dir_path[dir.size()] = '\0';
+
+    const auto wd = inotify_add_watch(state->notify_fd, dir.empty() ? "." : dir_path,
+        IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB);
+    if (wd < 0) {
+        deallocate(dir_path, dir.size() + 1);
+        return false;
+    }
+    state->dirs.push({ dir_path, wd, 1 });
+    for (auto& w : state->wds) {
+        if (w.wd == wd) {
+            w.refcount++;
+            return true;
+        }
+    }
+    state->wds.push({ wd, 1 });
+    return true;
+#else
+    (void)path;
+    return false;
+#endif
+}
+
+#ifdef UNG_INOTIFY
+static void release_wd(int wd)
+{
+    for (u32 i = 0; i < state->wds.size; ++i) {
+        if (state->wds[i].wd == wd) {
+            if (--state->wds[i].refcount == 0) {
+                inotify_rm_watch(state->notify_fd, wd);
+                remove(state->wds, i);
+            }
+            return;
+        }
+    }
+}
+#endif
+
+void unwatch(const char* path)
+{
+#ifdef UNG_INOTIFY
+    if (!state || state->notify_fd < 0) {
+        return;
+    }
+
+    const auto dir = get_dir(path);
+    for (u32 i = 0; i < state->dirs.size; ++i) {
+        auto& d = state->dirs[i];
+        if (dir == d.path) {
+            if (--d.refcount == 0) {
+                release_wd(d.wd);
+                deallocate_string(d.path);
+                remove(state->dirs, i);
+            }
+            return;
+        }
+    }
+#else
+    (void)path;
+#endif
+}
+
+// The paths (as passed to watch) that might have changed since the last frame.
+// Returns false if changes could not be tracked and all files have to be polled.
+bool get_changed_paths(std::span<char* const>& paths)
+{
+    paths = std::span<char* const>(state->changed_paths.data, state->changed_paths.size);
+    return state->notify_fd >= 0 && !state->events_lost;
+}
+
+static void add_changed_path(std::string_view dir, const char* name)
+{
+    const auto name_len = std::strlen(name);
+    const auto len = dir.empty() ? name_len : dir.size() + 1 + name_len;
+    auto path = allocate<char>(len + 1);
+    if (dir.empty()) {
+        std::memcpy(path, name, name_len);
+    } else {
+        std::memcpy(path, dir.data(), dir.size());
+        path[dir.size()] = '/';
+        std::memcpy(path + dir.size() + 1, name, name_len);
+    }
+    path[len] = '\0';
+
+    for (const auto p : state->changed_paths) {
+        if (std::strcmp(p, path) == 0) {
+            deallocate(path, len + 1);
+            return;
+        }
+    }
+    state->changed_paths.push(path);
+}
+
+static void read_events()
+{
+    for (auto path : state->changed_paths) {
+        deallocate_string(path);
+    }
+    state->changed_paths.clear();
+    state->events_lost = false;
+
+#ifdef UNG_INOTIFY
+    if (state->notify_fd < 0) {
+        return;
+    }
+
+    alignas(inotify_event) char buf[4096];
+    while (true) {
+        const auto n = read(state->notify_fd, buf, sizeof(buf));
+        if (n <= 0) {
+            break; // EAGAIN, nothing left
+        }
+        for (ssize_t offset = 0; offset < n;) {
+            const auto event = reinterpret_cast<const inotify_event*>(buf + offset);
+            offset += (ssize_t)(sizeof(inotify_event) + event->len);
+            if (event->mask & IN_Q_OVERFLOW) {
+                state->events_lost = true;
+                continue;
+            }
+            if (event->len == 0) {
+                continue;
+            }
+            // Every spelling of the directory gets the change
+            for (const auto& d : state->dirs) {
+                if (d.wd == event->wd) {
+                    add_changed_path(d.path, event->name);
+                }
+            }
+        }
+    }
+#endif
+}
+
 void init(ung_init_params params)
 {
     assert(!state);
@@ -29,6 +224,18 @@ void init(ung_init_params params)
     std::memset(state, 0, sizeof(State));
 
     state->watches.init(params.max_num_file_watches ? params.max_num_file_watches : 128);
+    state->dirs.init(16);
+    state->wds.init(16);
+    state->changed_paths.init(16);
+
+#ifdef UNG_INOTIFY
+    state->notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (state->notify_fd < 0) {
+        fprintf(stderr, "inotify_init1 failed, falling back to polling for file changes\n");
+    }
+#else
+    state->notify_fd = -1;
+#endif
 }
 
 void shutdown()
@@ -37,42 +244,82 @@ void shutdown()
         return;
     }
 
-    for (u32 i = 0; i < state->watches.keys.size; ++i) {
-        if (state->watches.contains(state->watches.keys[i])) {
-            ung_file_watch_destroy({ state->watches.keys[i] });
-        }
+    for (u32 i = state->watches.size(); i-- > 0;) {
+        ung_file_watch_destroy({ state->watches.alive_key(i) });
     }
     state->watches.free();
 
+#ifdef UNG_INOTIFY
+    if (state->notify_fd >= 0) {
+        close(state->notify_fd);
+    }
+#endif
+    for (auto& dir : state->dirs) {
+        deallocate_string(dir.path);
+    }
+    state->dirs.free();
+    state->wds.free();
+    for (auto path : state->changed_paths) {
+        deallocate_string(path);
+    }
+    state->changed_paths.free();
+
     deallocate(state, 1);
     state = nullptr;
 }
 
+bool is_changed(std::span<char* const> changed_paths, const char* path)
+{
+    for (const auto p : changed_paths) {
+        if (std::strcmp(p, path) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void begin_frame()
 {
-    if (state->next_file_watch_check > ung_get_time()) {
+    read_events();
+
+    std::span<char* const> changed_paths;
+    const auto poll_all = !get_changed_paths(changed_paths);
+    const auto poll = (poll_all || state->num_polled_paths)
+        && state->next_file_watch_check <= ung_get_time();
+    if (!poll && changed_paths.empty()) {
         return;
     }
 
-    for (u32 w = 0; w < state->watches.keys.size; ++w) {
-        if (state->watches.contains(state->watches.keys[w])) {
-            auto& watch = state->watches.data[w];
-            for (u32 p = 0; p < watch.paths.size; ++p) {
-                const auto mtime = ung_file_get_mtime(watch.paths[p]);
-                // File might also have been replaced with an older file, so we use !=
-                if (mtime != watch.last_mtime[p]) {
-                    watch.cb(watch.ctx, watch.paths[p]);
-                    watch.last_mtime[p] = mtime;
-                }
+    // The callbacks might create or destroy watches, so we can't use for_each
+    for (u32 w = state->watches.size(); w-- > 0;) {
+        if (w >= state->watches.size()) {
+            continue;
+        }
+        auto& watch = state->watches.data[state->watches.alive_index(w)];
+        for (u32 p = 0; p < watch.paths.size; ++p) {
+            const auto polled = poll_all || watch.polled[p];
+            if (polled ? !poll : !is_changed(changed_paths, watch.paths[p])) {
+                continue;
+            }
+            const auto mtime = ung_file_get_mtime(watch.paths[p]);
+            // File might also have been replaced with an older file, so we use !=
+            if (mtime != watch.last_mtime[p]) {
+                watch.cb(watch.ctx, watch.paths[p]);
+                watch.last_mtime[p] = mtime;
             }
         }
     }
 
-    state->next_file_watch_check = ung_get_time() + 0.5f;
+    if (poll) {
+        state->next_file_watch_check = ung_get_time() + 0.5f;
+    }
 }
 
 EXPORT char* ung_read_whole_file(const char* path, usize* size, bool panic_on_error)
 {
+    if (auto data = pack::read(path, size)) {
+        return data;
+    }
     auto data = (char*)SDL_LoadFile(path, size);
     if (panic_on_error && !data) {
         ung_panicf("Error reading file '%s': %s", path, SDL_GetError());
@@ -82,7 +329,7 @@ EXPORT char* ung_read_whole_file(const char* path, usize* size, bool panic_on_er
 
 EXPORT void ung_free_file_data(char* data, usize)
 {
-    SDL_free(data);
+    pack::free(data);
 }
 
 static std::string_view trim(std::string_view str)
@@ -193,9 +440,12 @@ EXPORT ung_file_watch_id ung_file_watch_create(
 
     watch->paths.init((u32)num_paths);
     watch->last_mtime.init((u32)num_paths);
+    watch->polled.init((u32)num_paths);
     for (u32 i = 0; i < (u32)num_paths; ++i) {
         watch->paths[i] = allocate_string(paths[i]);
         watch->last_mtime[i] = ung_file_get_mtime(paths[i]);
+        watch->polled[i] = !files::watch(paths[i]);
+        state->num_polled_paths += watch->polled[i];
     }
     watch->cb = cb;
     watch->ctx = ctx;
@@ -208,10 +458,16 @@ EXPORT void ung_file_watch_destroy(ung_file_watch_id watch_id)
     auto watch = get(state->watches, watch_id.id);
 
     for (u32 p = 0; p < watch->paths.size; ++p) {
+        if (watch->polled[p]) {
+            state->num_polled_paths--;
+        } else {
+            unwatch(watch->paths[p]);
+        }
         deallocate_string(watch->paths[p]);
     }
     watch->paths.free();
     watch->last_mtime.free();
+    watch->polled.free();
 }
 
 }
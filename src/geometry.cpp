@@ -1,7 +1,9 @@
 #include "state.hpp"
 
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
+#include <span>
 
 #ifdef UNG_FAST_OBJ
 #include <fast_obj.h>
@@ -138,10 +140,59 @@ EXPORT ung_geometry_id ung_geometry_box(float w, float h, float d)
         .index_count = indices.size(),
         .debug_label = "box.geom",
     });
+    get(state->geometries, geometry.id)->owns_buffers = true;
+
+    ung_geometry_set_bounds(geometry,
+        {
+            .min = { -w / 2.0f, -h / 2.0f, -d / 2.0f },
+            .max = { w / 2.0f, h / 2.0f, d / 2.0f },
+        });
 
     return geometry;
 }
 
+#ifdef UNG_FAST_OBJ
+// Go through ung_read_whole_file, so files in packs are found
+struct ObjFile {
+    char* data;
+    usize size;
+    usize cursor;
+};
+
+static void* obj_file_open(const char* path, void*)
+{
+    usize size = 0;
+    const auto data = ung_read_whole_file(path, &size, false);
+    if (!data) {
+        return nullptr;
+    }
+    auto file = allocate<ObjFile>();
+    *file = { data, size, 0 };
+    return file;
+}
+
+static void obj_file_close(void* file, void*)
+{
+    const auto f = (ObjFile*)file;
+    ung_free_file_data(f->data, f->size);
+    deallocate(f);
+}
+
+static size_t obj_file_read(void* file, void* dst, size_t bytes, void*)
+{
+    const auto f = (ObjFile*)file;
+    const auto n = std::min(bytes, f->size - f->cursor);
+    std::memcpy(dst, f->data + f->cursor, n);
+    f->cursor += n;
+    return n;
+}
+
+static unsigned long obj_file_size(void* file, void*)
+{
+    return (unsigned long)((ObjFile*)file)->size;
+}
+#endif
+
 ung_geometry_data geometry_data_load(const char* path)
 {
 #ifndef UNG_FAST_OBJ
@@ -149,7 +200,13 @@ ung_geometry_data geometry_data_load(const char* path)
     ung_panicf("Geometry loading requires fast_obj (UNG_FAST_OBJ=ON)");
     return {};
 #else
-    auto mesh = fast_obj_read(path);
+    const fastObjCallbacks callbacks = {
+        .file_open = obj_file_open,
+        .file_close = obj_file_close,
+        .file_read = obj_file_read,
+        .file_size = obj_file_size,
+    };
+    auto mesh = fast_obj_read_with_callbacks(path, &callbacks, nullptr);
     if (!mesh) {
         std::printf("Failed to load geometry '%s'\n", path);
         return {};
@@ -266,6 +323,10 @@ ung_geometry_data geometry_data_load(const char* path)
 
     fast_obj_destroy(mesh);
 
+    // OBJ faces reference positions, texcoords and normals separately, so we emit one vertex per
+    // face corner above and merge the duplicates here.
+    ung_geometry_data_optimize(&gdata, UNG_GEOMETRY_OPTIMIZE_ALL);
+
     return gdata;
 #endif
 }
@@ -286,6 +347,84 @@ EXPORT void ung_geometry_data_destroy(ung_geometry_data gdata)
     deallocate(gdata.indices, gdata.num_indices);
 }
 
+static void set_bounds(Geometry* geom, const ung_geometry_bounds& bounds)
+{
+    geom->has_bounds = true;
+    geom->aabb_min = { bounds.min[0], bounds.min[1], bounds.min[2] };
+    geom->aabb_max = { bounds.max[0], bounds.max[1], bounds.max[2] };
+    if (bounds.radius > 0.0f) {
+        geom->bounding_sphere = {
+            { bounds.center[0], bounds.center[1], bounds.center[2] },
+            bounds.radius,
+        };
+    } else {
+        const auto& min = geom->aabb_min;
+        const auto& max = geom->aabb_max;
+        const auto dx = max.x - min.x, dy = max.y - min.y, dz = max.z - min.z;
+        geom->bounding_sphere = {
+            { (min.x + max.x) * 0.5f, (min.y + max.y) * 0.5f, (min.z + max.z) * 0.5f },
+            std::sqrt(dx * dx + dy * dy + dz * dz) * 0.5f,
+        };
+    }
+}
+
+EXPORT ung_geometry_bounds ung_geometry_data_get_bounds(ung_geometry_data gdata)
+{
+    ung_geometry_bounds bounds = {};
+    if (!gdata.num_vertices) {
+        return bounds;
+    }
+
+    const auto pos = gdata.positions;
+    for (u32 c = 0; c < 3; ++c) {
+        bounds.min[c] = bounds.max[c] = pos[c];
+    }
+    for (u32 i = 1; i < gdata.num_vertices; ++i) {
+        for (u32 c = 0; c < 3; ++c) {
+            bounds.min[c] = std::fmin(bounds.min[c], pos[i * 3 + c]);
+            bounds.max[c] = std::fmax(bounds.max[c], pos[i * 3 + c]);
+        }
+    }
+
+    // Using the box center is not optimal, but the radius is still tighter than half the diagonal
+    for (u32 c = 0; c < 3; ++c) {
+        bounds.center[c] = (bounds.min[c] + bounds.max[c]) * 0.5f;
+    }
+    float max_dist_sq = 0.0f;
+    for (u32 i = 0; i < gdata.num_vertices; ++i) {
+        const auto dx = pos[i * 3 + 0] - bounds.center[0];
+        const auto dy = pos[i * 3 + 1] - bounds.center[1];
+        const auto dz = pos[i * 3 + 2] - bounds.center[2];
+        max_dist_sq = std::fmax(max_dist_sq, dx * dx + dy * dy + dz * dz);
+    }
+    bounds.radius = std::sqrt(max_dist_sq);
+    return bounds;
+}
+
+EXPORT bool ung_geometry_get_bounds(ung_geometry_id geometry_id, ung_geometry_bounds* bounds)
+{
+    const auto geometry = get(state->geometries, geometry_id.id);
+    if (!geometry->has_bounds) {
+        return false;
+    }
+    *bounds = {
+        .min = { geometry->aabb_min.x, geometry->aabb_min.y, geometry->aabb_min.z },
+        .max = { geometry->aabb_max.x, geometry->aabb_max.y, geometry->aabb_max.z },
+        .center = {
+            geometry->bounding_sphere.center.x,
+            geometry->bounding_sphere.center.y,
+            geometry->bounding_sphere.center.z,
+        },
+        .radius = geometry->bounding_sphere.radius,
+    };
+    return true;
+}
+
+EXPORT void ung_geometry_set_bounds(ung_geometry_id geometry_id, ung_geometry_bounds bounds)
+{
+    set_bounds(get(state->geometries, geometry_id.id), bounds);
+}
+
 EXPORT ung_geometry_id ung_geometry_create(mugfx_geometry_create_params params)
 {
     const auto geom = mugfx_geometry_create(params);
@@ -296,14 +435,85 @@ EXPORT ung_geometry_id ung_geometry_create(mugfx_geometry_create_params params)
     const auto [id, geometry] = state->geometries.insert();
     geometry->geometry = geom;
     geometry->mugfx_params = params;
+    geometry->draw_count = params.index_buffer.id ? params.index_count : params.vertex_count;
     return { id };
 }
 
+static void destroy_lods(Geometry* geometry)
+{
+    for (u32 l = 0; l < geometry->num_lods; ++l) {
+        mugfx_geometry_destroy(geometry->lods[l].geometry);
+    }
+    geometry->num_lods = 0;
+}
+
+// The levels share the buffers, but start further into the index buffer
+static void set_lods(Geometry* geometry, const ung_geometry_lod* lods, u32 num_lods)
+{
+    UNG_OR_PANIC(num_lods <= UNG_MAX_GEOMETRY_LODS, "Too many levels of detail (%u > %u)",
+        num_lods, UNG_MAX_GEOMETRY_LODS);
+    destroy_lods(geometry);
+    if (num_lods && !geometry->mugfx_params.index_buffer.id) {
+        ung_panicf("Levels of detail require an index buffer");
+    }
+    const auto index_size = geometry->mugfx_params.index_type == MUGFX_INDEX_TYPE_U32 ? 4u : 2u;
+    for (u32 l = 0; l < num_lods; ++l) {
+        auto params = geometry->mugfx_params;
+        params.index_buffer_offset += lods[l].index_offset * index_size;
+        params.index_count = lods[l].index_count;
+        const auto geom = mugfx_geometry_create(params);
+        if (!geom.id) {
+            ung_panicf("Error creating geometry");
+        }
+        geometry->lods[l] = { geom, lods[l].index_count, lods[l].error };
+    }
+    geometry->num_lods = num_lods;
+}
+
+EXPORT void ung_geometry_set_lods(
+    ung_geometry_id geometry_id, const ung_geometry_lod* lods, uint32_t num_lods)
+{
+    set_lods(get(state->geometries, geometry_id.id), lods, num_lods);
+}
+
+EXPORT uint32_t ung_geometry_get_num_lods(ung_geometry_id geometry_id)
+{
+    return get(state->geometries, geometry_id.id)->num_lods;
+}
+
+EXPORT void ung_geometry_destroy(ung_geometry_id geometry_id)
+{
+    const auto geometry = get(state->geometries, geometry_id.id);
+    destroy_lods(geometry);
+    mugfx_geometry_destroy(geometry->geometry);
+    if (geometry->owns_buffers) {
+        const auto& params = geometry->mugfx_params;
+        // Multiple slots may refer to the same buffer
+        for (size_t i = 0; i < MUGFX_MAX_VERTEX_BUFFERS; ++i) {
+            const auto buffer = params.vertex_buffers[i].buffer;
+            bool destroyed = false;
+            for (size_t j = 0; j < i; ++j) {
+                destroyed = destroyed || params.vertex_buffers[j].buffer.id == buffer.id;
+            }
+            if (buffer.id && !destroyed) {
+                mugfx_buffer_destroy(buffer);
+            }
+        }
+        if (params.index_buffer.id) {
+            mugfx_buffer_destroy(params.index_buffer);
+        }
+    }
+    state->geometries.remove(geometry_id.id);
+}
+
 EXPORT void ung_geometry_set_vertex_range(
     ung_geometry_id geometry_id, uint32_t offset, uint32_t count)
 {
     const auto geometry = get(state->geometries, geometry_id.id);
     mugfx_geometry_set_vertex_range(geometry->geometry, offset, count);
+    if (!geometry->mugfx_params.index_buffer.id) {
+        geometry->draw_count = count;
+    }
 }
 
 EXPORT void ung_geometry_set_index_range(
@@ -311,131 +521,373 @@ EXPORT void ung_geometry_set_index_range(
 {
     const auto geometry = get(state->geometries, geometry_id.id);
     mugfx_geometry_set_index_range(geometry->geometry, offset, count);
+    geometry->draw_count = count;
+    // The levels of detail were generated for the previous range
+    destroy_lods(geometry);
+}
+
+// Positions are quantized relative to the AABB with a uniform scale (so normals are not
+// distorted) and the dequantization is applied as part of the model matrix.
+struct QuantizedVertex {
+    u16 x, y, z, w; // MUGFX_VERTEX_ATTRIBUTE_TYPE_U16_NORM, w is padding
+    u16 u, v;
+    u32 n; // MUGFX_VERTEX_ATTRIBUTE_TYPE_I10_10_10_2_NORM
+    u8 r, g, b, a;
+};
+
+// GPU-ready vertex and index data, which is also what is stored in the geometry cache
+struct GeometryBuffers {
+    std::span<u8> vertices;
+    std::span<u8> indices; // the full geometry followed by the levels of detail
+    u32 num_vertices;
+    u32 num_indices; // of the full geometry
+    bool quantized; // vertices are QuantizedVertex instead of Vertex
+    ung_geometry_bounds bounds;
+    u32 num_lods;
+    ung_geometry_lod lods[UNG_MAX_GEOMETRY_LODS];
+
+    u32 get_index_buffer_count() const
+    {
+        return num_lods ? lods[num_lods - 1].index_offset + lods[num_lods - 1].index_count
+                        : num_indices;
+    }
+
+    // Buffers from build_geometry_buffers are scratch allocations
+    void free()
+    {
+        deallocate_scratch(vertices.data(), vertices.size());
+        deallocate_scratch(indices.data(), indices.size());
+    }
+};
+
+template <typename VertexType>
+static VertexType make_vertex(const ung_geometry_data& gdata, usize i)
+{
+    const auto u = f2u16norm(gdata.texcoords ? gdata.texcoords[i * 2 + 0] : 0.0f);
+    const auto v = f2u16norm(gdata.texcoords ? gdata.texcoords[i * 2 + 1] : 0.0f);
+
+    const auto nx = gdata.normals ? gdata.normals[i * 3 + 0] : 0.0f;
+    const auto ny = gdata.normals ? gdata.normals[i * 3 + 1] : 0.0f;
+    const auto nz = gdata.normals ? gdata.normals[i * 3 + 2] : 0.0f;
+
+    const auto r = f2u8norm(gdata.colors ? gdata.colors[i * 4 + 0] : 1.0f);
+    const auto g = f2u8norm(gdata.colors ? gdata.colors[i * 4 + 1] : 1.0f);
+    const auto b = f2u8norm(gdata.colors ? gdata.colors[i * 4 + 2] : 1.0f);
+    const auto a = f2u8norm(gdata.colors ? gdata.colors[i * 4 + 3] : 1.0f);
+
+    VertexType vtx = {};
+    vtx.u = u;
+    vtx.v = v;
+    vtx.n = pack1010102(nx, ny, nz);
+    vtx.r = r;
+    vtx.g = g;
+    vtx.b = b;
+    vtx.a = a;
+    return vtx;
 }
 
-static mugfx_geometry_create_params create_geometry_params(Vertex* vertices, usize num_vertices,
-    u32* indices, usize num_indices, const char* debug_label = nullptr)
+static float get_quantization_extent(const ung_geometry_bounds& bounds)
 {
-    mugfx_buffer_id vertex_buffer = mugfx_buffer_create({
+    float extent = 0.0f;
+    for (u32 c = 0; c < 3; ++c) {
+        extent = std::fmax(extent, bounds.max[c] - bounds.min[c]);
+    }
+    return extent > 0.0f ? extent : 1.0f;
+}
+
+static GeometryBuffers build_geometry_buffers(
+    const ung_geometry_data& gdata, bool quantize, u32 num_lods)
+{
+    GeometryBuffers bufs = {};
+    bufs.num_vertices = gdata.num_vertices;
+    bufs.num_indices = gdata.num_indices;
+    bufs.quantized = quantize;
+    bufs.bounds = ung_geometry_data_get_bounds(gdata);
+
+    const auto& min = bufs.bounds.min;
+    if (quantize) {
+        const auto extent = get_quantization_extent(bufs.bounds);
+        const auto size = gdata.num_vertices * sizeof(QuantizedVertex);
+        bufs.vertices = { allocate_scratch(size), size };
+        auto vertices = (QuantizedVertex*)bufs.vertices.data();
+        for (size_t i = 0; i < gdata.num_vertices; ++i) {
+            vertices[i] = make_vertex<QuantizedVertex>(gdata, i);
+            vertices[i].x = f2u16norm((gdata.positions[i * 3 + 0] - min[0]) / extent);
+            vertices[i].y = f2u16norm((gdata.positions[i * 3 + 1] - min[1]) / extent);
+            vertices[i].z = f2u16norm((gdata.positions[i * 3 + 2] - min[2]) / extent);
+        }
+    } else {
+        const auto size = gdata.num_vertices * sizeof(Vertex);
+        bufs.vertices = { allocate_scratch(size), size };
+        auto vertices = (Vertex*)bufs.vertices.data();
+        for (size_t i = 0; i < gdata.num_vertices; ++i) {
+            vertices[i] = make_vertex<Vertex>(gdata, i);
+            vertices[i].x = gdata.positions[i * 3 + 0];
+            vertices[i].y = gdata.positions[i * 3 + 1];
+            vertices[i].z = gdata.positions[i * 3 + 2];
+        }
+    }
+
+    if (!gdata.indices) {
+        return bufs;
+    }
+
+    // The levels of detail are appended to the original indices
+    const auto lod_indices_size = gdata.num_indices * num_lods * sizeof(u32);
+    auto lod_indices = (u32*)allocate_scratch(lod_indices_size);
+    if (num_lods) {
+        bufs.num_lods = ung_geometry_data_generate_lods(
+            &gdata, num_lods, state->geometry_lod_ratio, lod_indices, bufs.lods);
+    }
+    const auto count = bufs.get_index_buffer_count();
+    const auto get_index = [&](u32 i) {
+        return i < gdata.num_indices ? gdata.indices[i] : lod_indices[i - gdata.num_indices];
+    };
+
+    // Indices are stored as u16 if possible, because it halves the size of the index buffer
+    if (gdata.num_vertices <= 0x10000) {
+        const auto size = count * sizeof(u16);
+        bufs.indices = { allocate_scratch(size), size };
+        auto indices = (u16*)bufs.indices.data();
+        for (u32 i = 0; i < count; ++i) {
+            indices[i] = (u16)get_index(i);
+        }
+    } else {
+        const auto size = count * sizeof(u32);
+        bufs.indices = { allocate_scratch(size), size };
+        auto indices = (u32*)bufs.indices.data();
+        for (u32 i = 0; i < count; ++i) {
+            indices[i] = get_index(i);
+        }
+    }
+    deallocate_scratch((u8*)lod_indices, lod_indices_size);
+
+    return bufs;
+}
+
+static ung_geometry_id create_geometry(const GeometryBuffers& bufs, const char* debug_label)
+{
+    const auto vertex_buffer = mugfx_buffer_create({
         .target = MUGFX_BUFFER_TARGET_ARRAY,
-        .data = { vertices, num_vertices * sizeof(Vertex) },
+        .data = { bufs.vertices.data(), bufs.vertices.size() },
         .debug_label = debug_label,
     });
 
-    mugfx_buffer_id index_buffer = { 0 };
-    if (indices) {
-        index_buffer = mugfx_buffer_create({
-            .target = MUGFX_BUFFER_TARGET_INDEX,
-            .data = { indices, num_indices * sizeof(u32) },
-            .debug_label = debug_label,
-        });
-    }
-
-    mugfx_geometry_create_params geometry_params = {
+    const auto quantize = bufs.quantized;
+    const auto position_type
+        = quantize ? MUGFX_VERTEX_ATTRIBUTE_TYPE_U16_NORM : MUGFX_VERTEX_ATTRIBUTE_TYPE_F32;
+    mugfx_geometry_create_params params = {
         .vertex_buffers = {
             {
                 .buffer = vertex_buffer,
                 .attributes = {
-                    {.location = 0, .components = 3, .type = MUGFX_VERTEX_ATTRIBUTE_TYPE_F32}, // position
+                    {.location = 0, .components = quantize ? 4u : 3u, .type = position_type}, // position
                     {.location = 1, .components = 2, .type = MUGFX_VERTEX_ATTRIBUTE_TYPE_U16_NORM}, // texcoord
                     {.location = 2, .components = 4, .type = MUGFX_VERTEX_ATTRIBUTE_TYPE_I10_10_10_2_NORM}, // normal
                     {.location = 3, .components = 4, .type = MUGFX_VERTEX_ATTRIBUTE_TYPE_U8_NORM}, // color
                 },
             },
         },
-        .vertex_count = (u32)num_vertices,
-        .index_count = (u32)num_indices,
+        .vertex_count = bufs.num_vertices,
+        .index_count = bufs.num_indices,
         .debug_label = debug_label,
     };
-    if (index_buffer.id) {
-        geometry_params.index_buffer = index_buffer;
-        geometry_params.index_type = MUGFX_INDEX_TYPE_U32;
+    if (bufs.indices.size()) {
+        params.index_buffer = mugfx_buffer_create({
+            .target = MUGFX_BUFFER_TARGET_INDEX,
+            .data = { bufs.indices.data(), bufs.indices.size() },
+            .debug_label = debug_label,
+        });
+        params.index_type = bufs.indices.size() == bufs.get_index_buffer_count() * sizeof(u16)
+            ? MUGFX_INDEX_TYPE_U16
+            : MUGFX_INDEX_TYPE_U32;
     }
 
-    return geometry_params;
+    const auto geom = mugfx_geometry_create(params);
+    if (!geom.id) {
+        ung_panicf("Error creating geometry");
+    }
+
+    const auto [id, geometry] = state->geometries.insert();
+    geometry->geometry = geom;
+    geometry->mugfx_params = params;
+    geometry->draw_count = params.index_buffer.id ? params.index_count : params.vertex_count;
+    geometry->owns_buffers = true;
+    set_bounds(geometry, bufs.bounds);
+    if (quantize) {
+        const auto& min = bufs.bounds.min;
+        const auto extent = get_quantization_extent(bufs.bounds);
+        geometry->quantized = true;
+        geometry->dequantize = um_mat_mul(um_mat_translate({ min[0], min[1], min[2] }),
+            um_mat_scale({ extent, extent, extent }));
+    }
+    set_lods(geometry, bufs.lods, bufs.num_lods);
+    return { id };
 }
 
-static Vertex* build_vertex_buffer_data(ung_geometry_data gdata)
+EXPORT ung_geometry_id ung_geometry_create_from_data(ung_geometry_data gdata)
 {
-    auto vertices = allocate<Vertex>(gdata.num_vertices);
-    for (size_t i = 0; i < gdata.num_vertices; ++i) {
-        const auto x = gdata.positions[i * 3 + 0];
-        const auto y = gdata.positions[i * 3 + 1];
-        const auto z = gdata.positions[i * 3 + 2];
+    ScratchScope scratch;
+    auto bufs = build_geometry_buffers(
+        gdata, state->quantize_geometry_positions, state->geometry_num_lods);
+    const auto geometry = create_geometry(bufs, nullptr);
+    bufs.free();
+    return geometry;
+}
 
-        const auto u = f2u16norm(gdata.texcoords ? gdata.texcoords[i * 2 + 0] : 0.0f);
-        const auto v = f2u16norm(gdata.texcoords ? gdata.texcoords[i * 2 + 1] : 0.0f);
+static const char* format_geometry_cache_path(const char* path)
+{
+    thread_local char path_buf[128];
+    Formatter fmt { path_buf };
+    const auto mtime = ung_file_get_mtime(path);
+    fmt.append(".ungcache/");
+    fmt.append_hash(path, strlen(path));
+    fmt.append("-");
+    fmt.append_hex_obj(mtime);
+    if (state->quantize_geometry_positions) {
+        fmt.append("-q");
+    }
+    if (state->geometry_num_lods) {
+        fmt.append("-l");
+        fmt.append_hex_obj(state->geometry_num_lods);
+        fmt.append_hex_obj(state->geometry_lod_ratio);
+    }
+    fmt.append("-v2.geom");
+    return path_buf;
+}
 
-        const auto nx = gdata.normals ? gdata.normals[i * 3 + 0] : 0.0f;
-        const auto ny = gdata.normals ? gdata.normals[i * 3 + 1] : 0.0f;
-        const auto nz = gdata.normals ? gdata.normals[i * 3 + 2] : 0.0f;
+struct CacheGeomHeader {
+    char magic[4];
+    u32 version;
+    u32 num_vertices;
+    u32 num_indices;
+    u64 vertices_size;
+    u64 indices_size;
+    u32 quantized;
+    ung_geometry_bounds bounds;
+    u32 num_lods;
+    ung_geometry_lod lods[UNG_MAX_GEOMETRY_LODS];
+};
 
-        const auto r = f2u8norm(gdata.colors ? gdata.colors[i * 4 + 0] : 1.0f);
-        const auto g = f2u8norm(gdata.colors ? gdata.colors[i * 4 + 1] : 1.0f);
-        const auto b = f2u8norm(gdata.colors ? gdata.colors[i * 4 + 2] : 1.0f);
-        const auto a = f2u8norm(gdata.colors ? gdata.colors[i * 4 + 3] : 1.0f);
+static constexpr char CacheGeomMagic[4] = { 'U', 'G', 'E', 'O' };
+static constexpr u32 CacheGeomVersion = 2;
 
-        vertices[i] = { x, y, z, u, v, pack1010102(nx, ny, nz), r, g, b, a };
+static void write_geometry_cache_file(const char* cache_path, const GeometryBuffers& bufs)
+{
+    auto file = fopen(cache_path, "wb");
+    if (!file) {
+        fprintf(stderr, "Could not open geometry cache file for writing: %s\n", cache_path);
+        return;
     }
-    return vertices;
+    CacheGeomHeader hdr = {};
+    memcpy(hdr.magic, CacheGeomMagic, sizeof(CacheGeomMagic));
+    hdr.version = CacheGeomVersion;
+    hdr.num_vertices = bufs.num_vertices;
+    hdr.num_indices = bufs.num_indices;
+    hdr.vertices_size = bufs.vertices.size();
+    hdr.indices_size = bufs.indices.size();
+    hdr.quantized = bufs.quantized;
+    hdr.bounds = bufs.bounds;
+    hdr.num_lods = bufs.num_lods;
+    std::memcpy(hdr.lods, bufs.lods, sizeof(hdr.lods));
+    fwrite(&hdr, sizeof(CacheGeomHeader), 1, file);
+    fwrite(bufs.vertices.data(), 1, bufs.vertices.size(), file);
+    fwrite(bufs.indices.data(), 1, bufs.indices.size(), file);
+    fclose(file);
 }
 
-static mugfx_geometry_create_params create_params_from_data(
-    ung_geometry_data gdata, const char* debug_label = nullptr)
+// The buffers point into the file data (which might be a memory-mapped pack), so there is no
+// per-vertex work at all.
+// The index type is derived from indices_size, so it has to match the index count exactly
+static bool valid_cache_indices(const CacheGeomHeader& hdr)
 {
-    // We cannot build a proper indexed mesh trivially, because a face will reference different
-    // position, texcoord and normal indices, so you would have to generate all used
-    // combinations and build new indices. It's too bothersome and will not be fast.
-
-    auto vertices = build_vertex_buffer_data(gdata);
-
-    const auto params = create_geometry_params(
-        vertices, gdata.num_vertices, gdata.indices, gdata.num_indices, debug_label);
-
-    deallocate(vertices, gdata.num_vertices);
-
-    return params;
+    // Like GeometryBuffers::get_index_buffer_count
+    const u64 count = hdr.num_lods
+        ? (u64)hdr.lods[hdr.num_lods - 1].index_offset + hdr.lods[hdr.num_lods - 1].index_count
+        : hdr.num_indices;
+    if (count < hdr.num_indices) {
+        return false;
+    }
+    for (u32 l = 0; l < hdr.num_lods; ++l) {
+        if ((u64)hdr.lods[l].index_offset + hdr.lods[l].index_count > count) {
+            return false;
+        }
+    }
+    const auto u16_indices = hdr.indices_size == count * sizeof(u16);
+    return (u16_indices && hdr.num_vertices <= 0x10000) || hdr.indices_size == count * sizeof(u32);
 }
 
-EXPORT ung_geometry_id ung_geometry_create_from_data(ung_geometry_data gdata)
+static bool load_geometry_cache(const char* cache_path, ung_geometry_id* geometry)
 {
-    const auto params = create_params_from_data(gdata);
-    const auto geom = mugfx_geometry_create(params);
-    if (!geom.id) {
-        ung_panicf("Error creating geometry");
+    size_t file_size = 0;
+    const auto file_data = ung_read_whole_file(cache_path, &file_size, false);
+    if (!file_data) {
+        return false;
     }
 
-    const auto [id, geometry] = state->geometries.insert();
-    geometry->geometry = geom;
-    geometry->mugfx_params = params;
-    return { id };
+    CacheGeomHeader hdr;
+    if (file_size < sizeof(CacheGeomHeader)) {
+        ung_free_file_data(file_data, file_size);
+        return false;
+    }
+    memcpy(&hdr, file_data, sizeof(CacheGeomHeader));
+    const auto vertex_size = hdr.quantized ? sizeof(QuantizedVertex) : sizeof(Vertex);
+    if (memcmp(hdr.magic, CacheGeomMagic, sizeof(CacheGeomMagic)) != 0
+        || hdr.version != CacheGeomVersion || hdr.vertices_size != hdr.num_vertices * vertex_size
+        || hdr.num_lods > UNG_MAX_GEOMETRY_LODS || !valid_cache_indices(hdr)
+        || sizeof(CacheGeomHeader) + hdr.vertices_size + hdr.indices_size > file_size) {
+        fprintf(stderr, "Invalid geometry cache file: %s\n", cache_path);
+        ung_free_file_data(file_data, file_size);
+        return false;
+    }
+
+    const auto data = (u8*)file_data + sizeof(CacheGeomHeader);
+    GeometryBuffers bufs = {
+        .vertices = { data, hdr.vertices_size },
+        .indices = { data + hdr.vertices_size, hdr.indices_size },
+        .num_vertices = hdr.num_vertices,
+        .num_indices = hdr.num_indices,
+        .quantized = hdr.quantized != 0,
+        .bounds = hdr.bounds,
+        .num_lods = hdr.num_lods,
+    };
+    std::memcpy(bufs.lods, hdr.lods, sizeof(bufs.lods));
+    *geometry = create_geometry(bufs, cache_path);
+    ung_free_file_data(file_data, file_size);
+    return true;
 }
 
-mugfx_geometry_create_params load_geometry(const char* path)
+EXPORT ung_geometry_id ung_geometry_load(const char* path)
 {
     LoadProfScope s(path);
+
+    const char* cache_path = nullptr;
+    if (state->load_cache) {
+        cache_path = format_geometry_cache_path(path);
+        ung_geometry_id geometry;
+        if (load_geometry_cache(cache_path, &geometry)) {
+            return geometry;
+        }
+    }
+
     ung_load_profiler_push("load");
-    const auto gdata = ung_geometry_data_load(path);
+    auto gdata = ung_geometry_data_load(path);
     ung_load_profiler_pop("load");
+    if (!gdata.positions) {
+        ung_panicf("Error loading geometry '%s'", path);
+    }
     ung_load_profiler_push("upload");
-    const auto params = create_params_from_data(gdata, path);
+    ScratchScope scratch;
+    auto bufs = build_geometry_buffers(
+        gdata, state->quantize_geometry_positions, state->geometry_num_lods);
+    const auto geometry = create_geometry(bufs, path);
     ung_load_profiler_pop("upload");
-    ung_geometry_data_destroy(gdata);
-    return params;
-}
-
-EXPORT ung_geometry_id ung_geometry_load(const char* path)
-{
-    const auto params = load_geometry(path);
-    const auto geom = mugfx_geometry_create(params);
-    if (!geom.id) {
-        ung_panicf("Error loading geometry '%s'", path);
+    if (cache_path) {
+        write_geometry_cache_file(cache_path, bufs);
     }
-
-    const auto [id, geometry] = state->geometries.insert();
-    geometry->geometry = geom;
-    geometry->mugfx_params = params;
-    return { id };
+    bufs.free();
+    ung_geometry_data_destroy(gdata);
+    return geometry;
 }
 
 EXPORT ung_instance_buffer_id ung_instance_buffer_create(ung_instance_buffer_create_params params)
@@ -475,6 +927,7 @@ EXPORT void ung_instance_buffer_update(
     buf->num_instances = instance_count;
     mugfx_buffer_update(buf->buffer, 0, {}); // orphan
     mugfx_buffer_update(buf->buffer, 0, { instance_data, buf->stride * instance_count });
+    state->frame_stats.instance_upload_bytes += buf->stride * instance_count;
 }
 
 EXPORT ung_geometry_id ung_instanced_geometry_create(
@@ -493,6 +946,8 @@ EXPORT ung_geometry_id ung_instanced_geometry_create(
     if (vbuf >= MUGFX_MAX_VERTEX_BUFFERS) {
         ung_panicf("No space for additional vertex buffer");
     }
+    // Instance transforms are applied after the model matrix, which contains the dequantization
+    UNG_OR_PANIC(!base->quantized, "Instanced geometry can't have quantized positions");
 
     params.vertex_buffers[vbuf] = {
         .buffer = buf->buffer,
@@ -508,6 +963,7 @@ EXPORT ung_geometry_id ung_instanced_geometry_create(
     const auto [id, geometry] = state->geometries.insert();
     geometry->geometry = geom;
     geometry->mugfx_params = params;
+    geometry->draw_count = base->draw_count;
     geometry->instance_buffer = instance_buffer;
     return { id };
 }
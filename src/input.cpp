@@ -185,11 +185,8 @@ void process_event(SDL_Event* event)
             state->last_active_gamepad = 0;
             float max_last_active = 0.0f;
             auto& gps = state->gamepads;
-            for (u32 i = 0; i < gps.capacity(); ++i) {
-                const auto key = gps.get_key(i);
-                if (!key) {
-                    continue;
-                }
+            for (u32 n = 0; n < gps.size(); ++n) {
+                const auto i = gps.alive_index(n);
                 if (gps.data[i].last_active > max_last_active) {
                     state->last_active_gamepad = gps.keys[i];
                     max_last_active = gps.data[i].last_active;
@@ -404,13 +401,10 @@ EXPORT ung_gamepad_id ung_get_gamepad_from_event(uint32_t type, int32_t which)
     }
 
     const auto& gps = state->gamepads;
-    for (u32 i = 0; i < gps.capacity(); ++i) {
-        const auto key = gps.get_key(i);
-        if (!key) {
-            continue;
-        }
+    for (u32 n = 0; n < gps.size(); ++n) {
+        const auto i = gps.alive_index(n);
         if (gps.data[i].device_index == device_index || gps.data[i].instance_id == instance_id) {
-            return { key };
+            return { gps.keys[i] };
         }
     }
     return { 0 };
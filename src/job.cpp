@@ -0,0 +1,465 @@
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+#include "types.hpp"
+#include "ung.h"
+
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define UNG_JOBS_SYNC
+#endif
+
+// Every worker thread (and the main thread, index 0) owns a Chase-Lev deque. The owner pushes and
+// pops at the bottom (LIFO, good for cache locality), other threads steal from the top (FIFO).
+// Threads that are not workers (e.g. resource decode threads) push into a global queue protected
+// by a mutex, which is also used if a deque is full.
+// Dependencies are implemented by keeping the dependent jobs in the dependency counter until it
+// reaches zero.
+
+namespace ung::job {
+
+struct Counter;
+
+struct Job {
+    ung_job_func func;
+    void* ctx;
+    u32 index;
+    Counter* counter;
+};
+
+struct Counter {
+    std::atomic<u32> value;
+    Vector<Job>* waiting; // protected by State::waiting_mtx, element of State::waiting_lists
+};
+
+struct Deque {
+    static constexpr i64 Capacity = 1024; // must be power of two
+
+    // Thieves might read a slot while the owner overwrites it (the steal fails then), so the
+    // fields are atomic to make this well-defined.
+    struct Slot {
+        std::atomic<ung_job_func> func;
+        std::atomic<void*> ctx;
+        std::atomic<u32> index;
+        std::atomic<Counter*> counter;
+
+        void store(const Job& job);
+        Job load() const;
+    };
+
+    std::atomic<i64> top;
+    std::atomic<i64> bottom;
+    Array<Slot> jobs;
+
+    bool push(const Job& job);
+    bool pop(Job& job);
+    bool steal(Job& job);
+};
+
+struct State {
+    Pool<Counter> counters;
+    // Indexed like counters. They are allocated once in init, so creating a counter does not
+    // allocate (some are created every frame).
+    Array<Vector<Job>> waiting_lists;
+    std::mutex counters_mtx;
+    std::mutex waiting_mtx;
+
+    Array<Deque> deques; // index 0 is the main thread
+    Array<std::jthread> threads;
+
+    Vector<Job> global_queue;
+    std::mutex global_queue_mtx;
+
+    // Number of jobs that are in any queue
+    std::atomic<u32> num_queued;
+    std::atomic<u32> num_sleeping;
+    std::mutex sleep_mtx;
+    std::condition_variable_any sleep_cv;
+};
+
+State* state = nullptr;
+
+static constexpr u32 NotAWorker = 0xffff'ffff;
+
+static u32& worker_index()
+{
+    thread_local u32 index = NotAWorker;
+    return index;
+}
+
+// finish swaps the waiting jobs of a counter with this, so it can push them outside the lock
+// without allocating
+struct WaitingScratch {
+    Vector<Job> jobs = {};
+
+    ~WaitingScratch() { jobs.free(); }
+};
+
+static Vector<Job>& waiting_scratch()
+{
+    thread_local WaitingScratch scratch;
+    if (!scratch.jobs.data) {
+        scratch.jobs.init(8);
+    }
+    return scratch.jobs;
+}
+
+void Deque::Slot::store(const Job& job)
+{
+    func.store(job.func, std::memory_order_relaxed);
+    ctx.store(job.ctx, std::memory_order_relaxed);
+    index.store(job.index, std::memory_order_relaxed);
+    counter.store(job.counter, std::memory_order_relaxed);
+}
+
+Job Deque::Slot::load() const
+{
+    return {
+        func.load(std::memory_order_relaxed),
+        ctx.load(std::memory_order_relaxed),
+        index.load(std::memory_order_relaxed),
+        counter.load(std::memory_order_relaxed),
+    };
+}
+
+bool Deque::push(const Job& job)
+{
+    const auto b = bottom.load(std::memory_order_relaxed);
+    const auto t = top.load(std::memory_order_acquire);
+    if (b - t >= Capacity) {
+        return false;
+    }
+    jobs[(u32)(b & (Capacity - 1))].store(job);
+    bottom.store(b + 1, std::memory_order_release);
+    return true;
+}
+
+bool Deque::pop(Job& job)
+{
+    const auto b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto t = top.load(std::memory_order_relaxed);
+    if (t > b) { // empty
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return false;
+    }
+
+    job = jobs[(u32)(b & (Capacity - 1))].load();
+    if (t == b) {
+        // Last element, race against thieves
+        const auto won = top.compare_exchange_strong(
+            t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+bool Deque::steal(Job& job)
+{
+    auto t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const auto b = bottom.load(std::memory_order_acquire);
+    if (t >= b) {
+        return false;
+    }
+    job = jobs[(u32)(t & (Capacity - 1))].load();
+    return top.compare_exchange_strong(
+        t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+static void execute(const Job& job);
+
+static void push(const Job& job)
+{
+#ifdef UNG_JOBS_SYNC
+    execute(job);
+#else
+    state->num_queued.fetch_add(1);
+
+    const auto w = worker_index();
+    if (w == NotAWorker || !state->deques[w].push(job)) {
+        std::lock_guard lock(state->global_queue_mtx);
+        state->global_queue.push(job);
+    }
+
+    if (state->num_sleeping.load() > 0) {
+        // Taking the lock makes sure the sleeping thread is either waiting or has not checked
+        // num_queued yet.
+        std::lock_guard lock(state->sleep_mtx);
+        state->sleep_cv.notify_one();
+    }
+#endif
+}
+
+static bool try_get_job(Job& job)
+{
+    const auto w = worker_index();
+    if (w != NotAWorker && state->deques[w].pop(job)) {
+        state->num_queued.fetch_sub(1);
+        return true;
+    }
+
+    {
+        std::lock_guard lock(state->global_queue_mtx);
+        if (state->global_queue.size > 0) {
+            job = state->global_queue[state->global_queue.size - 1];
+            state->global_queue.size--;
+            state->num_queued.fetch_sub(1);
+            return true;
+        }
+    }
+
+    // Start at the next deque, so not all thieves go for the same victim
+    const auto num_deques = state->deques.size;
+    const auto start = w == NotAWorker ? 0 : w + 1;
+    for (u32 i = 0; i < num_deques; ++i) {
+        const auto victim = (start + i) % num_deques;
+        if (victim != w && state->deques[victim].steal(job)) {
+            state->num_queued.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void add(Counter* counter, u32 n)
+{
+    if (counter) {
+        counter->value.fetch_add(n);
+    }
+}
+
+static void finish(Counter* counter)
+{
+    if (!counter) {
+        return;
+    }
+
+    // Fast path if we are not the last job
+    auto value = counter->value.load();
+    while (value > 1) {
+        if (counter->value.compare_exchange_weak(value, value - 1)) {
+            return;
+        }
+    }
+
+    // We might be the last job. A waiting thread may destroy the counter as soon as it sees zero,
+    // which it can't while we hold the lock (see ung_job_counter_destroy), so the last decrement
+    // and taking the waiting jobs has to happen under the lock.
+    // Jobs are pushed outside the lock, because with UNG_JOBS_SYNC pushing executes the job,
+    // which might call ung_job_run_after.
+    auto& waiting = waiting_scratch();
+    {
+        std::lock_guard lock(state->waiting_mtx);
+        if (counter->value.fetch_sub(1) != 1 || counter->waiting->size == 0) {
+            return;
+        }
+        std::swap(waiting, *counter->waiting);
+    }
+    // With UNG_JOBS_SYNC pushing runs the job, which might finish another counter on this thread
+    // and needs the scratch itself.
+    auto jobs = waiting;
+    waiting = {};
+    for (const auto& job : jobs) {
+        push(job);
+    }
+    jobs.clear();
+    if (!waiting.data) {
+        waiting = jobs;
+    } else {
+        jobs.free();
+    }
+}
+
+static void execute(const Job& job)
+{
+    ProfScope prof("job");
+    job.func(job.ctx, job.index);
+    finish(job.counter);
+}
+
+static void worker(std::stop_token stop, u32 index)
+{
+    worker_index() = index;
+    char name[32];
+    std::snprintf(name, sizeof(name), "job %u", index);
+    ung_profiler_set_thread_name(name);
+    while (!stop.stop_requested()) {
+        Job job;
+        if (try_get_job(job)) {
+            execute(job);
+            continue;
+        }
+
+        std::unique_lock lock(state->sleep_mtx);
+        state->num_sleeping.fetch_add(1);
+        state->sleep_cv.wait(lock, stop, [] { return state->num_queued.load() > 0; });
+        state->num_sleeping.fetch_sub(1);
+    }
+}
+
+static Counter* get_counter(ung_job_counter_id counter_id)
+{
+    if (!counter_id.id) {
+        return nullptr;
+    }
+    std::lock_guard lock(state->counters_mtx);
+    return get(state->counters, counter_id.id);
+}
+
+void init(ung_init_params params)
+{
+    assert(!state);
+    state = allocate<State>();
+
+    state->counters.init(params.max_num_job_counters ? params.max_num_job_counters : 256);
+    state->waiting_lists.init(state->counters.capacity());
+    for (u32 i = 0; i < state->waiting_lists.size; ++i) {
+        state->waiting_lists[i].init(8);
+    }
+    state->global_queue.init(64);
+
+#ifndef UNG_JOBS_SYNC
+    u32 num_threads = params.num_job_threads;
+    if (!num_threads) {
+        const auto num_cores = std::thread::hardware_concurrency();
+        num_threads = num_cores > 1 ? num_cores - 1 : 0;
+    }
+
+    state->deques.init(num_threads + 1);
+    for (u32 i = 0; i < state->deques.size; ++i) {
+        state->deques[i].jobs.init(Deque::Capacity);
+    }
+
+    worker_index() = 0;
+    state->threads.init(num_threads);
+    for (u32 i = 0; i < num_threads; ++i) {
+        state->threads[i] = std::jthread([i](std::stop_token st) { worker(st, i + 1); });
+    }
+#endif
+}
+
+void shutdown()
+{
+    if (!state) {
+        return;
+    }
+
+    for (u32 i = 0; i < state->threads.size; ++i) {
+        state->threads[i].request_stop(); // notifies sleep_cv
+    }
+    state->threads.free(); // calls ~jthread
+
+    for (u32 i = 0; i < state->deques.size; ++i) {
+        state->deques[i].jobs.free();
+    }
+    state->deques.free();
+
+    for (u32 i = 0; i < state->waiting_lists.size; ++i) {
+        state->waiting_lists[i].free();
+    }
+    state->waiting_lists.free();
+    state->counters.free();
+    state->global_queue.free();
+
+    deallocate(state, 1);
+    state = nullptr;
+}
+
+EXPORT ung_job_counter_id ung_job_counter_create()
+{
+    assert(state);
+    std::lock_guard lock(state->counters_mtx);
+    const auto [id, counter] = state->counters.insert();
+    if (id == 0) {
+        ung_panic("Too many job counters");
+    }
+    counter->waiting = &state->waiting_lists[ung_slotmap_get_index(id)];
+    return { id };
+}
+
+EXPORT void ung_job_counter_destroy(ung_job_counter_id counter_id)
+{
+    assert(state);
+    // Wait for finish to release the counter
+    std::lock_guard waiting_lock(state->waiting_mtx);
+    std::lock_guard lock(state->counters_mtx);
+    auto counter = get(state->counters, counter_id.id);
+    assert(counter->value == 0);
+    counter->waiting->clear();
+    state->counters.remove(counter_id.id);
+}
+
+EXPORT bool ung_job_counter_done(ung_job_counter_id counter)
+{
+    assert(state);
+    return get_counter(counter)->value.load() == 0;
+}
+
+EXPORT void ung_job_run(ung_job_func func, void* ctx, uint32_t index, ung_job_counter_id counter_id)
+{
+    assert(state && func);
+    const auto counter = get_counter(counter_id);
+    add(counter, 1);
+    push({ func, ctx, index, counter });
+}
+
+EXPORT void ung_job_run_many(
+    ung_job_func func, void* ctx, uint32_t count, ung_job_counter_id counter_id)
+{
+    assert(state && func);
+    const auto counter = get_counter(counter_id);
+    // Add all at once, so the counter does not reach zero while we are still pushing
+    add(counter, count);
+    for (u32 i = 0; i < count; ++i) {
+        push({ func, ctx, i, counter });
+    }
+}
+
+EXPORT void ung_job_run_after(ung_job_counter_id dependency_id, ung_job_func func, void* ctx,
+    uint32_t index, ung_job_counter_id counter_id)
+{
+    assert(state && func);
+    const auto counter = get_counter(counter_id);
+    add(counter, 1);
+    const Job job = { func, ctx, index, counter };
+
+    const auto dependency = get_counter(dependency_id);
+    if (dependency) {
+        std::lock_guard lock(state->waiting_mtx);
+        // If the dependency reaches zero after this check, finish will wait for the lock and see
+        // this job.
+        if (dependency->value.load() > 0) {
+            dependency->waiting->push(job);
+            return;
+        }
+    }
+    push(job);
+}
+
+EXPORT void ung_job_wait(ung_job_counter_id counter_id)
+{
+    assert(state);
+    const auto counter = get_counter(counter_id);
+    while (counter->value.load() > 0) {
+        Job job;
+        if (try_get_job(job)) {
+            execute(job);
+        } else {
+            // The remaining jobs are running on other threads
+            std::this_thread::yield();
+        }
+    }
+}
+
+EXPORT uint32_t ung_job_get_num_threads()
+{
+    assert(state);
+    return state->threads.size;
+}
+
+}
@@ -1,6 +1,5 @@
 #include <algorithm>
 #include <stdio.h>
-#include <unordered_map>
 
 #include "state.hpp"
 
@@ -48,18 +47,19 @@ static void dump_speedscope(const Array<ZoneAux>& aux, u32 root, float total_dur
     // dedup frame names
     Vector<std::string_view> names = {};
     names.init(root);
-    std::unordered_map<std::string_view, u32> name_idx_map;
+    StrMap<u32> name_idx_map = {};
+    name_idx_map.init(root);
     Vector<u32> name_idx = {};
     name_idx.init(root);
 
     for (u32 i = 0; i < state->prof_zones.size; ++i) {
-        const auto it = name_idx_map.find(state->prof_zones[i].name);
-        if (it == name_idx_map.end()) {
-            name_idx_map.emplace(state->prof_zones[i].name, names.size);
+        const auto idx = name_idx_map.find(state->prof_zones[i].name);
+        if (!idx) {
+            name_idx_map.insert(state->prof_zones[i].name, names.size);
             name_idx.push(names.size);
             names.push(state->prof_zones[i].name);
         } else {
-            name_idx.push(it->second);
+            name_idx.push(*idx);
         }
     }
 
@@ -112,6 +112,10 @@ static void dump_speedscope(const Array<ZoneAux>& aux, u32 root, float total_dur
     fprintf(f, "\"name\": \"load.speedscope.json\"\n");
     fprintf(f, "}");
     fclose(f);
+
+    name_idx_map.free();
+    name_idx.free();
+    names.free();
 }
 
 static void sort_children(Array<ZoneAux>& aux, u32 root)
@@ -3,6 +3,7 @@
 #include "types.hpp"
 #include "ung.h"
 
+#include <cstdint>
 #include <cstdio>
 
 namespace ung {
@@ -11,12 +12,17 @@ struct MaterialPending {
     const char* error;
 };
 
+static BlockPool<MaterialPending, 32> pending_pool;
+
 struct MaterialResource {
     ung_material_id material;
     char* vert_path;
     char* frag_path;
     ung_material_create_params params;
     MaterialPending* pending;
+    // Loaded by res_material_can_upload, so they load while we wait. Released after upload.
+    ung_shader_id prefetch_vert;
+    ung_shader_id prefetch_frag;
 };
 
 Material* get_material(u64 key)
@@ -24,14 +30,50 @@ Material* get_material(u64 key)
     return get(state->materials, key);
 }
 
-static size_t get_binding(Material& mat, mugfx_draw_binding binding)
+static std::array<u8, 16>* get_slots(Material& mat, const mugfx_draw_binding& binding)
+{
+    switch (binding.type) {
+    case MUGFX_BINDING_TYPE_TEXTURE:
+        return binding.texture.binding < mat.texture_slots.size() ? &mat.texture_slots : nullptr;
+    case MUGFX_BINDING_TYPE_BUFFER:
+        return binding.buffer.binding < mat.buffer_slots.size() ? &mat.buffer_slots : nullptr;
+    default:
+        return nullptr;
+    }
+}
+
+static u32 get_binding_number(const mugfx_draw_binding& binding)
 {
+    return binding.type == MUGFX_BINDING_TYPE_TEXTURE ? binding.texture.binding
+                                                      : binding.buffer.binding;
+}
+
+// Returns the index into mat.bindings or SIZE_MAX if not present
+size_t find_binding(Material& mat, const mugfx_draw_binding& binding)
+{
+    if (const auto slots = get_slots(mat, binding)) {
+        const auto slot = (*slots)[get_binding_number(binding)];
+        return slot ? slot - 1u : SIZE_MAX;
+    }
     for (size_t i = 0; i < mat.bindings.size(); ++i) {
         if (is_same_binding(mat.bindings[i], binding)) {
             return i;
         }
     }
+    return SIZE_MAX;
+}
+
+static size_t get_binding(Material& mat, mugfx_draw_binding binding)
+{
+    mat.bindings_dirty = true;
+    const auto idx = find_binding(mat, binding);
+    if (idx != SIZE_MAX) {
+        return idx;
+    }
     mat.bindings.append() = binding;
+    if (const auto slots = get_slots(mat, binding)) {
+        (*slots)[get_binding_number(binding)] = (u8)mat.bindings.size();
+    }
     return mat.bindings.size() - 1;
 }
 
@@ -41,6 +83,61 @@ static void set_binding(Material& mat, mugfx_draw_binding binding)
     mat.bindings[idx] = binding;
 }
 
+// Returns the bindings with all textures resolved. The first three bindings (UngFrame, UngPass,
+// UngTransform) have to be filled in by the caller.
+StaticVector<mugfx_draw_binding, 16>& get_resolved_bindings(Material& mat)
+{
+    if (!mat.bindings_dirty && mat.resolved_texture_epoch == state->texture_epoch) {
+        return mat.resolved_bindings;
+    }
+
+    ung_resource_wait_ready(mat.resource);
+
+    mat.resolved_bindings = mat.bindings;
+    for (size_t i = 0; i < mat.bindings.size(); ++i) {
+        if (mat.textures[i].id) {
+            const auto tex = get(state->textures, mat.textures[i].id);
+            if (tex->resource.id) {
+                ung_resource_wait_ready(tex->resource);
+            }
+            mat.resolved_bindings[i].texture.id = tex->texture;
+        }
+    }
+
+    // Read the epoch after waiting, because finishing a texture load increments it.
+    mat.resolved_texture_epoch = state->texture_epoch;
+    mat.bindings_dirty = false;
+    return mat.resolved_bindings;
+}
+
+static bool is_shader_ready(ung_shader_id shader)
+{
+    const auto sh = get(state->shaders, shader.id);
+    return !sh->resource.id || ung_resource_is_ready(sh->resource);
+}
+
+static bool res_material_can_upload(ung_resource_id self, void* instance)
+{
+    // Upload would wait for the shaders to load and compile, so we start loading them and defer
+    // the upload until they are done (they are uploaded in ung_begin_frame as well).
+    auto res = (MaterialResource*)instance;
+    auto vert = res->params.vert;
+    auto frag = res->params.frag;
+    if (res->vert_path && !vert.id) {
+        if (!res->prefetch_vert.id) {
+            res->prefetch_vert = ung_shader_load(MUGFX_SHADER_STAGE_VERTEX, res->vert_path);
+        }
+        vert = res->prefetch_vert;
+    }
+    if (res->frag_path && !frag.id) {
+        if (!res->prefetch_frag.id) {
+            res->prefetch_frag = ung_shader_load(MUGFX_SHADER_STAGE_FRAGMENT, res->frag_path);
+        }
+        frag = res->prefetch_frag;
+    }
+    return is_shader_ready(vert) && is_shader_ready(frag);
+}
+
 static bool res_material_upload(ung_resource_id res_id, void* instance)
 {
     auto res = (MaterialResource*)instance;
@@ -73,7 +170,7 @@ static bool res_material_upload(ung_resource_id res_id, void* instance)
 
     const auto mugfx_mat = mugfx_material_create(params.mugfx);
     if (!mugfx_mat.id) {
-        res->pending = allocate<MaterialPending>();
+        res->pending = pending_pool.create();
         res->pending->error = "Could not create material";
         return false;
     }
@@ -82,6 +179,7 @@ static bool res_material_upload(ung_resource_id res_id, void* instance)
         mugfx_material_destroy(mat->material);
     }
     mat->material = mugfx_mat;
+    mat->instanced = vert->instanced;
 
     return true;
 }
@@ -96,9 +194,16 @@ static void res_material_cleanup_load(ung_resource_id self, void* instance)
 {
     auto res = (MaterialResource*)instance;
     if (res->pending) {
-        deallocate(res->pending);
+        pending_pool.destroy(res->pending);
         res->pending = nullptr;
     }
+    // upload has added its own references
+    for (auto prefetch : { &res->prefetch_vert, &res->prefetch_frag }) {
+        if (prefetch->id) {
+            ung_resource_decref(get(state->shaders, prefetch->id)->resource);
+            *prefetch = {};
+        }
+    }
 }
 
 static void res_material_destroy(ung_resource_id self, void* instance)
@@ -131,6 +236,7 @@ static ung_resource_type_id material_resource()
         res_type = ung_resource_type_register({
             .type_name = "material",
             .upload = res_material_upload,
+            .can_upload = res_material_can_upload,
             .get_error = res_material_get_error,
             .cleanup_load = res_material_cleanup_load,
             .destroy = res_material_destroy,
@@ -156,11 +262,11 @@ static ung_material_id load_material(MaterialResource* mat_res)
     // Prepare bindings so they can be set already (with ung_material_set_*)
     // The actual buffers will be set in ung_draw.
     // UngFrame
-    mat->bindings.append() = { .type = MUGFX_BINDING_TYPE_BUFFER, .buffer = { .binding = 0 } };
+    get_binding(*mat, { .type = MUGFX_BINDING_TYPE_BUFFER, .buffer = { .binding = 0 } });
     // UngPass
-    mat->bindings.append() = { .type = MUGFX_BINDING_TYPE_BUFFER, .buffer = { .binding = 1 } };
+    get_binding(*mat, { .type = MUGFX_BINDING_TYPE_BUFFER, .buffer = { .binding = 1 } });
     // UngTransform
-    mat->bindings.append() = { .type = MUGFX_BINDING_TYPE_BUFFER, .buffer = { .binding = 2 } };
+    get_binding(*mat, { .type = MUGFX_BINDING_TYPE_BUFFER, .buffer = { .binding = 2 } });
 
     // We create the buffers here, because we only want it to happen once and we don't want to copy
     // constant data (to pending).
@@ -171,10 +277,11 @@ static ung_material_id load_material(MaterialResource* mat_res)
             .data = { mat_res->params.constant_data, mat_res->params.constant_data_size },
             .debug_label = "mat.constant",
         });
-        mat->bindings.append() = {
-            .type = MUGFX_BINDING_TYPE_BUFFER,
-            .buffer = { .binding = 8, .id = mat->constant_buf },
-        };
+        set_binding(*mat,
+            {
+                .type = MUGFX_BINDING_TYPE_BUFFER,
+                .buffer = { .binding = 8, .id = mat->constant_buf },
+            });
     }
 
     if (mat_res->params.dynamic_data_size) {
@@ -188,10 +295,11 @@ static ung_material_id load_material(MaterialResource* mat_res)
             .debug_label = "mat.dynamic",
         });
 
-        mat->bindings.append() = {
-            .type = MUGFX_BINDING_TYPE_BUFFER,
-            .buffer = { .binding = 9, .id = mat->dynamic_buf },
-        };
+        set_binding(*mat,
+            {
+                .type = MUGFX_BINDING_TYPE_BUFFER,
+                .buffer = { .binding = 9, .id = mat->dynamic_buf },
+            });
     }
 
     mat->resource = res;
@@ -225,6 +333,19 @@ EXPORT void ung_material_destroy(ung_material_id material)
     ung_resource_destroy(mat->resource);
 }
 
+EXPORT bool ung_material_is_ready(ung_material_id material)
+{
+    return ung_resource_is_ready(get_material(material.id)->resource);
+}
+
+EXPORT void ung_material_set_loading_fallback(ung_material_id material)
+{
+    if (material.id) {
+        ung_resource_wait_ready(get_material(material.id)->resource);
+    }
+    state->loading_fallback_material = material;
+}
+
 EXPORT void ung_material_set_binding(ung_material_id material, mugfx_draw_binding binding)
 {
     set_binding(*get_material(material.id), binding);
@@ -0,0 +1,717 @@
+#include "state.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// Welding uses a hash table of the complete vertex (all attributes bitwise).
+// Triangle order is optimized with Tipsify ("Fast Triangle Reordering for Vertex Locality and
+// Reduced Overdraw", Sander et al. 2007) and the overdraw optimization is the fast variant from
+// the same paper: The Tipsify output is split into clusters at dead-ends and clusters facing away
+// from the mesh center are drawn first, because they are more likely to occlude others.
+// Simplification collapses edges onto one of their vertices (no new vertices), cheapest first by
+// quadric error. Because every collapse touches the neighborhood of its vertices, each pass only
+// does collapses with disjoint neighborhoods and the triangles are rebuilt between passes.
+
+namespace ung {
+
+static constexpr u32 VertexCacheSize = 16;
+
+static usize get_num_floats(const ung_geometry_data& gdata, u32 num_vertices)
+{
+    const bool normals = gdata.normals;
+    const bool texcoords = gdata.texcoords;
+    const bool colors = gdata.colors;
+    return num_vertices * (3 + normals * 3 + texcoords * 2 + colors * 4);
+}
+
+// Also see ung_geometry_data_destroy. All float attributes live in a single allocation.
+// joints and weights are moved in-place, because the geometry data does not own them.
+static void permute_vertices(ung_geometry_data& gdata, const u32* remap, u32 new_num_vertices)
+{
+    ung_geometry_data out = gdata;
+    out.num_vertices = new_num_vertices;
+    out.positions = allocate<float>(get_num_floats(gdata, new_num_vertices));
+    auto ptr = out.positions + new_num_vertices * 3;
+    if (gdata.normals) {
+        out.normals = ptr;
+        ptr += new_num_vertices * 3;
+    }
+    if (gdata.texcoords) {
+        out.texcoords = ptr;
+        ptr += new_num_vertices * 2;
+    }
+    if (gdata.colors) {
+        out.colors = ptr;
+    }
+
+    const auto copy = [&](const float* src, float* dst, u32 n, u32 old_idx) {
+        std::memcpy(dst + remap[old_idx] * n, src + old_idx * n, n * sizeof(float));
+    };
+    for (u32 i = 0; i < gdata.num_vertices; ++i) {
+        if (remap[i] == UINT32_MAX) {
+            continue;
+        }
+        copy(gdata.positions, out.positions, 3, i);
+        if (gdata.normals) {
+            copy(gdata.normals, out.normals, 3, i);
+        }
+        if (gdata.texcoords) {
+            copy(gdata.texcoords, out.texcoords, 2, i);
+        }
+        if (gdata.colors) {
+            copy(gdata.colors, out.colors, 4, i);
+        }
+    }
+
+    if (gdata.joints || gdata.weights) {
+        // remap[i] is not necessarily <= i (e.g. vertex fetch order), so go through a temp copy
+        auto joints = allocate<u16>(gdata.joints ? new_num_vertices * 4 : 0);
+        auto weights = allocate<float>(gdata.weights ? new_num_vertices * 4 : 0);
+        for (u32 i = 0; i < gdata.num_vertices; ++i) {
+            if (remap[i] == UINT32_MAX) {
+                continue;
+            }
+            if (gdata.joints) {
+                std::memcpy(joints + remap[i] * 4, gdata.joints + i * 4, 4 * sizeof(u16));
+            }
+            if (gdata.weights) {
+                std::memcpy(weights + remap[i] * 4, gdata.weights + i * 4, 4 * sizeof(float));
+            }
+        }
+        if (gdata.joints) {
+            std::memcpy(gdata.joints, joints, new_num_vertices * 4 * sizeof(u16));
+        }
+        if (gdata.weights) {
+            std::memcpy(gdata.weights, weights, new_num_vertices * 4 * sizeof(float));
+        }
+        deallocate(joints, gdata.joints ? new_num_vertices * 4 : 0);
+        deallocate(weights, gdata.weights ? new_num_vertices * 4 : 0);
+    }
+
+    for (u32 i = 0; i < gdata.num_indices; ++i) {
+        out.indices[i] = remap[gdata.indices[i]];
+    }
+
+    deallocate(gdata.positions, get_num_floats(gdata, gdata.num_vertices));
+    gdata = out;
+}
+
+static bool vertex_equal(const ung_geometry_data& gdata, u32 a, u32 b)
+{
+    const auto eq = [](const auto* data, u32 n, u32 a, u32 b) {
+        return !data || std::memcmp(data + a * n, data + b * n, n * sizeof(data[0])) == 0;
+    };
+    return eq(gdata.positions, 3, a, b) && eq(gdata.normals, 3, a, b)
+        && eq(gdata.texcoords, 2, a, b) && eq(gdata.colors, 4, a, b) && eq(gdata.joints, 4, a, b)
+        && eq(gdata.weights, 4, a, b);
+}
+
+static u64 hash_vertex(const ung_geometry_data& gdata, u32 v)
+{
+    auto hash = ung_fnv1a(gdata.positions + v * 3, 3 * sizeof(float));
+    const auto combine = [&](const auto* data, u32 n) {
+        if (data) {
+            hash ^= ung_fnv1a(data + v * n, n * sizeof(data[0])) + 0x9e3779b97f4a7c15 + (hash << 6)
+                + (hash >> 2);
+        }
+    };
+    combine(gdata.normals, 3);
+    combine(gdata.texcoords, 2);
+    combine(gdata.colors, 4);
+    combine(gdata.joints, 4);
+    combine(gdata.weights, 4);
+    return hash;
+}
+
+static void weld(ung_geometry_data& gdata)
+{
+    u32 table_size = 1;
+    while (table_size < gdata.num_vertices * 2) {
+        table_size *= 2;
+    }
+    Array<u32> table = {};
+    table.init(table_size);
+    std::fill(table.data, table.data + table.size, UINT32_MAX);
+
+    // First occurence keeps its (relative) position
+    Array<u32> remap = {};
+    remap.init(gdata.num_vertices);
+    u32 num_unique = 0;
+    for (u32 v = 0; v < gdata.num_vertices; ++v) {
+        auto slot = (u32)hash_vertex(gdata, v) & (table_size - 1);
+        while (table[slot] != UINT32_MAX && !vertex_equal(gdata, table[slot], v)) {
+            slot = (slot + 1) & (table_size - 1);
+        }
+        if (table[slot] == UINT32_MAX) {
+            table[slot] = v;
+            remap[v] = num_unique++;
+        } else {
+            remap[v] = remap[table[slot]];
+        }
+    }
+
+    if (num_unique < gdata.num_vertices) {
+        permute_vertices(gdata, remap.data, num_unique);
+    }
+
+    remap.free();
+    table.free();
+}
+
+struct Adjacency {
+    Array<u32> offsets; // num_vertices + 1
+    Array<u32> triangles;
+};
+
+static Adjacency build_adjacency(const ung_geometry_data& gdata)
+{
+    Adjacency adj = {};
+    adj.offsets.init(gdata.num_vertices + 1);
+    for (u32 i = 0; i < gdata.num_indices; ++i) {
+        adj.offsets[gdata.indices[i] + 1]++;
+    }
+    for (u32 v = 0; v < gdata.num_vertices; ++v) {
+        adj.offsets[v + 1] += adj.offsets[v];
+    }
+    adj.triangles.init(gdata.num_indices);
+    Array<u32> fill = {};
+    fill.init(gdata.num_vertices);
+    for (u32 i = 0; i < gdata.num_indices; ++i) {
+        const auto v = gdata.indices[i];
+        adj.triangles[adj.offsets[v] + fill[v]++] = i / 3;
+    }
+    fill.free();
+    return adj;
+}
+
+// Returns the triangle order and (if clusters is non-null) the index of the first triangle of
+// every cluster.
+static void tipsify(const ung_geometry_data& gdata, u32* triangle_order, Vector<u32>* clusters)
+{
+    const auto num_triangles = gdata.num_indices / 3;
+    auto adj = build_adjacency(gdata);
+
+    Array<u32> live = {}; // number of not yet emitted triangles using a vertex
+    live.init(gdata.num_vertices);
+    for (u32 v = 0; v < gdata.num_vertices; ++v) {
+        live[v] = adj.offsets[v + 1] - adj.offsets[v];
+    }
+    Array<u32> cache_time = {};
+    cache_time.init(gdata.num_vertices);
+    Array<bool> emitted = {};
+    emitted.init(num_triangles);
+    Vector<u32> dead_end = {};
+    dead_end.init(64);
+    Vector<u32> candidates = {};
+    candidates.init(16);
+
+    u32 time = VertexCacheSize + 1;
+    u32 cursor = 0; // for the dead-end fallback
+    u32 num_emitted = 0;
+    i64 fanning = gdata.num_vertices > 0 ? 0 : -1;
+    bool new_cluster = true;
+    while (fanning >= 0) {
+        const auto f = (u32)fanning;
+        candidates.clear();
+        for (u32 a = adj.offsets[f]; a < adj.offsets[f + 1]; ++a) {
+            const auto tri = adj.triangles[a];
+            if (emitted[tri]) {
+                continue;
+            }
+            if (new_cluster && clusters) {
+                clusters->push(num_emitted);
+            }
+            new_cluster = false;
+            for (u32 c = 0; c < 3; ++c) {
+                const auto v = gdata.indices[tri * 3 + c];
+                dead_end.push(v);
+                candidates.push(v);
+                live[v]--;
+                if (time - cache_time[v] > VertexCacheSize) {
+                    cache_time[v] = time++;
+                }
+            }
+            emitted[tri] = true;
+            triangle_order[num_emitted++] = tri;
+        }
+
+        // Pick the candidate that is in the cache and will still be in the cache after fanning it
+        fanning = -1;
+        i64 best = -1;
+        for (const auto v : candidates) {
+            if (live[v] == 0) {
+                continue;
+            }
+            i64 priority = 0;
+            if (time - cache_time[v] + 2 * live[v] <= VertexCacheSize) {
+                priority = time - cache_time[v];
+            }
+            if (priority > best) {
+                best = priority;
+                fanning = v;
+            }
+        }
+
+        if (fanning < 0) {
+            new_cluster = true;
+            while (dead_end.size && fanning < 0) {
+                const auto v = dead_end.last();
+                dead_end.size--;
+                if (live[v] > 0) {
+                    fanning = v;
+                }
+            }
+            for (; cursor < gdata.num_vertices && fanning < 0; ++cursor) {
+                if (live[cursor] > 0) {
+                    fanning = cursor;
+                }
+            }
+        }
+    }
+    assert(num_emitted == num_triangles);
+
+    candidates.free();
+    dead_end.free();
+    emitted.free();
+    cache_time.free();
+    live.free();
+    adj.triangles.free();
+    adj.offsets.free();
+}
+
+static um_vec3 get_position(const ung_geometry_data& gdata, u32 v)
+{
+    return { gdata.positions[v * 3 + 0], gdata.positions[v * 3 + 1], gdata.positions[v * 3 + 2] };
+}
+
+struct Cluster {
+    u32 start;
+    u32 end;
+    float sort_key;
+};
+
+static void sort_clusters(const ung_geometry_data& gdata, u32* triangle_order, Vector<u32>& starts)
+{
+    const auto num_triangles = gdata.num_indices / 3;
+
+    um_vec3 mesh_center = { 0.0f, 0.0f, 0.0f };
+    for (u32 v = 0; v < gdata.num_vertices; ++v) {
+        mesh_center = um_vec3_add(mesh_center, get_position(gdata, v));
+    }
+    mesh_center = um_vec3_mul(mesh_center, 1.0f / (float)std::max(gdata.num_vertices, 1u));
+
+    Array<Cluster> clusters = {};
+    clusters.init(starts.size);
+    for (u32 c = 0; c < starts.size; ++c) {
+        auto& cluster = clusters[c];
+        cluster.start = starts[c];
+        cluster.end = c + 1 < starts.size ? starts[c + 1] : num_triangles;
+
+        // The length of the sum of the cross products is the (twice) area, so it's area-weighted
+        um_vec3 center = { 0.0f, 0.0f, 0.0f };
+        um_vec3 normal = { 0.0f, 0.0f, 0.0f };
+        float area = 0.0f;
+        for (u32 t = cluster.start; t < cluster.end; ++t) {
+            const auto tri = triangle_order[t];
+            const auto p0 = get_position(gdata, gdata.indices[tri * 3 + 0]);
+            const auto p1 = get_position(gdata, gdata.indices[tri * 3 + 1]);
+            const auto p2 = get_position(gdata, gdata.indices[tri * 3 + 2]);
+            const auto n = um_vec3_cross(um_vec3_sub(p1, p0), um_vec3_sub(p2, p0));
+            const auto a = um_vec3_len(n);
+            const auto c = um_vec3_mul(um_vec3_add(um_vec3_add(p0, p1), p2), 1.0f / 3.0f);
+            center = um_vec3_add(center, um_vec3_mul(c, a));
+            normal = um_vec3_add(normal, n);
+            area += a;
+        }
+        if (area > 0.0f && um_vec3_len_sq(normal) > 0.0f) {
+            center = um_vec3_mul(center, 1.0f / area);
+            const auto dir = um_vec3_sub(center, mesh_center);
+            cluster.sort_key = um_vec3_dot(dir, um_vec3_normalized(normal));
+        }
+    }
+
+    // Outward facing clusters first
+    std::stable_sort(clusters.data, clusters.data + clusters.size,
+        [](const Cluster& a, const Cluster& b) { return a.sort_key > b.sort_key; });
+
+    Array<u32> order = {};
+    order.init(num_triangles);
+    u32 n = 0;
+    for (u32 c = 0; c < clusters.size; ++c) {
+        for (u32 t = clusters[c].start; t < clusters[c].end; ++t) {
+            order[n++] = triangle_order[t];
+        }
+    }
+    std::memcpy(triangle_order, order.data, num_triangles * sizeof(u32));
+
+    order.free();
+    clusters.free();
+}
+
+static void optimize_triangle_order(ung_geometry_data& gdata, bool overdraw)
+{
+    const auto num_triangles = gdata.num_indices / 3;
+    Array<u32> triangle_order = {};
+    triangle_order.init(num_triangles);
+    Vector<u32> clusters = {};
+    if (overdraw) {
+        clusters.init(64);
+    }
+
+    tipsify(gdata, triangle_order.data, overdraw ? &clusters : nullptr);
+    if (overdraw) {
+        sort_clusters(gdata, triangle_order.data, clusters);
+        clusters.free();
+    }
+
+    auto indices = allocate<u32>(gdata.num_indices);
+    for (u32 t = 0; t < num_triangles; ++t) {
+        std::memcpy(indices + t * 3, gdata.indices + triangle_order[t] * 3, 3 * sizeof(u32));
+    }
+    deallocate(gdata.indices, gdata.num_indices);
+    gdata.indices = indices;
+
+    triangle_order.free();
+}
+
+// Number vertices in the order they are first referenced, so vertex fetch is mostly linear.
+// This also removes unreferenced vertices.
+static void optimize_vertex_fetch(ung_geometry_data& gdata)
+{
+    Array<u32> remap = {};
+    remap.init(gdata.num_vertices);
+    std::fill(remap.data, remap.data + remap.size, UINT32_MAX);
+    u32 next = 0;
+    for (u32 i = 0; i < gdata.num_indices; ++i) {
+        auto& r = remap[gdata.indices[i]];
+        if (r == UINT32_MAX) {
+            r = next++;
+        }
+    }
+    permute_vertices(gdata, remap.data, next);
+    remap.free();
+}
+
+EXPORT void ung_geometry_data_optimize(ung_geometry_data* gdata, uint32_t flags)
+{
+    assert(gdata && gdata->positions && gdata->indices);
+    assert(gdata->num_indices % 3 == 0);
+
+    if (flags & UNG_GEOMETRY_OPTIMIZE_WELD) {
+        weld(*gdata);
+    }
+    if (flags & (UNG_GEOMETRY_OPTIMIZE_VERTEX_CACHE | UNG_GEOMETRY_OPTIMIZE_OVERDRAW)) {
+        optimize_triangle_order(*gdata, flags & UNG_GEOMETRY_OPTIMIZE_OVERDRAW);
+    }
+    if (flags & UNG_GEOMETRY_OPTIMIZE_VERTEX_FETCH) {
+        optimize_vertex_fetch(*gdata);
+    }
+}
+
+// Area-weighted sum of the squared distances to the planes of the triangles around a vertex
+struct Quadric {
+    float a00, a01, a02, a11, a12, a22; // n * n^T
+    float b0, b1, b2; // d * n
+    float c; // d * d
+    float weight;
+};
+
+static void add_plane(Quadric& q, um_vec3 n, float d, float weight)
+{
+    q.a00 += weight * n.x * n.x;
+    q.a01 += weight * n.x * n.y;
+    q.a02 += weight * n.x * n.z;
+    q.a11 += weight * n.y * n.y;
+    q.a12 += weight * n.y * n.z;
+    q.a22 += weight * n.z * n.z;
+    q.b0 += weight * d * n.x;
+    q.b1 += weight * d * n.y;
+    q.b2 += weight * d * n.z;
+    q.c += weight * d * d;
+    q.weight += weight;
+}
+
+static void add_quadric(Quadric& q, const Quadric& o)
+{
+    q.a00 += o.a00;
+    q.a01 += o.a01;
+    q.a02 += o.a02;
+    q.a11 += o.a11;
+    q.a12 += o.a12;
+    q.a22 += o.a22;
+    q.b0 += o.b0;
+    q.b1 += o.b1;
+    q.b2 += o.b2;
+    q.c += o.c;
+    q.weight += o.weight;
+}
+
+// Mean squared distance of p to the planes of a and b
+static float quadric_error(const Quadric& a, const Quadric& b, um_vec3 p)
+{
+    Quadric q = a;
+    add_quadric(q, b);
+    if (q.weight <= 0.0f) {
+        return 0.0f;
+    }
+    const auto rx = q.a00 * p.x + q.a01 * p.y + q.a02 * p.z;
+    const auto ry = q.a01 * p.x + q.a11 * p.y + q.a12 * p.z;
+    const auto rz = q.a02 * p.x + q.a12 * p.y + q.a22 * p.z;
+    const auto e = p.x * rx + p.y * ry + p.z * rz + 2.0f * (q.b0 * p.x + q.b1 * p.y + q.b2 * p.z)
+        + q.c;
+    return std::fmax(e / q.weight, 0.0f);
+}
+
+static um_vec3 triangle_normal(um_vec3 a, um_vec3 b, um_vec3 c)
+{
+    return um_vec3_cross(um_vec3_sub(b, a), um_vec3_sub(c, a));
+}
+
+// Vertices on borders (edges with only one triangle) and on seams (a position shared by multiple
+// vertices) can't be moved without opening holes.
+static void find_locked_vertices(const ung_geometry_data& gdata, Array<bool>& locked)
+{
+    u32 table_size = 1;
+    while (table_size < gdata.num_vertices * 2) {
+        table_size *= 2;
+    }
+    Array<u32> table = {};
+    table.init(table_size);
+    std::fill(table.data, table.data + table.size, UINT32_MAX);
+    for (u32 v = 0; v < gdata.num_vertices; ++v) {
+        auto slot = (u32)ung_fnv1a(gdata.positions + v * 3, 3 * sizeof(float)) & (table_size - 1);
+        while (table[slot] != UINT32_MAX
+            && std::memcmp(gdata.positions + table[slot] * 3, gdata.positions + v * 3,
+                   3 * sizeof(float))
+                != 0) {
+            slot = (slot + 1) & (table_size - 1);
+        }
+        if (table[slot] == UINT32_MAX) {
+            table[slot] = v;
+        } else {
+            locked[table[slot]] = true;
+            locked[v] = true;
+        }
+    }
+    table.free();
+
+    // An edge a -> b is a border if no triangle has b -> a
+    auto adj = build_adjacency(gdata);
+    const auto has_edge = [&](u32 a, u32 b) {
+        for (u32 i = adj.offsets[a]; i < adj.offsets[a + 1]; ++i) {
+            const auto tri = gdata.indices + adj.triangles[i] * 3;
+            for (u32 e = 0; e < 3; ++e) {
+                if (tri[e] == a && tri[(e + 1) % 3] == b) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    };
+    for (u32 i = 0; i < gdata.num_indices; ++i) {
+        const auto a = gdata.indices[i];
+        const auto b = gdata.indices[i / 3 * 3 + (i + 1) % 3];
+        if (!has_edge(b, a)) {
+            locked[a] = true;
+            locked[b] = true;
+        }
+    }
+    adj.triangles.free();
+    adj.offsets.free();
+}
+
+struct Collapse {
+    u32 from;
+    u32 to;
+    float error;
+};
+
+// Moving from onto to must not flip any of the remaining triangles around from
+static bool collapse_flips(const ung_geometry_data& gdata, const Adjacency& adj, u32 from, u32 to)
+{
+    const auto target = get_position(gdata, to);
+    for (u32 i = adj.offsets[from]; i < adj.offsets[from + 1]; ++i) {
+        const auto tri = gdata.indices + adj.triangles[i] * 3;
+        if (tri[0] == to || tri[1] == to || tri[2] == to) {
+            continue; // becomes degenerate
+        }
+        um_vec3 p[3];
+        um_vec3 q[3];
+        for (u32 c = 0; c < 3; ++c) {
+            p[c] = get_position(gdata, tri[c]);
+            q[c] = tri[c] == from ? target : p[c];
+        }
+        if (um_vec3_dot(triangle_normal(p[0], p[1], p[2]), triangle_normal(q[0], q[1], q[2]))
+            <= 0.0f) {
+            return true;
+        }
+    }
+    return false;
+}
+
+EXPORT uint32_t ung_geometry_data_simplify(const ung_geometry_data* gdata,
+    uint32_t target_num_indices, float max_error, uint32_t* indices, float* error)
+{
+    assert(gdata && gdata->positions && gdata->indices && indices);
+    assert(gdata->num_indices % 3 == 0);
+
+    // Normalize the positions, so errors are relative to the bounds radius
+    const auto bounds = ung_geometry_data_get_bounds(*gdata);
+    const auto scale = bounds.radius > 0.0f ? 1.0f / bounds.radius : 1.0f;
+    Array<float> positions = {};
+    positions.init(gdata->num_vertices * 3);
+    for (u32 i = 0; i < gdata->num_vertices * 3; ++i) {
+        positions[i] = (gdata->positions[i] - bounds.center[i % 3]) * scale;
+    }
+
+    // This works on a copy with only the positions and the indices we are rewriting
+    ung_geometry_data mesh = {
+        .num_vertices = gdata->num_vertices,
+        .positions = positions.data,
+        .num_indices = gdata->num_indices,
+        .indices = indices,
+    };
+    std::memcpy(indices, gdata->indices, gdata->num_indices * sizeof(u32));
+
+    Array<bool> locked = {};
+    locked.init(mesh.num_vertices);
+    find_locked_vertices(mesh, locked);
+
+    Array<Quadric> quadrics = {};
+    quadrics.init(mesh.num_vertices);
+    for (u32 t = 0; t < mesh.num_indices / 3; ++t) {
+        const auto tri = mesh.indices + t * 3;
+        const auto p0 = get_position(mesh, tri[0]);
+        const auto n = triangle_normal(p0, get_position(mesh, tri[1]), get_position(mesh, tri[2]));
+        const auto len = um_vec3_len(n);
+        if (len <= 0.0f) {
+            continue;
+        }
+        const auto normal = um_vec3_mul(n, 1.0f / len);
+        const auto d = -um_vec3_dot(normal, p0);
+        for (u32 c = 0; c < 3; ++c) {
+            add_plane(quadrics[tri[c]], normal, d, len * 0.5f);
+        }
+    }
+
+    Array<u32> collapse_to = {};
+    collapse_to.init(mesh.num_vertices);
+    Array<bool> touched = {};
+    touched.init(mesh.num_vertices);
+    Vector<Collapse> candidates = {};
+    candidates.init(mesh.num_indices * 2);
+
+    const auto max_error_sq = max_error * max_error;
+    float result_error_sq = 0.0f;
+    while (mesh.num_indices > target_num_indices) {
+        auto adj = build_adjacency(mesh);
+
+        // Every directed edge whose start may move
+        candidates.clear();
+        for (u32 i = 0; i < mesh.num_indices; ++i) {
+            const auto from = mesh.indices[i];
+            const auto to = mesh.indices[i / 3 * 3 + (i + 1) % 3];
+            if (!locked[from]) {
+                const auto e = quadric_error(quadrics[from], quadrics[to], get_position(mesh, to));
+                candidates.push({ from, to, e });
+            }
+            if (!locked[to]) {
+                const auto e
+                    = quadric_error(quadrics[to], quadrics[from], get_position(mesh, from));
+                candidates.push({ to, from, e });
+            }
+        }
+        std::sort(candidates.data, candidates.data + candidates.size,
+            [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+        for (u32 v = 0; v < mesh.num_vertices; ++v) {
+            collapse_to[v] = v;
+            touched[v] = false;
+        }
+        const auto tris_to_remove = (mesh.num_indices - target_num_indices + 2) / 3;
+        u32 tris_removed = 0;
+        u32 num_collapses = 0;
+        for (const auto& c : candidates) {
+            if (c.error > max_error_sq || tris_removed >= tris_to_remove) {
+                break;
+            }
+            if (touched[c.from] || touched[c.to] || collapse_flips(mesh, adj, c.from, c.to)) {
+                continue;
+            }
+            // The neighborhood of from changes, so later collapses must not rely on it
+            for (u32 i = adj.offsets[c.from]; i < adj.offsets[c.from + 1]; ++i) {
+                const auto tri = mesh.indices + adj.triangles[i] * 3;
+                touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = true;
+                tris_removed += tri[0] == c.to || tri[1] == c.to || tri[2] == c.to;
+            }
+            collapse_to[c.from] = c.to;
+            add_quadric(quadrics[c.to], quadrics[c.from]);
+            result_error_sq = std::fmax(result_error_sq, c.error);
+            num_collapses++;
+        }
+        adj.offsets.free();
+        adj.triangles.free();
+        if (num_collapses == 0) {
+            break;
+        }
+
+        u32 num_indices = 0;
+        for (u32 t = 0; t < mesh.num_indices / 3; ++t) {
+            const auto a = collapse_to[mesh.indices[t * 3 + 0]];
+            const auto b = collapse_to[mesh.indices[t * 3 + 1]];
+            const auto c = collapse_to[mesh.indices[t * 3 + 2]];
+            if (a != b && b != c && c != a) {
+                mesh.indices[num_indices++] = a;
+                mesh.indices[num_indices++] = b;
+                mesh.indices[num_indices++] = c;
+            }
+        }
+        mesh.num_indices = num_indices;
+    }
+
+    candidates.free();
+    touched.free();
+    collapse_to.free();
+    quadrics.free();
+    locked.free();
+    positions.free();
+
+    if (error) {
+        *error = std::sqrt(result_error_sq);
+    }
+    return mesh.num_indices;
+}
+
+EXPORT uint32_t ung_geometry_data_generate_lods(const ung_geometry_data* gdata, uint32_t num_lods,
+    float ratio, uint32_t* indices, ung_geometry_lod* lods)
+{
+    assert(num_lods <= UNG_MAX_GEOMETRY_LODS);
+    assert(ratio > 0.0f && ratio < 1.0f);
+
+    // Every level is simplified from the full geometry, so errors don't accumulate
+    u32 offset = 0;
+    u32 prev_num_indices = gdata->num_indices;
+    float prev_error = 0.0f;
+    for (u32 l = 0; l < num_lods; ++l) {
+        const auto target = (u32)((float)prev_num_indices * ratio) / 3 * 3;
+        if (target == 0) {
+            return l;
+        }
+        float error = 0.0f;
+        const auto num_indices
+            = ung_geometry_data_simplify(gdata, target, FLT_MAX, indices + offset, &error);
+        // Not worth the extra index data and draw state
+        if (num_indices * 10 > prev_num_indices * 9) {
+            return l;
+        }
+        // Selection expects the error to increase with the level
+        prev_error = std::fmax(error, prev_error);
+        lods[l] = { gdata->num_indices + offset, num_indices, prev_error };
+        offset += num_indices;
+        prev_num_indices = num_indices;
+    }
+    return num_lods;
+}
+
+}
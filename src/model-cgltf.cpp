@@ -4,10 +4,11 @@
 #include <cstring>
 #include <span>
 #include <string_view>
+#include <utility>
 
 #include <cgltf.h>
 
-#include "types.hpp"
+#include "state.hpp"
 
 namespace ung::model {
 static u8 get_num_components(cgltf_type type)
@@ -116,6 +117,69 @@ static u32 get_location(const cgltf_attribute* attr)
     }
 }
 
+static const cgltf_accessor* find_attribute(
+    const cgltf_primitive* prim, cgltf_attribute_type type, int index = 0)
+{
+    for (cgltf_size i = 0; i < prim->attributes_count; ++i) {
+        const auto& a = prim->attributes[i];
+        if (a.type == type && a.index == index) {
+            return a.data;
+        }
+    }
+    return nullptr;
+}
+
+// The levels of detail are appended to the original indices, so unlike without them the index
+// buffer can't be uploaded straight from the buffer view.
+static mugfx_buffer_id create_lod_index_buffer(const cgltf_primitive* prim,
+    const cgltf_accessor* pos_acc, mugfx_geometry_create_params& params, ung_geometry_lod* lods,
+    u32& num_lods)
+{
+    ung_geometry_data gdata = {
+        .num_vertices = (u32)pos_acc->count,
+        .num_indices = (u32)prim->indices->count,
+    };
+    gdata.positions = allocate<float>(gdata.num_vertices * 3);
+    if (cgltf_accessor_unpack_floats(pos_acc, gdata.positions, gdata.num_vertices * 3)
+        != gdata.num_vertices * 3) {
+        ung_panicf("ung_geometry_from_cgltf: Error reading position data");
+    }
+    const auto capacity = gdata.num_indices * (1 + state->geometry_num_lods);
+    gdata.indices = allocate<u32>(capacity);
+    for (u32 i = 0; i < gdata.num_indices; ++i) {
+        gdata.indices[i] = (u32)cgltf_accessor_read_index(prim->indices, i);
+    }
+
+    num_lods = ung_geometry_data_generate_lods(&gdata, state->geometry_num_lods,
+        state->geometry_lod_ratio, gdata.indices + gdata.num_indices, lods);
+    const auto count = num_lods ? lods[num_lods - 1].index_offset + lods[num_lods - 1].index_count
+                                : gdata.num_indices;
+
+    // Like ung_geometry_create_from_data. Packing in place is fine, because it only moves indices
+    // to the front.
+    const auto u16_indices = gdata.num_vertices <= 0x10000;
+    if (u16_indices) {
+        auto packed = (u16*)gdata.indices;
+        for (u32 i = 0; i < count; ++i) {
+            packed[i] = (u16)gdata.indices[i];
+        }
+    }
+    const auto buffer = mugfx_buffer_create({
+        .target = MUGFX_BUFFER_TARGET_INDEX,
+        .usage = MUGFX_BUFFER_USAGE_HINT_STATIC,
+        .data = {
+            .data = (uint8_t*)gdata.indices,
+            .length = count * (u16_indices ? sizeof(u16) : sizeof(u32)),
+        },
+    });
+    params.index_type = u16_indices ? MUGFX_INDEX_TYPE_U16 : MUGFX_INDEX_TYPE_U32;
+    params.index_count = gdata.num_indices;
+
+    deallocate(gdata.indices, capacity);
+    deallocate(gdata.positions, gdata.num_vertices * 3);
+    return buffer;
+}
+
 EXPORT ung_geometry_id ung_geometry_from_cgltf(const cgltf_primitive* prim)
 {
     assert(prim);
@@ -196,7 +260,13 @@ EXPORT ung_geometry_id ung_geometry_from_cgltf(const cgltf_primitive* prim)
     }
 
     // Index Buffer (optional)
-    if (prim->indices) {
+    const auto pos_acc = find_attribute(prim, cgltf_attribute_type_position);
+    ung_geometry_lod lods[UNG_MAX_GEOMETRY_LODS];
+    u32 num_lods = 0;
+    if (prim->indices && state->geometry_num_lods && prim->type == cgltf_primitive_type_triangles
+        && pos_acc && pos_acc->type == cgltf_type_vec3) {
+        params.index_buffer = create_lod_index_buffer(prim, pos_acc, params, lods, num_lods);
+    } else if (prim->indices) {
         const auto acc = prim->indices;
         const auto view = acc->buffer_view;
         const auto buffer = acc->buffer_view->buffer;
@@ -216,19 +286,20 @@ EXPORT ung_geometry_id ung_geometry_from_cgltf(const cgltf_primitive* prim)
         params.index_count = (u32)acc->count;
     }
 
-    return ung_geometry_create(params);
-}
+    const auto geometry = ung_geometry_create(params);
+    get(state->geometries, geometry.id)->owns_buffers = true;
+    ung_geometry_set_lods(geometry, lods, num_lods);
 
-static const cgltf_accessor* find_attribute(
-    const cgltf_primitive* prim, cgltf_attribute_type type, int index = 0)
-{
-    for (cgltf_size i = 0; i < prim->attributes_count; ++i) {
-        const auto& a = prim->attributes[i];
-        if (a.type == type && a.index == index) {
-            return a.data;
-        }
+    // glTF requires min and max for positions
+    if (pos_acc && pos_acc->has_min && pos_acc->has_max) {
+        ung_geometry_set_bounds(geometry,
+            {
+                .min = { pos_acc->min[0], pos_acc->min[1], pos_acc->min[2] },
+                .max = { pos_acc->max[0], pos_acc->max[1], pos_acc->max[2] },
+            });
     }
-    return nullptr;
+
+    return geometry;
 }
 
 EXPORT ung_geometry_data ung_geometry_data_from_cgltf(const cgltf_primitive* prim)
@@ -430,6 +501,12 @@ static ung_animation_interp map_interp(cgltf_interpolation_type t)
 
 EXPORT ung_animation_id ung_animation_from_cgltf(
     const cgltf_animation* anim, const cgltf_skin* skin)
+{
+    return ung_animation_from_cgltf_ex(anim, skin, {});
+}
+
+EXPORT ung_animation_id ung_animation_from_cgltf_ex(
+    const cgltf_animation* anim, const cgltf_skin* skin, ung_animation_options options)
 {
     assert(anim && skin);
 
@@ -548,6 +625,7 @@ EXPORT ung_animation_id ung_animation_from_cgltf(
         .channels = channels,
         .num_channels = num_channels,
         .duration_s = duration,
+        .options = options,
     });
 
     deallocate(values, total_values_floats);
@@ -661,62 +739,123 @@ ung_texture_type get_texture_type(uint32_t flag)
     }
 }
 
-ung_model_load_result model_load_gltf(ung_model_load_params params)
+// Go through ung_read_whole_file, so files in packs are found
+static cgltf_result read_file(const cgltf_memory_options*, const cgltf_file_options*,
+    const char* path, cgltf_size* size, void** data)
 {
-    LoadProfScope lpscope(params.path);
+    usize file_size = 0;
+    const auto file_data = ung_read_whole_file(path, &file_size, false);
+    if (!file_data) {
+        return cgltf_result_file_not_found;
+    }
+    *size = file_size;
+    *data = file_data;
+    return cgltf_result_success;
+}
 
-    const cgltf_options options = {};
-    cgltf_data* data = nullptr;
-    // TODO: use ung_read_whole_file
-    ung_load_profiler_push("cgltf_parse_file");
-    const auto result = cgltf_parse_file(&options, params.path, &data);
-    ung_load_profiler_pop("cgltf_parse_file");
+static void release_file(const cgltf_memory_options*, const cgltf_file_options*, void* data)
+{
+    ung_free_file_data((char*)data, 0);
+}
+
+static cgltf_result parse_gltf(const char* path, cgltf_data** data)
+{
+    cgltf_options options = {};
+    options.file.read = read_file;
+    options.file.release = release_file;
+    const auto result = cgltf_parse_file(&options, path, data);
     if (result != cgltf_result_success) {
-        ung_panicf("Error loading glTF file '%s': %d\n", params.path, result);
+        return result;
     }
-
-    ung_load_profiler_push("cgltf_load_buffers");
-    const auto buf_result = cgltf_load_buffers(&options, data, params.path);
-    ung_load_profiler_pop("cgltf_load_buffers");
+    const auto buf_result = cgltf_load_buffers(&options, *data, path);
     if (buf_result != cgltf_result_success) {
-        ung_panicf("Error loading buffers for glTF file '%s': %d\n", params.path, buf_result);
+        cgltf_free(*data);
+        *data = nullptr;
     }
+    return buf_result;
+}
 
-    ung_model_load_result res = {};
+static u32 count_primitives(const cgltf_data* data)
+{
+    u32 num_primitives = 0;
+    for (const auto& g_node : std::span<cgltf_node>(data->nodes, data->nodes_count)) {
+        if (g_node.mesh) {
+            num_primitives += (u32)g_node.mesh->primitives_count;
+        }
+    }
+    return num_primitives;
+}
 
-    if (params.flags & (UNG_MODEL_LOAD_GEOMETRIES | UNG_MODEL_LOAD_GEOMETRY_DATA)) {
-        for (const auto& g_node : std::span<cgltf_node>(data->nodes, data->nodes_count)) {
-            if (g_node.mesh) {
-                res.num_primitives += (u32)g_node.mesh->primitives_count;
+// In the same order as the result arrays
+template <typename Func>
+static void for_each_primitive(const cgltf_data* data, Func&& func)
+{
+    u32 idx = 0;
+    for (const auto& node : std::span<cgltf_node>(data->nodes, data->nodes_count)) {
+        if (node.mesh) {
+            for (const auto& prim :
+                std::span<cgltf_primitive>(node.mesh->primitives, node.mesh->primitives_count)) {
+                func(idx++, prim);
             }
         }
+    }
+}
+
+struct GeometryDataJob {
+    const cgltf_primitive** primitives;
+    ung_geometry_data* geometry_data;
+};
+
+static void geometry_data_job(void* ctx, uint32_t index)
+{
+    auto job = (GeometryDataJob*)ctx;
+    job->geometry_data[index] = ung_geometry_data_from_cgltf(job->primitives[index]);
+}
+
+// Converting primitives is independent and pure CPU work, so it's spread across the job system.
+// This may be called from decode threads.
+static ung_geometry_data* convert_geometry_data(const cgltf_data* data, u32 num_primitives)
+{
+    auto primitives = allocate<const cgltf_primitive*>(num_primitives);
+    for_each_primitive(
+        data, [&](u32 idx, const cgltf_primitive& prim) { primitives[idx] = &prim; });
+    auto geometry_data = allocate<ung_geometry_data>(num_primitives);
+
+    GeometryDataJob job = { primitives, geometry_data };
+    const auto counter = ung_job_counter_create();
+    ung_job_run_many(geometry_data_job, &job, num_primitives, counter);
+    ung_job_wait(counter);
+    ung_job_counter_destroy(counter);
+
+    deallocate(primitives, num_primitives);
+    return geometry_data;
+}
+
+// geometry_data is used for UNG_MODEL_LOAD_GEOMETRY_DATA if it was already converted
+static ung_model_load_result build_result(
+    const ung_model_load_params& params, const cgltf_data* data, ung_geometry_data* geometry_data)
+{
+    ung_model_load_result res = {};
+
+    if (params.flags & (UNG_MODEL_LOAD_GEOMETRIES | UNG_MODEL_LOAD_GEOMETRY_DATA)) {
+        res.num_primitives = count_primitives(data);
 
         if (params.flags & UNG_MODEL_LOAD_GEOMETRIES) {
             res.geometries = allocate<ung_geometry_id>(res.num_primitives);
             res.material_indices = allocate<uint32_t>(res.num_primitives);
+            for_each_primitive(data, [&](u32 idx, const cgltf_primitive& prim) {
+                LoadProfScope s("geometry");
+                res.geometries[idx] = ung_geometry_from_cgltf(&prim);
+                res.material_indices[idx]
+                    = prim.material ? (u32)(prim.material - data->materials) : (u32)UINT32_MAX;
+            });
         }
         if (params.flags & UNG_MODEL_LOAD_GEOMETRY_DATA) {
-            res.geometry_data = allocate<ung_geometry_data>(res.num_primitives);
-        }
-        size_t geom_idx = 0;
-
-        for (const auto& node : std::span<cgltf_node>(data->nodes, data->nodes_count)) {
-            if (node.mesh) {
-                for (const auto& prim : std::span<cgltf_primitive>(
-                         node.mesh->primitives, node.mesh->primitives_count)) {
-                    if (params.flags & UNG_MODEL_LOAD_GEOMETRIES) {
-                        LoadProfScope s("geometry");
-                        res.geometries[geom_idx] = ung_geometry_from_cgltf(&prim);
-                        res.material_indices[geom_idx] = prim.material
-                            ? (u32)(prim.material - data->materials)
-                            : (u32)UINT32_MAX;
-                    }
-                    if (params.flags & UNG_MODEL_LOAD_GEOMETRY_DATA) {
-                        LoadProfScope s("geometry data");
-                        res.geometry_data[geom_idx] = ung_geometry_data_from_cgltf(&prim);
-                    }
-                    geom_idx++;
-                }
+            if (geometry_data) {
+                res.geometry_data = geometry_data;
+            } else {
+                LoadProfScope s("geometry data");
+                res.geometry_data = convert_geometry_data(data, res.num_primitives);
             }
         }
     }
@@ -731,7 +870,6 @@ ung_model_load_result model_load_gltf(ung_model_load_params params)
             return { 0 };
         }
     };
-
     if (params.flags & UNG_MODEL_LOAD_MATERIALS) {
         LoadProfScope s("materials");
         res.num_materials = (u32)data->materials_count;
@@ -799,8 +937,8 @@ ung_model_load_result model_load_gltf(ung_model_load_params params)
                 res.animations[anim_idx] = {};
                 for (size_t i = 0; i < data->animations_count; ++i) {
                     if (data->animations[i].name && name_to_find == data->animations[i].name) {
-                        res.animations[anim_idx]
-                            = ung_animation_from_cgltf(&data->animations[i], skin);
+                        res.animations[anim_idx] = ung_animation_from_cgltf_ex(
+                            &data->animations[i], skin, params.animation_options);
                         break;
                     }
                 }
@@ -810,13 +948,275 @@ ung_model_load_result model_load_gltf(ung_model_load_params params)
             res.num_animations = (u32)data->animations_count;
             res.animations = allocate<ung_animation_id>(res.num_animations);
             for (size_t i = 0; i < data->animations_count; ++i) {
-                res.animations[i] = ung_animation_from_cgltf(&data->animations[i], skin);
+                res.animations[i] = ung_animation_from_cgltf_ex(
+                    &data->animations[i], skin, params.animation_options);
             }
         }
     }
 
+    return res;
+}
+
+ung_model_load_result model_load_gltf(ung_model_load_params params)
+{
+    LoadProfScope lpscope(params.path);
+
+    cgltf_data* data = nullptr;
+    ung_load_profiler_push("cgltf_parse_file");
+    const auto result = parse_gltf(params.path, &data);
+    ung_load_profiler_pop("cgltf_parse_file");
+    if (result != cgltf_result_success) {
+        ung_panicf("Error loading glTF file '%s': %d\n", params.path, result);
+    }
+
+    const auto res = build_result(params, data, nullptr);
+
     cgltf_free(data);
 
     return res;
 }
-}
\ No newline at end of file
+
+// Everything that is only needed while loading
+struct ModelPending {
+    cgltf_data* data;
+    ung_geometry_data* geometry_data;
+    u32 num_primitives;
+    const char* error;
+};
+
+struct ModelResource {
+    ung_model_id model;
+    // params.path and params.animation_names point into these
+    ung_model_load_params params;
+    Array<char> path;
+    Array<Array<char>> animation_names;
+    Array<const char*> animation_name_ptrs;
+    ModelPending pending;
+};
+
+static void depend_on_uris(const ModelResource* res, const cgltf_data* data)
+{
+    for (const auto& buffer : std::span<cgltf_buffer>(data->buffers, data->buffers_count)) {
+        if (buffer.uri && !std::string_view(buffer.uri).starts_with("data:")) {
+            ung_resource_depend_file(get_path(res->path.data, buffer.uri));
+        }
+    }
+}
+
+static bool res_model_decode(ung_resource_id, void* instance)
+{
+    auto res = (ModelResource*)instance;
+    auto& pending = res->pending;
+
+    ung_resource_depend_file(res->path.data);
+    const auto result = parse_gltf(res->path.data, &pending.data);
+    if (result != cgltf_result_success) {
+        fprintf(stderr, "Error loading glTF file '%s': %d\n", res->path.data, result);
+        pending.error = "Could not load glTF file";
+        return false;
+    }
+    depend_on_uris(res, pending.data);
+
+    if (res->params.flags & UNG_MODEL_LOAD_GEOMETRY_DATA) {
+        pending.num_primitives = count_primitives(pending.data);
+        pending.geometry_data = convert_geometry_data(pending.data, pending.num_primitives);
+    }
+    return true;
+}
+
+static void destroy_result(const ung_model_load_result& result)
+{
+    for (u32 i = 0; result.geometries && i < result.num_primitives; ++i) {
+        ung_geometry_destroy(result.geometries[i]);
+    }
+    for (u32 i = 0; result.geometry_data && i < result.num_primitives; ++i) {
+        ung_geometry_data_destroy(result.geometry_data[i]);
+    }
+    // Textures might be shared with other materials or models, so we only drop our reference
+    const auto release = [](ung_texture_id texture) {
+        if (texture.id) {
+            ung_resource_decref(ung_texture_resource(texture));
+        }
+    };
+    for (u32 i = 0; result.materials && i < result.num_materials; ++i) {
+        release(result.materials[i].base_color_texture);
+        release(result.materials[i].normal_texture);
+        release(result.materials[i].emissive_texture);
+    }
+    for (u32 i = 0; result.gltf_materials && i < result.num_materials; ++i) {
+        release(result.gltf_materials[i].metal_rough_texture);
+        release(result.gltf_materials[i].occlusion_texture);
+    }
+    for (u32 i = 0; result.animations && i < result.num_animations; ++i) {
+        if (result.animations[i].id) {
+            ung_animation_destroy(result.animations[i]);
+        }
+    }
+    if (result.skeleton.id) {
+        ung_skeleton_destroy(result.skeleton);
+    }
+    ung_model_load_result_free(&result);
+}
+
+// Keep the old texture id, so references to it stay valid
+// If the texture was loaded from a file, we get the same (shared) texture back and it reloads on
+// its own.
+static void reload_texture(ung_texture_id old_tex, ung_texture_id new_tex)
+{
+    if (old_tex.id && new_tex.id && old_tex.id != new_tex.id) {
+        ung_texture_swap(old_tex, new_tex);
+    }
+}
+
+// Swaps the new geometries and textures into the old handles and leaves the old ones in
+// new_result, so they can be destroyed.
+static void reload_result(ung_model_load_result& result, ung_model_load_result& new_result)
+{
+    for (u32 i = 0; result.geometries && i < result.num_primitives; ++i) {
+        std::swap(*get(state->geometries, result.geometries[i].id),
+            *get(state->geometries, new_result.geometries[i].id));
+    }
+    if (result.material_indices) {
+        std::swap(result.material_indices, new_result.material_indices);
+    }
+    std::swap(result.geometry_data, new_result.geometry_data);
+    for (u32 i = 0; result.materials && i < result.num_materials; ++i) {
+        auto& mat = result.materials[i];
+        auto& new_mat = new_result.materials[i];
+        reload_texture(mat.base_color_texture, new_mat.base_color_texture);
+        reload_texture(mat.normal_texture, new_mat.normal_texture);
+        reload_texture(mat.emissive_texture, new_mat.emissive_texture);
+        auto textures = std::array { mat.base_color_texture, mat.normal_texture,
+            mat.emissive_texture };
+        mat = new_mat;
+        mat.base_color_texture = textures[0];
+        mat.normal_texture = textures[1];
+        mat.emissive_texture = textures[2];
+    }
+    for (u32 i = 0; result.gltf_materials && i < result.num_materials; ++i) {
+        auto& mat = result.gltf_materials[i];
+        auto& new_mat = new_result.gltf_materials[i];
+        reload_texture(mat.metal_rough_texture, new_mat.metal_rough_texture);
+        reload_texture(mat.occlusion_texture, new_mat.occlusion_texture);
+        auto textures = std::array { mat.metal_rough_texture, mat.occlusion_texture };
+        mat = new_mat;
+        mat.metal_rough_texture = textures[0];
+        mat.occlusion_texture = textures[1];
+    }
+}
+
+static bool res_model_upload(ung_resource_id, void* instance)
+{
+    auto res = (ModelResource*)instance;
+    auto& pending = res->pending;
+    auto model = get(state->models, res->model.id);
+    LoadProfScope lpscope(res->path.data);
+
+    if (!model->loaded) {
+        model->result = build_result(res->params, pending.data, pending.geometry_data);
+        pending.geometry_data = nullptr; // owned by result now
+        model->loaded = true;
+        return true;
+    }
+
+    // Reload. The skeleton and animations are not reloaded, since skeleton instances and
+    // animation state refer to them.
+    auto params = res->params;
+    params.flags &= ~(u32)(UNG_MODEL_LOAD_SKELETON | UNG_MODEL_LOAD_ANIMATIONS);
+    if (count_primitives(pending.data) != model->result.num_primitives
+        || pending.data->materials_count != model->result.num_materials) {
+        pending.error = "Number of primitives or materials changed";
+        return false;
+    }
+    auto new_result = build_result(params, pending.data, pending.geometry_data);
+    pending.geometry_data = nullptr;
+    reload_result(model->result, new_result);
+    destroy_result(new_result);
+    return true;
+}
+
+static const char* res_model_get_error(void* instance)
+{
+    return ((ModelResource*)instance)->pending.error;
+}
+
+static void res_model_cleanup_load(ung_resource_id, void* instance)
+{
+    auto& pending = ((ModelResource*)instance)->pending;
+    if (pending.data) {
+        cgltf_free(pending.data);
+    }
+    for (u32 i = 0; pending.geometry_data && i < pending.num_primitives; ++i) {
+        ung_geometry_data_destroy(pending.geometry_data[i]);
+    }
+    if (pending.geometry_data) {
+        deallocate(pending.geometry_data, pending.num_primitives);
+    }
+    pending = {};
+}
+
+static void res_model_destroy(ung_resource_id, void* instance)
+{
+    auto res = (ModelResource*)instance;
+    auto model = get(state->models, res->model.id);
+    if (model->loaded) {
+        destroy_result(model->result);
+    }
+    state->models.remove(res->model.id);
+
+    for (u32 i = 0; i < res->animation_names.size; ++i) {
+        res->animation_names[i].free();
+    }
+    if (res->animation_names.size) {
+        res->animation_names.free();
+        res->animation_name_ptrs.free();
+    }
+    res->path.free();
+    deallocate(res);
+}
+
+static ung_resource_type_id model_resource()
+{
+    static ung_resource_type_id res_type = {};
+    if (!res_type.id) {
+        res_type = ung_resource_type_register({
+            .type_name = "model",
+            .decode = res_model_decode,
+            .upload = res_model_upload,
+            .get_error = res_model_get_error,
+            .cleanup_load = res_model_cleanup_load,
+            .destroy = res_model_destroy,
+        });
+    }
+    return res_type;
+}
+
+ung_model_id model_load_gltf_async(ung_model_load_params params)
+{
+    auto res = allocate<ModelResource>();
+    res->params = params;
+    assign(res->path, params.path);
+    res->params.path = res->path.data;
+    if (params.num_animation_names) {
+        res->animation_names.init(params.num_animation_names);
+        res->animation_name_ptrs.init(params.num_animation_names);
+        for (u32 i = 0; i < params.num_animation_names; ++i) {
+            assign(res->animation_names[i], params.animation_names[i]);
+            res->animation_name_ptrs[i] = res->animation_names[i].data;
+        }
+        res->params.animation_names = res->animation_name_ptrs.data;
+    }
+
+    // Insert the model before loading, because without async_decode it is uploaded right away
+    const auto [id, model] = state->models.insert();
+    if (!id) {
+        ung_panic("Too many models");
+    }
+    res->model = { id };
+    // No key, because the model owns its handles and they can't be shared
+    const ung_resource_load_params load_params = { .priority = params.texture_params.priority };
+    model->resource = ung_resource_load_ex(model_resource(), nullptr, res, load_params).res;
+    return { id };
+}
+
+}
@@ -2,10 +2,11 @@
 #include <cstdlib>
 #include <string_view>
 
-#include "types.hpp"
+#include "state.hpp"
 
 namespace ung::model {
 ung_model_load_result model_load_gltf(ung_model_load_params params);
+ung_model_id model_load_gltf_async(ung_model_load_params params);
 
 EXPORT ung_model_load_result ung_model_load(ung_model_load_params params)
 {
@@ -43,4 +44,41 @@ EXPORT void ung_model_load_result_free(const ung_model_load_result* result)
         deallocate(result->animations, result->num_animations);
     }
 }
-}
\ No newline at end of file
+
+EXPORT ung_model_id ung_model_load_async(ung_model_load_params params)
+{
+    if (!params.flags) {
+        params.flags = UNG_MODEL_LOAD_GEOMETRIES;
+    }
+
+    const std::string_view path = params.path;
+#ifdef UNG_CGLTF
+    if (path.ends_with(".gltf") || path.ends_with(".glb")) {
+        return model_load_gltf_async(params);
+    }
+#endif
+    ung_panicf("Unsupported model file format");
+}
+
+EXPORT bool ung_model_is_ready(ung_model_id model)
+{
+    return ung_resource_is_ready(get(state->models, model.id)->resource);
+}
+
+EXPORT const ung_model_load_result* ung_model_get(ung_model_id model_id)
+{
+    auto model = get(state->models, model_id.id);
+    ung_resource_wait_ready(model->resource);
+    return &model->result;
+}
+
+EXPORT ung_resource_id ung_model_resource(ung_model_id model)
+{
+    return get(state->models, model.id)->resource;
+}
+
+EXPORT void ung_model_destroy(ung_model_id model)
+{
+    ung_resource_destroy(get(state->models, model.id)->resource);
+}
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// This is shared between the runtime (pack.cpp) and the packing tool (tools/ung-pack.cpp).
+// Layout (little endian): PackHeader, PackEntry[num_entries] sorted by path_hash, path strings,
+// entry data. Every entry is followed by a null byte (not included in size), so uncompressed
+// entries can be used like the result of ung_read_whole_file.
+
+namespace ung::pack_format {
+
+constexpr char Magic[4] = { 'U', 'P', 'A', 'K' };
+constexpr uint32_t Version = 1;
+
+enum class Compression : uint32_t {
+    None = 0,
+    Lz = 1, // see decompress
+};
+
+struct PackHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t num_entries;
+    uint32_t alignment; // of entry data offsets
+    uint64_t strings_offset;
+    uint64_t strings_size;
+};
+
+struct PackEntry {
+    uint64_t path_hash; // ung_fnv1a of the path
+    uint64_t offset; // from start of file
+    uint64_t size; // uncompressed
+    uint64_t stored_size; // compressed size or size
+    uint32_t path_offset; // relative to strings_offset
+    uint32_t path_length;
+    Compression compression;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(PackHeader) == 32);
+static_assert(sizeof(PackEntry) == 48);
+
+inline uint64_t fnv1a(const void* data, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    auto bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; ++i) {
+        hash = hash ^ bytes[i];
+        hash = hash * 0x100000001b3;
+    }
+    return hash;
+}
+
+// Paths are stored without a leading "./"
+inline const char* normalize_path(const char* path)
+{
+    while (path[0] == '.' && path[1] == '/') {
+        path += 2;
+    }
+    return path;
+}
+
+// A byte-oriented LZ77 format similar to LZ4 blocks: Every sequence starts with a token, whose
+// upper 4 bits are the number of literals and lower 4 bits the match length - 4. A value of 15
+// means that more length bytes follow (each adding up to 255, until one is < 255). Then come the
+// literals and a 16 bit offset of the match (which is missing for the last sequence).
+// Returns false if the data is malformed or does not decompress to exactly dst_size bytes.
+inline bool decompress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size)
+{
+    const auto src_end = src + src_size;
+    size_t d = 0;
+    const auto read_length = [&](size_t len) -> size_t {
+        if (len == 15) {
+            uint8_t b;
+            do {
+                if (src >= src_end) {
+                    return SIZE_MAX;
+                }
+                b = *src++;
+                len += b;
+            } while (b == 255);
+        }
+        return len;
+    };
+
+    while (src < src_end) {
+        const auto token = *src++;
+        const auto num_literals = read_length(token >> 4);
+        if (num_literals == SIZE_MAX || num_literals > (size_t)(src_end - src)
+            || num_literals > dst_size - d) {
+            return false;
+        }
+        std::memcpy(dst + d, src, num_literals);
+        src += num_literals;
+        d += num_literals;
+
+        if (src == src_end) {
+            break; // last sequence has no match
+        }
+
+        if (src_end - src < 2) {
+            return false;
+        }
+        const size_t offset = (size_t)src[0] | ((size_t)src[1] << 8);
+        src += 2;
+        const auto match_len = read_length(token & 0xf);
+        if (match_len == SIZE_MAX || offset == 0 || offset > d || match_len + 4 > dst_size - d) {
+            return false;
+        }
+        // Matches may overlap the output, so we copy byte by byte
+        for (size_t i = 0; i < match_len + 4; ++i, ++d) {
+            dst[d] = dst[d - offset];
+        }
+    }
+    return d == dst_size;
+}
+
+}
@@ -0,0 +1,296 @@
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <mutex>
+
+#include <SDL.h>
+
+#include "pack-format.hpp"
+#include "state.hpp"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif !defined(__EMSCRIPTEN__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define UNG_PACK_MMAP
+#endif
+
+// Packs are memory-mapped (copy-on-write, because ung_read_whole_file returns mutable data) and
+// uncompressed entries are returned as pointers into the mapping. On Emscripten the whole pack is
+// read into memory instead, which is still much better than many small files.
+
+namespace ung::pack {
+
+using namespace pack_format;
+
+struct Pack {
+    char* data;
+    usize size;
+    const PackEntry* entries;
+    u32 num_entries;
+    const char* strings;
+#if defined(_WIN32)
+    HANDLE file;
+    HANDLE mapping;
+#endif
+};
+
+struct State {
+    Pool<Pack> packs;
+    Vector<u64> mount_order; // last mounted first
+    std::mutex mtx; // lookups happen in decode threads
+};
+
+State* state;
+
+void init(ung_init_params params)
+{
+    assert(!state);
+    state = allocate<State>();
+    state->packs.init(params.max_num_packs ? params.max_num_packs : 8);
+    state->mount_order.init(8);
+}
+
+void shutdown()
+{
+    if (!state) {
+        return;
+    }
+
+    while (state->mount_order.size) {
+        ung_pack_unmount({ state->mount_order[0] });
+    }
+    state->mount_order.free();
+    state->packs.free();
+
+    deallocate(state, 1);
+    state = nullptr;
+}
+
+static bool map_file(Pack& pack, const char* path)
+{
+#if defined(UNG_PACK_MMAP)
+    const auto fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    const auto size = (usize)st.st_size;
+    auto data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping stays valid
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    pack.data = (char*)data;
+    pack.size = size;
+    return true;
+#elif defined(_WIN32)
+    std::array<wchar_t, 1024> wbuf;
+    const auto wlen
+        = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, path, -1, wbuf.data(), wbuf.size());
+    if (wlen <= 0 || wlen > wbuf.size()) {
+        return false;
+    }
+    pack.file = CreateFileW(wbuf.data(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (pack.file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(pack.file, &size) || size.QuadPart == 0) {
+        CloseHandle(pack.file);
+        return false;
+    }
+    pack.mapping = CreateFileMappingW(pack.file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    if (!pack.mapping) {
+        CloseHandle(pack.file);
+        return false;
+    }
+    pack.data = (char*)MapViewOfFile(pack.mapping, FILE_MAP_COPY, 0, 0, 0);
+    if (!pack.data) {
+        CloseHandle(pack.mapping);
+        CloseHandle(pack.file);
+        return false;
+    }
+    pack.size = (usize)size.QuadPart;
+    return true;
+#else
+    pack.data = (char*)SDL_LoadFile(path, &pack.size);
+    return pack.data != nullptr;
+#endif
+}
+
+static void unmap_file(Pack& pack)
+{
+#if defined(UNG_PACK_MMAP)
+    munmap(pack.data, pack.size);
+#elif defined(_WIN32)
+    UnmapViewOfFile(pack.data);
+    CloseHandle(pack.mapping);
+    CloseHandle(pack.file);
+#else
+    SDL_free(pack.data);
+#endif
+}
+
+static bool validate(const Pack& pack)
+{
+    if (pack.size < sizeof(PackHeader)) {
+        return false;
+    }
+    const auto& header = *(const PackHeader*)pack.data;
+    if (std::memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.version != Version) {
+        return false;
+    }
+    const auto toc_end = sizeof(PackHeader) + (u64)header.num_entries * sizeof(PackEntry);
+    if (toc_end > pack.size || header.strings_offset < toc_end
+        || header.strings_offset + header.strings_size > pack.size) {
+        return false;
+    }
+    const auto entries = (const PackEntry*)(pack.data + sizeof(PackHeader));
+    for (u32 i = 0; i < header.num_entries; ++i) {
+        const auto& e = entries[i];
+        // Uncompressed entries are returned as is, so they need the size they claim
+        const auto valid_compression = e.compression == Compression::Lz
+            || (e.compression == Compression::None && e.size == e.stored_size);
+        // Strictly less for the null terminator (written this way to not overflow)
+        if (!valid_compression || e.offset >= pack.size || e.stored_size >= pack.size - e.offset
+            || pack.data[e.offset + e.stored_size] != '\0'
+            || (u64)e.path_offset + e.path_length > header.strings_size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+EXPORT ung_pack_id ung_pack_mount(const char* path)
+{
+    assert(state);
+    Pack pack = {};
+    if (!map_file(pack, path)) {
+        fprintf(stderr, "Could not open pack '%s'\n", path);
+        return { 0 };
+    }
+    if (!validate(pack)) {
+        fprintf(stderr, "Invalid pack '%s'\n", path);
+        unmap_file(pack);
+        return { 0 };
+    }
+
+    const auto& header = *(const PackHeader*)pack.data;
+    pack.entries = (const PackEntry*)(pack.data + sizeof(PackHeader));
+    pack.num_entries = header.num_entries;
+    pack.strings = pack.data + header.strings_offset;
+
+    std::lock_guard lock(state->mtx);
+    const auto [id, obj] = state->packs.insert();
+    if (!id) {
+        ung_panic("Too many packs");
+    }
+    *obj = pack;
+    state->mount_order.push(0);
+    std::memmove(state->mount_order.data + 1, state->mount_order.data,
+        (state->mount_order.size - 1) * sizeof(u64));
+    state->mount_order[0] = id;
+    return { id };
+}
+
+EXPORT void ung_pack_unmount(ung_pack_id pack_id)
+{
+    assert(state);
+    std::lock_guard lock(state->mtx);
+    auto pack = get(state->packs, pack_id.id);
+    unmap_file(*pack);
+    remove_v(state->mount_order, pack_id.id);
+    state->packs.remove(pack_id.id);
+}
+
+static const PackEntry* find_entry(const Pack& pack, const char* path, usize path_len, u64 hash)
+{
+    const auto end = pack.entries + pack.num_entries;
+    auto it = std::lower_bound(pack.entries, end, hash,
+        [](const PackEntry& e, u64 h) { return e.path_hash < h; });
+    for (; it != end && it->path_hash == hash; ++it) {
+        if (it->path_length == path_len
+            && std::memcmp(pack.strings + it->path_offset, path, path_len) == 0) {
+            return it;
+        }
+    }
+    return nullptr;
+}
+
+// Returns nullptr if the file should be read from the file system.
+// The returned data is null-terminated and has to be freed with free (or ung_free_file_data).
+char* read(const char* path, usize* size)
+{
+    if (!state) {
+        return nullptr;
+    }
+
+    // Prefer loose files, so they can be edited and reloaded
+    if (ung::state->auto_reload && ung_file_get_mtime(path) != 0) {
+        return nullptr;
+    }
+
+    path = normalize_path(path);
+    const auto path_len = std::strlen(path);
+    const auto hash = fnv1a(path, path_len);
+
+    std::lock_guard lock(state->mtx);
+    for (const auto pack_id : state->mount_order) {
+        const auto& pack = *state->packs.find(pack_id);
+        const auto entry = find_entry(pack, path, path_len, hash);
+        if (!entry) {
+            continue;
+        }
+
+        const auto stored = pack.data + entry->offset;
+        *size = entry->size;
+        if (entry->compression == Compression::None) {
+            return stored;
+        }
+
+        if (entry->compression == Compression::Lz) {
+            // SDL_malloc, so it can be freed just like the result of SDL_LoadFile
+            auto data = (char*)SDL_malloc(entry->size + 1);
+            if (decompress((const u8*)stored, entry->stored_size, (u8*)data, entry->size)) {
+                data[entry->size] = '\0';
+                return data;
+            }
+            SDL_free(data);
+        }
+        fprintf(stderr, "Could not read '%s' from pack\n", path);
+        return nullptr;
+    }
+    return nullptr;
+}
+
+// Returns whether data points into a mounted pack and does not need to be freed
+static bool contains(const char* data)
+{
+    std::lock_guard lock(state->mtx);
+    for (const auto pack_id : state->mount_order) {
+        const auto& pack = *state->packs.find(pack_id);
+        if (data >= pack.data && data < pack.data + pack.size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void free(char* data)
+{
+    if (!state || !contains(data)) {
+        SDL_free(data);
+    }
+}
+
+}
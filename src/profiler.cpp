@@ -0,0 +1,387 @@
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+
+#include <SDL.h>
+
+#include "state.hpp"
+
+#if !defined(MUGFX_WEBGL) && !defined(__EMSCRIPTEN__)
+#include <SDL_opengl.h>
+#define UNG_PROFILER_GPU
+#endif
+
+// Every thread that pushes a zone gets its own track with a ring buffer of zones, so recording
+// does not need any locks. Zones are only written to the ring buffer when they are popped, and the
+// write index is published with release semantics, so the dump (which might run while other
+// threads record) only reads complete zones below it. Zones that were overwritten while reading
+// are skipped.
+// Frame boundaries are kept in a separate ring and the dump only contains
+// zones that started within the last num_frames frames.
+// GPU times are measured with GL_TIME_ELAPSED queries around passes. They are read a few frames
+// later (to not stall) and placed at the CPU time the pass started, because CPU and GPU clocks are
+// not synchronized.
+
+namespace ung::profiler {
+
+struct Zone {
+    const char* name;
+    u64 start; // performance counter
+    u64 end;
+};
+
+struct Track {
+    char name[32];
+    Array<Zone> zones; // ring buffer
+    std::atomic<u64> num_zones; // total written, zone i is zones[i % zones.size]
+    StaticVector<Zone, 32> stack; // open zones (end is not set)
+    u32 num_dropped; // pushes that did not fit on the stack and have to be popped first
+};
+
+struct Frame {
+    u64 start;
+    u64 end; // 0 for the current frame
+};
+
+struct GpuSample {
+    u64 cpu_start;
+    u64 duration_ns;
+};
+
+constexpr u32 MaxTracks = 64;
+constexpr u32 MaxGpuPasses = 16; // per frame
+constexpr u32 NumGpuFrames = 3; // frames until a query is read back
+
+#ifdef UNG_PROFILER_GPU
+struct GpuFrame {
+    GLuint queries[MaxGpuPasses];
+    u64 cpu_start[MaxGpuPasses];
+    u32 num_queries;
+};
+#endif
+
+struct State {
+    Array<Track> tracks;
+    std::atomic<u32> num_tracks;
+    u32 max_zones_per_track;
+    std::mutex tracks_mtx; // only for allocating tracks
+
+    Array<Frame> frames;
+    u64 num_frames;
+
+    Array<GpuSample> gpu_samples;
+    u64 num_gpu_samples;
+#ifdef UNG_PROFILER_GPU
+    PFNGLGENQUERIESPROC gen_queries;
+    PFNGLDELETEQUERIESPROC delete_queries;
+    PFNGLBEGINQUERYPROC begin_query;
+    PFNGLENDQUERYPROC end_query;
+    PFNGLGETQUERYOBJECTIVPROC get_query_iv;
+    PFNGLGETQUERYOBJECTUI64VPROC get_query_ui64v;
+    GpuFrame gpu_frames[NumGpuFrames];
+    bool gpu_pass_open;
+#endif
+};
+
+State* state = nullptr;
+
+static Track*& current_track()
+{
+    thread_local Track* track = nullptr;
+    return track;
+}
+
+static Track* get_track()
+{
+    auto& track = current_track();
+    if (track) {
+        return track;
+    }
+
+    std::lock_guard lock(state->tracks_mtx);
+    const auto idx = state->num_tracks.load(std::memory_order_relaxed);
+    if (idx >= MaxTracks) {
+        return nullptr;
+    }
+    track = &state->tracks[idx];
+    std::snprintf(track->name, sizeof(track->name), "thread %u", idx);
+    track->zones.init(state->max_zones_per_track);
+    state->num_tracks.store(idx + 1, std::memory_order_release);
+    return track;
+}
+
+void init(ung_init_params params)
+{
+    assert(!state);
+    if (!params.profiler_num_frames) {
+        return;
+    }
+
+    state = allocate<State>();
+    state->tracks.init(MaxTracks);
+    state->max_zones_per_track
+        = params.profiler_max_zones_per_thread ? params.profiler_max_zones_per_thread : 16384;
+    state->frames.init(params.profiler_num_frames);
+    state->gpu_samples.init(params.profiler_num_frames * MaxGpuPasses);
+
+    const auto main = get_track();
+    std::snprintf(main->name, sizeof(main->name), "main");
+
+#ifdef UNG_PROFILER_GPU
+    state->gen_queries = (PFNGLGENQUERIESPROC)SDL_GL_GetProcAddress("glGenQueries");
+    state->delete_queries = (PFNGLDELETEQUERIESPROC)SDL_GL_GetProcAddress("glDeleteQueries");
+    state->begin_query = (PFNGLBEGINQUERYPROC)SDL_GL_GetProcAddress("glBeginQuery");
+    state->end_query = (PFNGLENDQUERYPROC)SDL_GL_GetProcAddress("glEndQuery");
+    state->get_query_iv = (PFNGLGETQUERYOBJECTIVPROC)SDL_GL_GetProcAddress("glGetQueryObjectiv");
+    state->get_query_ui64v
+        = (PFNGLGETQUERYOBJECTUI64VPROC)SDL_GL_GetProcAddress("glGetQueryObjectui64v");
+    if (state->gen_queries && state->delete_queries && state->begin_query && state->end_query
+        && state->get_query_iv && state->get_query_ui64v) {
+        for (auto& frame : state->gpu_frames) {
+            state->gen_queries(MaxGpuPasses, frame.queries);
+        }
+    } else {
+        std::fprintf(stderr, "GPU timer queries not available\n");
+        state->begin_query = nullptr;
+    }
+#endif
+}
+
+#ifdef UNG_PROFILER_GPU
+static void read_gpu_queries(GpuFrame& frame)
+{
+    for (u32 i = 0; i < frame.num_queries; ++i) {
+        GLint available = 0;
+        state->get_query_iv(frame.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            continue; // rather lose the sample than stall
+        }
+        GLuint64 ns = 0;
+        state->get_query_ui64v(frame.queries[i], GL_QUERY_RESULT, &ns);
+        const auto idx = state->num_gpu_samples++ % state->gpu_samples.size;
+        state->gpu_samples[(u32)idx] = { frame.cpu_start[i], ns };
+    }
+    frame.num_queries = 0;
+}
+#endif
+
+void begin_frame()
+{
+    if (!state) {
+        return;
+    }
+
+    const auto now = SDL_GetPerformanceCounter();
+    if (state->num_frames) {
+        state->frames[(u32)((state->num_frames - 1) % state->frames.size)].end = now;
+    }
+    state->frames[(u32)(state->num_frames % state->frames.size)] = { now, 0 };
+    state->num_frames++;
+
+#ifdef UNG_PROFILER_GPU
+    if (state->begin_query) {
+        read_gpu_queries(state->gpu_frames[ung::state->frame_counter % NumGpuFrames]);
+    }
+#endif
+}
+
+void begin_pass()
+{
+#ifdef UNG_PROFILER_GPU
+    if (!state || !state->begin_query) {
+        return;
+    }
+    auto& frame = state->gpu_frames[ung::state->frame_counter % NumGpuFrames];
+    if (frame.num_queries >= MaxGpuPasses) {
+        return;
+    }
+    frame.cpu_start[frame.num_queries] = SDL_GetPerformanceCounter();
+    state->begin_query(GL_TIME_ELAPSED, frame.queries[frame.num_queries]);
+    state->gpu_pass_open = true;
+#endif
+}
+
+void end_pass()
+{
+#ifdef UNG_PROFILER_GPU
+    if (!state || !state->gpu_pass_open) {
+        return;
+    }
+    state->end_query(GL_TIME_ELAPSED);
+    state->gpu_frames[ung::state->frame_counter % NumGpuFrames].num_queries++;
+    state->gpu_pass_open = false;
+#endif
+}
+
+void shutdown()
+{
+    if (!state) {
+        return;
+    }
+
+#ifdef UNG_PROFILER_GPU
+    if (state->begin_query) {
+        for (auto& frame : state->gpu_frames) {
+            state->delete_queries(MaxGpuPasses, frame.queries);
+        }
+    }
+#endif
+
+    const auto num_tracks = state->num_tracks.load(std::memory_order_acquire);
+    for (u32 i = 0; i < num_tracks; ++i) {
+        state->tracks[i].zones.free();
+    }
+    state->tracks.free();
+    state->frames.free();
+    state->gpu_samples.free();
+
+    deallocate(state, 1);
+    state = nullptr;
+    current_track() = nullptr;
+}
+
+EXPORT void ung_profiler_push(const char* name)
+{
+    if (!state) {
+        return;
+    }
+    const auto track = get_track();
+    if (!track) {
+        return;
+    }
+    if (track->stack.size() == track->stack.capacity()) {
+        track->num_dropped++;
+        return;
+    }
+    track->stack.append() = { name, SDL_GetPerformanceCounter(), 0 };
+}
+
+EXPORT void ung_profiler_pop()
+{
+    if (!state) {
+        return;
+    }
+    const auto track = current_track();
+    if (!track) {
+        return;
+    }
+    if (track->num_dropped) {
+        track->num_dropped--;
+        return;
+    }
+    assert(track->stack.size());
+    auto zone = track->stack[track->stack.size() - 1];
+    track->stack.pop();
+    zone.end = SDL_GetPerformanceCounter();
+    // Only this thread writes num_zones
+    const auto idx = track->num_zones.load(std::memory_order_relaxed);
+    track->zones[(u32)(idx % track->zones.size)] = zone;
+    track->num_zones.store(idx + 1, std::memory_order_release);
+}
+
+EXPORT void ung_profiler_set_thread_name(const char* name)
+{
+    if (!state) {
+        return;
+    }
+    if (const auto track = get_track()) {
+        std::snprintf(track->name, sizeof(track->name), "%s", name);
+    }
+}
+
+static void write_escaped(FILE* f, const char* str)
+{
+    for (; *str; ++str) {
+        if (*str == '"' || *str == '\\') {
+            std::fputc('\\', f);
+        }
+        std::fputc(*str, f);
+    }
+}
+
+EXPORT void ung_profiler_dump(const char* path)
+{
+    if (!state || !state->num_frames) {
+        return;
+    }
+
+    const auto f = std::fopen(path, "w");
+    if (!f) {
+        std::fprintf(stderr, "Could not open '%s'\n", path);
+        return;
+    }
+
+    const auto first_frame = state->num_frames > state->frames.size
+        ? state->num_frames - state->frames.size
+        : 0;
+    const auto min_time = state->frames[(u32)(first_frame % state->frames.size)].start;
+    const auto freq = (double)SDL_GetPerformanceFrequency();
+    const auto to_us = [&](u64 ticks) { return (double)(ticks - min_time) * 1e6 / freq; };
+
+    bool first_event = true;
+    const auto event = [&](const char* name, u32 tid, u64 start, double dur_us) {
+        std::fprintf(f, "%s\n{\"name\": \"", first_event ? "" : ",");
+        write_escaped(f, name);
+        std::fprintf(f, "\", \"ph\": \"X\", \"pid\": 0, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+            tid, to_us(start), dur_us);
+        first_event = false;
+    };
+    const auto thread_name = [&](u32 tid, const char* name) {
+        std::fprintf(f, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %u, ",
+            first_event ? "" : ",", tid);
+        std::fprintf(f, "\"args\": {\"name\": \"");
+        write_escaped(f, name);
+        std::fprintf(f, "\"}}");
+        first_event = false;
+    };
+
+    std::fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+
+    // Frames and GPU passes get their own tracks after the threads
+    const auto num_tracks = state->num_tracks.load(std::memory_order_acquire);
+    const auto frames_tid = num_tracks;
+    const auto gpu_tid = num_tracks + 1;
+
+    thread_name(frames_tid, "frames");
+    for (auto i = first_frame; i < state->num_frames; ++i) {
+        const auto& frame = state->frames[(u32)(i % state->frames.size)];
+        if (frame.end) {
+            event("frame", frames_tid, frame.start, to_us(frame.end) - to_us(frame.start));
+        }
+    }
+
+    for (u32 t = 0; t < num_tracks; ++t) {
+        const auto& track = state->tracks[t];
+        thread_name(t, track.name);
+        const auto num_zones = track.num_zones.load(std::memory_order_acquire);
+        const auto first = num_zones > track.zones.size ? num_zones - track.zones.size : 0;
+        for (auto i = first; i < num_zones; ++i) {
+            const auto zone = track.zones[(u32)(i % track.zones.size)];
+            // The owning thread might have wrapped around and be writing this slot (or have
+            // written it already), which the next write index tells us.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (track.num_zones.load(std::memory_order_relaxed) >= i + track.zones.size) {
+                continue;
+            }
+            if (zone.start >= min_time) {
+                event(zone.name, t, zone.start, to_us(zone.end) - to_us(zone.start));
+            }
+        }
+    }
+
+    thread_name(gpu_tid, "gpu");
+    const auto first_sample = state->num_gpu_samples > state->gpu_samples.size
+        ? state->num_gpu_samples - state->gpu_samples.size
+        : 0;
+    for (auto i = first_sample; i < state->num_gpu_samples; ++i) {
+        const auto& sample = state->gpu_samples[(u32)(i % state->gpu_samples.size)];
+        if (sample.cpu_start >= min_time) {
+            event("pass", gpu_tid, sample.cpu_start, (double)sample.duration_ns / 1000.0);
+        }
+    }
+
+    std::fprintf(f, "\n]}\n");
+    std::fclose(f);
+}
+
+}
@@ -1,10 +1,31 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 #include "state.hpp"
 
+namespace ung {
+size_t find_binding(Material& mat, const mugfx_draw_binding& binding);
+StaticVector<mugfx_draw_binding, 16>& get_resolved_bindings(Material& mat);
+}
+
+namespace ung::profiler {
+void begin_pass();
+void end_pass();
+}
+
 namespace ung::render {
 
+// GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT is at most 256 on all implementations we care about
+static constexpr u32 UniformOffsetAlignment = 256;
+static_assert(sizeof(UTransform) % UniformOffsetAlignment == 0);
+// 16KiB, which is the minimum GL_MAX_UNIFORM_BLOCK_SIZE
+static constexpr u32 InstancedTransformsSize = UNG_MAX_AUTO_INSTANCES * sizeof(UTransform);
+
 void init(ung_init_params params)
 {
     state->cameras.init(params.max_num_cameras ? params.max_num_cameras : 8);
+    state->cmdlists.init(params.max_num_cmdlists ? params.max_num_cmdlists : 16);
 
     state->u_frame_buf = mugfx_buffer_create({
         .target = MUGFX_BUFFER_TARGET_UNIFORM,
@@ -20,25 +41,56 @@ void init(ung_init_params params)
         .debug_label = "UngPass",
     });
 
+    const auto max_num_transforms
+        = params.max_num_transforms_per_frame ? params.max_num_transforms_per_frame : 4096;
+    state->u_transform_buf_size = max_num_transforms * (u32)sizeof(UTransform);
+    // Instanced materials always bind UNG_MAX_AUTO_INSTANCES transforms, so we need some slack at
+    // the end of the buffer.
     state->u_transform_buf = mugfx_buffer_create({
         .target = MUGFX_BUFFER_TARGET_UNIFORM,
         .usage = MUGFX_BUFFER_USAGE_HINT_STREAM,
-        .data = { nullptr, sizeof(UTransform) },
+        .data = { nullptr, state->u_transform_buf_size + InstancedTransformsSize },
         .debug_label = "UngTransform",
     });
+
+    state->draw_cmds.init(256);
+    state->draw_keys.init(256);
+    state->draw_keys_scratch.init(256);
+    state->draw_overrides.init(64);
+    state->draw_data.init(1024);
+    state->draw_transforms.init(256);
+    state->draw_bounds_x.init(256);
+    state->draw_bounds_y.init(256);
+    state->draw_bounds_z.init(256);
+    state->draw_bounds_r.init(256);
+    state->draw_visible.init(256);
 }
 
 void shutdown()
 {
+    state->draw_transforms.free();
+    state->draw_bounds_x.free();
+    state->draw_bounds_y.free();
+    state->draw_bounds_z.free();
+    state->draw_bounds_r.free();
+    state->draw_visible.free();
+    state->draw_data.free();
+    state->draw_overrides.free();
+    state->draw_keys_scratch.free();
+    state->draw_keys.free();
+    state->draw_cmds.free();
+
     mugfx_buffer_destroy(state->u_transform_buf);
     mugfx_buffer_destroy(state->u_pass_buf);
     mugfx_buffer_destroy(state->u_frame_buf);
 
-    for (u32 i = 0; i < state->cameras.capacity(); ++i) {
-        const auto key = state->cameras.get_key(i);
-        if (key) {
-            ung_camera_destroy({ key });
-        }
+    for (u32 i = state->cmdlists.size(); i-- > 0;) {
+        ung_cmdlist_destroy({ state->cmdlists.alive_key(i) });
+    }
+    state->cmdlists.free();
+
+    for (u32 i = state->cameras.size(); i-- > 0;) {
+        ung_camera_destroy({ state->cameras.alive_key(i) });
     }
     state->cameras.free();
 }
@@ -148,11 +200,21 @@ void begin_frame()
 
     mugfx_buffer_update(state->u_frame_buf, 0, {}); // orphan
     mugfx_buffer_update(state->u_frame_buf, 0, { &frame_data, sizeof(UFrame) });
+
+    // The transforms of the last frame might still be in use, so we orphan once and then only
+    // write to fresh ranges for the rest of the frame.
+    mugfx_buffer_update(state->u_transform_buf, 0, {}); // orphan
+    state->u_transform_offset = 0;
+    state->last_drawn_material = nullptr;
 }
 
-EXPORT void ung_begin_pass(mugfx_render_target_id target, ung_camera_id camera)
+EXPORT void ung_begin_pass_ex(
+    mugfx_render_target_id target, ung_camera_id camera, ung_pass_params params)
 {
+    assert(!state->queue_draws);
+    ung_profiler_push("pass");
     mugfx_begin_pass(target);
+    profiler::begin_pass();
 
     auto cam = get_camera(camera.id);
     state->pass_data.projection = cam->projection;
@@ -181,18 +243,64 @@ EXPORT void ung_begin_pass(mugfx_render_target_id target, ung_camera_id camera)
     if (!target.id) {
         mugfx_set_viewport(0, 0, state->fb_width, state->fb_height);
     }
+
+    state->cull_draws = params.cull;
+    if (params.cull) {
+        um_get_frustum(state->pass_data.view_projection, state->frustum);
+    }
+
+    state->queue_draws = params.sort_draws;
 }
 
-static void upload_transform(um_mat transform)
+EXPORT void ung_begin_pass(mugfx_render_target_id target, ung_camera_id camera)
+{
+    ung_begin_pass_ex(target, camera, {});
+}
+
+static void compute_transform(
+    UTransform& trafo_data, const um_mat& transform, const um_mat& view, const um_mat& projection)
 {
-    UTransform trafo_data;
     trafo_data.model = transform;
-    trafo_data.model_view = um_mat_mul(state->pass_data.view, trafo_data.model);
-    trafo_data.model_view_projection
-        = um_mat_mul(state->pass_data.projection, trafo_data.model_view);
+    trafo_data.model_view = um_mat_mul(view, trafo_data.model);
+    trafo_data.model_view_projection = um_mat_mul(projection, trafo_data.model_view);
     trafo_data.normal_matrix = um_mat_transpose(um_mat_invert(trafo_data.model));
+}
+
+static void compute_transform(UTransform& trafo_data, const um_mat& transform)
+{
+    compute_transform(trafo_data, transform, state->pass_data.view, state->pass_data.projection);
+}
 
-    mugfx_buffer_update(state->u_transform_buf, 0, { &trafo_data, sizeof(UTransform) });
+// Geometry with quantized positions needs the dequantization as part of the model matrix
+static um_mat get_model_matrix(const Geometry* geom, const um_mat& transform)
+{
+    return geom && geom->quantized ? um_mat_mul(transform, geom->dequantize) : transform;
+}
+
+// Returns the offset into u_transform_buf for `count` consecutive transforms
+static u32 reserve_transforms(u32 count)
+{
+    const auto size = count * (u32)sizeof(UTransform);
+    assert(size <= state->u_transform_buf_size);
+    if (state->u_transform_offset + size > state->u_transform_buf_size) {
+        // We ran out of space. Orphaning again is the best we can do without stalling.
+        mugfx_buffer_update(state->u_transform_buf, 0, {}); // orphan
+        state->u_transform_offset = 0;
+    }
+    const auto offset = state->u_transform_offset;
+    state->u_transform_offset += size;
+    state->frame_stats.transform_upload_bytes += size;
+    return offset;
+}
+
+// Returns the offset into u_transform_buf
+static u32 upload_transform(um_mat transform)
+{
+    UTransform trafo_data;
+    compute_transform(trafo_data, transform);
+    const auto offset = reserve_transforms(1);
+    mugfx_buffer_update(state->u_transform_buf, offset, { &trafo_data, sizeof(UTransform) });
+    return offset;
 }
 
 static mugfx_draw_binding buffer_binding(uint32_t binding, mugfx_buffer_id buffer)
@@ -200,77 +308,646 @@ static mugfx_draw_binding buffer_binding(uint32_t binding, mugfx_buffer_id buffe
     return { .type = MUGFX_BINDING_TYPE_BUFFER, .buffer = { binding, buffer } };
 }
 
-EXPORT void ung_draw(ung_material_id material, ung_geometry_id geometry, const float transform[16],
+static mugfx_draw_binding buffer_binding(
+    uint32_t binding, mugfx_buffer_id buffer, usize offset, usize size)
+{
+    return { .type = MUGFX_BINDING_TYPE_BUFFER, .buffer = { binding, buffer, offset, size } };
+}
+
+static void upload_dynamic_data(Material* mat, const void* data)
+{
+    if (mat->last_update_frame == state->frame_counter) {
+        mugfx_buffer_update(mat->dynamic_buf, 0, {}); // orphan
+    }
+    mugfx_buffer_update(mat->dynamic_buf, 0, { data, mat->dynamic_data_size });
+    state->frame_stats.material_upload_bytes += mat->dynamic_data_size;
+    mat->last_update_frame = state->frame_counter;
+}
+
+static u32 get_instance_count(const Geometry* geom, u32 instance_count)
+{
+    if (geom->instance_buffer.id) {
+        auto buf = get(state->instance_buffers, geom->instance_buffer.id);
+        return buf->num_instances;
+    }
+    return instance_count;
+}
+
+static void count_draw(const Material* mat, const Geometry* geom, u32 draw_count,
+    usize num_binding_overrides, u32 instance_count)
+{
+    auto& stats = state->frame_stats;
+    const auto instances = std::max(instance_count, 1u);
+    stats.draw_calls++;
+    stats.instances += instances;
+    const auto mode = geom->mugfx_params.draw_mode;
+    if (mode == MUGFX_DRAW_MODE_DEFAULT || mode == MUGFX_DRAW_MODE_TRIANGLES) {
+        stats.triangles += (u64)(draw_count / 3) * instances;
+    } else if (mode == MUGFX_DRAW_MODE_TRIANGLE_STRIP && draw_count >= 3) {
+        stats.triangles += (u64)(draw_count - 2) * instances;
+    }
+    if (mat != state->last_drawn_material) {
+        stats.material_changes++;
+        state->last_drawn_material = mat;
+    }
+    stats.binding_overrides += num_binding_overrides;
+}
+
+static void draw(Material* mat, Geometry* geom, u32 lod, u32 transform_offset,
+    const mugfx_draw_binding* binding_overrides, usize num_binding_overrides, u32 instance_count)
+{
+    assert(lod <= geom->num_lods);
+    const auto geometry = lod ? geom->lods[lod - 1].geometry : geom->geometry;
+    count_draw(mat, geom, lod ? geom->lods[lod - 1].draw_count : geom->draw_count,
+        num_binding_overrides, instance_count);
+    auto& bindings = get_resolved_bindings(*mat);
+
+    bindings[0] = buffer_binding(0, state->u_frame_buf);
+    bindings[1] = buffer_binding(1, state->u_pass_buf);
+    const auto transform_size = mat->instanced ? InstancedTransformsSize : sizeof(UTransform);
+    bindings[2] = buffer_binding(2, state->u_transform_buf, transform_offset, transform_size);
+
+    if (!num_binding_overrides) {
+        mugfx_draw_instanced(
+            mat->material, geometry, bindings.data(), bindings.size(), instance_count);
+        return;
+    }
+
+    assert(binding_overrides);
+    StaticVector<mugfx_draw_binding, MUGFX_MAX_SHADER_BINDINGS> draw_bindings {};
+    std::memcpy(
+        draw_bindings.data(), bindings.data(), sizeof(mugfx_draw_binding) * bindings.size());
+    draw_bindings.size_ = bindings.size();
+
+    for (size_t i = 0; i < num_binding_overrides; ++i) {
+        const auto override = binding_overrides[i];
+        auto idx = find_binding(*mat, override);
+        if (idx == SIZE_MAX) {
+            // Not a material binding, but it might have been appended by an earlier override
+            for (size_t j = bindings.size(); j < draw_bindings.size(); ++j) {
+                if (is_same_binding(draw_bindings[j], override)) {
+                    idx = j;
+                    break;
+                }
+            }
+        }
+        if (idx == SIZE_MAX) {
+            UNG_OR_PANIC(draw_bindings.size() < MUGFX_MAX_SHADER_BINDINGS,
+                "Too many draw bindings after overrides (%zu > %u)", draw_bindings.size() + 1,
+                MUGFX_MAX_SHADER_BINDINGS);
+            draw_bindings.append() = override;
+        } else {
+            draw_bindings[idx] = override;
+        }
+    }
+
+    mugfx_draw_instanced(
+        mat->material, geometry, draw_bindings.data(), draw_bindings.size(), instance_count);
+}
+
+// Draws that cannot be culled get an infinitely large sphere
+static um_sphere get_world_bounds(const Geometry* geom, const um_mat& transform, u32 instance_count)
+{
+    // We don't know where the instances are
+    if (!geom->has_bounds || instance_count) {
+        return { {}, std::numeric_limits<float>::infinity() };
+    }
+    return um_sphere_transform(transform, geom->bounding_sphere);
+}
+
+// Returns the coarsest level of detail whose error is at most lod_pixel_error pixels on screen.
+// The errors are relative to the bounding sphere radius, so the projected error is the error
+// times the projected radius. The distance to the front of the sphere is used, so this is
+// conservative for big objects. This uses the camera of the current pass.
+static u32 select_lod(const Geometry* geom, const um_sphere& bounds)
+{
+    if (!geom->num_lods || !std::isfinite(bounds.radius) || bounds.radius <= 0.0f) {
+        return 0;
+    }
+    const auto& view = state->pass_data.view;
+    const auto& proj = state->pass_data.projection;
+    // Pixels per world unit (at distance 1 if perspective)
+    const auto pixel_scale = proj.cols[1].y * 0.5f * state->pass_data.view_dimensions.y;
+    auto distance = 1.0f;
+    if (proj.cols[3].w == 0.0f) { // perspective
+        const um_vec4 row_z = { view.cols[0].z, view.cols[1].z, view.cols[2].z, view.cols[3].z };
+        const auto view_z
+            = um_vec4_dot(row_z, { bounds.center.x, bounds.center.y, bounds.center.z, 1.0f });
+        distance = -view_z - bounds.radius;
+        if (distance <= 0.0f) {
+            return 0;
+        }
+    }
+    const auto max_error
+        = state->lod_pixel_error * distance / (std::fabs(pixel_scale) * bounds.radius);
+    u32 lod = 0;
+    while (lod < geom->num_lods && geom->lods[lod].error <= max_error) {
+        lod++;
+    }
+    return lod;
+}
+
+// Draws bypassing the draw queue, e.g. for the sprite renderer, which reuses its geometry.
+void draw_immediate(ung_material_id material, ung_geometry_id geometry, const float transform[16],
     ung_draw_params params)
 {
     auto mat = get(state->materials, material.id);
     auto geom = get(state->geometries, geometry.id);
 
+    const auto model = transform ? um_mat_from_ptr(transform) : um_mat_identity();
+    const auto instance_count = get_instance_count(geom, params.instance_count);
+
+    u32 lod = 0;
+    if (state->cull_draws || geom->num_lods) {
+        const auto bounds = get_world_bounds(geom, model, instance_count);
+        if (state->cull_draws && !um_sphere_in_frustum(bounds, state->frustum, 6)) {
+            state->frame_stats.objects_culled++;
+            return;
+        }
+        lod = select_lod(geom, bounds);
+    }
+
     if (mat->dynamic_data_dirty && mat->dynamic_data) {
-        if (mat->last_update_frame == state->frame_counter) {
-            mugfx_buffer_update(mat->dynamic_buf, 0, {}); // orphan
+        upload_dynamic_data(mat, mat->dynamic_data);
+        mat->dynamic_data_dirty = false;
+    }
+
+    // TODO: maybe avoid upload if transform is overriden
+    const auto transform_offset = upload_transform(get_model_matrix(geom, model));
+
+    draw(mat, geom, lod, transform_offset, params.binding_overrides, params.num_binding_overrides,
+        instance_count);
+    state->frame_stats.objects_drawn++;
+}
+
+// Only depends on the draw and the view, so it can be computed outside of a pass
+static u64 draw_sort_key(
+    const DrawCmd& cmd, const mugfx_draw_binding* overrides, const um_mat& view)
+{
+    // The textures of the material are implied by the material, but overrides might change them
+    u64 texture = 0;
+    for (u32 i = 0; i < cmd.num_overrides; ++i) {
+        const auto& binding = overrides[i];
+        if (binding.type == MUGFX_BINDING_TYPE_TEXTURE) {
+            texture = binding.texture.id.id;
+            break;
         }
-        mugfx_buffer_update(mat->dynamic_buf, 0, { mat->dynamic_data, mat->dynamic_data_size });
+    }
+
+    // View space depth, so we draw front to back within a material/geometry/texture group
+    const auto view_z = um_vec4_dot(
+        { view.cols[0].z, view.cols[1].z, view.cols[2].z, view.cols[3].z }, cmd.transform.cols[3]);
+    // sqrt to have more precision close to the camera, 1024 units cover the range [0, 1024]
+    const auto depth = (u64)clamp(std::sqrt(std::fmax(-view_z, 0.0f)) * 32.0f, 0.0f, 1023.0f);
+
+    // material: 20 bits, geometry: 16 bits, texture: 12 bits, depth: 10 bits
+    const auto mat_idx = ung_slotmap_get_index(cmd.material.id) & 0xF'FFFF;
+    const auto geom_idx = ung_slotmap_get_index(cmd.geometry.id) & 0xFFFF;
+    const auto tex_bits = (texture ^ (texture >> 12)) & 0xFFF;
+    return (u64)mat_idx << 38 | (u64)geom_idx << 22 | tex_bits << 10 | depth;
+}
+
+// Every draw has to use the dynamic data that was current when it was recorded, even if it's
+// sorted in front of a draw that changed it. So every queued draw gets a snapshot, which is shared
+// with the other draws of this queue until the data changes.
+static void snapshot_dynamic_data(Material* mat, DrawCmd& cmd)
+{
+    if (!mat->dynamic_data) {
+        return;
+    }
+    if (mat->dynamic_data_dirty || mat->queued_data_queue != state->draw_queue_counter) {
+        const auto size = (u32)mat->dynamic_data_size;
+        state->draw_data.reserve(state->draw_data.size + size);
+        std::memcpy(state->draw_data.data + state->draw_data.size, mat->dynamic_data, size);
+        mat->queued_data_offset = state->draw_data.size;
+        mat->queued_data_queue = state->draw_queue_counter;
+        state->draw_data.size += size;
         mat->dynamic_data_dirty = false;
-        mat->last_update_frame = state->frame_counter;
     }
+    cmd.dynamic_data_offset = mat->queued_data_offset;
+    cmd.has_dynamic_data = true;
+}
 
-    StaticVector<mugfx_draw_binding, MUGFX_MAX_SHADER_BINDINGS> draw_bindings {};
-    std::memcpy(draw_bindings.data(), mat->bindings.data(),
-        sizeof(mugfx_draw_binding) * mat->bindings.size());
-    draw_bindings.size_ = mat->bindings.size();
+static void push_draw_bounds(const um_sphere& sphere)
+{
+    state->draw_bounds_x.push(sphere.center.x);
+    state->draw_bounds_y.push(sphere.center.y);
+    state->draw_bounds_z.push(sphere.center.z);
+    state->draw_bounds_r.push(sphere.radius);
+}
 
-    // TODO: maybe avoid upload if transform is overriden
-    draw_bindings[0] = buffer_binding(0, state->u_frame_buf);
-    draw_bindings[1] = buffer_binding(1, state->u_pass_buf);
-    draw_bindings[2] = buffer_binding(2, state->u_transform_buf);
-    upload_transform(transform ? um_mat_from_ptr(transform) : um_mat_identity());
-
-    for (size_t i = 0; i < mat->bindings.size(); ++i) {
-        if (mat->textures[i].id) {
-            const auto tex = get(state->textures, mat->textures[i].id);
-            if (tex->resource.id) {
-                ung_resource_wait_ready(tex->resource);
-            }
-            draw_bindings[i].texture.id = tex->texture;
+static void queue_draw(ung_material_id material, ung_geometry_id geometry,
+    const float transform[16], ung_draw_params params)
+{
+    auto mat = get(state->materials, material.id);
+    auto geom = get(state->geometries, geometry.id);
+
+    DrawCmd cmd {};
+    cmd.material = material;
+    cmd.geometry = geometry;
+    cmd.transform = transform ? um_mat_from_ptr(transform) : um_mat_identity();
+    cmd.instance_count = get_instance_count(geom, params.instance_count);
+
+    // Overrides and dynamic data might not live until ung_end_pass, so we copy them
+    cmd.first_override = state->draw_overrides.size;
+    cmd.num_overrides = (u32)params.num_binding_overrides;
+    for (size_t i = 0; i < params.num_binding_overrides; ++i) {
+        state->draw_overrides.push(params.binding_overrides[i]);
+    }
+
+    snapshot_dynamic_data(mat, cmd);
+
+    if (state->cull_draws || geom->num_lods) {
+        const auto bounds = get_world_bounds(geom, cmd.transform, cmd.instance_count);
+        if (state->cull_draws) {
+            push_draw_bounds(bounds);
         }
+        cmd.lod = select_lod(geom, bounds);
     }
 
-    if (params.num_binding_overrides) {
-        assert(params.binding_overrides);
-        for (size_t i = 0; i < params.num_binding_overrides; ++i) {
-            const auto override = params.binding_overrides[i];
-            bool found = false;
-            for (size_t j = 0; j < draw_bindings.size(); ++j) {
-                if (is_same_binding(draw_bindings[j], override)) {
-                    draw_bindings[j] = override;
-                    found = true;
-                    break;
-                }
+    const auto key = draw_sort_key(
+        cmd, state->draw_overrides.data + cmd.first_override, state->pass_data.view);
+    state->draw_keys.push({ key, state->draw_cmds.size });
+    state->draw_cmds.push(cmd);
+}
+
+// Returns false if the draw should be skipped
+static bool resolve_loading_material(ung_material_id& material)
+{
+    if (state->async_materials && !ung_material_is_ready(material)) {
+        state->frame_stats.draws_loading++;
+        material = state->loading_fallback_material;
+        return material.id != 0;
+    }
+    return true;
+}
+
+EXPORT void ung_draw(ung_material_id material, ung_geometry_id geometry, const float transform[16],
+    ung_draw_params params)
+{
+    // No profiler zone, because there are usually so many draws that they would fill the track
+    if (!resolve_loading_material(material)) {
+        return;
+    }
+    if (state->queue_draws) {
+        queue_draw(material, geometry, transform, params);
+    } else {
+        draw_immediate(material, geometry, transform, params);
+    }
+}
+
+// LSD radix sort, 8 bits at a time. Returns either items or scratch, depending on where the
+// sorted items ended up.
+static DrawSortKey* radix_sort(DrawSortKey* items, DrawSortKey* scratch, u32 count)
+{
+    for (u32 shift = 0; shift < 64; shift += 8) {
+        std::array<u32, 256> offsets = {};
+        for (u32 i = 0; i < count; ++i) {
+            offsets[(items[i].key >> shift) & 0xFF]++;
+        }
+        // All keys have the same byte here, so this pass would not change anything
+        if (offsets[(items[0].key >> shift) & 0xFF] == count) {
+            continue;
+        }
+        u32 sum = 0;
+        for (auto& offset : offsets) {
+            const auto c = offset;
+            offset = sum;
+            sum += c;
+        }
+        for (u32 i = 0; i < count; ++i) {
+            scratch[offsets[(items[i].key >> shift) & 0xFF]++] = items[i];
+        }
+        std::swap(items, scratch);
+    }
+    return items;
+}
+
+static bool same_binding(const mugfx_draw_binding& a, const mugfx_draw_binding& b)
+{
+    if (!is_same_binding(a, b)) {
+        return false;
+    }
+    if (a.type == MUGFX_BINDING_TYPE_TEXTURE) {
+        return a.texture.id.id == b.texture.id.id;
+    }
+    return a.buffer.id.id == b.buffer.id.id && a.buffer.offset == b.buffer.offset
+        && a.buffer.size == b.buffer.size;
+}
+
+static bool can_merge(const DrawCmd& a, const DrawCmd& b)
+{
+    if (a.material.id != b.material.id || a.geometry.id != b.geometry.id || a.lod != b.lod
+        || b.instance_count != 0 || a.num_overrides != b.num_overrides
+        || a.has_dynamic_data != b.has_dynamic_data
+        || a.dynamic_data_offset != b.dynamic_data_offset) {
+        return false;
+    }
+    for (u32 i = 0; i < a.num_overrides; ++i) {
+        if (!same_binding(state->draw_overrides[a.first_override + i],
+                state->draw_overrides[b.first_override + i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Tests all queued draws against the frustum at once. Iterating over the planes in the outer loop
+// and using separate arrays for every component lets the compiler vectorize the inner loop.
+static void cull_spheres(const float* x, const float* y, const float* z, const float* r, u32 count,
+    const um_plane planes[6], u8* visible)
+{
+    std::memset(visible, 1, count);
+    for (u32 p = 0; p < 6; ++p) {
+        const auto n = planes[p].normal;
+        const auto d = planes[p].distance;
+        for (u32 i = 0; i < count; ++i) {
+            visible[i] &= (u8)(n.x * x[i] + n.y * y[i] + n.z * z[i] + d >= -r[i]);
+        }
+    }
+}
+
+// Removes the keys of invisible draws, so they are not even sorted
+static void cull_draw_queue()
+{
+    const auto num_cmds = state->draw_cmds.size;
+    state->draw_visible.reserve(num_cmds);
+    cull_spheres(state->draw_bounds_x.data, state->draw_bounds_y.data, state->draw_bounds_z.data,
+        state->draw_bounds_r.data, num_cmds, state->frustum, state->draw_visible.data);
+
+    u32 num_visible = 0;
+    for (const auto& key : state->draw_keys) {
+        if (state->draw_visible.data[key.cmd_idx]) {
+            state->draw_keys[num_visible++] = key;
+        }
+    }
+    state->frame_stats.objects_culled += state->draw_keys.size - num_visible;
+    state->draw_keys.size = num_visible;
+}
+
+static void clear_draw_queue()
+{
+    state->draw_cmds.clear();
+    state->draw_keys.clear();
+    state->draw_overrides.clear();
+    state->draw_data.clear();
+    state->draw_bounds_x.clear();
+    state->draw_bounds_y.clear();
+    state->draw_bounds_z.clear();
+    state->draw_bounds_r.clear();
+    // Invalidates the dynamic data snapshots
+    state->draw_queue_counter++;
+}
+
+static void flush_draw_queue()
+{
+    ProfScope prof("flush_draw_queue");
+    if (state->cull_draws) {
+        cull_draw_queue();
+    }
+
+    const auto count = state->draw_keys.size;
+    if (count == 0) {
+        clear_draw_queue();
+        return;
+    }
+    state->frame_stats.objects_drawn += count;
+
+    state->draw_keys_scratch.reserve(count);
+    const auto sorted
+        = radix_sort(state->draw_keys.data, state->draw_keys_scratch.data, state->draw_keys.size);
+
+    const Material* data_mat = nullptr;
+    u32 data_offset = 0;
+
+    // Upload the transforms for as many draws as fit into the transform buffer at once
+    const auto max_chunk_size = state->u_transform_buf_size / (u32)sizeof(UTransform);
+    state->draw_transforms.reserve(std::min(count, max_chunk_size));
+    for (u32 chunk_start = 0; chunk_start < count; chunk_start += max_chunk_size) {
+        const auto chunk_size = std::min(count - chunk_start, max_chunk_size);
+        for (u32 i = 0; i < chunk_size; ++i) {
+            const auto& cmd = state->draw_cmds[sorted[chunk_start + i].cmd_idx];
+            if (cmd.transform_data) {
+                state->draw_transforms.data[i] = *cmd.transform_data;
+                continue;
+            }
+            const auto geom = state->geometries.find(cmd.geometry.id);
+            const auto model = get_model_matrix(geom, cmd.transform);
+            compute_transform(state->draw_transforms.data[i], model);
+        }
+        const auto base_offset = reserve_transforms(chunk_size);
+        mugfx_buffer_update(state->u_transform_buf, base_offset,
+            { state->draw_transforms.data, chunk_size * sizeof(UTransform) });
+
+        u32 i = 0;
+        while (i < chunk_size) {
+            const auto& cmd = state->draw_cmds[sorted[chunk_start + i].cmd_idx];
+            auto mat = state->materials.find(cmd.material.id);
+            auto geom = state->geometries.find(cmd.geometry.id);
+            // Materials and geometries might have been destroyed (or their levels of detail
+            // changed) after the draw was recorded
+            if (!mat || !geom || cmd.lod > geom->num_lods) {
+                i++;
+                continue;
             }
-            if (!found) {
-                UNG_OR_PANIC(draw_bindings.size() < MUGFX_MAX_SHADER_BINDINGS,
-                    "Too many draw bindings after overrides (%zu > %u)", draw_bindings.size() + 1,
-                    MUGFX_MAX_SHADER_BINDINGS);
-                draw_bindings.append() = override;
+            if (cmd.has_dynamic_data
+                && (mat != data_mat || cmd.dynamic_data_offset != data_offset)) {
+                upload_dynamic_data(mat, state->draw_data.data + cmd.dynamic_data_offset);
+                // The snapshot might be older than the current data
+                mat->dynamic_data_dirty = true;
+                data_mat = mat;
+                data_offset = cmd.dynamic_data_offset;
+            }
+
+            // The transforms of consecutive draws are consecutive in the buffer, so we can
+            // merge them into a single instanced draw.
+            u32 run = 1;
+            if (mat->instanced && cmd.instance_count == 0) {
+                while (i + run < chunk_size && run < UNG_MAX_AUTO_INSTANCES
+                    && can_merge(cmd, state->draw_cmds[sorted[chunk_start + i + run].cmd_idx])) {
+                    run++;
+                }
             }
+
+            const auto transform_offset = base_offset + i * (u32)sizeof(UTransform);
+            const auto instance_count = run > 1 ? run : cmd.instance_count;
+            draw(mat, geom, cmd.lod, transform_offset,
+                state->draw_overrides.data + cmd.first_override, cmd.num_overrides, instance_count);
+            i += run;
         }
     }
 
-    ung_resource_wait_ready(mat->resource);
+    clear_draw_queue();
+}
 
-    if (geom->instance_buffer.id) {
-        auto buf = get(state->instance_buffers, geom->instance_buffer.id);
-        params.instance_count = buf->num_instances;
+EXPORT ung_cmdlist_id ung_cmdlist_create()
+{
+    const auto [id, list] = state->cmdlists.insert();
+    list->cmds.init(256);
+    list->transforms.init(256);
+    list->keys.init(256);
+    list->bounds.init(256);
+    list->overrides.init(64);
+    return { id };
+}
+
+EXPORT void ung_cmdlist_destroy(ung_cmdlist_id list_id)
+{
+    auto list = get(state->cmdlists, list_id.id);
+    list->cmds.free();
+    list->transforms.free();
+    list->keys.free();
+    list->bounds.free();
+    list->overrides.free();
+    state->cmdlists.remove(list_id.id);
+}
+
+EXPORT void ung_cmdlist_begin(ung_cmdlist_id list_id, ung_camera_id camera, bool cull)
+{
+    auto list = get(state->cmdlists, list_id.id);
+    const auto cam = get_camera(camera.id);
+    list->view = cam->view;
+    list->projection = cam->projection;
+    list->cull = cull;
+    if (cull) {
+        um_get_frustum(um_mat_mul(cam->projection, cam->view), list->frustum);
     }
+    list->num_culled = 0;
+    list->cmds.clear();
+    list->transforms.clear();
+    list->keys.clear();
+    list->bounds.clear();
+    list->overrides.clear();
+}
 
-    mugfx_draw_instanced(mat->material, geom->geometry, draw_bindings.data(), draw_bindings.size(),
-        params.instance_count);
+// This may run on any thread, so it must not touch anything the main thread might change (e.g.
+// materials or instance buffers).
+EXPORT void ung_cmdlist_draw(ung_cmdlist_id list_id, ung_material_id material,
+    ung_geometry_id geometry, const float transform[16], ung_draw_params params)
+{
+    auto list = get(state->cmdlists, list_id.id);
+    const auto geom = get(state->geometries, geometry.id);
+
+    DrawCmd cmd {};
+    cmd.material = material;
+    cmd.geometry = geometry;
+    cmd.transform = transform ? um_mat_from_ptr(transform) : um_mat_identity();
+    cmd.instance_count = params.instance_count; // instance buffers are resolved in submit
+
+    const auto bounds = get_world_bounds(
+        geom, cmd.transform, geom->instance_buffer.id ? 1 : params.instance_count);
+    if (list->cull && !um_sphere_in_frustum(bounds, list->frustum, 6)) {
+        list->num_culled++;
+        return;
+    }
+
+    cmd.first_override = list->overrides.size;
+    cmd.num_overrides = (u32)params.num_binding_overrides;
+    for (size_t i = 0; i < params.num_binding_overrides; ++i) {
+        list->overrides.push(params.binding_overrides[i]);
+    }
+
+    list->keys.push(draw_sort_key(cmd, list->overrides.data + cmd.first_override, list->view));
+    list->transforms.push({});
+    compute_transform(list->transforms.last(), get_model_matrix(geom, cmd.transform), list->view,
+        list->projection);
+    list->bounds.push(bounds);
+    list->cmds.push(cmd);
+}
+
+static void submit_queued(const CmdList* list)
+{
+    for (u32 i = 0; i < list->cmds.size; ++i) {
+        auto cmd = list->cmds[i];
+        if (!resolve_loading_material(cmd.material)) {
+            continue;
+        }
+        auto mat = get(state->materials, cmd.material.id);
+        auto geom = get(state->geometries, cmd.geometry.id);
+        cmd.instance_count = get_instance_count(geom, cmd.instance_count);
+
+        const auto overrides = list->overrides.data + cmd.first_override;
+        cmd.first_override = state->draw_overrides.size;
+        for (u32 o = 0; o < cmd.num_overrides; ++o) {
+            state->draw_overrides.push(overrides[o]);
+        }
+
+        snapshot_dynamic_data(mat, cmd);
+        cmd.transform_data = &list->transforms[i];
+
+        if (state->cull_draws) {
+            push_draw_bounds(list->bounds[i]);
+        }
+        cmd.lod = select_lod(geom, list->bounds[i]);
+
+        // The material might have been replaced by the loading fallback
+        const auto key = cmd.material.id == list->cmds[i].material.id
+            ? list->keys[i]
+            : draw_sort_key(cmd, overrides, list->view);
+        state->draw_keys.push({ key, state->draw_cmds.size });
+        state->draw_cmds.push(cmd);
+    }
+}
+
+static void submit_immediate(const CmdList* list)
+{
+    const auto count = list->cmds.size;
+    const auto max_chunk_size = state->u_transform_buf_size / (u32)sizeof(UTransform);
+    for (u32 chunk_start = 0; chunk_start < count; chunk_start += max_chunk_size) {
+        // The transforms are already computed, so they can be uploaded all at once
+        const auto chunk_size = std::min(count - chunk_start, max_chunk_size);
+        const auto base_offset = reserve_transforms(chunk_size);
+        mugfx_buffer_update(state->u_transform_buf, base_offset,
+            { list->transforms.data + chunk_start, chunk_size * sizeof(UTransform) });
+
+        for (u32 i = 0; i < chunk_size; ++i) {
+            auto cmd = list->cmds[chunk_start + i];
+            if (!resolve_loading_material(cmd.material)) {
+                continue;
+            }
+            if (state->cull_draws
+                && !um_sphere_in_frustum(list->bounds[chunk_start + i], state->frustum, 6)) {
+                state->frame_stats.objects_culled++;
+                continue;
+            }
+
+            auto mat = get(state->materials, cmd.material.id);
+            auto geom = get(state->geometries, cmd.geometry.id);
+            if (mat->dynamic_data_dirty && mat->dynamic_data) {
+                upload_dynamic_data(mat, mat->dynamic_data);
+                mat->dynamic_data_dirty = false;
+            }
+
+            draw(mat, geom, select_lod(geom, list->bounds[chunk_start + i]),
+                base_offset + i * (u32)sizeof(UTransform),
+                list->overrides.data + cmd.first_override, cmd.num_overrides,
+                get_instance_count(geom, cmd.instance_count));
+            state->frame_stats.objects_drawn++;
+        }
+    }
+}
+
+EXPORT void ung_cmdlist_submit(ung_cmdlist_id list_id)
+{
+    ProfScope prof("ung_cmdlist_submit");
+    const auto list = get(state->cmdlists, list_id.id);
+    state->frame_stats.objects_culled += list->num_culled;
+    if (state->queue_draws) {
+        submit_queued(list);
+    } else {
+        submit_immediate(list);
+    }
 }
 
 EXPORT void ung_end_pass()
 {
+    if (state->queue_draws) {
+        flush_draw_queue();
+        state->queue_draws = false;
+    }
+    profiler::end_pass();
     mugfx_end_pass();
+    ung_profiler_pop();
 }
 
 void end_frame()
@@ -278,4 +955,17 @@ void end_frame()
     mugfx_end_frame();
 }
 
+EXPORT ung_frame_stats ung_get_frame_stats()
+{
+    auto stats = state->frame_stats;
+    const auto live = [](MemTag tag) {
+        return (u64)std::max<i64>(allocated_bytes[(size_t)tag].load(std::memory_order_relaxed), 0);
+    };
+    stats.memory_core = live(MemTag::Core);
+    stats.memory_mugfx = live(MemTag::Mugfx);
+    stats.memory_text = live(MemTag::Text);
+    stats.memory_malloc = live(MemTag::Malloc);
+    return stats;
+}
+
 }
@@ -4,6 +4,8 @@
 
 #include <um.hpp>
 
+#include <algorithm>
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
 #include <thread>
@@ -17,6 +19,13 @@
 // Iteration still requires locking a mutex, because insertion might partially initialize the Pool.
 // The resource key map needs to be protected as well.
 
+namespace ung::files {
+bool watch(const char* path);
+void unwatch(const char* path);
+bool get_changed_paths(std::span<char* const>& paths);
+bool is_changed(std::span<char* const> changed_paths, const char* path);
+}
+
 namespace ung::resource {
 
 static bool is_main_thread()
@@ -29,10 +38,13 @@ struct DecodeThreadPool {
     struct Task {
         decltype(ung_resource_type_desc::decode) decode;
         ung_resource_id self;
+        i32 priority;
+        u64 seq; // tasks with equal priority are decoded in order
     };
 
     Array<std::jthread> threads;
-    Vector<Task> tasks;
+    Vector<Task> tasks; // max-heap
+    u64 next_seq;
     std::condition_variable_any tasks_cv;
     std::mutex tasks_mtx;
 
@@ -40,26 +52,31 @@ struct DecodeThreadPool {
     void start();
     void stop();
     void push(Task task);
+    void promote(ung_resource_id id);
+    bool cancel(ung_resource_id id);
 };
 
 struct ResourceType {
     const char* name;
     decltype(ung_resource_type_desc::decode) decode;
     decltype(ung_resource_type_desc::upload) upload;
+    decltype(ung_resource_type_desc::can_upload) can_upload;
     decltype(ung_resource_type_desc::get_error) get_error;
     decltype(ung_resource_type_desc::cleanup_load) cleanup_load;
     decltype(ung_resource_type_desc::destroy) destroy;
-    FlatMap<std::string_view, ung_resource_id> map; // put this into state instead?
+    StrMap<ung_resource_id> map; // keys are interned in State::keys
 };
 
 struct FileDep {
     char* path;
     u64 mtime;
+    bool polled; // files::watch failed
 };
 
 struct Resource {
     enum class State {
         DecodeQueued,
+        Cancelled, // destroyed while DecodeQueued
         Decoding,
         Decoded,
         Error,
@@ -67,9 +84,10 @@ struct Resource {
     };
 
     ResourceType* type;
-    char* key;
+    const char* key; // interned
     void* instance;
     u32 version;
+    i32 priority;
     bool ready;
     Vector<FileDep> file_deps;
     Vector<ung_resource_id> res_deps;
@@ -86,10 +104,16 @@ struct Resource {
 struct State {
     Pool<ResourceType> resource_types;
     Pool<Resource> resources;
+    // Keys are never freed, because the same keys are usually loaded again (e.g. on level change)
+    StrInterner keys;
     std::mutex resource_mtx;
     std::condition_variable decoded_cv;
     DecodeThreadPool decode_pool;
     float next_reload_check;
+    u32 num_polled_file_deps; // main thread only
+    u32 upload_budget_us;
+    u32 finish_cursor; // position in the alive list to continue finish_resources from
+    std::atomic<u64> num_decodes; // since the last begin_frame, for ung_frame_stats
 };
 
 State* state = nullptr;
@@ -121,8 +145,14 @@ static void pop_current_resource()
     current_resource_stack().pop();
 }
 
+static bool task_less(const DecodeThreadPool::Task& a, const DecodeThreadPool::Task& b)
+{
+    return a.priority < b.priority || (a.priority == b.priority && a.seq > b.seq);
+}
+
 void DecodeThreadPool::worker(std::stop_token stop)
 {
+    ung_profiler_set_thread_name("decode");
     while (!stop.stop_requested()) {
         Task task;
         {
@@ -132,24 +162,31 @@ void DecodeThreadPool::worker(std::stop_token stop)
                 return;
             }
 
-            task = std::move(tasks[0]);
-            remove(tasks, 0);
+            std::pop_heap(tasks.begin(), tasks.end(), task_less);
+            task = tasks[tasks.size - 1];
+            tasks.size--;
         }
 
         void* instance = nullptr;
+        const char* type_name = nullptr;
         {
             ResourceLock lock;
             const auto res = state->resources.find(task.self.id);
-            if (!res) {
-                continue; // likely destroyed
+            // The resource might have been destroyed after we popped the task
+            if (!res || res->pending_state == Resource::State::Cancelled) {
+                continue;
             }
             // Do not modify state if this is a reload.
             res->pending_state = Resource::State::Decoding;
             instance = res->instance;
+            type_name = res->type->name;
             push_current_resource(res);
         }
 
+        ung_profiler_push(type_name);
         auto decoded = task.decode(task.self, instance);
+        ung_profiler_pop();
+        state->num_decodes.fetch_add(1, std::memory_order_relaxed);
 
         {
             pop_current_resource();
@@ -183,11 +220,41 @@ void DecodeThreadPool::push(Task task)
 {
     {
         std::lock_guard lock(tasks_mtx);
-        tasks.push(std::move(task));
+        task.seq = next_seq++;
+        tasks.push(task);
+        std::push_heap(tasks.begin(), tasks.end(), task_less);
     }
     tasks_cv.notify_one();
 }
 
+void DecodeThreadPool::promote(ung_resource_id id)
+{
+    std::lock_guard lock(tasks_mtx);
+    for (auto& task : tasks) {
+        if (task.self.id == id.id) {
+            task.priority = INT32_MAX;
+            // Rare enough, so we don't bother sifting up
+            std::make_heap(tasks.begin(), tasks.end(), task_less);
+            return;
+        }
+    }
+}
+
+// Returns false if the task has already been popped by a worker
+bool DecodeThreadPool::cancel(ung_resource_id id)
+{
+    std::lock_guard lock(tasks_mtx);
+    for (u32 i = 0; i < tasks.size; ++i) {
+        if (tasks[i].self.id == id.id) {
+            tasks[i] = tasks[tasks.size - 1];
+            tasks.size--;
+            std::make_heap(tasks.begin(), tasks.end(), task_less);
+            return true;
+        }
+    }
+    return false;
+}
+
 static const char* resource_name(Resource& res)
 {
     return res.key ? res.key : res.type->name;
@@ -198,12 +265,15 @@ static Resource& get_res(ung_resource_id res)
     return *get(state->resources, res.id);
 }
 
-static void wait_for_decode(ResourceLock& lock, Resource& res)
+static void wait_for_decode(ResourceLock& lock, ung_resource_id id, Resource& res)
 {
     // This is just insurance, should not be needed.
     if (res.pending_state == Resource::State::Ready) {
         return;
     }
+    if (res.pending_state == Resource::State::DecodeQueued) {
+        state->decode_pool.promote(id);
+    }
     state->decoded_cv.wait(lock.lock, [&res]() {
         const auto state = res.pending_state.load();
         return state == Resource::State::Decoded || state == Resource::State::Error;
@@ -235,6 +305,15 @@ static void update_dependencies(ung_resource_id id, Resource& res)
 
 static void remove_deps(ung_resource_id id, Resource& res)
 {
+    if (ung::state->auto_reload) {
+        for (const auto& dep : res.file_deps) {
+            if (dep.polled) {
+                state->num_polled_file_deps--;
+            } else {
+                files::unwatch(dep.path);
+            }
+        }
+    }
     free(res.file_deps);
 
     for (auto& dep : res.res_deps) {
@@ -250,14 +329,17 @@ static void destroy(ResourceLock& lock, ung_resource_id id, Resource& res)
 
     if (res.key) {
         res.type->map.remove(res.key);
-        deallocate_string(res.key);
     }
 
     // This will destroy the instance, which the decode thread might be using right now, so we need
     // to wait. If we are uninitialized yet, decoding has not started and we don't need to wait (and
     // it cannot start, because it needs the mutex).
-    if (res.pending_state == Resource::State::Decoding) {
-        wait_for_decode(lock, res);
+    if (res.pending_state == Resource::State::DecodeQueued) {
+        // If a worker popped the task already, it's waiting for the lock and will see this state.
+        state->decode_pool.cancel(id);
+        res.pending_state = Resource::State::Cancelled;
+    } else if (res.pending_state == Resource::State::Decoding) {
+        wait_for_decode(lock, id, res);
     }
 
     // Relax mutex for callbacks (to avoid deadlocks)
@@ -295,6 +377,12 @@ static void commit_deps(ung_resource_id id, Resource& res)
 
     res.file_deps = res.pending_file_deps;
     res.pending_file_deps = {};
+    if (ung::state->auto_reload) {
+        for (auto& dep : res.file_deps) {
+            dep.polled = !files::watch(dep.path);
+            state->num_polled_file_deps += dep.polled;
+        }
+    }
     res.res_deps = res.pending_res_deps;
     res.pending_res_deps = {};
     update_dependencies(id, res);
@@ -305,7 +393,9 @@ static void upload(ung_resource_id id, Resource& res)
     assert(res.pending_state.load() == Resource::State::Decoded);
     if (res.type->upload) {
         push_current_resource(&res);
+        ung_profiler_push(res.type->name);
         const auto success = res.type->upload(id, res.instance);
+        ung_profiler_pop();
         pop_current_resource();
 
         if (!success) {
@@ -387,11 +477,14 @@ static void start_load(ung_resource_id id, Resource& res)
     if (res.type->decode) {
         res.pending_state = Resource::State::DecodeQueued;
         if (ung::state->async_decode) {
-            state->decode_pool.push({ res.type->decode, { id } });
+            state->decode_pool.push({ res.type->decode, { id }, res.priority });
         } else {
             res.pending_state = Resource::State::Decoding;
             push_current_resource(&res);
+            ung_profiler_push(res.type->name);
             auto decoded = res.type->decode(id, res.instance);
+            ung_profiler_pop();
+            state->num_decodes.fetch_add(1, std::memory_order_relaxed);
             pop_current_resource();
             res.pending_state = decoded ? Resource::State::Decoded : Resource::State::Error;
         }
@@ -413,75 +506,150 @@ void init(ung_init_params params)
 
     if (!params.max_num_resources) {
         params.max_num_resources = params.max_num_textures + params.max_num_shaders
-            + params.max_num_geometries + params.max_num_materials + params.max_num_sound_sources;
+            + params.max_num_geometries + params.max_num_materials + params.max_num_sound_sources
+            + params.max_num_models;
     }
 
     state->resource_types.init(params.max_num_resource_types);
     state->resources.init(params.max_num_resources);
+    state->keys.init(params.max_num_resources);
+    state->upload_budget_us = params.resource_upload_budget_us;
 
     state->decode_pool.start();
 }
 
-static void check_reload()
+static void check_file_deps()
 {
+    // If we get change notifications, we only look at the files that might have changed.
+    // Otherwise we poll every file every so often.
+    // Files that could not be watched are always polled.
+    std::span<char* const> changed_paths;
+    const auto poll_all = !files::get_changed_paths(changed_paths);
+    const auto poll = (poll_all || state->num_polled_file_deps)
+        && state->next_reload_check <= ung_get_time();
+    if (!poll && changed_paths.empty()) {
+        return;
+    }
+    if (poll) {
+        state->next_reload_check = ung_get_time() + 0.5f;
+    }
+
     ResourceLock lock;
-    for (u32 i = 0; i < state->resources.keys.size; ++i) {
-        if (state->resources.contains(state->resources.keys[i])) {
-            auto& res = state->resources.data[i];
-            for (u32 f = 0; f < res.file_deps.size; ++f) {
-                const auto mtime = ung_file_get_mtime(res.file_deps[f].path);
-                if (res.file_deps[f].mtime != mtime) {
-                    printf("File changed: %s\n", res.file_deps[f].path);
-                    res.file_deps[f].mtime = mtime;
-                    mark_needs_reload(res);
-                }
+    state->resources.for_each([&](u64, Resource& res) {
+        for (u32 f = 0; f < res.file_deps.size; ++f) {
+            const auto polled = poll_all || res.file_deps[f].polled;
+            if (polled ? !poll : !files::is_changed(changed_paths, res.file_deps[f].path)) {
+                continue;
+            }
+            const auto mtime = ung_file_get_mtime(res.file_deps[f].path);
+            if (res.file_deps[f].mtime != mtime) {
+                printf("File changed: %s\n", res.file_deps[f].path);
+                res.file_deps[f].mtime = mtime;
+                mark_needs_reload(res);
             }
         }
-    }
+    });
+}
 
-    for (u32 i = 0; i < state->resources.keys.size; ++i) {
-        if (state->resources.contains(state->resources.keys[i])) {
-            auto& res = state->resources.data[i];
-            if (res.needs_reload && res.pending_state == Resource::State::Ready
-                && deps_up_to_date(res)) {
-                printf("Reloading: %s\n", resource_name(res));
-                start_load({ state->resources.get_key(i) }, res);
-                // Reload at most one resource per frame
-                break;
-            }
+static void check_reload()
+{
+    check_file_deps();
+
+    ResourceLock lock;
+    for (u32 n = 0; n < state->resources.size(); ++n) {
+        const auto i = state->resources.alive_index(n);
+        auto& res = state->resources.data[i];
+        if (res.needs_reload && res.pending_state == Resource::State::Ready
+            && deps_up_to_date(res)) {
+            printf("Reloading: %s\n", resource_name(res));
+            start_load({ state->resources.get_key(i) }, res);
+            // Reload at most one resource per frame
+            break;
         }
     }
 }
 
+static bool needs_finish(const Resource& res)
+{
+    const auto rstate = res.pending_state.load();
+    return rstate == Resource::State::Decoded || rstate == Resource::State::Error;
+}
+
 static void finish_resources()
 {
     // Some resources are reloaded and then never waited on again (e.g. shaders), so we have to
     // finish them here.
-    StaticVector<ung_resource_id, 64> finish_resources = {};
+    // We continue where the last frame stopped, so every resource gets its turn even if there are
+    // more finished resources than fit in here or the upload budget is exhausted.
+    // Only the alive resources are visited, so this is cheap even if the pool is mostly empty.
+    struct Finish {
+        ung_resource_id id;
+        u32 pos; // in the alive list, for finish_cursor
+    };
+    StaticVector<Finish, 64> finish_resources = {};
+    u32 num_pending = 0;
+    u32 num_waiting = 0;
     {
         // decode might insert into resources, so when we iterate them, we need a lock.
         ResourceLock lock;
-        for (u32 i = 0; i < state->resources.keys.size; ++i) {
-            finish_resources.append() = { state->resources.get_key(i) };
-            if (finish_resources.size() == finish_resources.capacity()) {
-                break; // let's get them next time
+        const auto num_alive = state->resources.size();
+        for (u32 n = 0; n < num_alive; ++n) {
+            const auto pos = (state->finish_cursor + n) % num_alive;
+            const auto i = state->resources.alive_index(pos);
+            if (needs_finish(state->resources.data[i])) {
+                if (finish_resources.size() < finish_resources.capacity()) {
+                    finish_resources.append() = { { state->resources.keys[i] }, pos };
+                } else {
+                    num_pending++;
+                }
             }
         }
     }
-    for (auto& res_id : finish_resources) {
+
+    using clock = std::chrono::steady_clock;
+    const auto start = clock::now();
+    const auto elapsed_us = [start]() {
+        return (u64)std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start)
+            .count();
+    };
+
+    u32 num_finished = 0;
+    for (u32 f = 0; f < finish_resources.size(); ++f) {
+        const auto [res_id, pos] = finish_resources[f];
+        if (state->upload_budget_us && num_finished > 0
+            && elapsed_us() >= state->upload_budget_us) {
+            num_pending += (u32)finish_resources.size() - f;
+            break;
+        }
         // It might have been destroyed by an earlier iteration of finish_load
         if (auto res = state->resources.find(res_id.id)) {
+            // This is called without the lock, because it might load other resources
+            if (res->pending_state == Resource::State::Decoded && res->type->can_upload
+                && !res->type->can_upload(res_id, res->instance)) {
+                num_waiting++;
+                continue;
+            }
             finish_load(res_id, *res);
         }
+        // The alive list might have changed in finish_load, but this only affects fairness
+        state->finish_cursor = pos + 1;
+        num_finished++;
     }
+
+    ung::state->frame_stats.resource_uploads += num_finished;
+    ung::state->frame_stats.resource_upload_us += num_finished ? elapsed_us() : 0;
+    ung::state->frame_stats.resource_uploads_pending += num_pending;
+    ung::state->frame_stats.resource_uploads_waiting += num_waiting;
 }
 
 void begin_frame()
 {
     assert(is_main_thread());
+    ProfScope prof("resource::begin_frame");
+    ung::state->frame_stats.resource_decodes
+        += state->num_decodes.exchange(0, std::memory_order_relaxed);
 
-    if (ung::state->auto_reload && state->next_reload_check <= ung_get_time()) {
-        state->next_reload_check = ung_get_time();
+    if (ung::state->auto_reload) {
         check_reload();
     }
 
@@ -493,6 +661,9 @@ void begin_frame()
 void shutdown()
 {
     state->decode_pool.stop();
+
+    state->resource_types.for_each([](u64, ResourceType& type) { type.map.free(); });
+    state->keys.free();
 }
 
 EXPORT ung_resource_type_id ung_resource_type_register(ung_resource_type_desc desc)
@@ -502,6 +673,7 @@ EXPORT ung_resource_type_id ung_resource_type_register(ung_resource_type_desc de
     type->name = desc.type_name;
     type->decode = desc.decode;
     type->upload = desc.upload;
+    type->can_upload = desc.can_upload;
     type->get_error = desc.get_error;
     type->cleanup_load = desc.cleanup_load;
     type->destroy = desc.destroy;
@@ -511,6 +683,12 @@ EXPORT ung_resource_type_id ung_resource_type_register(ung_resource_type_desc de
 
 EXPORT ung_resource_load_result ung_resource_load(
     ung_resource_type_id res_type, const char* key, void* instance)
+{
+    return ung_resource_load_ex(res_type, key, instance, {});
+}
+
+EXPORT ung_resource_load_result ung_resource_load_ex(ung_resource_type_id res_type,
+    const char* key, void* instance, ung_resource_load_params params)
 {
     ResourceLock lock;
     const auto type = state->resource_types.find(res_type.id);
@@ -528,9 +706,14 @@ EXPORT ung_resource_load_result ung_resource_load(
     const auto [id, res] = state->resources.insert();
     res->type = type;
     res->instance = instance;
-    res->key = key ? allocate_string(key) : nullptr;
+    res->key = key ? state->keys.intern(key).data() : nullptr;
     res->pending_state = Resource::State::DecodeQueued;
     res->version = 0;
+    res->priority = params.priority;
+    if (current_resource()) {
+        // Otherwise a dependency might be waiting behind lower priority resources
+        res->priority = std::max(res->priority, current_resource()->priority);
+    }
     res->dependents.init(1);
     if (key) {
         type->map.insert(res->key, { id });
@@ -586,6 +769,7 @@ EXPORT void ung_resource_depend_file(const char* path)
     current_resource()->pending_file_deps.push({
         allocate_string(path),
         ung_file_get_mtime(path),
+        false,
     });
 }
 
@@ -604,6 +788,11 @@ EXPORT uint32_t ung_resource_version(ung_resource_id res)
     return get_res(res).version;
 }
 
+EXPORT bool ung_resource_is_ready(ung_resource_id res)
+{
+    return get_res(res).ready;
+}
+
 EXPORT void ung_resource_wait_ready(ung_resource_id id)
 {
     assert(is_main_thread());
@@ -618,7 +807,7 @@ EXPORT void ung_resource_wait_ready(ung_resource_id id)
         return;
     } else {
         ResourceLock lock;
-        wait_for_decode(lock, res);
+        wait_for_decode(lock, id, res);
     }
 
     finish_load(id, res);
@@ -13,6 +13,7 @@ struct ShaderPending {
     size_t source_size;
 
     mugfx_shader_create_params params;
+    bool instanced;
     const char* error;
 
     void free() { deallocate(source_data, source_size); }
@@ -77,6 +78,26 @@ static constexpr std::string_view UngTransform
 };
 )";
 
+// If a vertex shader defines UNG_INSTANCED before including UngTransform, it gets an array of
+// transforms indexed by gl_InstanceID instead, so draws can be merged into instanced draws.
+static constexpr std::string_view UngTransformInstanced = R"(struct UngTransformData {
+    mat4 model;
+    mat4 model_view;
+    mat4 model_view_projection;
+    mat4 normal_matrix;
+};
+
+layout (binding = 2, std140) uniform UngTransform {
+    UngTransformData ung_transforms[64];
+};
+
+#define model (ung_transforms[gl_InstanceID].model)
+#define model_view (ung_transforms[gl_InstanceID].model_view)
+#define model_view_projection (ung_transforms[gl_InstanceID].model_view_projection)
+#define normal_matrix (ung_transforms[gl_InstanceID].normal_matrix)
+)";
+static_assert(UNG_MAX_AUTO_INSTANCES == 64);
+
 static void append(Formatter& fmt, std::string_view str)
 {
     if (!fmt.fits(str.size())) {
@@ -106,14 +127,19 @@ static const char* nullterm(std::string_view str)
 }
 
 // Returns an owning span
-static std::span<char> process_pragmas(std::string_view src)
+static std::span<char> process_pragmas(std::string_view src, bool* instanced)
 {
     const auto buf_size = src.size() + 1;
     Formatter fmt { std::span { allocate<char>(buf_size), buf_size } };
     u32 line_num = 1;
+    *instanced = false;
     while (src.size()) {
         const auto nl = src.find('\n');
         auto line = ltrim(src.substr(0, nl));
+        auto define = line;
+        if (expect(define, "#define") && trim(define) == "UNG_INSTANCED") {
+            *instanced = true;
+        }
         if (expect(line, "#pragma ung-")) {
             if (expect(line, "include ")) {
                 const auto name = trim(line);
@@ -124,7 +150,7 @@ static std::span<char> process_pragmas(std::string_view src)
                     append(fmt, UngPass);
                     append_line_directive(fmt, line_num + 1);
                 } else if (name == "UngTransform") {
-                    append(fmt, UngTransform);
+                    append(fmt, *instanced ? UngTransformInstanced : UngTransform);
                     append_line_directive(fmt, line_num + 1);
                 } else if (name.size() > 2 && name[0] == '"') {
                     const auto path = nullterm(name.substr(1, name.size() - 2));
@@ -235,7 +261,8 @@ static bool res_shader_decode(ung_resource_id self, void* instance)
         return false;
     }
 
-    const auto processed = process_pragmas(std::string_view(file_data, file_size));
+    const auto processed
+        = process_pragmas(std::string_view(file_data, file_size), &pending->instanced);
     ung_free_file_data(file_data, file_size);
     if (processed.empty()) {
         pending->error = "Could not process pragmas";
@@ -272,6 +299,7 @@ static bool res_shader_upload(ung_resource_id self, void* instance)
         mugfx_shader_destroy(shader->shader);
     }
     shader->shader = mugfx_shader;
+    shader->instanced = pending->instanced;
 
     return true;
 }
@@ -325,7 +353,8 @@ static ung_resource_type_id shader_resource()
 
 EXPORT ung_shader_id ung_shader_create(mugfx_shader_create_params params)
 {
-    const auto processed = process_pragmas(params.source);
+    bool instanced = false;
+    const auto processed = process_pragmas(params.source, &instanced);
     if (processed.empty()) {
         ung_panic("Failed to process pragmas");
     }
@@ -341,6 +370,7 @@ EXPORT ung_shader_id ung_shader_create(mugfx_shader_create_params params)
     const auto [id, shader] = state->shaders.insert();
     shader->shader = sh;
     shader->stage = params.stage;
+    shader->instanced = instanced;
     return { id };
 }
 
@@ -30,6 +30,7 @@ EXPORT void ung_slotmap_init(ung_slotmap* s)
 {
     assert(s->keys);
     assert(s->capacity < 0xFF'FFFF);
+    assert(!s->alive == !s->alive_pos);
     for (u32 i = 0; i < s->capacity; ++i) {
         // We invalidate on removal and we want to start with generation 1, so we init with 1
         s->keys[i] = FreeMask | make_key(i + 1, 1);
@@ -51,6 +52,10 @@ EXPORT uint64_t ung_slotmap_insert(ung_slotmap* s, uint32_t* oidx)
     const auto gen = ung_slotmap_get_generation(s->keys[idx]);
     s->keys[idx] = make_key(idx, gen);
     *oidx = idx;
+    if (s->alive) {
+        s->alive[s->num_alive] = idx;
+        s->alive_pos[idx] = s->num_alive;
+    }
     s->num_alive++;
     return s->keys[idx];
 }
@@ -92,6 +97,13 @@ EXPORT bool ung_slotmap_remove(ung_slotmap* s, uint64_t key)
     s->keys[idx] = FreeMask | make_key(s->free_list_head, gen + 1);
     s->free_list_head = idx;
     s->num_alive--;
+    if (s->alive) {
+        // swap remove
+        const auto pos = s->alive_pos[idx];
+        const auto last = s->alive[s->num_alive];
+        s->alive[pos] = last;
+        s->alive_pos[last] = pos;
+    }
     return true;
 }
 }
@@ -1,4 +1,8 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cfloat>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 
@@ -19,11 +23,42 @@
  * and whenever I want to play a sound, I take sounds from those.
  * Loaded sounds are reused as much as possible and at some point it should converge so that
  * no ung_sound_play should allocate.
+ *
+ * Independently of that, only max_num_voices sounds are actually mixed. In begin_frame all playing
+ * sounds are sorted by priority and audibility and the ones that don't get a voice are stopped
+ * (virtualized). Their cursor is advanced by hand, so they can be seeked to the right position and
+ * started again when they get a voice back.
+ *
+ * Position updates (ung_sound(s)_update) are not applied directly, but pushed into a ring buffer
+ * that the audio thread drains after it mixed a period, so it doesn't race with the mixer.
+ * Before a ma_sound is reconfigured or uninitialized on the main thread, the ring is flushed.
  */
 
+namespace ung::pack {
+char* read(const char* path, usize* size);
+void free(char* data);
+}
+
 namespace ung::sound {
 struct Sound;
 
+// The resource manager (used for streamed sounds) opens files itself, so we give it a VFS that
+// reads from packs and forwards everything else to the default VFS.
+struct PackVfs {
+    ma_vfs_callbacks cb;
+    ma_default_vfs fallback;
+};
+
+struct VfsFile {
+    char* data; // null if loose file
+    usize size;
+    usize cursor;
+    ma_vfs_file loose;
+};
+
+// Files are opened for every streamed sound
+static BlockPool<VfsFile, 64> vfs_file_pool;
+
 struct SoundSourcePending {
     const char* error;
     void* pcm;
@@ -40,6 +75,8 @@ struct SoundSourcePending {
     }
 };
 
+static BlockPool<SoundSourcePending, 32> pending_pool;
+
 struct SoundSourceResource {
     ung_sound_source_id source;
     // We duplicate some fields here with SoundSource, so we don't have to touch SoundSource in a
@@ -62,6 +99,7 @@ struct SoundSource {
 
     u32 flags;
     u8 group;
+    i32 voice_priority;
 
     // This represents a list of idle sounds for this source.
     // A sound in this list, should be in sounds_idle_lru as well (and vice-versa)!
@@ -95,9 +133,19 @@ struct Sound {
     uint32_t generation;
     bool in_use; // !idle
     bool paused;
+
+    um_vec3 position; // last position set on the main thread, the ma_sound might lag behind
+
+    // A virtual sound is in use and not paused, but its ma_sound is stopped. virtual_cursor is the
+    // playback position in seconds, which is advanced in begin_frame.
+    bool is_virtual;
+    float virtual_cursor;
+    i32 priority;
+    float audibility; // volume after distance attenuation, updated in begin_frame
 };
 
 struct State {
+    PackVfs vfs;
     ma_engine sound_engine;
     Pool<SoundSource> sound_sources;
     Array<Sound> sounds;
@@ -114,6 +162,12 @@ struct State {
     Sound* free_sounds_head; // unused sounds (remove only)
 
     ung_sound_spatial_params spatial_params;
+
+    Array<Sound*> voices; // playing sounds, sorted in begin_frame
+    u32 max_num_voices;
+    u32 num_voices; // from begin_frame + the sounds started since then
+    float audible_volume;
+    ma_uint64 engine_time; // in PCM frames, at the last begin_frame
 };
 
 State* state;
@@ -206,18 +260,163 @@ static void source_idle_remove(SoundSource* source, Sound* sound)
     sound->source_idle_next = nullptr;
 }
 
+struct SoundCommand {
+    Sound* sound;
+    um_vec3 position;
+    um_vec3 velocity;
+    bool has_velocity;
+};
+
+// Single producer (main thread), single consumer (audio thread, or the main thread in
+// flush_commands while it holds consuming).
+struct CommandQueue {
+    Array<SoundCommand> ring; // size is a power of two
+    std::atomic<u32> head; // next slot to write, only written by the producer
+    std::atomic<u32> tail; // next slot to read, only written by the consumer
+    std::atomic_flag consuming;
+};
+
+static CommandQueue command_queue;
+
+static void drain_commands()
+{
+    auto& q = command_queue;
+    const auto head = q.head.load(std::memory_order_acquire);
+    auto tail = q.tail.load(std::memory_order_relaxed);
+    for (; tail != head; ++tail) {
+        const auto& cmd = q.ring[tail & (q.ring.size - 1)];
+        ma_sound_set_position(&cmd.sound->sound, cmd.position.x, cmd.position.y, cmd.position.z);
+        if (cmd.has_velocity) {
+            ma_sound_set_velocity(
+                &cmd.sound->sound, cmd.velocity.x, cmd.velocity.y, cmd.velocity.z);
+        }
+    }
+    q.tail.store(tail, std::memory_order_release);
+}
+
+// Called by miniaudio on the audio thread at the end of every ma_engine_read_pcm_frames
+static void on_engine_process(void*, float*, ma_uint64)
+{
+    if (command_queue.consuming.test_and_set(std::memory_order_acquire)) {
+        return; // the main thread is flushing
+    }
+    drain_commands();
+    command_queue.consuming.clear(std::memory_order_release);
+}
+
+// Applies all queued commands on the main thread
+static void flush_commands()
+{
+    auto& q = command_queue;
+    if (q.head.load(std::memory_order_relaxed) == q.tail.load(std::memory_order_acquire)) {
+        return;
+    }
+    // The audio thread only holds this while draining, so this is short
+    while (q.consuming.test_and_set(std::memory_order_acquire)) {
+    }
+    drain_commands();
+    q.consuming.clear(std::memory_order_release);
+}
+
+static ma_result vfs_open(ma_vfs* vfs, const char* path, ma_uint32 mode, ma_vfs_file* file)
+{
+    auto pvfs = (PackVfs*)vfs;
+    VfsFile f = {};
+    if (!(mode & MA_OPEN_MODE_WRITE)) {
+        f.data = pack::read(path, &f.size);
+    }
+    if (!f.data) {
+        const auto res = ma_vfs_open(&pvfs->fallback, path, mode, &f.loose);
+        if (res != MA_SUCCESS) {
+            return res;
+        }
+    }
+    auto vf = vfs_file_pool.create();
+    *vf = f;
+    *file = vf;
+    return MA_SUCCESS;
+}
+
+static ma_result vfs_close(ma_vfs* vfs, ma_vfs_file file)
+{
+    auto f = (VfsFile*)file;
+    auto res = MA_SUCCESS;
+    if (f->data) {
+        pack::free(f->data);
+    } else {
+        res = ma_vfs_close(&((PackVfs*)vfs)->fallback, f->loose);
+    }
+    vfs_file_pool.destroy(f);
+    return res;
+}
+
+static ma_result vfs_read(ma_vfs* vfs, ma_vfs_file file, void* dst, size_t size, size_t* num_read)
+{
+    auto f = (VfsFile*)file;
+    if (!f->data) {
+        return ma_vfs_read(&((PackVfs*)vfs)->fallback, f->loose, dst, size, num_read);
+    }
+    const auto n = std::min(size, f->size - f->cursor);
+    std::memcpy(dst, f->data + f->cursor, n);
+    f->cursor += n;
+    if (num_read) {
+        *num_read = n;
+    }
+    return n == 0 && size > 0 ? MA_AT_END : MA_SUCCESS;
+}
+
+static ma_result vfs_seek(ma_vfs* vfs, ma_vfs_file file, ma_int64 offset, ma_seek_origin origin)
+{
+    auto f = (VfsFile*)file;
+    if (!f->data) {
+        return ma_vfs_seek(&((PackVfs*)vfs)->fallback, f->loose, offset, origin);
+    }
+    auto cursor = offset;
+    if (origin == ma_seek_origin_current) {
+        cursor += (ma_int64)f->cursor;
+    } else if (origin == ma_seek_origin_end) {
+        cursor += (ma_int64)f->size;
+    }
+    if (cursor < 0 || cursor > (ma_int64)f->size) {
+        return MA_BAD_SEEK;
+    }
+    f->cursor = (usize)cursor;
+    return MA_SUCCESS;
+}
+
+static ma_result vfs_tell(ma_vfs* vfs, ma_vfs_file file, ma_int64* cursor)
+{
+    auto f = (VfsFile*)file;
+    if (!f->data) {
+        return ma_vfs_tell(&((PackVfs*)vfs)->fallback, f->loose, cursor);
+    }
+    *cursor = (ma_int64)f->cursor;
+    return MA_SUCCESS;
+}
+
+static ma_result vfs_info(ma_vfs* vfs, ma_vfs_file file, ma_file_info* info)
+{
+    auto f = (VfsFile*)file;
+    if (!f->data) {
+        return ma_vfs_info(&((PackVfs*)vfs)->fallback, f->loose, info);
+    }
+    info->sizeInBytes = f->size;
+    return MA_SUCCESS;
+}
+
 void init(ung_init_params params)
 {
     assert(!state);
     state = allocate<State>();
     std::memset(state, 0, sizeof(State));
 
-    auto ma_res = ma_engine_init(nullptr, &state->sound_engine);
-    if (ma_res != MA_SUCCESS) {
-        ung_panicf("Error initializing audio engine: %s", ma_result_description(ma_res));
-    }
-
-    state->sound_sources.init(params.max_num_sound_sources ? params.max_num_sound_sources : 64);
+    ma_default_vfs_init(&state->vfs.fallback, nullptr);
+    state->vfs.cb.onOpen = vfs_open;
+    state->vfs.cb.onClose = vfs_close;
+    state->vfs.cb.onRead = vfs_read;
+    state->vfs.cb.onSeek = vfs_seek;
+    state->vfs.cb.onTell = vfs_tell;
+    state->vfs.cb.onInfo = vfs_info;
 
     state->sounds.init(params.max_num_sounds ? params.max_num_sounds : 64);
     for (u32 i = 0; i < state->sounds.size - 1; ++i) {
@@ -225,6 +424,26 @@ void init(ung_init_params params)
     }
     state->free_sounds_head = &state->sounds[0];
 
+    // Enough for a couple of updates per sound per frame, even if the audio thread is slow
+    command_queue.ring.init(std::bit_ceil(std::max(256u, state->sounds.size * 4)));
+    command_queue.head.store(0);
+    command_queue.tail.store(0);
+
+    auto engine_config = ma_engine_config_init();
+    engine_config.pResourceManagerVFS = &state->vfs;
+    engine_config.onProcess = on_engine_process;
+    auto ma_res = ma_engine_init(&engine_config, &state->sound_engine);
+    if (ma_res != MA_SUCCESS) {
+        ung_panicf("Error initializing audio engine: %s", ma_result_description(ma_res));
+    }
+
+    state->sound_sources.init(params.max_num_sound_sources ? params.max_num_sound_sources : 64);
+
+    state->voices.init(state->sounds.size);
+    state->max_num_voices = params.max_num_voices ? params.max_num_voices : 32;
+    state->audible_volume
+        = params.sound_audible_volume > 0.0f ? params.sound_audible_volume : 0.001f;
+
     state->sound_groups.init(params.num_sound_groups ? params.num_sound_groups : 4);
     for (u32 i = 0; i < state->sound_groups.size; ++i) {
         ma_res = ma_sound_group_init(&state->sound_engine, 0, nullptr, &state->sound_groups[i]);
@@ -246,6 +465,7 @@ void init(ung_init_params params)
 static void sound_set_idle(Sound* sound)
 {
     sound->in_use = false;
+    sound->is_virtual = false;
     sound->generation++;
     // It's possible the sound source has been destroyed since the sound was started
     if (sound->source) {
@@ -254,14 +474,131 @@ static void sound_set_idle(Sound* sound)
     sounds_idle_lru_push_front(sound);
 }
 
+// This mirrors the distance attenuation in miniaudio's spatializer (without cones and direction).
+static float get_audibility(Sound* sound)
+{
+    const auto volume = ma_sound_get_volume(&sound->sound);
+    if (!ma_sound_is_spatialization_enabled(&sound->sound)) {
+        return volume;
+    }
+
+    const auto listener = ma_engine_listener_get_position(&state->sound_engine, 0);
+    const auto pos = sound->position;
+    const auto dx = pos.x - listener.x, dy = pos.y - listener.y, dz = pos.z - listener.z;
+    const auto min_dist = ma_sound_get_min_distance(&sound->sound);
+    const auto max_dist = ma_sound_get_max_distance(&sound->sound);
+    const auto rolloff = ma_sound_get_rolloff(&sound->sound);
+    const auto dist = std::clamp(std::sqrt(dx * dx + dy * dy + dz * dz), min_dist, max_dist);
+    if (min_dist >= max_dist || dist <= 0.0f) {
+        return volume;
+    }
+
+    switch (ma_sound_get_attenuation_model(&sound->sound)) {
+    case ma_attenuation_model_inverse:
+        return volume * min_dist / (min_dist + rolloff * (dist - min_dist));
+    case ma_attenuation_model_linear:
+        return volume
+            * std::max(0.0f, 1.0f - rolloff * (dist - min_dist) / (max_dist - min_dist));
+    case ma_attenuation_model_exponential:
+        return volume * std::pow(dist / min_dist, -rolloff);
+    default:
+        return volume;
+    }
+}
+
+// Returns true if a should get a voice before b
+static bool voice_before(const Sound* a, const Sound* b)
+{
+    if (a->priority != b->priority) {
+        return a->priority > b->priority;
+    }
+    return a->audibility > b->audibility;
+}
+
+static void virtualize(Sound* sound)
+{
+    if (ma_sound_get_cursor_in_seconds(&sound->sound, &sound->virtual_cursor) != MA_SUCCESS) {
+        sound->virtual_cursor = 0.0f;
+    }
+    ma_sound_stop(&sound->sound);
+    sound->is_virtual = true;
+}
+
+static void devirtualize(Sound* sound)
+{
+    ma_sound_seek_to_second(&sound->sound, sound->virtual_cursor);
+    ma_sound_start(&sound->sound);
+    sound->is_virtual = false;
+}
+
+// Returns false if the sound reached its end
+static bool advance_virtual(Sound* sound, float dt)
+{
+    sound->virtual_cursor += dt * ma_sound_get_pitch(&sound->sound);
+    float length = 0.0f;
+    // Streams might not know their length (yet), then they are virtual until they get a voice
+    if (ma_sound_get_length_in_seconds(&sound->sound, &length) != MA_SUCCESS || length <= 0.0f
+        || sound->virtual_cursor < length) {
+        return true;
+    }
+    if (ma_sound_is_looping(&sound->sound)) {
+        sound->virtual_cursor = std::fmod(sound->virtual_cursor, length);
+        return true;
+    }
+    return false;
+}
+
 void begin_frame()
 {
+    ProfScope prof("sound::begin_frame");
+
+    const auto engine_time = ma_engine_get_time_in_pcm_frames(&state->sound_engine);
+    const auto dt = (float)(engine_time - state->engine_time)
+        / (float)ma_engine_get_sample_rate(&state->sound_engine);
+    state->engine_time = engine_time;
+
+    u32 num_playing = 0;
     for (u32 i = 0; i < state->sounds.size; ++i) {
         auto sound = &state->sounds[i];
-        if (sound->in_use && !sound->paused && !ma_sound_is_playing(&sound->sound)) {
+        if (!sound->in_use || sound->paused) {
+            continue;
+        }
+        if (sound->is_virtual) {
+            if (!advance_virtual(sound, dt)) {
+                // The ma_sound was stopped somewhere in the middle, so rewind it for the next play
+                ma_sound_seek_to_pcm_frame(&sound->sound, 0);
+                sound_set_idle(sound);
+                continue;
+            }
+        } else if (!ma_sound_is_playing(&sound->sound)) {
             sound_set_idle(sound);
+            continue;
         }
+        sound->audibility = get_audibility(sound);
+        state->voices[num_playing++] = sound;
     }
+
+    std::sort(state->voices.data, state->voices.data + num_playing, voice_before);
+
+    u32 num_voices = 0;
+    for (u32 i = 0; i < num_playing; ++i) {
+        auto sound = state->voices[i];
+        // Sounds with a voice keep it a little longer, so they don't flip every frame
+        const auto audible_volume
+            = sound->is_virtual ? state->audible_volume : state->audible_volume * 0.5f;
+        if (num_voices < state->max_num_voices && sound->audibility >= audible_volume) {
+            if (sound->is_virtual) {
+                devirtualize(sound);
+            }
+            num_voices++;
+        } else if (!sound->is_virtual) {
+            virtualize(sound);
+        }
+    }
+    state->num_voices = num_voices;
+
+    ung::state->frame_stats.sounds_mixed = num_voices;
+    ung::state->frame_stats.sounds_virtual = num_playing - num_voices;
 }
 
 void shutdown()
@@ -271,13 +608,12 @@ void shutdown()
     }
 
     // destroying the sources should take care of de-initing the sounds
-    for (u32 i = 0; i < state->sound_sources.keys.size; ++i) {
-        if (state->sound_sources.contains(state->sound_sources.keys[i])) {
-            ung_sound_source_destroy({ state->sound_sources.keys[i] });
-        }
+    for (u32 i = state->sound_sources.size(); i-- > 0;) {
+        ung_sound_source_destroy({ state->sound_sources.alive_key(i) });
     }
     state->sounds.free();
     state->sound_sources.free();
+    state->voices.free();
 
     for (u32 i = 0; i < state->sound_groups.size; ++i) {
         ma_sound_group_uninit(&state->sound_groups[i]);
@@ -285,6 +621,7 @@ void shutdown()
     state->sound_groups.free();
 
     ma_engine_uninit(&state->sound_engine);
+    command_queue.ring.free();
 }
 
 EXPORT ung_sound_spatial_params ung_sound_get_default_spatial_params(void)
@@ -313,6 +650,7 @@ static Sound* get_idle_sound()
 static void unload_sound(Sound* sound)
 {
     if (sound->sound_loaded) {
+        flush_commands(); // there might still be commands for this sound
         ma_sound_stop(&sound->sound);
         ma_sound_uninit(&sound->sound);
         sound->sound_loaded = false;
@@ -389,17 +727,34 @@ static bool res_source_decode(ung_resource_id self, void* instance)
 
     ung_resource_depend_file(res->path.data);
 
-    res->pending = allocate<SoundSourcePending>();
+    res->pending = pending_pool.create();
     auto pending = res->pending;
 
     if (res->flags & MA_SOUND_FLAG_STREAM) {
-        // TODO: Maybe validate?
+        // Every sound opens its own stream later, but we make sure here (off the main thread)
+        // that the file exists and is decodable.
+        auto config = ma_decoder_config_init(ma_format_f32, 0, 0);
+        ma_decoder decoder;
+        const auto result = ma_decoder_init_vfs(&state->vfs, res->path.data, &config, &decoder);
+        if (result != MA_SUCCESS) {
+            pending->error = ma_result_description(result);
+            return false;
+        }
+        ma_decoder_uninit(&decoder);
         return true;
     }
 
+    usize file_size = 0;
+    const auto file_data = ung_read_whole_file(res->path.data, &file_size, false);
+    if (!file_data) {
+        pending->error = "Could not read file";
+        return false;
+    }
+
     auto config = ma_decoder_config_init(ma_format_f32, 0, 0);
     const auto result
-        = ma_decode_file(res->path.data, &config, &pending->frame_count, &pending->pcm);
+        = ma_decode_memory(file_data, file_size, &config, &pending->frame_count, &pending->pcm);
+    ung_free_file_data(file_data, file_size);
     if (result != MA_SUCCESS) {
         pending->error = ma_result_description(result);
         return false;
@@ -418,6 +773,7 @@ static void set_free(Sound* sound)
         sounds_idle_lru_remove(sound);
     } else {
         sound->in_use = false;
+        sound->is_virtual = false;
         sound->generation++; // invalidate active user handle
     }
 
@@ -490,7 +846,7 @@ static void res_source_cleanup_load(ung_resource_id self, void* instance)
     auto res = (SoundSourceResource*)instance;
     if (res->pending) {
         res->pending->free();
-        deallocate(res->pending);
+        pending_pool.destroy(res->pending);
         res->pending = nullptr;
     }
 }
@@ -538,23 +894,25 @@ EXPORT ung_sound_source_id ung_sound_source_load(
     fmt.append("-");
     // left out stream and num prewarm on purpose. those are just loading hints.
     fmt.append_hex_obj(params.group);
+    fmt.append_hex_obj(params.voice_priority);
     if (params.spatial_params) {
         fmt.append_hex_obj(*params.spatial_params);
     }
 
     auto source_res = allocate<SoundSourceResource>();
     assign(source_res->path, path);
-    source_res->flags = MA_SOUND_FLAG_DECODE;
-    if (params.stream) {
-        source_res->flags |= MA_SOUND_FLAG_STREAM;
-    }
+    // Streams are initialized asynchronously, so the first pages are decoded on the resource
+    // manager's job thread instead of stalling ung_sound_play.
+    source_res->flags
+        = params.stream ? MA_SOUND_FLAG_STREAM | MA_SOUND_FLAG_ASYNC : MA_SOUND_FLAG_DECODE;
     // prewarm at least one, so we make sure the sound file exists and is
     // decodeable
     source_res->num_prewarm_sounds = params.num_prewarm_sounds ? params.num_prewarm_sounds : 1;
 
     const auto [id, source] = state->sound_sources.insert();
     source_res->source = { id };
-    const auto [res, created] = ung_resource_load(source_resource(), fmt.data(), source_res);
+    const auto [res, created] = ung_resource_load_ex(
+        source_resource(), fmt.data(), source_res, { .priority = params.priority });
 
     if (!created) {
         state->sound_sources.remove(id);
@@ -566,6 +924,7 @@ EXPORT ung_sound_source_id ung_sound_source_load(
     assign(source->path, path);
     source->flags = source_res->flags;
     source->group = params.group;
+    source->voice_priority = params.voice_priority;
 
     if (params.spatial_params) {
         std::memcpy(
@@ -604,6 +963,31 @@ static ma_attenuation_model get_atten_model(ung_sound_attenuation_model model)
     return ma_attenuation_model_none;
 }
 
+// Stops the least important sound with a lower priority than the given one, so it can be reused.
+// The returned sound is in_use = false, but not in any of the idle lists.
+static Sound* steal_sound(i32 priority)
+{
+    Sound* victim = nullptr;
+    for (u32 i = 0; i < state->sounds.size; ++i) {
+        auto sound = &state->sounds[i];
+        if (sound->in_use && sound->priority < priority
+            && (!victim || voice_before(victim, sound))) {
+            victim = sound;
+        }
+    }
+    if (!victim) {
+        return nullptr;
+    }
+
+    ma_sound_stop(&victim->sound);
+    ma_sound_seek_to_pcm_frame(&victim->sound, 0);
+    victim->in_use = false;
+    victim->is_virtual = false;
+    victim->paused = false;
+    victim->generation++; // invalidate active user handle
+    return victim;
+}
+
 EXPORT ung_sound_id ung_sound_play(ung_sound_source_id src_id, ung_sound_play_params params)
 {
     auto source = get(state->sound_sources, src_id.id);
@@ -621,8 +1005,12 @@ EXPORT ung_sound_id ung_sound_play(ung_sound_source_id src_id, ung_sound_play_pa
         return { 0 };
     }
 
+    const auto priority = source->voice_priority + params.priority;
     if (!sound) {
         sound = get_idle_sound();
+        if (!sound) {
+            sound = steal_sound(priority);
+        }
         if (!sound) {
             std::fprintf(stderr, "No idle sounds\n");
             return { 0 }; // no idle sounds at all
@@ -630,11 +1018,15 @@ EXPORT ung_sound_id ung_sound_play(ung_sound_source_id src_id, ung_sound_play_pa
         set_source(sound, source);
     }
 
+    // Queued updates for the previous user of this sound must not overwrite the new position
+    flush_commands();
+
     ma_sound_set_volume(&sound->sound, params.volume != 0.0f ? params.volume : 1.0f);
     ma_sound_set_pitch(&sound->sound, params.pitch != 0.0f ? params.pitch : 1.0f);
     ma_sound_set_looping(&sound->sound, params.loop);
     ma_sound_set_spatialization_enabled(&sound->sound, params.spatial);
     if (params.spatial) {
+        sound->position = um_vec3_from_ptr(params.position);
         ma_sound_set_position(
             &sound->sound, params.position[0], params.position[1], params.position[2]);
         const ung_sound_spatial_params& spatial_params
@@ -650,7 +1042,17 @@ EXPORT ung_sound_id ung_sound_play(ung_sound_source_id src_id, ung_sound_play_pa
     }
 
     sound->paused = false;
-    ma_sound_start(&sound->sound);
+    sound->priority = priority;
+    sound->audibility = get_audibility(sound);
+    // Sounds with a lower priority might be using all the voices, but that is sorted out in the
+    // next begin_frame.
+    sound->is_virtual = state->num_voices >= state->max_num_voices
+        || sound->audibility < state->audible_volume;
+    sound->virtual_cursor = 0.0f;
+    if (!sound->is_virtual) {
+        ma_sound_start(&sound->sound);
+        state->num_voices++;
+    }
 
     sound->in_use = true;
     const auto idx = sound - state->sounds.data;
@@ -669,14 +1071,40 @@ static Sound* get_sound(u64 id)
     return &state->sounds[idx];
 }
 
-EXPORT void ung_sound_update(ung_sound_id snd_id, const float position[3], const float velocity[3])
+EXPORT void ung_sounds_update(
+    const ung_sound_id* sounds, const float* positions, const float* velocities, size_t count)
 {
-    auto sound = get_sound(snd_id.id);
-    if (!sound) {
-        return;
+    auto& q = command_queue;
+    const auto mask = q.ring.size - 1;
+    auto head = q.head.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < count; ++i) {
+        auto sound = get_sound(sounds[i].id);
+        if (!sound) {
+            continue;
+        }
+        sound->position = um_vec3_from_ptr(positions + i * 3);
+
+        if (head - q.tail.load(std::memory_order_acquire) == q.ring.size) {
+            // Full. Publish what we have so far and apply everything ourselves.
+            q.head.store(head, std::memory_order_release);
+            flush_commands();
+        }
+
+        auto& cmd = q.ring[head & mask];
+        cmd.sound = sound;
+        cmd.position = sound->position;
+        cmd.has_velocity = velocities != nullptr;
+        if (velocities) {
+            cmd.velocity = um_vec3_from_ptr(velocities + i * 3);
+        }
+        head++;
     }
-    ma_sound_set_position(&sound->sound, position[0], position[1], position[2]);
-    ma_sound_set_velocity(&sound->sound, velocity[0], velocity[1], velocity[2]);
+    q.head.store(head, std::memory_order_release);
+}
+
+EXPORT void ung_sound_update(ung_sound_id snd_id, const float position[3], const float velocity[3])
+{
+    ung_sounds_update(&snd_id, position, velocity, 1);
 }
 
 EXPORT bool ung_sound_is_playing(ung_sound_id snd_id)
@@ -685,6 +1113,9 @@ EXPORT bool ung_sound_is_playing(ung_sound_id snd_id)
     if (!sound) {
         return false;
     }
+    if (sound->is_virtual) {
+        return !sound->paused;
+    }
     return ma_sound_is_playing(&sound->sound);
 }
 
@@ -697,6 +1128,10 @@ EXPORT void ung_sound_set_paused(ung_sound_id snd_id, bool paused)
 
     sound->paused = paused;
 
+    if (sound->is_virtual) {
+        return; // begin_frame only advances the cursor of virtual sounds that are not paused
+    }
+
     if (paused) {
         ma_sound_stop(&sound->sound);
     } else {
@@ -712,7 +1147,9 @@ EXPORT void ung_sound_stop(ung_sound_id snd_id)
     }
 
     sound->paused = false;
-    ma_sound_stop(&sound->sound);
+    if (!sound->is_virtual) {
+        ma_sound_stop(&sound->sound);
+    }
     ma_sound_seek_to_pcm_frame(&sound->sound, 0);
     sound_set_idle(sound);
 }
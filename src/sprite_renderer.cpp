@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
@@ -5,17 +6,47 @@
 #include "state.hpp"
 #include "types.hpp"
 
+namespace ung::render {
+void draw_immediate(ung_material_id material, ung_geometry_id geometry, const float transform[16],
+    ung_draw_params params);
+}
+
 namespace ung::sprite_renderer {
+// Sprites with different textures are batched by binding up to UNG_SPRITE_MAX_TEXTURES textures
+// (bindings 0 to N-1) and passing an index in the vertex. Binding 0 stays the first texture, so
+// shaders that only sample u_base keep working with a single texture slot.
 static const char* default_sprite_frag = R"(
 layout(binding = 0) uniform sampler2D u_base;
+layout(binding = 1) uniform sampler2D u_tex1;
+layout(binding = 2) uniform sampler2D u_tex2;
+layout(binding = 3) uniform sampler2D u_tex3;
+layout(binding = 4) uniform sampler2D u_tex4;
+layout(binding = 5) uniform sampler2D u_tex5;
+layout(binding = 6) uniform sampler2D u_tex6;
+layout(binding = 7) uniform sampler2D u_tex7;
 
 in vec2 vs_out_texcoord;
 in vec4 vs_out_color;
+flat in int vs_out_texture;
 
 out vec4 frag_color;
 
+// Samplers can't be indexed dynamically in GLSL ES 3.0
+vec4 sample_sprite_texture(vec2 uv) {
+    switch (vs_out_texture) {
+    case 1: return texture(u_tex1, uv);
+    case 2: return texture(u_tex2, uv);
+    case 3: return texture(u_tex3, uv);
+    case 4: return texture(u_tex4, uv);
+    case 5: return texture(u_tex5, uv);
+    case 6: return texture(u_tex6, uv);
+    case 7: return texture(u_tex7, uv);
+    default: return texture(u_base, uv);
+    }
+}
+
 void main() {
-    frag_color = vs_out_color * texture(u_base, vs_out_texcoord);
+    frag_color = vs_out_color * sample_sprite_texture(vs_out_texcoord);
 }
 )";
 
@@ -23,24 +54,43 @@ struct Vertex {
     float x, y;
     uint16_t u, v;
     uint8_t r, g, b, a;
+    uint8_t texture; // slot index
+    uint8_t pad[3];
+};
+
+// The GPU buffers hold this many batches. Every flush appends to them and they are orphaned
+// once per frame (or when they are full), so we never overwrite data a previous draw might still
+// be reading from.
+constexpr u32 NumRingBatches = 4;
+
+struct TextureSlot {
+    ung_texture_id texture;
+    u32 width;
+    u32 height;
 };
 
 struct State {
+    // Current batch. Indices are 32 bit, so we can add the offset of the batch in the GPU buffer
+    // in place before uploading.
     Vertex* vertices;
     size_t num_vertices;
-    uint16_t* indices;
+    u32* indices;
     size_t num_indices;
+    u32 vertex_offset;
+    u32 index_offset;
     mugfx_buffer_id vertex_buffer;
     mugfx_buffer_id index_buffer;
     ung_geometry_id geometry;
-    u32 vertex_offset;
-    u32 index_offset;
+    u32 buffer_vertex_offset;
+    u32 buffer_index_offset;
     ung_material_id current_material;
     ung_material_id next_material;
-    ung_texture_id current_texture;
+    u32 max_texture_slots; // of current_material
+    u32 next_max_texture_slots;
     ung_texture_id next_texture;
-    u32 current_tex_width;
-    u32 current_tex_height;
+    // Textures used by the current batch. Cleared on flush.
+    StaticVector<TextureSlot, UNG_SPRITE_MAX_TEXTURES> slots;
+    u32 current_slot; // of next_texture, if slots is not empty
     ung_shader_id default_frag;
     ung_material_id default_material;
 };
@@ -55,20 +105,23 @@ void init(ung_init_params params)
 
     state->num_vertices
         = params.max_num_sprite_vertices ? params.max_num_sprite_vertices : 16 * 1024;
+    // ung_sprite_add_vertex returns 16 bit indices
+    UNG_OR_PANIC(state->num_vertices <= 0x10000, "max_num_sprite_vertices must be <= 65536");
     state->vertices = allocate<Vertex>(state->num_vertices);
     state->vertex_buffer = mugfx_buffer_create({
         .target = MUGFX_BUFFER_TARGET_ARRAY,
         .usage = MUGFX_BUFFER_USAGE_HINT_STREAM,
-        .data = { .data = nullptr, .length = sizeof(Vertex) * state->num_vertices },
+        .data = { .data = nullptr,
+            .length = sizeof(Vertex) * state->num_vertices * NumRingBatches },
     }),
 
     state->num_indices
         = params.max_num_sprite_indices ? params.max_num_sprite_indices : state->num_vertices / 4;
-    state->indices = allocate<u16>(state->num_indices);
+    state->indices = allocate<u32>(state->num_indices);
     state->index_buffer = mugfx_buffer_create({
         .target = MUGFX_BUFFER_TARGET_INDEX,
         .usage = MUGFX_BUFFER_USAGE_HINT_STREAM,
-        .data = { .data = nullptr, .length = sizeof(u16) * state->num_indices },
+        .data = { .data = nullptr, .length = sizeof(u32) * state->num_indices * NumRingBatches },
     });
 
     state->geometry = ung_geometry_create({
@@ -79,12 +132,13 @@ void init(ung_init_params params)
                     {.location = 0, .components = 2, .type = MUGFX_VERTEX_ATTRIBUTE_TYPE_F32}, // xy
                     {.location = 1, .components = 2, .type = MUGFX_VERTEX_ATTRIBUTE_TYPE_U16_NORM}, // uv
                     {.location = 2, .components = 4, .type = MUGFX_VERTEX_ATTRIBUTE_TYPE_U8_NORM}, // rgba
+                    {.location = 3, .components = 1, .type = MUGFX_VERTEX_ATTRIBUTE_TYPE_U8}, // texture
                 },
             }
         },
         .index_buffer = state->index_buffer,
-        .index_type = MUGFX_INDEX_TYPE_U16,
-        .index_count = (u32)state->num_indices,
+        .index_type = MUGFX_INDEX_TYPE_U32,
+        .index_count = (u32)state->num_indices * NumRingBatches,
     });
 
     state->default_frag = ung_shader_create({
@@ -92,6 +146,13 @@ void init(ung_init_params params)
         .source = default_sprite_frag,
         .bindings = {
             { .type = MUGFX_SHADER_BINDING_TYPE_SAMPLER, .binding = 0 },
+            { .type = MUGFX_SHADER_BINDING_TYPE_SAMPLER, .binding = 1 },
+            { .type = MUGFX_SHADER_BINDING_TYPE_SAMPLER, .binding = 2 },
+            { .type = MUGFX_SHADER_BINDING_TYPE_SAMPLER, .binding = 3 },
+            { .type = MUGFX_SHADER_BINDING_TYPE_SAMPLER, .binding = 4 },
+            { .type = MUGFX_SHADER_BINDING_TYPE_SAMPLER, .binding = 5 },
+            { .type = MUGFX_SHADER_BINDING_TYPE_SAMPLER, .binding = 6 },
+            { .type = MUGFX_SHADER_BINDING_TYPE_SAMPLER, .binding = 7 },
         },
         .debug_label = "ung:default_sprite.frag",
     });
@@ -110,6 +171,23 @@ void init(ung_init_params params)
 
     state->current_material = state->default_material;
     state->next_material = state->default_material;
+    state->max_texture_slots = UNG_SPRITE_MAX_TEXTURES;
+    state->next_max_texture_slots = UNG_SPRITE_MAX_TEXTURES;
+}
+
+static void orphan_buffers()
+{
+    mugfx_buffer_update(state->vertex_buffer, 0, {}); // orphan
+    mugfx_buffer_update(state->index_buffer, 0, {}); // orphan
+    state->buffer_vertex_offset = 0;
+    state->buffer_index_offset = 0;
+}
+
+void begin_frame()
+{
+    if (state->buffer_vertex_offset > 0) {
+        orphan_buffers();
+    }
 }
 
 void shutdown()
@@ -128,28 +206,71 @@ void shutdown()
     state = nullptr;
 }
 
+static u32 find_slot(ung_texture_id texture)
+{
+    for (u32 i = 0; i < state->slots.size(); ++i) {
+        if (state->slots[i].texture.id == texture.id) {
+            return i;
+        }
+    }
+    return UINT32_MAX;
+}
+
+static void add_slot(ung_texture_id texture)
+{
+    auto& slot = state->slots.append();
+    slot.texture = texture;
+    slot.width = 0;
+    slot.height = 0;
+    if (texture.id) {
+        const auto [w, h] = ung_texture_get_size(texture);
+        slot.width = w;
+        slot.height = h;
+    }
+    state->current_slot = (u32)state->slots.size() - 1;
+}
+
+// Only a material change or running out of texture slots flushes the batch
 static void apply_next()
 {
-    const auto mat_changed = state->next_material.id != state->current_material.id;
-    const auto tex_changed = state->next_texture.id != state->current_texture.id;
-    if (mat_changed || tex_changed) {
+    if (state->next_material.id != state->current_material.id) {
         ung_sprite_flush();
+        state->current_material = state->next_material;
+        state->max_texture_slots = state->next_max_texture_slots;
     }
-    if (tex_changed) {
-        const auto [w, h] = ung_texture_get_size(state->next_texture);
-        state->current_tex_width = w;
-        state->current_tex_height = h;
+
+    if (state->slots.size()
+        && state->slots[state->current_slot].texture.id == state->next_texture.id) {
+        return;
+    }
+    const auto slot = find_slot(state->next_texture);
+    if (slot != UINT32_MAX) {
+        state->current_slot = slot;
+        return;
     }
-    state->current_material = state->next_material;
-    state->current_texture = state->next_texture;
+    if (state->slots.size() >= state->max_texture_slots) {
+        ung_sprite_flush();
+    }
+    add_slot(state->next_texture);
 }
 
 EXPORT void ung_sprite_set_material(ung_material_id mat)
 {
-    if (!mat.id) {
-        mat = state->default_material;
+    if (!mat.id || mat.id == state->default_material.id) {
+        ung_sprite_set_material_ex(state->default_material, UNG_SPRITE_MAX_TEXTURES);
+    } else if (mat.id == ung::state->default_text_mat.id) {
+        ung_sprite_set_material_ex(mat, UNG_SPRITE_MAX_TEXTURES);
+    } else {
+        ung_sprite_set_material_ex(mat, 1);
     }
+}
+
+EXPORT void ung_sprite_set_material_ex(ung_material_id mat, uint32_t num_texture_slots)
+{
+    assert(mat.id);
+    assert(num_texture_slots >= 1 && num_texture_slots <= UNG_SPRITE_MAX_TEXTURES);
     state->next_material = mat;
+    state->next_max_texture_slots = num_texture_slots;
 }
 
 EXPORT ung_material_id ung_sprite_get_material()
@@ -180,6 +301,8 @@ EXPORT uint16_t ung_sprite_add_vertex(float x, float y, float u, float v, ung_co
         f2u8norm(color.g),
         f2u8norm(color.b),
         f2u8norm(color.a),
+        (u8)state->current_slot,
+        {},
     };
     return (u16)state->vertex_offset++;
 }
@@ -190,9 +313,19 @@ EXPORT void ung_sprite_add_index(uint16_t idx)
     state->indices[state->index_offset++] = idx;
 }
 
+// Flush early if the batch can't hold another primitive, so it's not limited to one batch
+static void reserve(u32 num_vertices, u32 num_indices)
+{
+    if (state->vertex_offset + num_vertices > state->num_vertices
+        || state->index_offset + num_indices > state->num_indices) {
+        ung_sprite_flush();
+    }
+}
+
 EXPORT void ung_sprite_add_quad(
     float x, float y, float w, float h, ung_texture_region texture, ung_color color)
 {
+    reserve(4, 6);
     const auto tl = ung_sprite_add_vertex(x, y, texture.x, texture.y, color);
     const auto bl = ung_sprite_add_vertex(x, y + h, texture.x, texture.y + texture.h, color);
     const auto tr = ung_sprite_add_vertex(x + w, y, texture.x + texture.w, texture.y, color);
@@ -208,89 +341,131 @@ EXPORT void ung_sprite_add_quad(
     ung_sprite_add_index(tr);
 }
 
-struct vec2 {
-    float x, y;
-};
-
-static vec2 transform_vec2(ung_transform_2d t, float x, float y)
+// Instead of transforming every corner separately, we transform the top left corner and the two
+// edges, so every sprite needs only one sin/cos and the other corners are just additions.
+static void write_sprite(const TextureSlot& slot, u8 slot_idx, ung_transform_2d t,
+    ung_texture_region region, ung_color color)
 {
-    // offset
-    x += t.offset_x;
-    y += t.offset_y;
-
-    // scale
-    x *= t.scale_x;
-    y *= t.scale_y;
-
-    // rotate
+    const auto sx = t.scale_x != 0.0f ? t.scale_x : 1.0f;
+    const auto sy = t.scale_y != 0.0f ? t.scale_y : 1.0f;
     const auto s = sinf(t.rotation);
     const auto c = cosf(t.rotation);
-    const auto rx = x * c - y * s;
-    const auto ry = x * s + y * c;
-
-    // translate
-    x = rx + t.x;
-    y = ry + t.y;
 
-    return vec2 { x, y };
-}
-
-static u16 add_vertex(
-    const vec2& p, ung_transform_2d transform, ung_texture_region region, ung_color color)
-{
-    const auto pos = transform_vec2(transform, p.x * (float)state->current_tex_width * region.w,
-        p.y * (float)state->current_tex_height * region.h);
-    const auto u = region.x + p.x * region.w;
-    const auto v = region.y + p.y * region.h;
-    return ung_sprite_add_vertex(pos.x, pos.y, u, v, color);
+    const auto ox = t.offset_x * sx;
+    const auto oy = t.offset_y * sy;
+    const auto x = t.x + ox * c - oy * s;
+    const auto y = t.y + ox * s + oy * c;
+    const auto w = (float)slot.width * region.w * sx;
+    const auto h = (float)slot.height * region.h * sy;
+    const float ex[2] = { w * c, w * s };
+    const float ey[2] = { -h * s, h * c };
+
+    const auto u0 = f2u16norm(region.x);
+    const auto v0 = f2u16norm(region.y);
+    const auto u1 = f2u16norm(region.x + region.w);
+    const auto v1 = f2u16norm(region.y + region.h);
+    const auto r = f2u8norm(color.r);
+    const auto g = f2u8norm(color.g);
+    const auto b = f2u8norm(color.b);
+    const auto a = f2u8norm(color.a);
+
+    const auto base = state->vertex_offset;
+    auto v = state->vertices + base;
+    v[0] = { x, y, u0, v0, r, g, b, a, slot_idx, {} }; // tl
+    v[1] = { x + ey[0], y + ey[1], u0, v1, r, g, b, a, slot_idx, {} }; // bl
+    v[2] = { x + ex[0], y + ex[1], u1, v0, r, g, b, a, slot_idx, {} }; // tr
+    v[3] = { x + ex[0] + ey[0], y + ex[1] + ey[1], u1, v1, r, g, b, a, slot_idx, {} }; // br
+    state->vertex_offset += 4;
+
+    auto i = state->indices + state->index_offset;
+    i[0] = base + 0;
+    i[1] = base + 1;
+    i[2] = base + 2;
+    i[3] = base + 1;
+    i[4] = base + 3;
+    i[5] = base + 2;
+    state->index_offset += 6;
 }
 
 EXPORT void ung_sprite_add(
     ung_texture_id tex, ung_transform_2d transform, ung_texture_region texture, ung_color color)
 {
-    transform.scale_x = transform.scale_x != 0.0f ? transform.scale_x : 1.0f;
-    transform.scale_y = transform.scale_y != 0.0f ? transform.scale_y : 1.0f;
-
     ung_sprite_set_texture(tex);
+    reserve(4, 6);
     apply_next(); // make sure current texture size is correct
+    write_sprite(
+        state->slots[state->current_slot], (u8)state->current_slot, transform, texture, color);
+}
 
-    const auto tl = add_vertex({ 0.0f, 0.0f }, transform, texture, color);
-    const auto bl = add_vertex({ 0.0f, 1.0f }, transform, texture, color);
-    const auto tr = add_vertex({ 1.0f, 0.0f }, transform, texture, color);
-    const auto br = add_vertex({ 1.0f, 1.0f }, transform, texture, color);
-
-    ung_sprite_add_index(tl);
-    ung_sprite_add_index(bl);
-    ung_sprite_add_index(tr);
-
-    ung_sprite_add_index(bl);
-    ung_sprite_add_index(br);
-    ung_sprite_add_index(tr);
+EXPORT void ung_sprite_add_many(
+    ung_texture_id tex, const ung_sprite_instance* sprites, size_t num_sprites)
+{
+    assert(sprites || num_sprites == 0);
+    ung_sprite_set_texture(tex);
+    size_t i = 0;
+    while (i < num_sprites) {
+        reserve(4, 6);
+        apply_next();
+        const auto slot = state->slots[state->current_slot];
+        const auto slot_idx = (u8)state->current_slot;
+        const auto n = std::min((state->num_vertices - state->vertex_offset) / 4,
+            (state->num_indices - state->index_offset) / 6);
+        const auto end = std::min(num_sprites, i + n);
+        for (; i < end; ++i) {
+            write_sprite(slot, slot_idx, sprites[i].transform, sprites[i].region, sprites[i].color);
+        }
+    }
 }
 
 EXPORT void ung_sprite_flush()
 {
-    static mugfx_draw_binding binding = {
-        .type = MUGFX_BINDING_TYPE_TEXTURE,
-        .texture = { .binding = 0 },
-    };
-    if (state->index_offset > 0) {
-        if (state->current_texture.id) {
-            const auto tex = ung::state->textures.find(state->current_texture.id);
+    ProfScope prof("ung_sprite_flush");
+    StaticVector<mugfx_draw_binding, UNG_SPRITE_MAX_TEXTURES> bindings {};
+    for (u32 i = 0; i < state->slots.size(); ++i) {
+        // Slots without a texture use whatever the material has bound
+        if (const auto tex_id = state->slots[i].texture.id) {
+            const auto tex = ung::state->textures.find(tex_id);
             assert(tex);
-            binding.texture.id = tex->texture;
-
-            const auto geom = get(ung::state->geometries, state->geometry.id);
-            mugfx_buffer_update(state->vertex_buffer, 0,
-                { .data = state->vertices, .length = sizeof(Vertex) * state->vertex_offset });
-            mugfx_buffer_update(state->index_buffer, 0,
-                { .data = state->indices, .length = sizeof(u16) * state->index_offset });
-            mugfx_geometry_set_index_range(geom->geometry, 0, state->index_offset);
-            ung_draw(state->current_material, state->geometry, nullptr,
-                { .binding_overrides = &binding, .num_binding_overrides = 1 });
+            bindings.append() = {
+                .type = MUGFX_BINDING_TYPE_TEXTURE,
+                .texture = { .binding = i, .id = tex->texture },
+            };
         }
-        state->vertex_offset = 0;
-        state->index_offset = 0;
     }
+
+    if (state->index_offset > 0 && bindings.size()) {
+        if (state->buffer_vertex_offset + state->vertex_offset
+                > state->num_vertices * NumRingBatches
+            || state->buffer_index_offset + state->index_offset
+                > state->num_indices * NumRingBatches) {
+            orphan_buffers();
+        }
+
+        // Instead of a base vertex we offset the indices
+        const auto base_vertex = state->buffer_vertex_offset;
+        for (u32 i = 0; i < state->index_offset; ++i) {
+            state->indices[i] += base_vertex;
+        }
+
+        const auto geom = get(ung::state->geometries, state->geometry.id);
+        mugfx_buffer_update(state->vertex_buffer, sizeof(Vertex) * state->buffer_vertex_offset,
+            { .data = state->vertices, .length = sizeof(Vertex) * state->vertex_offset });
+        mugfx_buffer_update(state->index_buffer, sizeof(u32) * state->buffer_index_offset,
+            { .data = state->indices, .length = sizeof(u32) * state->index_offset });
+        mugfx_geometry_set_index_range(
+            geom->geometry, state->buffer_index_offset, state->index_offset);
+        geom->draw_count = state->index_offset;
+        ung::state->frame_stats.sprite_upload_bytes
+            += sizeof(Vertex) * state->vertex_offset + sizeof(u32) * state->index_offset;
+        ung::state->frame_stats.sprite_flushes++;
+        state->buffer_vertex_offset += state->vertex_offset;
+        state->buffer_index_offset += state->index_offset;
+        // The geometry is reused for the next flush, so it can't go through the draw queue
+        render::draw_immediate(state->current_material, state->geometry, nullptr,
+            { .binding_overrides = bindings.data(), .num_binding_overrides = bindings.size() });
+    }
+    state->vertex_offset = 0;
+    state->index_offset = 0;
+    state->slots.clear();
 }
 }
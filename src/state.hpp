@@ -39,6 +39,7 @@ struct Shader {
     mugfx_shader_stage stage;
     mugfx_shader_id shader;
     ung_resource_id resource;
+    bool instanced; // defines UNG_INSTANCED
 };
 
 struct InstanceBuffer {
@@ -49,11 +50,33 @@ struct InstanceBuffer {
     mugfx_vertex_attribute attributes[MUGFX_MAX_VERTEX_ATTRIBUTES];
 };
 
+struct GeometryLod {
+    mugfx_geometry_id geometry; // same buffers as Geometry::geometry, but a different index range
+    u32 draw_count;
+    float error; // relative to the bounding sphere radius
+};
+
 struct Geometry {
     mugfx_geometry_id geometry;
     mugfx_geometry_create_params mugfx_params;
     ung_instance_buffer_id instance_buffer;
     ung_resource_id resource;
+    bool owns_buffers; // vertex and index buffers are destroyed with the geometry
+    u32 draw_count; // indices (or vertices without index buffer) drawn, for ung_frame_stats
+    bool has_bounds;
+    um_vec3 aabb_min;
+    um_vec3 aabb_max;
+    um_sphere bounding_sphere;
+    bool quantized; // positions are U16_NORM and have to be transformed by dequantize
+    um_mat dequantize;
+    GeometryLod lods[UNG_MAX_GEOMETRY_LODS]; // finest first
+    u32 num_lods;
+};
+
+struct Model {
+    ung_resource_id resource;
+    ung_model_load_result result; // valid once loaded
+    bool loaded;
 };
 
 struct Material {
@@ -65,8 +88,18 @@ struct Material {
     size_t dynamic_data_size;
     bool dynamic_data_dirty;
     u64 last_update_frame;
+    u32 queued_data_queue; // draw_queue_counter when dynamic data was last snapshotted
+    u32 queued_data_offset;
+    bool instanced; // vertex shader uses UNG_INSTANCED
     StaticVector<mugfx_draw_binding, 16> bindings;
     std::array<ung_texture_id, 16> textures;
+    // binding number -> index + 1 into bindings (0 if not present), for binding numbers < 16
+    std::array<u8, 16> buffer_slots;
+    std::array<u8, 16> texture_slots;
+    // bindings with textures resolved, rebuilt if bindings change or any texture is (re)created
+    StaticVector<mugfx_draw_binding, 16> resolved_bindings;
+    u64 resolved_texture_epoch;
+    bool bindings_dirty;
 };
 
 struct Camera {
@@ -89,12 +122,57 @@ struct TextLayoutRun {
     uintptr_t user_data;
 };
 
+// Created by ung_text_layout_draw_mesh, rebuilt when the layout changed
+struct TextMesh {
+    ung_geometry_id geometry;
+    mugfx_buffer_id vertex_buffer;
+    mugfx_buffer_id index_buffer;
+    u32 index_count;
+    StaticVector<ung_texture_id, UNG_SPRITE_MAX_TEXTURES> textures; // binding = slot index
+    bool dirty;
+};
+
 struct TextLayout {
     utxt_layout* layout;
     Array<TextLayoutRun> runs;
     size_t num_glyphs;
+    size_t max_num_glyphs;
     u32 num_runs;
     bool dirty;
+    TextMesh mesh;
+};
+
+struct DrawCmd {
+    ung_material_id material;
+    ung_geometry_id geometry;
+    u32 lod; // 0 is the full geometry, otherwise Geometry::lods[lod - 1]
+    um_mat transform;
+    u32 instance_count;
+    u32 first_override; // index into State::draw_overrides
+    u32 num_overrides;
+    u32 dynamic_data_offset; // offset into State::draw_data
+    bool has_dynamic_data;
+    const UTransform* transform_data; // precomputed by a command list, if not null
+};
+
+struct CmdList {
+    // Transforms, sort keys and culling use the camera passed to ung_cmdlist_begin
+    um_mat view;
+    um_mat projection;
+    um_plane frustum[6];
+    bool cull;
+    u32 num_culled;
+    // All of these have one element per draw, except overrides
+    Vector<DrawCmd> cmds; // first_override is an index into overrides
+    Vector<UTransform> transforms;
+    Vector<u64> keys; // without the pass bits
+    Vector<um_sphere> bounds;
+    Vector<mugfx_draw_binding> overrides;
+};
+
+struct DrawSortKey {
+    u64 key;
+    u32 cmd_idx;
 };
 
 struct LoadProfilerZone {
@@ -112,17 +190,42 @@ struct State {
     Pool<Geometry> geometries;
     Pool<Material> materials;
     Pool<Camera> cameras;
+    Pool<CmdList> cmdlists;
     Pool<Font> fonts;
     Pool<TextLayout> text_layouts;
     Pool<InstanceBuffer> instance_buffers;
+    Pool<Model> models;
+    u64 texture_epoch; // incremented every time any Texture::texture changes
 
     // Uniform Buffers
     mugfx_buffer_id u_frame_buf;
     mugfx_buffer_id u_pass_buf;
     mugfx_buffer_id u_transform_buf;
+    u32 u_transform_buf_size;
+    u32 u_transform_offset;
 
     // Rendering
     UPass pass_data;
+    ung_frame_stats frame_stats;
+    u32 draw_queue_counter; // incremented every time the draw queue is flushed
+    const Material* last_drawn_material; // for ung_frame_stats::material_changes
+    bool cull_draws;
+    um_plane frustum[6];
+
+    // Draw Queue (reused every pass)
+    bool queue_draws;
+    Vector<DrawCmd> draw_cmds;
+    Vector<DrawSortKey> draw_keys;
+    Vector<DrawSortKey> draw_keys_scratch;
+    Vector<mugfx_draw_binding> draw_overrides;
+    Vector<u8> draw_data; // snapshots of material dynamic data
+    Vector<UTransform> draw_transforms;
+    // World space bounding spheres of all queued draws (SoA), if culling
+    Vector<float> draw_bounds_x;
+    Vector<float> draw_bounds_y;
+    Vector<float> draw_bounds_z;
+    Vector<float> draw_bounds_r;
+    Vector<u8> draw_visible;
 
     // SDL
     SDL_Window* window;
@@ -137,11 +240,19 @@ struct State {
     // Text
     ung_shader_id default_text_frag;
     ung_material_id default_text_mat;
+    ung_shader_id default_text_mesh_vert;
+    ung_material_id default_text_mesh_mat;
 
     // Other
     bool auto_reload;
     bool async_decode;
+    bool async_materials;
+    ung_material_id loading_fallback_material;
     bool load_cache;
+    bool quantize_geometry_positions;
+    u32 geometry_num_lods;
+    float geometry_lod_ratio;
+    float lod_pixel_error;
     u64 frame_counter;
     ung_shader_id default_sprite_vert;
 
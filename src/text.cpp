@@ -1,21 +1,74 @@
 #include "state.hpp"
 
+#include <algorithm>
 #include <span>
 
 namespace ung::text {
+// Supports multiple textures like the default sprite material (see sprite_renderer.cpp)
 static const char* default_text_frag = R"(
 layout(binding = 0) uniform sampler2D u_base;
+layout(binding = 1) uniform sampler2D u_tex1;
+layout(binding = 2) uniform sampler2D u_tex2;
+layout(binding = 3) uniform sampler2D u_tex3;
+layout(binding = 4) uniform sampler2D u_tex4;
+layout(binding = 5) uniform sampler2D u_tex5;
+layout(binding = 6) uniform sampler2D u_tex6;
+layout(binding = 7) uniform sampler2D u_tex7;
 
 in vec2 vs_out_texcoord;
 in vec4 vs_out_color;
+flat in int vs_out_texture;
 
 out vec4 frag_color;
 
+float sample_glyph(vec2 uv) {
+    switch (vs_out_texture) {
+    case 1: return texture(u_tex1, uv).r;
+    case 2: return texture(u_tex2, uv).r;
+    case 3: return texture(u_tex3, uv).r;
+    case 4: return texture(u_tex4, uv).r;
+    case 5: return texture(u_tex5, uv).r;
+    case 6: return texture(u_tex6, uv).r;
+    case 7: return texture(u_tex7, uv).r;
+    default: return texture(u_base, uv).r;
+    }
+}
+
+void main() {
+    frag_color = vs_out_color * sample_glyph(vs_out_texcoord);
+}
+)";
+
+// Text meshes are drawn with ung_draw, so they get a transform
+static const char* default_text_mesh_vert = R"(
+#pragma ung-include UngTransform
+
+layout (location = 0) in vec2 a_position;
+layout (location = 1) in vec2 a_texcoord;
+layout (location = 2) in vec4 a_color;
+layout (location = 3) in float a_texture;
+
+out vec2 vs_out_texcoord;
+out vec4 vs_out_color;
+flat out int vs_out_texture;
+
 void main() {
-    frag_color = vs_out_color * texture(u_base, vs_out_texcoord).r;
+    vs_out_texcoord = a_texcoord;
+    vs_out_color = a_color;
+    vs_out_texture = int(a_texture);
+    gl_Position = model_view_projection * vec4(a_position, 0.0, 1.0);
 }
 )";
 
+// Same layout as the sprite vertices
+struct MeshVertex {
+    float x, y;
+    uint16_t u, v;
+    uint8_t r, g, b, a;
+    uint8_t texture; // slot index
+    uint8_t pad[3];
+};
+
 void init(ung_init_params params)
 {
     state->fonts.init(params.max_num_fonts ? params.max_num_fonts : 16);
@@ -26,6 +79,13 @@ void init(ung_init_params params)
         .source = default_text_frag,
         .bindings = {
             { .type = MUGFX_SHADER_BINDING_TYPE_SAMPLER, .binding = 0 },
+            { .type = MUGFX_SHADER_BINDING_TYPE_SAMPLER, .binding = 1 },
+            { .type = MUGFX_SHADER_BINDING_TYPE_SAMPLER, .binding = 2 },
+            { .type = MUGFX_SHADER_BINDING_TYPE_SAMPLER, .binding = 3 },
+            { .type = MUGFX_SHADER_BINDING_TYPE_SAMPLER, .binding = 4 },
+            { .type = MUGFX_SHADER_BINDING_TYPE_SAMPLER, .binding = 5 },
+            { .type = MUGFX_SHADER_BINDING_TYPE_SAMPLER, .binding = 6 },
+            { .type = MUGFX_SHADER_BINDING_TYPE_SAMPLER, .binding = 7 },
         },
         .debug_label = "ung:default_text.frag",
     });
@@ -41,22 +101,37 @@ void init(ung_init_params params)
         .vert = state->default_sprite_vert,
         .frag = state->default_text_frag,
     });
+
+    state->default_text_mesh_vert = ung_shader_create({
+        .stage = MUGFX_SHADER_STAGE_VERTEX,
+        .source = default_text_mesh_vert,
+        .bindings = {
+            { .type = MUGFX_SHADER_BINDING_TYPE_UNIFORM, .binding = 2 },
+        },
+        .debug_label = "ung:default_text_mesh.vert",
+    });
+
+    state->default_text_mesh_mat = ung_material_create({
+        .mugfx = {
+            .depth_func = MUGFX_DEPTH_FUNC_ALWAYS,
+            .write_mask = MUGFX_WRITE_MASK_RGBA,
+            .cull_face = MUGFX_CULL_FACE_MODE_NONE,
+            .src_blend = MUGFX_BLEND_FUNC_SRC_ALPHA,
+            .dst_blend = MUGFX_BLEND_FUNC_ONE_MINUS_SRC_ALPHA,
+        },
+        .vert = state->default_text_mesh_vert,
+        .frag = state->default_text_frag,
+    });
 }
 
 void shutdown()
 {
-    for (u32 i = 0; i < state->text_layouts.capacity(); ++i) {
-        const auto key = state->text_layouts.get_key(i);
-        if (key) {
-            ung_text_layout_destroy({ key });
-        }
+    for (u32 i = state->text_layouts.size(); i-- > 0;) {
+        ung_text_layout_destroy({ state->text_layouts.alive_key(i) });
     }
 
-    for (u32 i = 0; i < state->fonts.capacity(); ++i) {
-        const auto key = state->fonts.get_key(i);
-        if (key) {
-            ung_font_destroy({ key });
-        }
+    for (u32 i = state->fonts.size(); i-- > 0;) {
+        ung_font_destroy({ state->fonts.alive_key(i) });
     }
 
     state->text_layouts.free();
@@ -104,11 +179,20 @@ static ung_font_id create_font(utxt_font* utxt_font, const char* debug_label)
 static void* utxt_realloc(void* ptr, size_t old_size, size_t new_size, void*)
 {
     if (!ptr) {
-        return allocator.allocate(new_size, allocator.ctx);
+        const auto new_ptr = allocator.allocate(new_size, allocator.ctx);
+        if (new_ptr) {
+            track_allocation(MemTag::Text, (int64_t)new_size);
+        }
+        return new_ptr;
     } else if (new_size) {
-        return allocator.reallocate(ptr, old_size, new_size, allocator.ctx);
+        const auto new_ptr = allocator.reallocate(ptr, old_size, new_size, allocator.ctx);
+        if (new_ptr) {
+            track_allocation(MemTag::Text, (int64_t)new_size - (int64_t)old_size);
+        }
+        return new_ptr;
     } else {
         allocator.deallocate(ptr, old_size, allocator.ctx);
+        track_allocation(MemTag::Text, -(int64_t)old_size);
         return nullptr;
     }
 }
@@ -233,6 +317,7 @@ EXPORT ung_text_layout_id ung_text_layout_create(uint32_t num_glyphs, uint32_t n
 
     layout->runs.init(num_runs);
     layout->num_glyphs = 0;
+    layout->max_num_glyphs = num_glyphs;
     layout->num_runs = 0;
     layout->dirty = false;
 
@@ -242,6 +327,9 @@ EXPORT ung_text_layout_id ung_text_layout_create(uint32_t num_glyphs, uint32_t n
 EXPORT void ung_text_layout_destroy(ung_text_layout_id layout_id)
 {
     auto layout = get_text_layout(layout_id.id);
+    if (layout->mesh.geometry.id) {
+        ung_geometry_destroy(layout->mesh.geometry);
+    }
     if (layout->runs.data) {
         layout->runs.free();
     }
@@ -257,6 +345,7 @@ EXPORT void ung_text_layout_reset(
     layout->num_glyphs = 0;
     layout->num_runs = 0;
     layout->dirty = true;
+    layout->mesh.dirty = true;
 }
 
 EXPORT uint32_t ung_text_layout_add_text(ung_text_layout_id layout_id, ung_font_id font_id,
@@ -279,6 +368,7 @@ EXPORT uint32_t ung_text_layout_add_text(ung_text_layout_id layout_id, ung_font_
 
     layout->num_glyphs += added_glyphs;
     layout->dirty = true;
+    layout->mesh.dirty = true;
     return (uint32_t)added_glyphs;
 }
 
@@ -432,4 +522,167 @@ EXPORT void ung_text_layout_draw(
     }
 }
 
-}
\ No newline at end of file
+static void create_text_mesh(TextLayout* layout)
+{
+    auto& mesh = layout->mesh;
+    const auto max_vertices = (u32)layout->max_num_glyphs * 4;
+    const auto index_size = max_vertices <= 0x10000 ? sizeof(u16) : sizeof(u32);
+    mesh.vertex_buffer = mugfx_buffer_create({
+        .target = MUGFX_BUFFER_TARGET_ARRAY,
+        .usage = MUGFX_BUFFER_USAGE_HINT_DYNAMIC,
+        .data = { .data = nullptr, .length = sizeof(MeshVertex) * max_vertices },
+        .debug_label = "ung:text_mesh.vbuf",
+    });
+    mesh.index_buffer = mugfx_buffer_create({
+        .target = MUGFX_BUFFER_TARGET_INDEX,
+        .usage = MUGFX_BUFFER_USAGE_HINT_DYNAMIC,
+        .data = { .data = nullptr, .length = index_size * layout->max_num_glyphs * 6 },
+        .debug_label = "ung:text_mesh.ibuf",
+    });
+    mesh.geometry = ung_geometry_create({
+        .vertex_buffers = {
+            {
+                .buffer = mesh.vertex_buffer,
+                .attributes = {
+                    {.location = 0, .components = 2, .type = MUGFX_VERTEX_ATTRIBUTE_TYPE_F32}, // xy
+                    {.location = 1, .components = 2, .type = MUGFX_VERTEX_ATTRIBUTE_TYPE_U16_NORM}, // uv
+                    {.location = 2, .components = 4, .type = MUGFX_VERTEX_ATTRIBUTE_TYPE_U8_NORM}, // rgba
+                    {.location = 3, .components = 1, .type = MUGFX_VERTEX_ATTRIBUTE_TYPE_U8}, // texture
+                },
+            }
+        },
+        .index_buffer = mesh.index_buffer,
+        .index_type = index_size == sizeof(u16) ? MUGFX_INDEX_TYPE_U16 : MUGFX_INDEX_TYPE_U32,
+        .index_count = (u32)layout->max_num_glyphs * 6,
+        .debug_label = "ung:text_mesh",
+    });
+    get(state->geometries, mesh.geometry.id)->owns_buffers = true;
+}
+
+template <typename Index>
+static void upload_mesh_indices(mugfx_buffer_id buffer, u32 num_quads)
+{
+    Array<Index> indices;
+    indices.init(num_quads * 6);
+    for (u32 q = 0; q < num_quads; ++q) {
+        const auto base = (Index)(q * 4);
+        // tl, bl, tr, bl, br, tr like the sprite renderer
+        indices[q * 6 + 0] = base;
+        indices[q * 6 + 1] = (Index)(base + 1);
+        indices[q * 6 + 2] = (Index)(base + 2);
+        indices[q * 6 + 3] = (Index)(base + 1);
+        indices[q * 6 + 4] = (Index)(base + 3);
+        indices[q * 6 + 5] = (Index)(base + 2);
+    }
+    mugfx_buffer_update(
+        buffer, 0, { .data = indices.data, .length = sizeof(Index) * indices.size });
+    state->frame_stats.other_upload_bytes += sizeof(Index) * indices.size;
+    indices.free();
+}
+
+static u8 get_mesh_texture_slot(TextMesh& mesh, ung_texture_id texture)
+{
+    for (u32 i = 0; i < mesh.textures.size(); ++i) {
+        if (mesh.textures[i].id == texture.id) {
+            return (u8)i;
+        }
+    }
+    UNG_OR_PANIC(mesh.textures.size() < mesh.textures.capacity(),
+        "Text meshes support at most %u different fonts", UNG_SPRITE_MAX_TEXTURES);
+    mesh.textures.append() = texture;
+    return (u8)(mesh.textures.size() - 1);
+}
+
+// All glyphs of a run share font and color, so we get the quads of a run at once
+static void build_text_mesh(TextLayout* layout)
+{
+    auto& mesh = layout->mesh;
+    if (!mesh.geometry.id) {
+        create_text_mesh(layout);
+    }
+    mesh.textures.clear();
+
+    size_t num_glyphs_layout = 0;
+    const auto glyphs = utxt_layout_get_glyphs(layout->layout, &num_glyphs_layout);
+    assert(layout->num_glyphs == num_glyphs_layout);
+
+    const auto num_quads = (u32)layout->num_glyphs;
+    Array<utxt_quad> quads;
+    quads.init(std::max(num_quads, 1u));
+    Array<MeshVertex> vertices;
+    vertices.init(std::max(num_quads * 4, 1u));
+
+    for (u32 r = 0; r < layout->num_runs; ++r) {
+        const auto& run = layout->runs[r];
+        if (!run.glyph_count) {
+            continue;
+        }
+        utxt_layout_glyph_get_quads(
+            &glyphs[run.first_glyph], run.glyph_count, &quads[run.first_glyph], 0.0f, 0.0f);
+        const auto slot = get_mesh_texture_slot(mesh, get_font(run.font.id)->texture);
+        const auto cr = f2u8norm(run.color.r);
+        const auto cg = f2u8norm(run.color.g);
+        const auto cb = f2u8norm(run.color.b);
+        const auto ca = f2u8norm(run.color.a);
+        for (u32 g = run.first_glyph; g < run.first_glyph + run.glyph_count; ++g) {
+            const auto& q = quads[g];
+            const auto u0 = f2u16norm(q.u0);
+            const auto v0 = f2u16norm(q.v0);
+            const auto u1 = f2u16norm(q.u1);
+            const auto v1 = f2u16norm(q.v1);
+            auto v = &vertices[g * 4];
+            v[0] = { q.x, q.y, u0, v0, cr, cg, cb, ca, slot, {} }; // tl
+            v[1] = { q.x, q.y + q.h, u0, v1, cr, cg, cb, ca, slot, {} }; // bl
+            v[2] = { q.x + q.w, q.y, u1, v0, cr, cg, cb, ca, slot, {} }; // tr
+            v[3] = { q.x + q.w, q.y + q.h, u1, v1, cr, cg, cb, ca, slot, {} }; // br
+        }
+    }
+
+    if (num_quads) {
+        mugfx_buffer_update(mesh.vertex_buffer, 0,
+            { .data = vertices.data, .length = sizeof(MeshVertex) * num_quads * 4 });
+
+        const auto geom = get(state->geometries, mesh.geometry.id);
+        if (geom->mugfx_params.index_type == MUGFX_INDEX_TYPE_U16) {
+            upload_mesh_indices<u16>(mesh.index_buffer, num_quads);
+        } else {
+            upload_mesh_indices<u32>(mesh.index_buffer, num_quads);
+        }
+        mugfx_geometry_set_index_range(geom->geometry, 0, num_quads * 6);
+        geom->draw_count = num_quads * 6;
+        state->frame_stats.other_upload_bytes += sizeof(MeshVertex) * num_quads * 4;
+    }
+    mesh.index_count = num_quads * 6;
+
+    vertices.free();
+    quads.free();
+    mesh.dirty = false;
+}
+
+EXPORT void ung_text_layout_draw_mesh(
+    ung_text_layout_id layout_id, ung_material_id mat, const float transform[16])
+{
+    auto layout = get_text_layout(layout_id.id);
+    ensure_computed(layout);
+    if (layout->mesh.dirty || !layout->mesh.geometry.id) {
+        build_text_mesh(layout);
+    }
+
+    auto& mesh = layout->mesh;
+    if (!mesh.index_count) {
+        return;
+    }
+
+    StaticVector<mugfx_draw_binding, UNG_SPRITE_MAX_TEXTURES> bindings {};
+    for (u32 i = 0; i < mesh.textures.size(); ++i) {
+        const auto tex = get(state->textures, mesh.textures[i].id);
+        bindings.append() = {
+            .type = MUGFX_BINDING_TYPE_TEXTURE,
+            .texture = { .binding = i, .id = tex->texture },
+        };
+    }
+    ung_draw(mat.id ? mat : state->default_text_mesh_mat, mesh.geometry, transform,
+        { .binding_overrides = bindings.data(), .num_binding_overrides = bindings.size() });
+}
+
+}
@@ -48,6 +48,9 @@ struct TexturePending {
     }
 };
 
+// Only a few textures are in flight at the same time
+static BlockPool<TexturePending, 32> pending_pool;
+
 // This stores everything you need to keep around to reload a texture later, i.e.
 // for as long as the texture itself.
 struct TextureResource {
@@ -58,14 +61,19 @@ struct TextureResource {
     TexturePending* pending;
 };
 
-static void format_texture_cache_path(Formatter& fmt, const void* data, usize size, bool flip_y)
+static void format_texture_cache_suffix(Formatter& fmt, bool flip_y)
 {
-    fmt.append(".ungcache/");
-    fmt.append_hash(data, size);
     if (flip_y) {
         fmt.append("-flip");
     }
-    fmt.append("-v1.tex");
+    fmt.append("-v2.tex");
+}
+
+static void format_texture_cache_path(Formatter& fmt, const void* data, usize size, bool flip_y)
+{
+    fmt.append(".ungcache/");
+    fmt.append_hash(data, size);
+    format_texture_cache_suffix(fmt, flip_y);
 }
 
 static const char* format_texture_cache_path(const void* data, usize size, bool flip_y)
@@ -83,10 +91,7 @@ static void format_texture_cache_path(Formatter& fmt, const char* path, bool fli
     fmt.append_hash(path, strlen(path));
     fmt.append("-");
     fmt.append_hex_obj(mtime);
-    if (flip_y) {
-        fmt.append("-flip");
-    }
-    fmt.append("-v1.tex");
+    format_texture_cache_suffix(fmt, flip_y);
 }
 
 static const char* format_texture_cache_path(const char* path, bool flip_y)
@@ -98,9 +103,14 @@ static const char* format_texture_cache_path(const char* path, bool flip_y)
 }
 
 struct CacheTexHeader {
+    char magic[4];
+    u32 version;
     u32 width, height, components;
 };
 
+static constexpr char CacheTexMagic[4] = { 'U', 'T', 'E', 'X' };
+static constexpr u32 CacheTexVersion = 2;
+
 static void write_texture_cache_file(TexturePending* pending)
 {
     auto file = fopen(pending->cache_path, "wb");
@@ -108,7 +118,12 @@ static void write_texture_cache_file(TexturePending* pending)
         fprintf(stderr, "Could not open texture cache file for writing: %s\n", pending->cache_path);
         return;
     }
-    CacheTexHeader hdr { pending->width, pending->height, pending->components };
+    CacheTexHeader hdr = {};
+    memcpy(hdr.magic, CacheTexMagic, sizeof(CacheTexMagic));
+    hdr.version = CacheTexVersion;
+    hdr.width = pending->width;
+    hdr.height = pending->height;
+    hdr.components = pending->components;
     fwrite(&hdr, sizeof(CacheTexHeader), 1, file);
     fwrite(pending->decoded_data, 1, hdr.width * hdr.height * hdr.components, file);
     fclose(file);
@@ -122,11 +137,24 @@ static bool load_cache(TexturePending* pending)
         return false; // couldn't load from cache
     }
 
-    pending->file_data = file_data;
-    pending->file_size = file_size;
-
     CacheTexHeader hdr;
+    if (file_size < sizeof(CacheTexHeader)) {
+        ung_free_file_data(file_data, file_size);
+        return false;
+    }
     memcpy(&hdr, file_data, sizeof(CacheTexHeader));
+    const auto data_size = (u64)hdr.width * hdr.height * hdr.components;
+    if (memcmp(hdr.magic, CacheTexMagic, sizeof(CacheTexMagic)) != 0
+        || hdr.version != CacheTexVersion || hdr.components == 0 || hdr.components > 4
+        || data_size == 0 || sizeof(CacheTexHeader) + data_size > file_size) {
+        // Probably truncated (crash during write), just decode again
+        fprintf(stderr, "Invalid texture cache file: %s\n", pending->cache_path);
+        ung_free_file_data(file_data, file_size);
+        return false;
+    }
+
+    pending->file_data = file_data;
+    pending->file_size = file_size;
     pending->decoded_data = (u8*)file_data + sizeof(CacheTexHeader);
     pending->width = hdr.width;
     pending->height = hdr.height;
@@ -175,7 +203,7 @@ static bool res_texture_decode(ung_resource_id self, void* instance)
     auto res = (TextureResource*)instance;
 
     if (!res->pending) {
-        res->pending = allocate<TexturePending>();
+        res->pending = pending_pool.create();
     }
     auto pending = res->pending;
 
@@ -277,6 +305,7 @@ static bool res_texture_upload(ung_resource_id self, void* instance)
         mugfx_texture_destroy(tex->texture);
     }
     tex->texture = mugfx_tex;
+    state->texture_epoch++;
 
     return true;
 }
@@ -292,7 +321,7 @@ static void res_texture_cleanup_load(ung_resource_id self, void* instance)
     auto res = (TextureResource*)instance;
     if (res->pending) {
         res->pending->free();
-        deallocate(res->pending);
+        pending_pool.destroy(res->pending);
         res->pending = nullptr;
     }
 }
@@ -310,6 +339,7 @@ void res_texture_destroy(ung_resource_id self, void* instance)
         mugfx_texture_destroy(tex->texture);
     }
     state->textures.remove(tex_id);
+    state->texture_epoch++;
 }
 
 EXPORT ung_texture_id ung_texture_create(mugfx_texture_create_params params)
@@ -343,11 +373,13 @@ static ung_resource_type_id texture_resource()
 // Pass a fully initialized TextureResource, becaude decode might kick off right away!
 static ung_texture_id load_texture(TextureResource* tex_res, const char* key)
 {
+    const ung_resource_load_params load_params = { .priority = tex_res->params.priority };
     // We have to insert and assign the texture to the resource before we load, because
     // it might kick off the decode immediately, which might want to access the texture.
     const auto [id, tex] = state->textures.insert();
     tex_res->texture = { id };
-    const auto [res, created] = ung_resource_load(texture_resource(), key, tex_res);
+    const auto [res, created]
+        = ung_resource_load_ex(texture_resource(), key, tex_res, load_params);
 
     if (!created) {
         state->textures.remove(id);
@@ -356,7 +388,7 @@ static ung_texture_id load_texture(TextureResource* tex_res, const char* key)
         }
         if (tex_res->pending) {
             tex_res->pending->free();
-            deallocate(tex_res->pending);
+            pending_pool.destroy(tex_res->pending);
         }
         deallocate(tex_res);
         return ((TextureResource*)ung_resource_instance(res))->texture;
@@ -378,7 +410,10 @@ EXPORT ung_texture_id ung_texture_load(
     fmt.append("-");
     fmt.append_hex_obj((u8)type);
     fmt.append("-");
-    fmt.append_hash_obj(params);
+    // Loading the same texture with a different priority should not load it twice
+    auto key_params = params;
+    key_params.priority = 0;
+    fmt.append_hash_obj(key_params);
 
     auto tex_res = allocate<TextureResource>();
     assign(tex_res->path, path);
@@ -396,7 +431,7 @@ EXPORT ung_texture_id ung_texture_load_buffer(
     auto tex_res = allocate<TextureResource>();
     tex_res->type = type;
     tex_res->params = params;
-    tex_res->pending = allocate<TexturePending>();
+    tex_res->pending = pending_pool.create();
     tex_res->pending->allocated_data = { allocate<u8>(size), size };
     std::memcpy(tex_res->pending->allocated_data.data(), buffer, size);
     tex_res->pending->encoded_data = tex_res->pending->allocated_data;
@@ -415,6 +450,7 @@ EXPORT void ung_texture_swap(ung_texture_id dst_id, ung_texture_id src_id)
     // instead.
     assert((dst->resource.id && src->resource.id) || (!dst->resource.id && !src->resource.id));
     std::swap(dst->texture, src->texture);
+    state->texture_epoch++;
     if (dst->resource.id) {
         ung_resource_swap(dst->resource, src->resource);
         ((TextureResource*)ung_resource_instance(dst->resource))->texture = dst_id;
@@ -430,6 +466,7 @@ EXPORT void ung_texture_destroy(ung_texture_id id)
     } else {
         mugfx_texture_destroy(texture->texture);
         state->textures.remove(id.id);
+        state->texture_epoch++;
     }
 }
 
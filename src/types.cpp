@@ -44,6 +44,14 @@ void StrPool::init(u32 ps)
     pages.push(allocate<char>(page_size));
 }
 
+void StrPool::free()
+{
+    for (auto page : pages) {
+        deallocate(page, page_size);
+    }
+    pages.free();
+}
+
 std::string_view StrPool::insert(std::string_view str)
 {
     assert(str.size() + 1 <= page_size);
@@ -60,6 +68,28 @@ std::string_view StrPool::insert(std::string_view str)
     return { dest, str.size() };
 }
 
+void StrInterner::init(u32 capacity, u32 page_size)
+{
+    pool.init(page_size);
+    map.init(capacity);
+}
+
+void StrInterner::free()
+{
+    map.free();
+    pool.free();
+}
+
+std::string_view StrInterner::intern(std::string_view str)
+{
+    if (const auto slot = map.find_slot(str)) {
+        return slot->key;
+    }
+    const auto interned = pool.insert(str);
+    map.insert(interned, 0);
+    return interned;
+}
+
 bool is_same_binding(const mugfx_draw_binding& a, const mugfx_draw_binding& b)
 {
     if (a.type != b.type) {
@@ -148,6 +148,24 @@ struct Vector {
         data[size++] = std::move(v);
     }
 
+    // Makes sure capacity >= c (growing by doubling), does not change size
+    void reserve(u32 c)
+    {
+        if (c <= capacity) {
+            return;
+        }
+        assert(capacity > 0);
+        auto new_capacity = capacity;
+        while (new_capacity < c) {
+            new_capacity *= 2;
+        }
+        auto temp = allocate<T>(new_capacity);
+        std::memcpy(temp, data, size * sizeof(T));
+        deallocate(data, capacity);
+        data = temp;
+        capacity = new_capacity;
+    }
+
     void remove(u32 idx)
     {
         assert(idx < size);
@@ -205,13 +223,17 @@ template <typename T>
 struct Pool {
     Array<u64> keys;
     Array<T> data;
+    Array<u32> alive;
+    Array<u32> alive_pos;
     ung_slotmap sm;
 
     void init(u32 capacity)
     {
         keys.init(capacity);
         data.init(capacity);
-        sm = ung_slotmap { keys.data, capacity, 0 };
+        alive.init(capacity);
+        alive_pos.init(capacity);
+        sm = ung_slotmap { keys.data, capacity, 0, 0, alive.data, alive_pos.data };
         ung_slotmap_init(&sm);
     }
 
@@ -219,6 +241,8 @@ struct Pool {
     {
         keys.free();
         data.free();
+        alive.free();
+        alive_pos.free();
     }
 
     std::pair<u64, T*> insert()
@@ -249,6 +273,27 @@ struct Pool {
 
     u32 capacity() const { return sm.capacity; }
 
+    u32 size() const { return sm.num_alive; }
+
+    // Slot indices of all alive objects (see ung_slotmap::alive)
+    u32 alive_index(u32 i) const
+    {
+        assert(i < sm.num_alive);
+        return alive[i];
+    }
+
+    u64 alive_key(u32 i) const { return keys[alive_index(i)]; }
+
+    // Calls func(key, obj) for each alive object. func must not insert or remove objects.
+    template <typename Func>
+    void for_each(Func&& func)
+    {
+        for (u32 i = 0; i < sm.num_alive; ++i) {
+            const auto idx = alive[i];
+            func(keys[idx], data[idx]);
+        }
+    }
+
     u64 get_key(u32 idx) const { return ung_slotmap_get_key(&sm, idx); }
 
     bool contains(u64 key) { return ung_slotmap_contains(&sm, key); }
@@ -262,15 +307,140 @@ auto get(Pool<T>& pool, u64 key)
     return obj;
 }
 
+// Open addressing hash map (linear probing) with string keys. The hashes (ung_fnv1a) are stored,
+// so keys are only compared if the hashes match. Keys are not copied, so they have to outlive the
+// map (use StrPool or StrInterner). It grows when it is 3/4 full.
+template <typename Value>
+struct StrMap {
+    struct Slot {
+        u64 hash; // 0 means empty
+        std::string_view key;
+        Value value;
+    };
+
+    Array<Slot> slots;
+    u32 size;
+
+    void init(u32 capacity)
+    {
+        u32 num_slots = 8;
+        while (num_slots / 4 * 3 < capacity) {
+            num_slots *= 2;
+        }
+        slots.init(num_slots);
+        size = 0;
+    }
+
+    void free()
+    {
+        slots.free();
+        size = 0;
+    }
+
+    static u64 hash(std::string_view key)
+    {
+        const auto h = ung_fnv1a(key.data(), key.size());
+        return h ? h : 1;
+    }
+
+    // Returns the slot containing key or the empty slot where it would be inserted
+    Slot& probe(std::string_view key, u64 h)
+    {
+        const auto mask = slots.size - 1;
+        auto i = (u32)h & mask;
+        while (slots[i].hash && (slots[i].hash != h || slots[i].key != key)) {
+            i = (i + 1) & mask;
+        }
+        return slots[i];
+    }
+
+    Slot* find_slot(std::string_view key)
+    {
+        auto& slot = probe(key, hash(key));
+        return slot.hash ? &slot : nullptr;
+    }
+
+    Value* find(std::string_view key)
+    {
+        const auto slot = find_slot(key);
+        return slot ? &slot->value : nullptr;
+    }
+
+    // Overwrites the value if key is already present
+    Value& insert(std::string_view key, Value value)
+    {
+        if ((size + 1) * 4 > slots.size * 3) {
+            grow();
+        }
+        const auto h = hash(key);
+        auto& slot = probe(key, h);
+        if (!slot.hash) {
+            slot.hash = h;
+            slot.key = key;
+            size++;
+        }
+        slot.value = std::move(value);
+        return slot.value;
+    }
+
+    bool remove(std::string_view key)
+    {
+        auto slot = find_slot(key);
+        if (!slot) {
+            return false;
+        }
+        // Backward shift deletion, so we don't need tombstones: Move following entries of the
+        // cluster into the hole, unless that would move them before their home slot.
+        const auto mask = slots.size - 1;
+        auto hole = (u32)(slot - slots.data);
+        for (auto i = (hole + 1) & mask; slots[i].hash; i = (i + 1) & mask) {
+            const auto home = (u32)slots[i].hash & mask;
+            if (((i - home) & mask) >= ((i - hole) & mask)) {
+                slots[hole] = std::move(slots[i]);
+                hole = i;
+            }
+        }
+        slots[hole] = Slot {};
+        size--;
+        return true;
+    }
+
+    void grow()
+    {
+        auto old = slots;
+        slots = {};
+        slots.init(old.size * 2);
+        for (u32 i = 0; i < old.size; ++i) {
+            if (old[i].hash) {
+                probe(old[i].key, old[i].hash) = std::move(old[i]);
+            }
+        }
+        old.free();
+    }
+};
+
 struct StrPool {
     Vector<char*> pages;
     size_t page_size;
     size_t offset;
 
     void init(u32 page_size = 1024);
+    void free();
+    // The returned string is null-terminated
     std::string_view insert(std::string_view str);
 };
 
+// Inserting the same string twice returns the same (null-terminated) string. Strings are never
+// freed individually, they live as long as the interner.
+struct StrInterner {
+    StrPool pool;
+    StrMap<u8> map; // value is unused
+
+    void init(u32 capacity, u32 page_size = 4096);
+    void free();
+    std::string_view intern(std::string_view str);
+};
+
 struct LoadProfScope {
     const char* name;
     explicit LoadProfScope(const char* n) : name(n) { ung_load_profiler_push(n); }
@@ -279,6 +449,13 @@ struct LoadProfScope {
     LoadProfScope& operator=(const LoadProfScope&) = delete;
 };
 
+struct ProfScope {
+    explicit ProfScope(const char* name) { ung_profiler_push(name); }
+    ~ProfScope() { ung_profiler_pop(); }
+    ProfScope(const ProfScope&) = delete;
+    ProfScope& operator=(const ProfScope&) = delete;
+};
+
 bool is_same_binding(const mugfx_draw_binding& a, const mugfx_draw_binding& b);
 
 char* fmt_hex(char* buf, const void* data, usize size);
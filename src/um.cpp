@@ -8,12 +8,246 @@
 
 using namespace um;
 
-#if defined(WIN32)
+// tools/um-check.cpp defines EXPORT to compile a scalar copy of this file into a namespace.
+#if defined(EXPORT)
+#elif defined(WIN32)
 #define EXPORT extern "C" __declspec(dllexport)
 #else
 #define EXPORT extern "C"
 #endif
 
+// Define UM_NO_SIMD to use the scalar implementations everywhere.
+// SSE2 is part of x86-64, so the x86 code path does not need anything newer.
+#if !defined(UM_NO_SIMD)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UM_SIMD_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define UM_SIMD_NEON
+#include <arm_neon.h>
+#elif defined(__wasm_simd128__) // Emscripten with -msimd128
+#define UM_SIMD_WASM
+#include <wasm_simd128.h>
+#endif
+#endif
+
+#if defined(UM_SIMD_SSE2) || defined(UM_SIMD_NEON) || defined(UM_SIMD_WASM)
+#define UM_SIMD
+#endif
+
+#ifdef UM_SIMD
+// A minimal 4-wide float vector, so the functions below can be written once for all backends.
+namespace {
+#if defined(UM_SIMD_SSE2)
+using f32x4 = __m128;
+
+inline f32x4 load(const float* p)
+{
+    return _mm_loadu_ps(p);
+}
+
+inline void store(float* p, f32x4 v)
+{
+    _mm_storeu_ps(p, v);
+}
+
+inline f32x4 set(float x, float y, float z, float w)
+{
+    return _mm_setr_ps(x, y, z, w);
+}
+
+inline f32x4 splat(float s)
+{
+    return _mm_set1_ps(s);
+}
+
+inline f32x4 add(f32x4 a, f32x4 b)
+{
+    return _mm_add_ps(a, b);
+}
+
+inline f32x4 sub(f32x4 a, f32x4 b)
+{
+    return _mm_sub_ps(a, b);
+}
+
+inline f32x4 mul(f32x4 a, f32x4 b)
+{
+    return _mm_mul_ps(a, b);
+}
+
+inline float first(f32x4 v)
+{
+    return _mm_cvtss_f32(v);
+}
+
+// Returns { a[X], a[Y], b[Z], b[W] }
+template <int X, int Y, int Z, int W>
+inline f32x4 shuffle(f32x4 a, f32x4 b)
+{
+    return _mm_shuffle_ps(a, b, _MM_SHUFFLE(W, Z, Y, X));
+}
+#elif defined(UM_SIMD_NEON)
+using f32x4 = float32x4_t;
+
+inline f32x4 load(const float* p)
+{
+    return vld1q_f32(p);
+}
+
+inline void store(float* p, f32x4 v)
+{
+    vst1q_f32(p, v);
+}
+
+inline f32x4 set(float x, float y, float z, float w)
+{
+    const float v[4] = { x, y, z, w };
+    return vld1q_f32(v);
+}
+
+inline f32x4 splat(float s)
+{
+    return vdupq_n_f32(s);
+}
+
+inline f32x4 add(f32x4 a, f32x4 b)
+{
+    return vaddq_f32(a, b);
+}
+
+inline f32x4 sub(f32x4 a, f32x4 b)
+{
+    return vsubq_f32(a, b);
+}
+
+inline f32x4 mul(f32x4 a, f32x4 b)
+{
+    return vmulq_f32(a, b);
+}
+
+inline float first(f32x4 v)
+{
+    return vgetq_lane_f32(v, 0);
+}
+
+// Returns { a[X], a[Y], b[Z], b[W] }. The compiler turns this into dup/ins instructions.
+template <int X, int Y, int Z, int W>
+inline f32x4 shuffle(f32x4 a, f32x4 b)
+{
+    f32x4 r = vdupq_n_f32(vgetq_lane_f32(a, X));
+    r = vsetq_lane_f32(vgetq_lane_f32(a, Y), r, 1);
+    r = vsetq_lane_f32(vgetq_lane_f32(b, Z), r, 2);
+    return vsetq_lane_f32(vgetq_lane_f32(b, W), r, 3);
+}
+#elif defined(UM_SIMD_WASM)
+using f32x4 = v128_t;
+
+inline f32x4 load(const float* p)
+{
+    return wasm_v128_load(p);
+}
+
+inline void store(float* p, f32x4 v)
+{
+    wasm_v128_store(p, v);
+}
+
+inline f32x4 set(float x, float y, float z, float w)
+{
+    return wasm_f32x4_make(x, y, z, w);
+}
+
+inline f32x4 splat(float s)
+{
+    return wasm_f32x4_splat(s);
+}
+
+inline f32x4 add(f32x4 a, f32x4 b)
+{
+    return wasm_f32x4_add(a, b);
+}
+
+inline f32x4 sub(f32x4 a, f32x4 b)
+{
+    return wasm_f32x4_sub(a, b);
+}
+
+inline f32x4 mul(f32x4 a, f32x4 b)
+{
+    return wasm_f32x4_mul(a, b);
+}
+
+inline float first(f32x4 v)
+{
+    return wasm_f32x4_extract_lane(v, 0);
+}
+
+// Returns { a[X], a[Y], b[Z], b[W] }
+template <int X, int Y, int Z, int W>
+inline f32x4 shuffle(f32x4 a, f32x4 b)
+{
+    return wasm_i32x4_shuffle(a, b, X, Y, Z + 4, W + 4);
+}
+#endif
+
+template <int X, int Y, int Z, int W>
+inline f32x4 shuffle(f32x4 v)
+{
+    return shuffle<X, Y, Z, W>(v, v);
+}
+
+inline f32x4 madd(f32x4 a, f32x4 b, f32x4 c)
+{
+    return add(mul(a, b), c);
+}
+
+inline f32x4 load(const um_vec4& v)
+{
+    return load(&v.x);
+}
+
+inline f32x4 load(const um_quat& q)
+{
+    return load(&q.x);
+}
+
+inline um_vec4 store_vec4(f32x4 v)
+{
+    um_vec4 r;
+    store(&r.x, v);
+    return r;
+}
+
+inline um_quat store_quat(f32x4 v)
+{
+    um_quat r;
+    store(&r.x, v);
+    return r;
+}
+
+inline void transpose(f32x4& c0, f32x4& c1, f32x4& c2, f32x4& c3)
+{
+    const auto t0 = shuffle<0, 1, 0, 1>(c0, c1); // c0x, c0y, c1x, c1y
+    const auto t1 = shuffle<0, 1, 0, 1>(c2, c3); // c2x, c2y, c3x, c3y
+    const auto t2 = shuffle<2, 3, 2, 3>(c0, c1); // c0z, c0w, c1z, c1w
+    const auto t3 = shuffle<2, 3, 2, 3>(c2, c3); // c2z, c2w, c3z, c3w
+    c0 = shuffle<0, 2, 0, 2>(t0, t1);
+    c1 = shuffle<1, 3, 1, 3>(t0, t1);
+    c2 = shuffle<0, 2, 0, 2>(t2, t3);
+    c3 = shuffle<1, 3, 1, 3>(t2, t3);
+}
+
+inline f32x4 mat_mul_vec4(const f32x4 m[4], f32x4 v)
+{
+    auto r = mul(m[0], shuffle<0, 0, 0, 0>(v));
+    r = madd(m[1], shuffle<1, 1, 1, 1>(v), r);
+    r = madd(m[2], shuffle<2, 2, 2, 2>(v), r);
+    return madd(m[3], shuffle<3, 3, 3, 3>(v), r);
+}
+}
+#endif
+
 EXPORT float um_exp(float x)
 {
     return expf(x);
@@ -316,12 +550,22 @@ EXPORT um_quat um_quat_conjugate(um_quat q)
 
 EXPORT um_quat um_quat_mul(um_quat a, um_quat b)
 {
+#ifdef UM_SIMD
+    // The scalar version below, sorted by components of a
+    const auto vb = load(b);
+    auto r = mul(splat(a.w), vb);
+    r = madd(splat(a.x), mul(shuffle<3, 2, 1, 0>(vb), set(1.0f, -1.0f, 1.0f, -1.0f)), r);
+    r = madd(splat(a.y), mul(shuffle<2, 3, 0, 1>(vb), set(1.0f, 1.0f, -1.0f, -1.0f)), r);
+    r = madd(splat(a.z), mul(shuffle<1, 0, 3, 2>(vb), set(-1.0f, 1.0f, 1.0f, -1.0f)), r);
+    return store_quat(r);
+#else
     um_quat result;
     result.x = a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y;
     result.y = a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x;
     result.z = a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w;
     result.w = a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z;
     return result;
+#endif
 }
 
 EXPORT um_quat um_quat_from_matrix(um_mat m)
@@ -436,6 +680,21 @@ EXPORT um_quat um_quat_look_dir(um_vec3 direction, um_vec3 up)
     return um_quat_normalized(um_quat_mul(twist, swing));
 }
 
+// a * wa + b * wb
+static um_quat quat_blend(um_quat a, um_quat b, float wa, float wb)
+{
+#ifdef UM_SIMD
+    return store_quat(madd(load(a), splat(wa), mul(load(b), splat(wb))));
+#else
+    return {
+        a.x * wa + b.x * wb,
+        a.y * wa + b.y * wb,
+        a.z * wa + b.z * wb,
+        a.w * wa + b.w * wb,
+    };
+#endif
+}
+
 EXPORT um_quat um_quat_slerp(um_quat a, um_quat b, float t)
 {
     // Calculate angle between quaternions
@@ -444,12 +703,7 @@ EXPORT um_quat um_quat_slerp(um_quat a, um_quat b, float t)
 
     // If a and b are very close, linearly interpolate to avoid divide by zero
     if (fabsf(cos_half_theta) >= 0.999f) {
-        return um_quat_normalized({
-            a.x + (b.x - a.x) * t,
-            a.y + (b.y - a.y) * t,
-            a.z + (b.z - a.z) * t,
-            a.w + (b.w - a.w) * t,
-        });
+        return um_quat_normalized(quat_blend(a, b, 1.0f - t, t));
     }
 
     // Ensure we take the shortest path
@@ -467,23 +721,13 @@ EXPORT um_quat um_quat_slerp(um_quat a, um_quat b, float t)
     // If theta = 180 degrees, rotation not well-defined
     // We could rotate around any axis perpendicular to a or b
     if (fabsf(sin_half_theta) < 0.001f) {
-        return um_quat_normalized({
-            a.x * 0.5f + b.x * 0.5f,
-            a.y * 0.5f + b.y * 0.5f,
-            a.z * 0.5f + b.z * 0.5f,
-            a.w * 0.5f + b.w * 0.5f,
-        });
+        return um_quat_normalized(quat_blend(a, b, 0.5f, 0.5f));
     }
 
     float ratio_a = sinf((1.0f - t) * half_theta) / sin_half_theta;
     float ratio_b = sinf(t * half_theta) / sin_half_theta;
 
-    return um_quat_normalized({
-        a.x * ratio_a + b.x * ratio_b,
-        a.y * ratio_a + b.y * ratio_b,
-        a.z * ratio_a + b.z * ratio_b,
-        a.w * ratio_a + b.w * ratio_b,
-    });
+    return um_quat_normalized(quat_blend(a, b, ratio_a, ratio_b));
 }
 
 EXPORT um_vec3 um_quat_mul_vec3(um_quat q, um_vec3 v)
@@ -677,6 +921,11 @@ EXPORT um_mat um_mat_look_at(um_vec3 eye, um_vec3 target, um_vec3 up)
 
 EXPORT um_mat um_mat_transpose(um_mat m)
 {
+#ifdef UM_SIMD
+    f32x4 c0 = load(m.cols[0]), c1 = load(m.cols[1]), c2 = load(m.cols[2]), c3 = load(m.cols[3]);
+    transpose(c0, c1, c2, c3);
+    return { { store_vec4(c0), store_vec4(c1), store_vec4(c2), store_vec4(c3) } };
+#else
     um_mat result;
 
     result.cols[0] = { m.cols[0].x, m.cols[1].x, m.cols[2].x, m.cols[3].x };
@@ -685,10 +934,85 @@ EXPORT um_mat um_mat_transpose(um_mat m)
     result.cols[3] = { m.cols[0].w, m.cols[1].w, m.cols[2].w, m.cols[3].w };
 
     return result;
+#endif
 }
 
+#ifdef UM_SIMD
+// This is the same computation as the scalar version, but the rows of the result are computed as
+// a whole. See the comments for which b of the scalar version ends up in which lane.
+static um_mat mat_invert_simd(um_mat m)
+{
+    // Rows of m
+    f32x4 r0 = load(m.cols[0]), r1 = load(m.cols[1]), r2 = load(m.cols[2]), r3 = load(m.cols[3]);
+    transpose(r0, r1, r2, r3);
+
+    // b00, b01, b02, b03
+    const auto b0 = sub(mul(shuffle<0, 0, 0, 1>(r0), shuffle<1, 2, 3, 2>(r1)),
+        mul(shuffle<0, 0, 0, 1>(r1), shuffle<1, 2, 3, 2>(r0)));
+    // b04, b05, b04, b05
+    const auto b1 = sub(mul(shuffle<1, 2, 1, 2>(r0), shuffle<3, 3, 3, 3>(r1)),
+        mul(shuffle<1, 2, 1, 2>(r1), shuffle<3, 3, 3, 3>(r0)));
+    // b06, b07, b08, b09
+    const auto b2 = sub(mul(shuffle<0, 0, 0, 1>(r2), shuffle<1, 2, 3, 2>(r3)),
+        mul(shuffle<0, 0, 0, 1>(r3), shuffle<1, 2, 3, 2>(r2)));
+    // b10, b11, b10, b11
+    const auto b3 = sub(mul(shuffle<1, 2, 1, 2>(r2), shuffle<3, 3, 3, 3>(r3)),
+        mul(shuffle<1, 2, 1, 2>(r3), shuffle<3, 3, 3, 3>(r2)));
+
+    const auto sign_a = set(1.0f, -1.0f, 1.0f, -1.0f);
+    const auto sign_b = set(-1.0f, 1.0f, -1.0f, 1.0f);
+
+    // b11, -b11, b10, -b09
+    const auto p0 = mul(shuffle<0, 0, 1, 2>(shuffle<1, 0, 3, 3>(b3, b2)), sign_a);
+    // -b10, b08, -b08, b07
+    const auto p1 = mul(shuffle<0, 2, 2, 3>(shuffle<0, 0, 2, 1>(b3, b2)), sign_b);
+    // b09, -b07, b06, -b06
+    const auto p2 = mul(shuffle<3, 1, 0, 0>(b2), sign_a);
+
+    // b05, -b05, b04, -b03
+    const auto q0 = mul(shuffle<0, 0, 1, 2>(shuffle<1, 0, 3, 3>(b1, b0)), sign_a);
+    // -b04, b02, -b02, b01
+    const auto q1 = mul(shuffle<0, 2, 2, 3>(shuffle<0, 0, 2, 1>(b1, b0)), sign_b);
+    // b03, -b01, b00, -b00
+    const auto q2 = mul(shuffle<3, 1, 0, 0>(b0), sign_a);
+
+    // row -> (a_1, a_0, a_0, a_0), (a_2, a_2, a_1, a_1), (a_3, a_3, a_3, a_2)
+    const auto cofactors = [](f32x4 row, f32x4 c0, f32x4 c1, f32x4 c2) {
+        auto r = mul(shuffle<1, 0, 0, 0>(row), c0);
+        r = madd(shuffle<2, 2, 1, 1>(row), c1, r);
+        return madd(shuffle<3, 3, 3, 2>(row), c2, r);
+    };
+
+    const auto c0 = cofactors(r1, p0, p1, p2);
+    const auto c1 = sub(splat(0.0f), cofactors(r0, p0, p1, p2));
+    const auto c2 = cofactors(r3, q0, q1, q2);
+    const auto c3 = sub(splat(0.0f), cofactors(r2, q0, q1, q2));
+
+    // The first row of m times the first column of the adjugate
+    const auto d = mul(r0, c0);
+    const auto det = first(add(add(d, shuffle<1, 1, 1, 1>(d)), add(shuffle<2, 2, 2, 2>(d),
+                                                                 shuffle<3, 3, 3, 3>(d))));
+
+    if (fabsf(det) < 0.000001f) {
+        // Matrix is not invertible, return identity
+        return um_mat_identity();
+    }
+
+    const auto inv_det = splat(1.0f / det);
+    return { {
+        store_vec4(mul(c0, inv_det)),
+        store_vec4(mul(c1, inv_det)),
+        store_vec4(mul(c2, inv_det)),
+        store_vec4(mul(c3, inv_det)),
+    } };
+}
+#endif
+
 EXPORT um_mat um_mat_invert(um_mat m)
 {
+#ifdef UM_SIMD
+    return mat_invert_simd(m);
+#else
     um_mat result;
 
     // Extract the 3x3 rotation & scale part
@@ -741,6 +1065,7 @@ EXPORT um_mat um_mat_invert(um_mat m)
     result.cols[3].w = (a20 * b03 - a21 * b01 + a22 * b00) * det;
 
     return result;
+#endif
 }
 
 EXPORT um_vec3 um_mat_mul_vec3(um_mat m, um_vec3 v, float w)
@@ -759,6 +1084,10 @@ EXPORT um_vec3 um_mat_mul_vec3(um_mat m, um_vec3 v, float w)
 
 EXPORT um_vec4 um_mat_mul_vec4(um_mat m, um_vec4 v)
 {
+#ifdef UM_SIMD
+    const f32x4 cols[4] = { load(m.cols[0]), load(m.cols[1]), load(m.cols[2]), load(m.cols[3]) };
+    return store_vec4(mat_mul_vec4(cols, load(v)));
+#else
     um_vec4 result;
 
     result.x = m.cols[0].x * v.x + m.cols[1].x * v.y + m.cols[2].x * v.z + m.cols[3].x * v.w;
@@ -767,10 +1096,20 @@ EXPORT um_vec4 um_mat_mul_vec4(um_mat m, um_vec4 v)
     result.w = m.cols[0].w * v.x + m.cols[1].w * v.y + m.cols[2].w * v.z + m.cols[3].w * v.w;
 
     return result;
+#endif
 }
 
 EXPORT um_mat um_mat_mul(um_mat a, um_mat b)
 {
+#ifdef UM_SIMD
+    const f32x4 cols[4] = { load(a.cols[0]), load(a.cols[1]), load(a.cols[2]), load(a.cols[3]) };
+    return { {
+        store_vec4(mat_mul_vec4(cols, load(b.cols[0]))),
+        store_vec4(mat_mul_vec4(cols, load(b.cols[1]))),
+        store_vec4(mat_mul_vec4(cols, load(b.cols[2]))),
+        store_vec4(mat_mul_vec4(cols, load(b.cols[3]))),
+    } };
+#else
     um_mat result;
 
     for (int i = 0; i < 4; i++) {
@@ -780,6 +1119,7 @@ EXPORT um_mat um_mat_mul(um_mat a, um_mat b)
     }
 
     return result;
+#endif
 }
 
 EXPORT um_trafo um_trafo_identity()
@@ -38,6 +38,7 @@ namespace input {
 
 namespace sprite_renderer {
     void init(ung_init_params params);
+    void begin_frame();
     void shutdown();
 }
 
@@ -59,6 +60,22 @@ namespace resource {
     void shutdown();
 }
 
+namespace job {
+    void init(ung_init_params params);
+    void shutdown();
+}
+
+namespace pack {
+    void init(ung_init_params params);
+    void shutdown();
+}
+
+namespace profiler {
+    void init(ung_init_params params);
+    void begin_frame();
+    void shutdown();
+}
+
 static const char* default_sprite_vert = R"(
 layout (binding = 1, std140) uniform UngPass {
     mat4 view;
@@ -73,13 +90,16 @@ layout (binding = 1, std140) uniform UngPass {
 layout (location = 0) in vec2 a_position;
 layout (location = 1) in vec2 a_texcoord;
 layout (location = 2) in vec4 a_color;
+layout (location = 3) in float a_texture;
 
 out vec2 vs_out_texcoord;
 out vec4 vs_out_color;
+flat out int vs_out_texture;
 
 void main() {
     vs_out_texcoord = a_texcoord;
     vs_out_color = a_color;
+    vs_out_texture = int(a_texture);
     gl_Position = view_projection * vec4(a_position, 0.0, 1.0);
 }
 )";
@@ -113,6 +133,9 @@ EXPORT void ung_init(ung_init_params params)
     state = allocate<State>();
     std::memset(state, 0, sizeof(State));
 
+    init_arenas(params.frame_arena_size ? params.frame_arena_size : 4 * 1024 * 1024,
+        params.scratch_arena_size ? params.scratch_arena_size : 16 * 1024 * 1024);
+
     if (params.window_mode.fullscreen_mode == UNG_FULLSCREEN_MODE_DEFAULT) {
         params.window_mode.fullscreen_mode = UNG_FULLSCREEN_MODE_WINDOWED;
     }
@@ -174,7 +197,8 @@ EXPORT void ung_init(ung_init_params params)
 #endif
 
     // Window
-    u32 flags = SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN | SDL_WINDOW_ALLOW_HIGHDPI;
+    u32 flags = SDL_WINDOW_OPENGL | SDL_WINDOW_ALLOW_HIGHDPI;
+    flags |= params.window_mode.hidden ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN;
     if (params.window_mode.fullscreen_mode == UNG_FULLSCREEN_MODE_DESKTOP_FULLSCREEN
         || params.window_mode.fullscreen_mode == UNG_FULLSCREEN_MODE_FULLSCREEN) {
         flags |= SDL_WINDOW_FULLSCREEN;
@@ -216,13 +240,19 @@ EXPORT void ung_init(ung_init_params params)
         = params.mugfx.max_num_shaders ? params.mugfx.max_num_shaders : params.max_num_shaders;
 
     params.max_num_geometries = params.max_num_geometries ? params.max_num_geometries : 1024;
+    // Every level of detail is a separate mugfx geometry
+    UNG_OR_PANIC(params.geometry_num_lods <= UNG_MAX_GEOMETRY_LODS,
+        "geometry_num_lods must be <= %u", UNG_MAX_GEOMETRY_LODS);
     params.mugfx.max_num_geometries = params.mugfx.max_num_geometries
         ? params.mugfx.max_num_geometries
-        : params.max_num_geometries;
+        : params.max_num_geometries * (1 + params.geometry_num_lods);
 
     params.max_num_instance_buffers
         = params.max_num_instance_buffers ? params.max_num_instance_buffers : 64;
 
+    params.max_num_materials = params.max_num_materials ? params.max_num_materials : 1024;
+    params.max_num_models = params.max_num_models ? params.max_num_models : 64;
+
     // Materials have a constant and dynamic buffer (or only one of them or neither)
     // Geometries have vertex/index (or just vertex)
     // Add 8 for sprite rendering and default uniform blocks
@@ -235,11 +265,17 @@ EXPORT void ung_init(ung_init_params params)
     state->shaders.init(params.max_num_shaders);
     state->geometries.init(params.max_num_geometries);
     state->instance_buffers.init(params.max_num_instance_buffers);
-    state->materials.init(params.max_num_materials ? params.max_num_materials : 1024);
+    state->materials.init(params.max_num_materials);
+    state->models.init(params.max_num_models);
 
     state->auto_reload = params.auto_reload;
     state->async_decode = params.async_decode;
+    state->async_materials = params.async_materials;
     state->load_cache = params.load_cache;
+    state->quantize_geometry_positions = params.quantize_geometry_positions;
+    state->geometry_num_lods = params.geometry_num_lods;
+    state->geometry_lod_ratio = params.geometry_lod_ratio > 0.0f ? params.geometry_lod_ratio : 0.5f;
+    state->lod_pixel_error = params.lod_pixel_error > 0.0f ? params.lod_pixel_error : 1.0f;
 
     state->default_sprite_vert = ung_shader_create({
         .stage = MUGFX_SHADER_STAGE_VERTEX,
@@ -250,6 +286,9 @@ EXPORT void ung_init(ung_init_params params)
         .debug_label = "ung:default_sprite.vert",
     });
 
+    profiler::init(params);
+    job::init(params);
+    pack::init(params);
     resource::init(params);
     files::init(params);
     render::init(params);
@@ -279,9 +318,13 @@ EXPORT void ung_shutdown()
     render::shutdown();
     files::shutdown();
     resource::shutdown();
+    pack::shutdown();
+    job::shutdown();
+    profiler::shutdown();
 
     state->materials.free();
     state->cameras.free();
+    state->models.free();
 
     mugfx_shutdown();
 
@@ -293,6 +336,7 @@ EXPORT void ung_shutdown()
     }
 
     deallocate(state);
+    shutdown_arenas();
 
     state = nullptr;
 }
@@ -355,6 +399,7 @@ EXPORT void* ung_malloc(size_t size)
         return nullptr;
     }
     malloced->size = sizeof(Malloced) + size;
+    track_allocation(MemTag::Malloc, (int64_t)malloced->size);
     return (uint8_t*)malloced + sizeof(Malloced);
 }
 
@@ -368,21 +413,29 @@ EXPORT void* ung_realloc(void* ptr, size_t new_size)
         return nullptr;
     }
     auto malloced = (Malloced*)((uint8_t*)ptr - sizeof(Malloced));
+    const auto old_size = malloced->size;
     malloced = (Malloced*)allocator.reallocate(
-        malloced, malloced->size, sizeof(Malloced) + new_size, allocator.ctx);
+        malloced, old_size, sizeof(Malloced) + new_size, allocator.ctx);
     if (!malloced) {
         return nullptr;
     }
     malloced->size = sizeof(Malloced) + new_size;
+    track_allocation(MemTag::Malloc, (int64_t)malloced->size - (int64_t)old_size);
     return (uint8_t*)malloced + sizeof(Malloced);
 }
 
+EXPORT void* ung_frame_alloc(size_t size, size_t alignment)
+{
+    return frame_allocate(size, alignment ? alignment : 16);
+}
+
 EXPORT void ung_free(void* ptr)
 {
     if (!ptr) {
         return;
     }
     auto malloced = (Malloced*)((uint8_t*)ptr - sizeof(Malloced));
+    track_allocation(MemTag::Malloc, -(int64_t)malloced->size);
     allocator.deallocate(malloced, malloced->size, allocator.ctx);
 }
 
@@ -443,14 +496,20 @@ EXPORT bool ung_poll_events()
 EXPORT void ung_begin_frame()
 {
     state->frame_counter++;
+    state->frame_stats = {};
+    swap_frame_arenas();
+    profiler::begin_frame();
+    ProfScope prof("ung_begin_frame");
     files::begin_frame();
     resource::begin_frame();
     render::begin_frame();
+    sprite_renderer::begin_frame();
     sound::begin_frame();
 }
 
 EXPORT void ung_end_frame()
 {
+    ProfScope prof("ung_end_frame");
     render::end_frame();
     SDL_GL_SwapWindow(state->window);
 }
@@ -0,0 +1,154 @@
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+// Usage: um-check [iterations]
+// Compares the SIMD implementations in um (linked as usual) against the scalar implementations
+// on random inputs and exits with 1 if any result differs by more than the tolerance.
+// The scalar implementations are src/um.cpp compiled again with UM_NO_SIMD into namespace scalar.
+// um.h is included in that namespace too (with C++ linkage), so the types are scalar::um_mat etc.
+// and argument-dependent lookup does not find the SIMD functions.
+
+namespace scalar {
+#define UM_NO_SIMD
+#define UM_NO_EXTERN_C
+#define EXPORT
+#include "../src/um.cpp"
+#undef EXPORT
+}
+
+using scalar::um_mat;
+using scalar::um_quat;
+using scalar::um_vec3;
+using scalar::um_vec4;
+
+// The SIMD implementations from the um library. The types are the same, only in another namespace.
+extern "C" {
+um_mat um_mat_mul(um_mat a, um_mat b);
+um_mat um_mat_invert(um_mat m);
+um_mat um_mat_transpose(um_mat m);
+um_vec4 um_mat_mul_vec4(um_mat m, um_vec4 v);
+um_vec3 um_mat_mul_vec3(um_mat m, um_vec3 v, float w);
+um_mat um_mat_transform(um_vec3 t, um_quat r, um_vec3 s);
+um_quat um_quat_mul(um_quat a, um_quat b);
+um_quat um_quat_slerp(um_quat a, um_quat b, float t);
+}
+
+static uint32_t rng_state = 0x12345678u;
+
+static float rand_float(float lo, float hi)
+{
+    // xorshift32
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return lo + (float)(rng_state >> 8) / (float)(1u << 24) * (hi - lo);
+}
+
+static um_vec3 rand_vec3(float lo, float hi)
+{
+    return { rand_float(lo, hi), rand_float(lo, hi), rand_float(lo, hi) };
+}
+
+static um_vec4 rand_vec4(float lo, float hi)
+{
+    return { rand_float(lo, hi), rand_float(lo, hi), rand_float(lo, hi), rand_float(lo, hi) };
+}
+
+static um_quat rand_quat()
+{
+    const auto q = rand_vec4(-1.0f, 1.0f);
+    return scalar::um_quat_normalized({ q.x, q.y, q.z, q.w });
+}
+
+// Translation, rotation and scales in [0.25, 4] keep the matrices well-conditioned
+static um_mat rand_transform()
+{
+    return scalar::um_mat_transform(rand_vec3(-100.0f, 100.0f), rand_quat(),
+        rand_vec3(0.25f, 4.0f));
+}
+
+static uint32_t num_failures = 0;
+
+static bool close(float simd, float ref)
+{
+    // Relative for large values, absolute for small ones
+    return std::fabs(simd - ref) <= 1e-4f * std::fmax(1.0f, std::fabs(ref));
+}
+
+static void check(const char* name, uint32_t it, const float* simd, const float* ref, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        if (!close(simd[i], ref[i])) {
+            if (num_failures < 16) {
+                std::printf("%s (iteration %u): component %zu is %g, scalar is %g\n", name, it, i,
+                    simd[i], ref[i]);
+            }
+            num_failures++;
+            return;
+        }
+    }
+}
+
+static void check(const char* name, uint32_t it, const um_mat& simd, const um_mat& ref)
+{
+    check(name, it, &simd.cols[0].x, &ref.cols[0].x, 16);
+}
+
+static void check(const char* name, uint32_t it, const um_vec4& simd, const um_vec4& ref)
+{
+    check(name, it, &simd.x, &ref.x, 4);
+}
+
+static void check(const char* name, uint32_t it, const um_vec3& simd, const um_vec3& ref)
+{
+    check(name, it, &simd.x, &ref.x, 3);
+}
+
+static void check(const char* name, uint32_t it, const um_quat& simd, const um_quat& ref)
+{
+    check(name, it, &simd.x, &ref.x, 4);
+}
+
+int main(int argc, char** argv)
+{
+    const auto iterations = argc > 1 ? (uint32_t)std::atoi(argv[1]) : 100000u;
+
+    for (uint32_t it = 0; it < iterations; ++it) {
+        const auto a = rand_transform();
+        const auto b = rand_transform();
+        check("um_mat_mul", it, ::um_mat_mul(a, b), scalar::um_mat_mul(a, b));
+        check("um_mat_invert", it, ::um_mat_invert(a), scalar::um_mat_invert(a));
+        check("um_mat_transpose", it, ::um_mat_transpose(a), scalar::um_mat_transpose(a));
+
+        const auto v4 = rand_vec4(-100.0f, 100.0f);
+        check("um_mat_mul_vec4", it, ::um_mat_mul_vec4(a, v4), scalar::um_mat_mul_vec4(a, v4));
+        const auto v3 = rand_vec3(-100.0f, 100.0f);
+        check("um_mat_mul_vec3", it, ::um_mat_mul_vec3(a, v3, 1.0f),
+            scalar::um_mat_mul_vec3(a, v3, 1.0f));
+
+        const auto t = rand_vec3(-100.0f, 100.0f);
+        const auto s = rand_vec3(0.25f, 4.0f);
+        const auto q = rand_quat();
+        check("um_mat_transform", it, ::um_mat_transform(t, q, s),
+            scalar::um_mat_transform(t, q, s));
+
+        const auto r = rand_quat();
+        check("um_quat_mul", it, ::um_quat_mul(q, r), scalar::um_quat_mul(q, r));
+        const auto f = rand_float(0.0f, 1.0f);
+        check("um_quat_slerp", it, ::um_quat_slerp(q, r, f), scalar::um_quat_slerp(q, r, f));
+    }
+
+    if (num_failures) {
+        std::printf("%u mismatches in %u iterations\n", num_failures, iterations);
+        return 1;
+    }
+    std::printf("SIMD and scalar results match (%u iterations)\n", iterations);
+    return 0;
+}
@@ -0,0 +1,468 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <um.h>
+#include <ung.h>
+
+// Only for the Pool benchmark
+#include "../src/types.hpp"
+
+// Usage: ung-bench [-o results.json] [filter]
+// Run this from the repository root, because it loads the example assets.
+// Only benchmarks whose name contains filter are run. Results are printed in a table and written
+// as JSON (if -o is given), so they can be tracked per commit.
+// The window is hidden and vsync is off, but draws still go to the real GL driver.
+
+struct Result {
+    std::string name;
+    uint64_t iterations;
+    double ns_per_op;
+    double total_ms;
+};
+
+static std::vector<Result> results;
+static const char* filter = nullptr;
+
+static uint64_t now_ns()
+{
+    const auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+template <typename T>
+static void do_not_optimize(const T& value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+static bool enabled(const char* name)
+{
+    return !filter || std::strstr(name, filter);
+}
+
+static void report(const char* name, uint64_t ops, uint64_t elapsed_ns)
+{
+    const auto ns_per_op = (double)elapsed_ns / (double)ops;
+    const auto total_ms = (double)elapsed_ns / 1e6;
+    std::printf("%-40s %12llu ops %12.1f ns/op %10.2f ms\n", name, (unsigned long long)ops,
+        ns_per_op, total_ms);
+    results.push_back({ name, ops, ns_per_op, total_ms });
+}
+
+// Calls func(i) for i in [0, iterations) and reports the time per call
+template <typename Func>
+static void bench(const char* name, uint64_t iterations, Func&& func)
+{
+    if (!enabled(name)) {
+        return;
+    }
+    const auto start = now_ns();
+    for (uint64_t i = 0; i < iterations; ++i) {
+        func(i);
+    }
+    report(name, iterations, now_ns() - start);
+}
+
+// Runs whole frames and only times submit() (inside a pass), which does ops_per_frame operations
+template <typename Func>
+static void bench_frames(const char* name, ung_camera_id camera, uint32_t num_frames,
+    uint64_t ops_per_frame, Func&& submit)
+{
+    if (!enabled(name)) {
+        return;
+    }
+    uint64_t elapsed = 0;
+    for (uint32_t f = 0; f < num_frames; ++f) {
+        ung_begin_frame();
+        ung_begin_pass(MUGFX_RENDER_TARGET_BACKBUFFER, camera);
+        const auto start = now_ns();
+        submit();
+        ung_end_pass();
+        elapsed += now_ns() - start;
+        ung_end_frame();
+    }
+    report(name, num_frames * ops_per_frame, elapsed);
+}
+
+static void write_json(const char* path)
+{
+    auto f = std::fopen(path, "w");
+    if (!f) {
+        std::fprintf(stderr, "Could not open '%s'\n", path);
+        std::exit(1);
+    }
+    std::fprintf(f, "{\n\"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& r = results[i];
+        std::fprintf(f,
+            "{\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.3f, \"total_ms\": %.3f}%s\n",
+            r.name.c_str(), (unsigned long long)r.iterations, r.ns_per_op, r.total_ms,
+            i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(f, "]\n}\n");
+    std::fclose(f);
+}
+
+static void bench_math()
+{
+    const auto a = um_mat_from_trafo(um_trafo_identity());
+    auto m = um_mat_from_trafo({
+        .position = { 1.0f, 2.0f, 3.0f },
+        .orientation = um_quat_from_axis_angle({ 0.0f, 1.0f, 0.0f }, { 0.5f }),
+        .scale = { 1.0f, 1.0f, 1.0f },
+    });
+    bench("um/mat_mul", 1'000'000, [&](uint64_t) {
+        m = um_mat_mul(a, m);
+        do_not_optimize(m);
+    });
+    bench("um/mat_invert", 1'000'000, [&](uint64_t) {
+        m = um_mat_invert(m);
+        do_not_optimize(m);
+    });
+
+    const auto q0 = um_quat_identity();
+    const auto q1 = um_quat_from_axis_angle({ 1.0f, 0.0f, 0.0f }, { 1.0f });
+    bench("um/quat_slerp", 1'000'000, [&](uint64_t i) {
+        const auto q = um_quat_slerp(q0, q1, (float)(i & 1023) / 1024.0f);
+        do_not_optimize(q);
+    });
+}
+
+static void bench_hash()
+{
+    std::vector<uint8_t> data(4096);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = (uint8_t)(i * 31);
+    }
+    bench("fnv1a/32B", 1'000'000, [&](uint64_t) {
+        const auto h = ung_fnv1a(data.data(), 32);
+        do_not_optimize(h);
+    });
+    bench("fnv1a/4KiB", 100'000, [&](uint64_t) {
+        const auto h = ung_fnv1a(data.data(), data.size());
+        do_not_optimize(h);
+    });
+}
+
+static void bench_slotmap()
+{
+    constexpr uint32_t N = 1 << 16;
+    std::vector<uint64_t> keys(N);
+    std::vector<uint64_t> inserted(N);
+    ung_slotmap sm = { keys.data(), N, 0, 0 };
+    ung_slotmap_init(&sm);
+
+    bench("slotmap/insert", N, [&](uint64_t i) {
+        uint32_t idx;
+        inserted[i] = ung_slotmap_insert(&sm, &idx);
+    });
+    bench("slotmap/contains", N, [&](uint64_t i) {
+        const auto c = ung_slotmap_contains(&sm, inserted[(i * 7919) % N]);
+        do_not_optimize(c);
+    });
+    bench("slotmap/remove", N, [&](uint64_t i) { ung_slotmap_remove(&sm, inserted[i]); });
+
+    struct Payload {
+        float data[4];
+    };
+    ung::Pool<Payload> pool = {};
+    pool.init(N);
+    bench("pool/insert", N, [&](uint64_t i) { inserted[i] = pool.insert().first; });
+    bench("pool/find", N, [&](uint64_t i) {
+        const auto p = pool.find(inserted[(i * 7919) % N]);
+        do_not_optimize(p);
+    });
+    bench("pool/remove", N, [&](uint64_t i) { pool.remove(inserted[i]); });
+    pool.free();
+}
+
+static void bench_animation()
+{
+    constexpr uint16_t NumJoints = 64;
+    constexpr uint32_t NumSkeletons = 256;
+    constexpr size_t NumKeys = 30;
+
+    std::vector<ung_skeleton_joint> joints(NumJoints);
+    const auto identity = um_mat_from_trafo(um_trafo_identity());
+    for (uint16_t j = 0; j < NumJoints; ++j) {
+        std::memcpy(joints[j].inverse_bind_matrix, &identity, sizeof(identity));
+        joints[j].parent_index = (int16_t)(j - 1); // a chain
+    }
+
+    std::vector<float> times(NumKeys);
+    std::vector<float> values(NumKeys * 4);
+    for (size_t k = 0; k < NumKeys; ++k) {
+        times[k] = (float)k / (float)(NumKeys - 1);
+        const auto q = um_quat_from_axis_angle({ 0.0f, 0.0f, 1.0f }, { times[k] });
+        std::memcpy(&values[k * 4], &q, sizeof(q));
+    }
+    std::vector<ung_animation_channel> channels(NumJoints);
+    for (uint16_t j = 0; j < NumJoints; ++j) {
+        channels[j] = {
+            .key = { .joint_index = j, .dof = UNG_JOINT_DOF_ROTATION },
+            .sampler_type = UNG_ANIM_SAMPLER_TYPE_QUAT,
+            .interp_type = UNG_ANIM_INTERP_LINEAR,
+            .num_samples = NumKeys,
+            .times = times.data(),
+            .values = values.data(),
+        };
+    }
+    const auto anim = ung_animation_create({
+        .channels = channels.data(),
+        .num_channels = channels.size(),
+        .duration_s = 1.0f,
+    });
+
+    std::vector<ung_skeleton_id> skeletons(NumSkeletons);
+    for (auto& skel : skeletons) {
+        skel = ung_skeleton_create({ .num_joints = NumJoints, .joints = joints.data() });
+    }
+
+    const auto sample_all = [&](uint64_t i) {
+        const auto t = (float)(i % 100) / 100.0f;
+        for (const auto skel : skeletons) {
+            uint16_t num_joints = 0;
+            const auto transforms = ung_skeleton_get_joint_transforms(skel, &num_joints);
+            ung_animation_sample(anim, t, transforms, num_joints);
+        }
+    };
+
+    // One op is the whole crowd
+    bench("animation/sample_256x64", 200, sample_all);
+    bench("animation/skeleton_update_256x64", 200, [&](uint64_t) {
+        for (const auto skel : skeletons) {
+            ung_skeleton_update(skel);
+        }
+    });
+    bench("animation/skeletons_update_256x64", 200,
+        [&](uint64_t) { ung_skeletons_update(skeletons.data(), skeletons.size()); });
+    bench("animation/skeletons_update_jobs_256x64", 200, [&](uint64_t) {
+        ung_skeletons_update_ex(skeletons.data(), skeletons.size(), { .num_jobs = 8 });
+    });
+
+    for (const auto skel : skeletons) {
+        ung_skeleton_destroy(skel);
+    }
+    ung_animation_destroy(anim);
+}
+
+static void bench_rendering()
+{
+    uint32_t fb_w, fb_h;
+    ung_get_framebuffer_size(&fb_w, &fb_h);
+    const auto camera = ung_camera_create();
+    ung_camera_set_perspective(camera, 45.0f, (float)fb_w / (float)fb_h, 0.1f, 100.0f);
+    const auto ui_camera = ung_camera_create();
+    ung_camera_set_orthographic_fullscreen(ui_camera);
+
+    const auto texture
+        = ung_texture_load("examples/assets/checkerboard.png", UNG_TEXTURE_COLOR, {});
+    const auto material = ung_material_load(
+        "examples/assets/hello_game.vert", "examples/assets/hello_game.frag", {});
+    ung_material_set_texture(material, 0, texture);
+    const auto box = ung_geometry_box(1.0f, 1.0f, 1.0f);
+
+    constexpr uint32_t NumDraws = 10'000;
+    std::vector<um_mat> transforms(NumDraws);
+    for (uint32_t i = 0; i < NumDraws; ++i) {
+        auto trafo = um_trafo_identity();
+        trafo.position = { (float)(i % 100) - 50.0f, (float)(i / 100) - 50.0f, -60.0f };
+        transforms[i] = um_mat_from_trafo(trafo);
+    }
+    const auto draw_all = [&] {
+        for (const auto& t : transforms) {
+            ung_draw(material, box, &t.cols[0].x, {});
+        }
+    };
+    bench_frames("draw/immediate_10k", camera, 50, NumDraws, draw_all);
+
+    if (enabled("draw/sorted_10k")) {
+        // Same as bench_frames, but with a sorted pass
+        uint64_t elapsed = 0;
+        for (uint32_t f = 0; f < 50; ++f) {
+            ung_begin_frame();
+            ung_begin_pass_ex(MUGFX_RENDER_TARGET_BACKBUFFER, camera, { .sort_draws = true });
+            const auto start = now_ns();
+            draw_all();
+            ung_end_pass();
+            elapsed += now_ns() - start;
+            ung_end_frame();
+        }
+        report("draw/sorted_10k", 50 * NumDraws, elapsed);
+    }
+
+    if (enabled("draw/cmdlist_sorted_10k")) {
+        // Record on the job threads, one list per chunk, and submit into a sorted pass
+        constexpr uint32_t NumLists = 8;
+        struct Recording {
+            ung_cmdlist_id lists[NumLists];
+            ung_camera_id camera;
+            ung_material_id material;
+            ung_geometry_id geometry;
+            const um_mat* transforms;
+        };
+        Recording rec = { {}, camera, material, box, transforms.data() };
+        for (auto& list : rec.lists) {
+            list = ung_cmdlist_create();
+        }
+        const auto record = [](void* ctx, uint32_t index) {
+            const auto r = (Recording*)ctx;
+            ung_cmdlist_begin(r->lists[index], r->camera, false);
+            constexpr auto n = NumDraws / NumLists;
+            for (uint32_t i = index * n; i < (index + 1) * n; ++i) {
+                ung_cmdlist_draw(r->lists[index], r->material, r->geometry,
+                    &r->transforms[i].cols[0].x, {});
+            }
+        };
+        const auto counter = ung_job_counter_create();
+        uint64_t elapsed = 0;
+        for (uint32_t f = 0; f < 50; ++f) {
+            ung_begin_frame();
+            ung_begin_pass_ex(MUGFX_RENDER_TARGET_BACKBUFFER, camera, { .sort_draws = true });
+            const auto start = now_ns();
+            ung_job_run_many(record, &rec, NumLists, counter);
+            ung_job_wait(counter);
+            for (const auto list : rec.lists) {
+                ung_cmdlist_submit(list);
+            }
+            ung_end_pass();
+            elapsed += now_ns() - start;
+            ung_end_frame();
+        }
+        report("draw/cmdlist_sorted_10k", 50 * NumDraws, elapsed);
+        ung_job_counter_destroy(counter);
+        for (const auto list : rec.lists) {
+            ung_cmdlist_destroy(list);
+        }
+    }
+
+    constexpr uint32_t NumSprites = 100'000;
+    // Both sprite benchmarks use the same transforms, so they are comparable
+    const auto sprite_transform = [](uint32_t i) {
+        return ung_transform_2d {
+            .x = (float)(i % 1000),
+            .y = (float)(i / 1000),
+            .rotation = (float)i * 0.01f,
+            .scale_x = 0.1f,
+            .scale_y = 0.1f,
+        };
+    };
+    bench_frames("sprites/add_100k", ui_camera, 50, NumSprites, [&] {
+        for (uint32_t i = 0; i < NumSprites; ++i) {
+            ung_sprite_add(texture, sprite_transform(i), UNG_REGION_FULL, UNG_COLOR_WHITE);
+        }
+        ung_sprite_flush();
+    });
+
+    std::vector<ung_sprite_instance> sprites(NumSprites);
+    for (uint32_t i = 0; i < NumSprites; ++i) {
+        sprites[i] = {
+            .transform = sprite_transform(i),
+            .region = UNG_REGION_FULL,
+            .color = UNG_COLOR_WHITE,
+        };
+    }
+    bench_frames("sprites/add_many_100k", ui_camera, 50, NumSprites, [&] {
+        ung_sprite_add_many(texture, sprites.data(), sprites.size());
+        ung_sprite_flush();
+    });
+
+    ung_geometry_destroy(box);
+    ung_material_destroy(material);
+    ung_texture_destroy(texture);
+    ung_camera_destroy(camera);
+    ung_camera_destroy(ui_camera);
+}
+
+static void load_texture(uint64_t)
+{
+    const auto tex = ung_texture_load("examples/assets/checkerboard.png", UNG_TEXTURE_COLOR, {});
+    ung_resource_wait_ready(ung_texture_resource(tex));
+    ung_texture_destroy(tex);
+}
+
+static void load_geometry(uint64_t)
+{
+    ung_geometry_destroy(ung_geometry_load("examples/assets/Wasp.obj"));
+}
+
+// Cold loads decode the source files (ung is initialized without load_cache)
+static void bench_loading_cold()
+{
+    bench("load/texture_cold", 20, load_texture);
+    bench("load/geometry_cold", 20, load_geometry);
+
+    bench("load/gltf", 5, [&](uint64_t) {
+        const auto model = ung_model_load({
+            .path = "examples/assets/Quaternius_Universal_Animation_Library.glb",
+            .flags = UNG_MODEL_LOAD_GEOMETRIES,
+        });
+        for (uint32_t i = 0; i < model.num_primitives; ++i) {
+            ung_geometry_destroy(model.geometries[i]);
+        }
+        ung_model_load_result_free(&model);
+    });
+}
+
+// Cached loads read the .ungcache files written by the first load (ung is initialized with
+// load_cache)
+static void bench_loading_cached()
+{
+    load_texture(0);
+    load_geometry(0);
+    bench("load/texture_cached", 20, load_texture);
+    bench("load/geometry_cached", 20, load_geometry);
+}
+
+static void init(bool load_cache)
+{
+    ung_init({
+        .title = "ung-bench",
+        .window_mode = { .width = 1280, .height = 720, .vsync = false, .hidden = true },
+        .max_num_skeletons = 512,
+        .async_decode = false,
+        .load_cache = load_cache,
+    });
+}
+
+int main(int argc, char** argv)
+{
+    const char* output_path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (argv[i][0] == '-') {
+            std::fprintf(stderr, "Usage: ung-bench [-o results.json] [filter]\n");
+            return 1;
+        } else {
+            filter = argv[i];
+        }
+    }
+
+    init(false);
+    bench_math();
+    bench_hash();
+    bench_slotmap();
+    bench_animation();
+    bench_rendering();
+    bench_loading_cold();
+    ung_shutdown();
+
+    init(true);
+    bench_loading_cached();
+    ung_shutdown();
+
+    if (output_path) {
+        write_json(output_path);
+    }
+    return 0;
+}
@@ -0,0 +1,236 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "../src/pack-format.hpp"
+
+// Usage: ung-pack [-c] [-a alignment] [-C dir] output.pak files...
+// Paths are stored as passed (relative to -C dir if given), so pass them like you would pass them
+// to ung_read_whole_file.
+
+using namespace ung::pack_format;
+
+struct InputFile {
+    std::string path;
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> compressed;
+    PackEntry entry;
+};
+
+static bool read_file(const std::string& path, std::vector<uint8_t>& data)
+{
+    auto f = std::fopen(path.c_str(), "rb");
+    if (!f) {
+        return false;
+    }
+    std::fseek(f, 0, SEEK_END);
+    const auto size = std::ftell(f);
+    std::fseek(f, 0, SEEK_SET);
+    data.resize((size_t)size);
+    const auto n = std::fread(data.data(), 1, data.size(), f);
+    std::fclose(f);
+    return n == data.size();
+}
+
+static void write_length(std::vector<uint8_t>& out, size_t len)
+{
+    // The first 15 are in the token
+    len -= 15;
+    while (len >= 255) {
+        out.push_back(255);
+        len -= 255;
+    }
+    out.push_back((uint8_t)len);
+}
+
+static void write_sequence(std::vector<uint8_t>& out, const uint8_t* literals, size_t num_literals,
+    size_t match_offset, size_t match_len)
+{
+    const auto lit_nibble = std::min<size_t>(num_literals, 15);
+    const auto match_nibble = match_len ? std::min<size_t>(match_len - 4, 15) : 0;
+    out.push_back((uint8_t)(lit_nibble << 4 | match_nibble));
+    if (lit_nibble == 15) {
+        write_length(out, num_literals);
+    }
+    out.insert(out.end(), literals, literals + num_literals);
+    if (match_len) {
+        out.push_back((uint8_t)(match_offset & 0xff));
+        out.push_back((uint8_t)(match_offset >> 8));
+        if (match_nibble == 15) {
+            write_length(out, match_len - 4);
+        }
+    }
+}
+
+// Greedy matching with a hash table of the last position of every 4 byte sequence.
+// Compression ratio is not great, but decompression is fast.
+static std::vector<uint8_t> compress(const std::vector<uint8_t>& src)
+{
+    constexpr size_t MinMatch = 4;
+    constexpr size_t MaxOffset = 0xffff;
+    constexpr uint32_t HashBits = 16;
+
+    std::vector<uint8_t> out;
+    std::vector<int64_t> table(1 << HashBits, -1);
+    const auto hash = [&](size_t pos) {
+        uint32_t v;
+        std::memcpy(&v, src.data() + pos, 4);
+        return (v * 2654435761u) >> (32 - HashBits);
+    };
+
+    size_t pos = 0, literal_start = 0;
+    while (pos + MinMatch <= src.size()) {
+        const auto h = hash(pos);
+        const auto candidate = table[h];
+        table[h] = (int64_t)pos;
+        if (candidate >= 0 && pos - (size_t)candidate <= MaxOffset
+            && std::memcmp(src.data() + candidate, src.data() + pos, MinMatch) == 0) {
+            size_t len = MinMatch;
+            while (pos + len < src.size() && src[candidate + len] == src[pos + len]) {
+                len++;
+            }
+            write_sequence(
+                out, src.data() + literal_start, pos - literal_start, pos - (size_t)candidate, len);
+            pos += len;
+            literal_start = pos;
+        } else {
+            pos++;
+        }
+    }
+    write_sequence(out, src.data() + literal_start, src.size() - literal_start, 0, 0);
+    return out;
+}
+
+static void usage()
+{
+    std::fprintf(stderr, "Usage: ung-pack [-c] [-a alignment] [-C dir] output.pak files...\n");
+    std::fprintf(stderr, "  -c: compress entries (if it makes them smaller)\n");
+    std::fprintf(stderr, "  -a: alignment of entry data (default: 16)\n");
+    std::fprintf(stderr, "  -C: directory the paths are relative to\n");
+}
+
+int main(int argc, char** argv)
+{
+    bool use_compression = false;
+    uint32_t alignment = 16;
+    std::string dir;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "-c") {
+            use_compression = true;
+        } else if (arg == "-a" && i + 1 < argc) {
+            alignment = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+            if (alignment == 0 || alignment > 4096 || (alignment & (alignment - 1)) != 0) {
+                std::fprintf(stderr, "Alignment must be a power of two <= 4096\n");
+                return 1;
+            }
+        } else if (arg == "-C" && i + 1 < argc) {
+            dir = argv[++i];
+            if (!dir.empty() && dir.back() != '/') {
+                dir += '/';
+            }
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (argc - i < 2) {
+        usage();
+        return 1;
+    }
+    const char* output_path = argv[i++];
+
+    std::vector<InputFile> files;
+    std::string strings;
+    for (; i < argc; ++i) {
+        InputFile file = {};
+        file.path = normalize_path(argv[i]);
+        if (!read_file(dir + file.path, file.data)) {
+            std::fprintf(stderr, "Could not read '%s'\n", (dir + file.path).c_str());
+            return 1;
+        }
+        for (const auto& other : files) {
+            if (other.path == file.path) {
+                std::fprintf(stderr, "Duplicate path '%s'\n", file.path.c_str());
+                return 1;
+            }
+        }
+
+        file.entry.path_hash = fnv1a(file.path.data(), file.path.size());
+        file.entry.size = file.data.size();
+        file.entry.stored_size = file.data.size();
+        file.entry.compression = Compression::None;
+        if (use_compression && !file.data.empty()) {
+            auto compressed = compress(file.data);
+            if (compressed.size() < file.data.size()) {
+                file.compressed = std::move(compressed);
+                file.entry.stored_size = file.compressed.size();
+                file.entry.compression = Compression::Lz;
+            }
+        }
+        file.entry.path_offset = (uint32_t)strings.size();
+        file.entry.path_length = (uint32_t)file.path.size();
+        strings += file.path;
+        files.push_back(std::move(file));
+    }
+
+    std::sort(files.begin(), files.end(), [](const InputFile& a, const InputFile& b) {
+        return a.entry.path_hash < b.entry.path_hash;
+    });
+
+    PackHeader header = {};
+    std::memcpy(header.magic, Magic, sizeof(Magic));
+    header.version = Version;
+    header.num_entries = (uint32_t)files.size();
+    header.alignment = alignment;
+    header.strings_offset = sizeof(PackHeader) + files.size() * sizeof(PackEntry);
+    header.strings_size = strings.size();
+
+    const auto align
+        = [alignment](uint64_t v) { return (v + alignment - 1) & ~(uint64_t)(alignment - 1); };
+    auto offset = header.strings_offset + header.strings_size;
+    for (auto& file : files) {
+        offset = align(offset);
+        file.entry.offset = offset;
+        offset += file.entry.stored_size + 1; // null terminator
+    }
+
+    auto f = std::fopen(output_path, "wb");
+    if (!f) {
+        std::fprintf(stderr, "Could not open '%s'\n", output_path);
+        return 1;
+    }
+    std::fwrite(&header, sizeof(header), 1, f);
+    for (const auto& file : files) {
+        std::fwrite(&file.entry, sizeof(PackEntry), 1, f);
+    }
+    std::fwrite(strings.data(), 1, strings.size(), f);
+    const uint8_t zeros[4096] = {};
+    auto pos = header.strings_offset + header.strings_size;
+    for (const auto& file : files) {
+        std::fwrite(zeros, 1, file.entry.offset - pos, f);
+        const auto compressed = file.entry.compression != Compression::None;
+        const auto& data = compressed ? file.compressed : file.data;
+        if (!data.empty()) {
+            std::fwrite(data.data(), 1, data.size(), f);
+        }
+        std::fwrite(zeros, 1, 1, f);
+        pos = file.entry.offset + data.size() + 1;
+    }
+    if (std::fclose(f) != 0) {
+        std::fprintf(stderr, "Could not write '%s'\n", output_path);
+        return 1;
+    }
+
+    uint64_t total_size = 0, total_stored = 0;
+    for (const auto& file : files) {
+        total_size += file.entry.size;
+        total_stored += file.entry.stored_size;
+    }
+    std::printf("Packed %zu files (%llu bytes, %llu stored) into '%s'\n", files.size(),
+        (unsigned long long)total_size, (unsigned long long)total_stored, output_path);
+    return 0;
+}